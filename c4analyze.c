@@ -0,0 +1,394 @@
+/* Position analysis for server1
+
+   A client that opens with "ANALYZE <moves> [ms]" has the position
+   after those moves (columns, as in RESUMED, or "-" for none) searched
+   by c4search.c for up to ms milliseconds (the "analyze" setting, see
+   c4conf.h, if not given),
+   less when the workers are short of time (see c4sched.h). Searches run
+   on a work-stealing pool of analysis threads (see c4steal.h) at a
+   lower priority than the workers, so a deep search holds up no one's
+   moves; with more than one thread, each search is split across the
+   pool as well, so a lone search uses every thread. As each depth is
+   finished the client is sent
+
+   	INFO depth <d> time <ms> nodes <n> scores <s1> ... <s7> pv <c> ...
+
+   with '-' as the score of a full column, and at the end
+
+   	BEST <column> score <s> depth <d> nodes <n> time <ms>
+
+   While the search runs the client may send "STOP", to have the best
+   answer so far at once, or "EXTEND <ms>" to give it longer. After
+   BEST it may send another ANALYZE.
+
+   The analysis thread writes to its own dup() of the client's socket,
+   so the session can be closed under it; the search just sees stop set
+   and the job goes when both have let go of it. INFO lines that find
+   the socket full are dropped, as the next one supersedes them. Each
+   line goes out under the job's lock, and once the session has let go
+   of a job, for a new ANALYZE or for good, nothing more of it is sent:
+   a client never sees an old search's BEST after the answer to a new
+   request. Letting go waits for a line already going out, which only
+   takes long for a client that has stopped reading.
+
+   To compile: gcc -c c4analyze.c -pthread
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include "c4server.h"
+#include "c4search.h"
+#include "c4steal.h"
+#include "c4metrics.h"
+#include "c4trace.h"
+
+	/* most search time allowed, in ms */
+#define ANALYZE_MAX	60000
+
+	/* most analysis threads */
+#define ANALYZE_THREADS	C4STEAL_WORKERS
+
+	/* how much nicer than the workers they are */
+#define ANALYZE_NICE	10
+
+struct c4ajob {
+	struct c4task task;		/* first, to find the job from */
+	atomic_int refs;		/* the session and the thread */
+	_Atomic int stop;
+	_Atomic uint64_t deadline;
+	uint64_t t_limit;		/* EXTEND goes no further */
+	int fd;
+	pthread_mutex_t lock;		/* held to write to fd */
+	int dropped;			/* under lock: the session let go */
+	struct c4search search;
+};
+
+	/* the analysis threads, which also take the jobs */
+static struct c4steal *pool;
+static int nthreads;
+#ifdef C4TRACE
+	/* when the last depth of this thread's search was done */
+static _Thread_local uint64_t t_depth;
+#endif
+
+static void analyze_init(int id);
+static void analyze_job(struct c4task *t);
+static void put_locked(struct c4ajob *j, const char *buf, int len,
+	int wait);
+static int busy(struct worker *w, struct session *s);
+
+/* Start n analysis threads; with none, ANALYZE is refused
+ */
+int
+analyze_start(int n) {
+	if (n > ANALYZE_THREADS) {
+		n = ANALYZE_THREADS;
+	}
+	if (n <= 0) {
+		return 0;
+	}
+	if ((pool = c4steal_start(n, analyze_init)) == NULL) {
+		return -1;
+	}
+	nthreads = n;
+	return 0;
+}
+
+/* How the analysis threads have shared out the work, for the admin
+ * socket; 0 with none
+ */
+int
+analyze_stats(char *out, int len) {
+	return pool != NULL ? c4steal_format(pool, out, len) : 0;
+}
+
+static void
+release(struct c4ajob *j) {
+	if (atomic_fetch_sub(&j->refs, 1) == 1) {
+		close(j->fd);
+		pthread_mutex_destroy(&j->lock);
+		free(j);
+	}
+}
+
+/* The session is finished with its search, whether or not the search
+ * is finished with it
+ */
+void
+analyze_drop(struct session *s) {
+	if (s->job != NULL) {
+		atomic_store(&s->job->stop, 1);
+		/* once any line going out has gone, no more will */
+		pthread_mutex_lock(&s->job->lock);
+		s->job->dropped = 1;
+		pthread_mutex_unlock(&s->job->lock);
+		release(s->job);
+		s->job = NULL;
+	}
+}
+
+/* Queue a search of the position after the moves in arg; returns -1
+ * once the session is closed
+ */
+int
+analyze_request(struct worker *w, struct session *s, char *arg) {
+	struct c4ajob *j;
+	const struct c4conf *conf;
+	struct c4bb pos;
+	char *p = arg;
+	long ms = 1;
+	int given = 0;
+	uint64_t now = c4search_now();
+
+	/* one search at a time for each client, and nothing more from
+	 * the last one once this is answered
+	 */
+	analyze_drop(s);
+	c4bb_init(&pos);
+	while (*p == ' ') {
+		p++;
+	}
+	if (*p == '-') {
+		p++;
+	}
+	while (*p >= '1' && *p <= '0'+WIDTH) {
+		if (!c4bb_can_play(&pos, *p - '0')
+				|| (pos.nmoves > 0 && c4bb_won(&pos))) {
+			break;
+		}
+		c4bb_play(&pos, *p++ - '0');
+	}
+	if (*p == ' ') {
+		ms = strtol(p, &p, 10);
+		given = 1;
+	}
+	if ((*p != '\0' && *p != '\r') || ms <= 0) {
+		if (session_send(w, s, "BADPOS\n") < 0) {
+			session_close(w, s, 0);
+			return -1;
+		}
+		return 0;
+	}
+	conf = c4conf_enter();
+	if (!given) {
+		ms = conf->analyze_ms;
+	}
+	if (ms > ANALYZE_MAX) {
+		ms = ANALYZE_MAX;
+	}
+	ms = c4sched_analysis(conf, ms);
+	c4conf_leave();
+	if (ms == 0) {
+		return busy(w, s);
+	}
+
+	if (nthreads == 0 || (j = calloc(1, sizeof(*j))) == NULL) {
+		return busy(w, s);
+	}
+	if ((j->fd = fcntl(s->fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+		free(j);
+		return busy(w, s);
+	}
+	pthread_mutex_init(&j->lock, NULL);
+	atomic_init(&j->refs, 2);
+	atomic_init(&j->deadline, now + ms*1000000ull);
+	j->t_limit = now + ANALYZE_MAX*1000000ull;
+	j->search.pos = pos;
+	j->task.fn = analyze_job;
+	/* the job may be freed by the time analyze_job returns */
+	j->task.detached = 1;
+	if (c4steal_submit(pool, &j->task) < 0) {
+		close(j->fd);
+		pthread_mutex_destroy(&j->lock);
+		free(j);
+		return busy(w, s);
+	}
+	s->job = j;
+	s->mode = MODE_ANALYZE;
+	return 0;
+}
+
+/* No thread or room for another search just now
+ */
+static int
+busy(struct worker *w, struct session *s) {
+	if (session_send(w, s, "BUSY\n") < 0) {
+		session_close(w, s, 0);
+		return -1;
+	}
+	return 0;
+}
+
+/* A line from a client whose search may still be running
+ */
+int
+analyze_line(struct worker *w, struct session *s, char *line, int len) {
+	struct c4ajob *j = s->job;
+	const struct c4conf *conf;
+	uint64_t d, want;
+
+	line[len-1] = '\0';
+	if (strncmp(line, "ANALYZE", 7) == 0) {
+		return analyze_request(w, s, line+7);
+	}
+	if (strncmp(line, "STOP", 4) == 0) {
+		if (j != NULL) {
+			atomic_store(&j->stop, 1);
+		}
+		return 0;
+	}
+	if (strncmp(line, "EXTEND ", 7) == 0) {
+		if (j != NULL) {
+			d = atomic_load(&j->deadline);
+			conf = c4conf_enter();
+			want = d + c4sched_analysis(conf, strtol(line+7,
+				NULL, 10)) * 1000000ull;
+			c4conf_leave();
+			if (want > j->t_limit) {
+				want = j->t_limit;
+			}
+			/* only the worker moves it, so no CAS is needed */
+			atomic_store(&j->deadline, want);
+		}
+		return 0;
+	}
+	session_close(w, s, 0);
+	return -1;
+}
+
+/* Write a whole line to the client, waiting for room only if wait,
+ * unless the session has let go of the job
+ */
+static void
+put(struct c4ajob *j, const char *buf, int len, int wait) {
+	pthread_mutex_lock(&j->lock);
+	if (!j->dropped) {
+		put_locked(j, buf, len, wait);
+	}
+	pthread_mutex_unlock(&j->lock);
+}
+
+static void
+put_locked(struct c4ajob *j, const char *buf, int len, int wait) {
+	struct pollfd pfd;
+	int n;
+
+	while (len > 0) {
+		n = send(j->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n > 0) {
+			buf += n;
+			len -= n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)
+				|| !wait || atomic_load(&j->stop)) {
+			return;
+		}
+		pfd.fd = j->fd;
+		pfd.events = POLLOUT;
+		if (poll(&pfd, 1, 1000) <= 0) {
+			return;
+		}
+	}
+}
+
+static void
+report(const struct c4search *s, void *arg) {
+	struct c4ajob *j = arg;
+	char buf[LEN + WIDTH*HEIGHT*2];
+	int c, i, n;
+
+	n = sprintf(buf, "INFO depth %d time %d nodes %llu scores", s->depth,
+		(int)((c4search_now() - s->t_start) / 1000000),
+		(unsigned long long)s->nodes);
+	for (c=0; c<WIDTH; c++) {
+		if (s->score[c] == C4S_NONE) {
+			n += sprintf(buf+n, " -");
+		} else {
+			n += sprintf(buf+n, " %d", s->score[c]);
+		}
+	}
+	n += sprintf(buf+n, " pv");
+	for (i=0; i<s->npv; i++) {
+		n += sprintf(buf+n, " %d", s->pv[i]);
+	}
+	buf[n++] = '\n';
+	put(j, buf, n, 0);
+#ifdef C4TRACE
+	C4TRACE_SINCE(t_depth, "depth", s->depth);
+	t_depth = c4trace_now();
+#endif
+}
+
+/* Set up an analysis thread, before it takes any job
+ */
+static void
+analyze_init(int id) {
+	char buf[LEN];
+
+	snprintf(buf, sizeof(buf), "analysis%d", id);
+	c4m_attach(buf);
+	C4TRACE_ATTACH(buf);
+	/* on Linux this is the thread's own priority */
+	setpriority(PRIO_PROCESS, 0, ANALYZE_NICE);
+	/* entries are keyed by whole positions, so one search's are
+	 * good for the next and the table is never cleared
+	 */
+	if (c4search_thread_tt() == NULL) {
+		perror("ERROR allocating transposition table");
+	}
+}
+
+static void
+analyze_job(struct c4task *t) {
+	struct c4ajob *j = (struct c4ajob *)t;
+	struct c4search *s = &j->search;
+	const struct c4conf *conf;
+	char buf[LEN];
+	int n, every;
+
+	if (atomic_load(&j->stop)) {
+		/* the client went, or asked again, before we began */
+		release(j);
+		return;
+	}
+	if ((s->tt = c4search_thread_tt()) == NULL) {
+		put(j, "BUSY\n", 5, 1);
+		release(j);
+		return;
+	}
+	s->stop = &j->stop;
+	s->deadline = &j->deadline;
+	s->report = report;
+	s->arg = j;
+	s->pool = nthreads > 1 ? pool : NULL;
+	s->tb = endgame;
+#ifdef C4TRACE
+	t_depth = c4trace_now();
+#endif
+	c4search_run(s);
+	C4TRACE_SINCE(s->t_start, "analysis", s->depth);
+
+	n = sprintf(buf, "BEST %d score %d depth %d nodes %llu time %d\n",
+		s->best, s->best ? s->score[s->best-1] : 0, s->depth,
+		(unsigned long long)s->nodes,
+		(int)((c4search_now() - s->t_start) / 1000000));
+	put(j, buf, n, 1);
+	conf = c4conf_enter();
+	every = conf->stats;
+	c4conf_leave();
+	c4sched_searched(s, every);
+	release(j);
+}
@@ -0,0 +1,474 @@
+/* Annotate archived games with the engine's view of every move
+
+   Reads games from journal directories or segments (see c4journal.h)
+   and from text files, one game a line as the columns played (e.g.
+   "4453..."; "-" reads standard input), and writes each back out with
+   every move labelled: its score by c4search.c for the side that
+   played it, the best move in its place and that move's score, and
+   the depth searched to. Each position is searched to -d plies
+   (default 10) or for -t ms if given, whichever comes first, with the
+   endgame tables given with -E (see c4tb.h) if any.
+
+   A game is one task on a c4steal pool of -j threads (default 1):
+   its positions are searched in order by the one thread, so that
+   each search starts with the transposition table the one before it
+   filled, from one move earlier in the same game. Games are read only
+   while fewer than -w (default four a thread) are waiting to go out,
+   and go out in the order they were read as soon as each and all
+   before it are done, so memory stays bounded however long the
+   archive. The table is not cleared between games, so a score short
+   of a proven one, or a choice between moves that score the same, can
+   depend on what the thread searched before, as it can in the server.
+
+   Each game is one line of JSON on standard output:
+   	{"game": 1, "moves": "4453", "result": "unfinished",
+   	 "plies": [[4, 0, 4, 0, 10], ...]}
+   a ply being [move, score, best, best score, depth], the scores
+   null where not even one ply could be searched in time. A game with
+   an illegal move, or a move after it was won, has "error" in place
+   of "plies". At the end a JSON summary goes to standard error: games,
+   positions, nodes, the time taken and positions an hour.
+
+   -s writes every search's statistics to a file as it finishes, one
+   line each as c4search_stats has it under its game and ply:
+   	{"game": 1, "ply": 0, "search": {"depth": 10, ...}}
+   in no particular order. -S adds "search" to the summary, the same
+   over all searches: nodes a second of searching, the mean depth and
+   effective branching factor, TT hit and first-move cut-off rates,
+   and the mean time of each depth, in ms, over the searches that
+   completed it.
+
+   To compile: gcc -O2 c4annotate.c c4journal.c c4search.c c4steal.c
+   		c4ring.c c4tb.c c4map.c c4game.c -o c4annotate -pthread
+
+   To run: c4annotate [-d depth] [-t ms] [-j threads] [-w games]
+   		[-E tables] [-s stats-file] [-S]
+   		journal-dir|segment.c4j|games.txt|- ...
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "c4game.h"
+#include "c4journal.h"
+#include "c4search.h"
+#include "c4steal.h"
+#include "c4ring.h"
+#include "c4tb.h"
+
+#define SIZE		(WIDTH*HEIGHT)
+
+	/* longest line of a text file of games */
+#define LINE		256
+
+	/* longest line of search statistics */
+#define STATS		1024
+
+	/* what -S adds up over searches */
+struct totals {
+	uint64_t searches, ns, nodes, depths;
+	uint64_t tt_probes, tt_hits, cutoffs, first_cutoffs;
+	uint64_t nebf;			/* searches of two depths or more */
+	double ebf;			/* ... and their branching factors */
+	uint64_t iter_ns[SIZE];		/* by depth, over the searches */
+	uint64_t iter_n[SIZE];		/* ... that completed it */
+};
+
+struct game {
+	struct c4task task;		/* first, to find the rest from */
+	atomic_int ready;		/* annotated, may go out */
+	uint64_t seq;			/* read as the seq'th game */
+	int nmoves;
+	uint8_t move[SIZE];
+	const char *error;		/* NULL for a game that checks out */
+	const char *result;
+	int8_t score[SIZE], best_score[SIZE];
+	uint8_t best[SIZE], depth[SIZE];
+	uint64_t nodes;
+	struct totals tot;		/* with -S */
+};
+
+	/* where games are read from: the arguments in turn */
+struct input {
+	char **arg;
+	int narg;
+	char **paths;		/* segments of a journal directory */
+	int npaths, ipath;
+	struct c4jseg seg;
+	int inseg;
+	FILE *text;
+};
+
+static struct c4steal *pool;
+static struct c4mpmc finished;		/* games done, to wake main */
+static struct c4tb *tables;
+static int depth = 10, limit_ms, summary;
+static FILE *stats;
+
+static void usage(char *prog);
+
+/* The next game of the input into g; -1 once there are no more
+ */
+static int
+next_game(struct input *in, struct game *g) {
+	const struct c4j_rec *r;
+	char line[LINE];
+	struct stat st;
+	int i;
+
+	for (;;) {
+		if (in->inseg) {
+			if ((r = c4jseg_next(&in->seg)) != NULL) {
+				g->nmoves = r->nmoves;
+				for (i=0; i<r->nmoves && i<SIZE; i++) {
+					g->move[i] = c4j_move(r, i);
+				}
+				return 0;
+			}
+			c4jseg_close(&in->seg);
+			in->inseg = 0;
+		} else if (in->text != NULL) {
+			if (fgets(line, sizeof(line), in->text) != NULL) {
+				for (i=0; line[i] >= '0' && line[i] <= '9'
+						&& i < SIZE; i++) {
+					g->move[i] = line[i] - '0';
+				}
+				g->nmoves = i;
+				if (line[i] >= '0' && line[i] <= '9') {
+					g->nmoves = SIZE + 1;
+				}
+				if (i > 0) {
+					return 0;
+				}
+				continue;
+			}
+			if (in->text != stdin) {
+				fclose(in->text);
+			}
+			in->text = NULL;
+		} else if (in->ipath < in->npaths) {
+			if (c4jseg_open(&in->seg, in->paths[in->ipath]) < 0) {
+				fprintf(stderr, "%s: not a journal segment\n",
+					in->paths[in->ipath]);
+			} else {
+				in->inseg = 1;
+			}
+			in->ipath++;
+		} else if (in->narg > 0) {
+			if (in->paths != NULL) {
+				c4journal_free_list(in->paths, in->npaths);
+				in->paths = NULL;
+			}
+			in->npaths = in->ipath = 0;
+			if (strcmp(*in->arg, "-") == 0) {
+				in->text = stdin;
+			} else if (stat(*in->arg, &st) == 0
+					&& S_ISDIR(st.st_mode)) {
+				in->npaths = c4journal_list(*in->arg,
+					&in->paths);
+			} else if (c4jseg_open(&in->seg, *in->arg) == 0) {
+				in->inseg = 1;
+			} else if ((in->text = fopen(*in->arg, "r")) == NULL) {
+				perror(*in->arg);
+			}
+			in->arg++;
+			in->narg--;
+		} else {
+			return -1;
+		}
+	}
+}
+
+static void
+add_search(struct totals *t, const struct c4search *s) {
+	int d;
+
+	t->searches++;
+	t->ns += s->ns;
+	t->nodes += s->nodes;
+	t->depths += s->depth;
+	t->tt_probes += s->tt_probes;
+	t->tt_hits += s->tt_hits;
+	t->cutoffs += s->cutoffs;
+	t->first_cutoffs += s->first_cutoffs;
+	if (s->depth >= 2) {
+		t->nebf++;
+		t->ebf += c4search_ebf(s);
+	}
+	for (d=0; d<s->depth; d++) {
+		t->iter_ns[d] += s->iter_ns[d];
+		t->iter_n[d]++;
+	}
+}
+
+static void
+add_totals(struct totals *t, const struct totals *u) {
+	int d;
+
+	t->searches += u->searches;
+	t->ns += u->ns;
+	t->nodes += u->nodes;
+	t->depths += u->depths;
+	t->tt_probes += u->tt_probes;
+	t->tt_hits += u->tt_hits;
+	t->cutoffs += u->cutoffs;
+	t->first_cutoffs += u->first_cutoffs;
+	t->nebf += u->nebf;
+	t->ebf += u->ebf;
+	for (d=0; d<SIZE; d++) {
+		t->iter_ns[d] += u->iter_ns[d];
+		t->iter_n[d] += u->iter_n[d];
+	}
+}
+
+/* Search every position of a game in turn, on the thread's own table
+ */
+static void
+annotate(struct c4task *t) {
+	struct game *g = (struct game *)t;
+	struct c4search s;
+	_Atomic uint64_t deadline;
+	char line[STATS];
+	int i, c, n;
+
+	g->error = NULL;
+	g->result = "unfinished";
+	g->nodes = 0;
+	memset(&g->tot, 0, sizeof(g->tot));
+	memset(&s, 0, sizeof(s));
+	s.maxdepth = depth;
+	s.deadline = &deadline;
+	s.tb = tables;
+	c4bb_init(&s.pos);
+	if (g->nmoves > SIZE) {
+		g->error = "too many moves";
+	} else if ((s.tt = c4search_thread_tt()) == NULL) {
+		g->error = "no memory";
+	}
+	for (i=0; i<g->nmoves && g->error == NULL; i++) {
+		c = g->move[i];
+		if (s.pos.nmoves > 0 && c4bb_won(&s.pos)) {
+			g->error = "move after the game was won";
+			break;
+		}
+		if (c < 1 || c > WIDTH || !c4bb_can_play(&s.pos, c)) {
+			g->error = "illegal move";
+			break;
+		}
+		atomic_store(&deadline, limit_ms > 0
+			? c4search_now() + limit_ms * 1000000ull : 0);
+		c4search_run(&s);
+		g->nodes += s.nodes;
+		if (summary) {
+			add_search(&g->tot, &s);
+		}
+		if (stats != NULL) {
+			n = snprintf(line, sizeof(line), "{\"game\": %llu, "
+				"\"ply\": %d, \"search\": ",
+				(unsigned long long)g->seq + 1, i);
+			n += c4search_stats(&s, line+n, sizeof(line)-n);
+			/* the record's newline goes after the brace */
+			line[n-1] = '}';
+			fprintf(stats, "%s\n", line);
+		}
+		g->best[i] = s.best;
+		g->depth[i] = s.depth;
+		if (s.best != 0) {
+			g->score[i] = s.score[c-1];
+			g->best_score[i] = s.score[s.best-1];
+		}
+		c4bb_play(&s.pos, c);
+	}
+	if (g->error == NULL && g->nmoves > 0) {
+		if (c4bb_won(&s.pos)) {
+			g->result = g->nmoves & 1 ? "yellow" : "red";
+		} else if (c4bb_full(&s.pos)) {
+			g->result = "draw";
+		}
+	}
+	atomic_store_explicit(&g->ready, 1, memory_order_release);
+	c4mpmc_push(&finished, g);
+}
+
+static void
+put_game(FILE *out, const struct game *g) {
+	int i;
+
+	fprintf(out, "{\"game\": %llu, \"moves\": \"",
+		(unsigned long long)g->seq + 1);
+	for (i=0; i<g->nmoves && i<SIZE; i++) {
+		putc('0' + g->move[i], out);
+	}
+	if (g->error != NULL) {
+		fprintf(out, "\", \"error\": \"%s\"}\n", g->error);
+		return;
+	}
+	fprintf(out, "\", \"result\": \"%s\", \"plies\": [", g->result);
+	for (i=0; i<g->nmoves; i++) {
+		if (g->best[i] == 0) {
+			fprintf(out, "%s[%d, null, null, null, 0]",
+				i ? ", " : "", g->move[i]);
+		} else {
+			fprintf(out, "%s[%d, %d, %d, %d, %d]", i ? ", " : "",
+				g->move[i], g->score[i], g->best[i],
+				g->best_score[i], g->depth[i]);
+		}
+	}
+	fprintf(out, "]}\n");
+}
+
+static void
+put_totals(FILE *out, const struct totals *t) {
+	int d;
+
+	fprintf(out, ", \"search\": {\"searches\": %llu, "
+		"\"nodes_per_second\": %.0f, \"mean_depth\": %.2f, "
+		"\"ebf\": %.2f, \"tt_hit_rate\": %.3f, "
+		"\"first_cutoff_rate\": %.3f, \"iteration_ms\": [",
+		(unsigned long long)t->searches,
+		t->ns ? t->nodes * 1e9 / t->ns : 0,
+		t->searches ? (double)t->depths / t->searches : 0,
+		t->nebf ? t->ebf / t->nebf : 0,
+		t->tt_probes ? (double)t->tt_hits / t->tt_probes : 0,
+		t->cutoffs ? (double)t->first_cutoffs / t->cutoffs : 0);
+	for (d=0; d<SIZE && t->iter_n[d] > 0; d++) {
+		fprintf(out, "%s%.3f", d ? ", " : "",
+			t->iter_ns[d] / 1e6 / t->iter_n[d]);
+	}
+	fprintf(out, "]}");
+}
+
+int
+main(int argc, char *argv[]) {
+	struct input in;
+	struct game *games, *g;
+	uint64_t start = c4search_now(), next_in = 0, next_out = 0;
+	uint64_t positions = 0, nodes = 0, errors = 0;
+	struct totals tot;
+	double secs;
+	int opt, nthreads = 1, window = 0, eof = 0;
+
+	while ((opt = getopt(argc, argv, "d:t:j:w:E:s:S")) != -1) {
+		switch (opt) {
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 't':
+			limit_ms = atoi(optarg);
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 'w':
+			window = atoi(optarg);
+			break;
+		case 'E':
+			if ((tables = c4tb_open(optarg)) == NULL) {
+				perror("ERROR opening endgame tables");
+				exit(1);
+			}
+			break;
+		case 's':
+			if ((stats = fopen(optarg, "w")) == NULL) {
+				perror(optarg);
+				exit(1);
+			}
+			break;
+		case 'S':
+			summary = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (window == 0) {
+		window = 4 * nthreads;
+	}
+	if (optind == argc || depth < 0 || nthreads < 1
+			|| nthreads > C4STEAL_WORKERS || window < 1
+			|| window > C4STEAL_INJECT) {
+		usage(argv[0]);
+	}
+	memset(&in, 0, sizeof(in));
+	memset(&tot, 0, sizeof(tot));
+	in.arg = argv + optind;
+	in.narg = argc - optind;
+
+	if ((games = calloc(window, sizeof(*games))) == NULL
+			|| c4mpmc_init(&finished, C4STEAL_INJECT,
+				C4RING_WAIT) < 0
+			|| (pool = c4steal_start(nthreads, NULL)) == NULL) {
+		perror("ERROR starting");
+		exit(1);
+	}
+
+	while (!eof || next_out < next_in) {
+		/* read ahead as far as the window goes */
+		while (!eof && next_in - next_out < (uint64_t)window) {
+			g = &games[next_in % window];
+			if (next_game(&in, g) < 0) {
+				eof = 1;
+				break;
+			}
+			g->task.fn = annotate;
+			g->seq = next_in++;
+			atomic_store(&g->ready, 0);
+			c4steal_submit(pool, &g->task);
+		}
+		/* then out with what is done, in order */
+		while (next_out < next_in) {
+			g = &games[next_out % window];
+			if (!atomic_load_explicit(&g->ready,
+					memory_order_acquire)) {
+				break;
+			}
+			put_game(stdout, g);
+			positions += g->error == NULL ? g->nmoves : 0;
+			errors += g->error != NULL;
+			nodes += g->nodes;
+			add_totals(&tot, &g->tot);
+			next_out++;
+			/* the pool marks it done just after: wait for
+			 * that before it is filled again
+			 */
+			while (!atomic_load(&g->task.done)) {
+				sched_yield();
+			}
+		}
+		if (next_out < next_in) {
+			c4mpmc_pop_wait(&finished, 100);
+			while (c4mpmc_pop(&finished) != NULL) {
+			}
+		}
+	}
+	fflush(stdout);
+	c4steal_stop(pool);
+	if (stats != NULL) {
+		fclose(stats);
+	}
+
+	secs = (c4search_now() - start) / 1e9;
+	fprintf(stderr, "{\"games\": %llu, \"errors\": %llu, "
+		"\"positions\": %llu, \"nodes\": %llu, \"seconds\": %.1f, "
+		"\"positions_per_hour\": %.0f",
+		(unsigned long long)next_out, (unsigned long long)errors,
+		(unsigned long long)positions, (unsigned long long)nodes,
+		secs, secs > 0 ? positions * 3600 / secs : 0);
+	if (summary) {
+		put_totals(stderr, &tot);
+	}
+	fprintf(stderr, "}\n");
+	return 0;
+}
+
+static void
+usage(char *prog) {
+	fprintf(stderr, "usage: %s [-d depth] [-t ms] [-j threads] "
+		"[-w games] [-E tables] [-s stats-file] [-S] "
+		"journal|games|- ...\n", prog);
+	exit(1);
+}
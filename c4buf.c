@@ -0,0 +1,57 @@
+/* Reference-counted buffers, see c4buf.h
+
+   To compile: gcc -c c4buf.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "c4buf.h"
+
+	/* longest message c4buf_printf will build */
+#define MAXMSG	1024
+
+/* A buffer of len bytes holding one reference for the caller
+ */
+struct c4buf *
+c4buf_new(int len) {
+	struct c4buf *b = malloc(sizeof(*b) + len);
+	if (b != NULL) {
+		atomic_init(&b->ref, 1);
+		b->len = len;
+	}
+	return b;
+}
+
+/* A buffer holding a formatted message, without its trailing NUL
+ */
+struct c4buf *
+c4buf_printf(const char *fmt, ...) {
+	char msg[MAXMSG];
+	struct c4buf *b;
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+	if (n < 0) {
+		return NULL;
+	}
+	if (n >= MAXMSG) {
+		n = MAXMSG - 1;
+	}
+	if ((b = c4buf_new(n)) != NULL) {
+		memcpy(b->data, msg, n);
+	}
+	return b;
+}
+
+void
+c4buf_put(struct c4buf *b) {
+	if (b != NULL && atomic_fetch_sub_explicit(&b->ref, 1,
+			memory_order_acq_rel) == 1) {
+		free(b);
+	}
+}
@@ -0,0 +1,31 @@
+/* Immutable, reference-counted byte buffers
+
+   A message meant for many sockets is encoded once into a c4buf and
+   the same buffer is queued to every one of them; each queue holds a
+   reference and the last one to let go frees it.
+
+   To compile: gcc -c c4buf.c
+*/
+
+#ifndef C4BUF_H
+#define C4BUF_H
+
+#include <stdatomic.h>
+
+struct c4buf {
+	atomic_int ref;
+	int len;
+	char data[];
+};
+
+struct c4buf *c4buf_new(int len);
+struct c4buf *c4buf_printf(const char *fmt, ...);
+void c4buf_put(struct c4buf *b);
+
+static inline struct c4buf *
+c4buf_get(struct c4buf *b) {
+	atomic_fetch_add_explicit(&b->ref, 1, memory_order_relaxed);
+	return b;
+}
+
+#endif
@@ -0,0 +1,172 @@
+/* Traffic capture for server1.c, see c4capture.h
+
+   To compile: gcc -c c4capture.c -pthread
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "c4capture.h"
+
+	/* how often buffers are written out while their threads are idle */
+#define FLUSH_MS	1000
+
+	/* longest line recorded; anything longer is cut */
+#define LINE_MAX	1024
+
+struct cbuf {
+	pthread_mutex_t lock;	/* taken by the flusher, else uncontended */
+	int n;
+	char data[C4CAP_BUF];
+};
+
+static int capfd = -1;
+static uint64_t start;
+static struct cbuf *bufs[C4CAP_THREADS];
+static atomic_int nbufs;
+static _Thread_local struct cbuf *mine;
+static _Thread_local int failed;
+static pthread_t flusher;
+static atomic_int stopping;
+
+static uint64_t
+now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000u + ts.tv_nsec/1000;
+}
+
+/* Write out what b has; its lock must be held
+ */
+static void
+flush(struct cbuf *b) {
+	/* O_APPEND, so one write lands whole whoever else writes */
+	if (b->n > 0 && capfd >= 0 && write(capfd, b->data, b->n) != b->n) {
+		perror("ERROR writing capture");
+	}
+	b->n = 0;
+}
+
+static void
+flush_locked(int i) {
+	struct cbuf *b = __atomic_load_n(&bufs[i], __ATOMIC_ACQUIRE);
+
+	if (b != NULL) {
+		pthread_mutex_lock(&b->lock);
+		flush(b);
+		pthread_mutex_unlock(&b->lock);
+	}
+}
+
+static void *
+flush_main(void *param) {
+	struct timespec ts = { FLUSH_MS / 1000, (FLUSH_MS % 1000) * 1000000L };
+	int i, n;
+
+	while (!atomic_load(&stopping)) {
+		nanosleep(&ts, NULL);
+		n = atomic_load(&nbufs);
+		for (i=0; i<n && i<C4CAP_THREADS; i++) {
+			flush_locked(i);
+		}
+	}
+	return NULL;
+}
+
+/* Begin capturing to path, which is emptied first
+ */
+int
+c4cap_open(const char *path) {
+	char head[64];
+	int n;
+
+	if ((capfd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+			0644)) < 0) {
+		return -1;
+	}
+	start = now_us();
+	n = sprintf(head, "# c4capture 1 start %llu\n",
+		(unsigned long long)start);
+	if (write(capfd, head, n) != n
+			|| pthread_create(&flusher, NULL, flush_main, NULL)) {
+		close(capfd);
+		capfd = -1;
+		return -1;
+	}
+	return 0;
+}
+
+/* The calling thread's buffer, made the first time it records
+ */
+static struct cbuf *
+buffer(void) {
+	struct cbuf *b;
+	int i;
+
+	if (failed || (b = calloc(1, sizeof(*b))) == NULL) {
+		failed = 1;
+		return NULL;
+	}
+	if ((i = atomic_fetch_add(&nbufs, 1)) >= C4CAP_THREADS) {
+		free(b);
+		failed = 1;
+		return NULL;
+	}
+	pthread_mutex_init(&b->lock, NULL);
+	__atomic_store_n(&bufs[i], b, __ATOMIC_RELEASE);
+	return mine = b;
+}
+
+/* Record that something of type happened on sock, with text (len
+ * bytes, no newline) for a line or a token
+ */
+void
+c4cap_record(int sock, int type, const char *text, int len) {
+	struct cbuf *b = mine;
+
+	if (capfd < 0 || (b == NULL && (b = buffer()) == NULL)) {
+		return;
+	}
+	if (len > LINE_MAX) {
+		len = LINE_MAX;
+	}
+	pthread_mutex_lock(&b->lock);
+	if (b->n + len + 48 > C4CAP_BUF) {
+		flush(b);
+	}
+	b->n += sprintf(b->data + b->n, "%llu %d %c",
+		(unsigned long long)(now_us() - start), sock, type);
+	if (text != NULL) {
+		b->data[b->n++] = ' ';
+		memcpy(b->data + b->n, text, len);
+		b->n += len;
+	}
+	b->data[b->n++] = '\n';
+	pthread_mutex_unlock(&b->lock);
+}
+
+/* Stop capturing and write out everything buffered
+ */
+void
+c4cap_close(void) {
+	int i, n;
+
+	if (capfd < 0) {
+		return;
+	}
+	atomic_store(&stopping, 1);
+	pthread_join(flusher, NULL);
+	n = atomic_load(&nbufs);
+	for (i=0; i<n && i<C4CAP_THREADS; i++) {
+		flush_locked(i);
+	}
+	close(capfd);
+	capfd = -1;
+}
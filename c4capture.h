@@ -0,0 +1,46 @@
+/* Traffic capture for server1.c, to be fed back by c4playback.c
+
+   With a capture file open, every line a client sends is recorded with
+   when it came in and the socket it came in on, as are connections
+   opening and closing and the tokens given out for HELLO (so that a
+   replayed RESUME can be pointed at the replayed game). The file is
+   text, one record per line, after a header giving the CLOCK_MONOTONIC
+   time the capture began, in us, which lines up the files of several
+   processes:
+
+   	# c4capture 1 start <us>
+   	<us since start> <socket> O		connection opened
+   	<us since start> <socket> L <line>	a line, without its newline
+   	<us since start> <socket> T <token>	HELLO was answered so
+   	<us since start> <socket> C		connection closed
+
+   A socket number is reused once its connection has closed, so a
+   connection is a socket from its O to its C. Workers append to a
+   buffer of their own, written out in one go when it fills and every
+   FLUSH_MS by a thread of the capture's, so records from different
+   workers are in order of time only within a buffer; c4playback sorts
+   them. Lines still in a buffer when the server is killed are lost.
+
+   To compile: gcc -c c4capture.c -pthread
+*/
+
+#ifndef C4CAPTURE_H
+#define C4CAPTURE_H
+
+	/* kinds of record */
+#define C4CAP_OPEN	'O'
+#define C4CAP_LINE	'L'
+#define C4CAP_TOKEN	'T'
+#define C4CAP_CLOSE	'C'
+
+	/* bytes each thread buffers before writing */
+#define C4CAP_BUF	65536
+
+	/* most threads that may ever record */
+#define C4CAP_THREADS	256
+
+int c4cap_open(const char *path);
+void c4cap_record(int sock, int type, const char *text, int len);
+void c4cap_close(void);
+
+#endif
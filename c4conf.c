@@ -0,0 +1,329 @@
+/* Hot-reloadable engine settings and opening book, see c4conf.h
+
+   To compile: gcc -c c4conf.c -pthread
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "c4conf.h"
+
+	/* how long a reload sleeps between looks at the readers, in ns */
+#define GRACE_POLL	100000
+
+struct reader {
+	_Alignas(64) _Atomic uint64_t epoch;	/* 0 when not reading */
+};
+
+static struct reader readers[C4CONF_READERS];
+static atomic_int nreaders;
+static _Thread_local struct reader *me;
+static _Thread_local int locked;
+
+static _Atomic(struct c4conf *) current;
+static _Atomic uint64_t epoch = 1;
+
+	/* one reload at a time; readers without a slot read under it */
+static pthread_mutex_t reload_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t overflow = PTHREAD_RWLOCK_INITIALIZER;
+
+static char path[256];
+static int default_slo;
+
+static int
+by_key(const void *a, const void *b) {
+	const struct c4book_entry *x = a, *y = b;
+	return x->key < y->key ? -1 : x->key > y->key;
+}
+
+static void
+conf_free(struct c4conf *c) {
+	if (c != NULL) {
+		free(c->book);
+		free(c);
+	}
+}
+
+/* A book line's position, after moves ("-" for none); -1 if they are
+ * not a game in progress
+ */
+static int
+position(const char *moves, struct c4bb *b) {
+	c4bb_init(b);
+	if (strcmp(moves, "-") == 0) {
+		return 0;
+	}
+	for (; *moves; moves++) {
+		if (*moves < '1' || *moves > '0'+WIDTH
+				|| !c4bb_can_play(b, *moves - '0')
+				|| (b->nmoves > 0 && c4bb_won(b))) {
+			return -1;
+		}
+		c4bb_play(b, *moves - '0');
+	}
+	return c4bb_won(b) || c4bb_full(b) ? -1 : 0;
+}
+
+/* Read the settings file into a new struct, starting from the
+ * defaults; NULL with the reason in err if it will not do
+ */
+static struct c4conf *
+parse(char *err, int len) {
+	struct c4conf *c;
+	struct c4bb b;
+	FILE *f = NULL;
+	char line[256], key[32], moves[64], *p;
+	int n = 0, v, col, room = 0;
+
+	if ((c = calloc(1, sizeof(*c))) == NULL) {
+		snprintf(err, len, "out of memory");
+		return NULL;
+	}
+	c->slo_ms = default_slo;
+	c->rated = 50;
+	c->casual = 12;
+	c->analyze_ms = 1000;
+	c->stats = 16;
+	if (*path == '\0') {
+		return c;
+	}
+	if ((f = fopen(path, "r")) == NULL) {
+		snprintf(err, len, "%s: %s", path, strerror(errno));
+		conf_free(c);
+		return NULL;
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		n++;
+		if ((p = strchr(line, '#')) != NULL) {
+			*p = '\0';
+		}
+		if (sscanf(line, "%31s", key) != 1) {
+			continue;
+		}
+		if (strcmp(key, "book") == 0) {
+			if (sscanf(line, "%*s %63s %d", moves, &col) != 2
+					|| position(moves, &b) < 0
+					|| col < 1 || col > WIDTH
+					|| !c4bb_can_play(&b, col)) {
+				snprintf(err, len, "%s:%d: bad book line",
+					path, n);
+				goto fail;
+			}
+			if (c->nbook == room) {
+				room = room ? room*2 : 256;
+				if (room > C4CONF_BOOK || (p = realloc(c->book,
+						room * sizeof(*c->book)))
+						== NULL) {
+					snprintf(err, len, "%s:%d: book too "
+						"long", path, n);
+					goto fail;
+				}
+				c->book = (struct c4book_entry *)p;
+			}
+			c->book[c->nbook].key = b.cur + b.mask;
+			c->book[c->nbook++].move = col;
+			continue;
+		}
+		if (sscanf(line, "%*s %d", &v) != 1 || v < 0) {
+			snprintf(err, len, "%s:%d: bad value", path, n);
+			goto fail;
+		}
+		if (strcmp(key, "slo") == 0) {
+			c->slo_ms = v;
+		} else if (strcmp(key, "rated") == 0 && v <= 100) {
+			c->rated = v;
+		} else if (strcmp(key, "casual") == 0 && v <= 100) {
+			c->casual = v;
+		} else if (strcmp(key, "analyze") == 0 && v > 0) {
+			c->analyze_ms = v;
+		} else if (strcmp(key, "stats") == 0) {
+			c->stats = v;
+		} else {
+			snprintf(err, len, "%s:%d: bad setting", path, n);
+			goto fail;
+		}
+	}
+	fclose(f);
+
+	qsort(c->book, c->nbook, sizeof(*c->book), by_key);
+	for (v=1; v<c->nbook; v++) {
+		if (c->book[v].key == c->book[v-1].key) {
+			snprintf(err, len, "%s: a position is in the book "
+				"twice", path);
+			conf_free(c);
+			return NULL;
+		}
+	}
+	return c;
+
+fail:
+	fclose(f);
+	conf_free(c);
+	return NULL;
+}
+
+/* Publish the first settings: those in path, if not NULL, over the
+ * defaults
+ */
+int
+c4conf_init(const char *file, int slo_ms) {
+	struct c4conf *c;
+	char err[256];
+
+	default_slo = slo_ms;
+	if (file != NULL) {
+		snprintf(path, sizeof(path), "%s", file);
+	}
+	if ((c = parse(err, sizeof(err))) == NULL) {
+		fprintf(stderr, "ERROR in settings: %s\n", err);
+		return -1;
+	}
+	c->version = 1;
+	atomic_store(&current, c);
+	return 0;
+}
+
+/* Read the settings again and swap them in, freeing the old ones once
+ * nobody can be reading them; -1 with the reason in err if the file
+ * will not do
+ */
+int
+c4conf_reload(char *err, int len) {
+	struct c4conf *c, *old;
+	struct timespec ts = { 0, GRACE_POLL };
+	uint64_t e, v;
+	int i, n;
+
+	if ((c = parse(err, len)) == NULL) {
+		return -1;
+	}
+	pthread_mutex_lock(&reload_lock);
+	old = atomic_load(&current);
+	c->version = old->version + 1;
+	atomic_store(&current, c);
+
+	/* anyone who entered before this could have the old one */
+	e = atomic_fetch_add(&epoch, 1) + 1;
+	n = atomic_load(&nreaders);
+	for (i=0; i<n && i<C4CONF_READERS; i++) {
+		while ((v = atomic_load(&readers[i].epoch)) != 0 && v < e) {
+			nanosleep(&ts, NULL);
+		}
+	}
+	pthread_rwlock_wrlock(&overflow);
+	pthread_rwlock_unlock(&overflow);
+	pthread_mutex_unlock(&reload_lock);
+
+	conf_free(old);
+	return 0;
+}
+
+/* The current settings, good until c4conf_leave
+ */
+const struct c4conf *
+c4conf_enter(void) {
+	int i;
+
+	if (me == NULL && !locked) {
+		i = atomic_fetch_add(&nreaders, 1);
+		if (i < C4CONF_READERS) {
+			me = &readers[i];
+		} else {
+			locked = 1;
+		}
+	}
+	if (me == NULL) {
+		pthread_rwlock_rdlock(&overflow);
+		return atomic_load(&current);
+	}
+	/* seq_cst, so a reload that misses this epoch in the slot has
+	 * not yet swapped the pointer we load next
+	 */
+	atomic_store(&me->epoch, atomic_load(&epoch));
+	return atomic_load(&current);
+}
+
+void
+c4conf_leave(void) {
+	if (me == NULL) {
+		pthread_rwlock_unlock(&overflow);
+		return;
+	}
+	atomic_store_explicit(&me->epoch, 0, memory_order_release);
+}
+
+/* The book's answer to pos, or 0 if it has none
+ */
+int
+c4conf_book(const struct c4conf *conf, const struct c4bb *pos) {
+	struct c4book_entry k, *e;
+
+	if (conf->nbook == 0) {
+		return 0;
+	}
+	k.key = pos->cur + pos->mask;
+	e = bsearch(&k, conf->book, conf->nbook, sizeof(k), by_key);
+	return e != NULL && c4bb_can_play(pos, e->move) ? e->move : 0;
+}
+
+static void *
+watch_main(void *param) {
+	sigset_t set;
+	char err[256];
+	int sig;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGHUP);
+	for (;;) {
+		if (sigwait(&set, &sig) != 0) {
+			continue;
+		}
+		if (c4conf_reload(err, sizeof(err)) < 0) {
+			fprintf(stderr, "ERROR reloading settings: %s\n", err);
+		}
+	}
+	return NULL;
+}
+
+/* Reload on SIGHUP, which the caller must have blocked in every thread
+ */
+int
+c4conf_watch(void) {
+	pthread_t tid;
+
+	if (pthread_create(&tid, NULL, watch_main, NULL)) {
+		return -1;
+	}
+	pthread_detach(tid);
+	return 0;
+}
+
+/* Admin commands "reload" and "conf"
+ */
+int
+c4conf_command(const char *cmd, char *out, int len) {
+	const struct c4conf *c;
+	char err[256];
+	int n;
+
+	if (strcmp(cmd, "reload") == 0) {
+		if (c4conf_reload(err, sizeof(err)) < 0) {
+			return snprintf(out, len, "reload failed: %s\n", err);
+		}
+	} else if (strcmp(cmd, "conf") != 0) {
+		return -1;
+	}
+	c = c4conf_enter();
+	n = snprintf(out, len, "version %llu slo %d rated %d casual %d "
+		"analyze %d stats %d book %d\n",
+		(unsigned long long)c->version, c->slo_ms, c->rated,
+		c->casual, c->analyze_ms, c->stats, c->nbook);
+	c4conf_leave();
+	return n;
+}
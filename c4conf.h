@@ -0,0 +1,64 @@
+/* Hot-reloadable engine settings and opening book
+
+   What the engine plays by lives in one struct c4conf, never changed
+   once it is published. Threads read the current one between
+   c4conf_enter and c4conf_leave without taking a lock: each reading
+   thread has a slot of its own in which it posts the epoch it entered
+   in. A reload reads the file named with -C into a new struct off to
+   the side, swaps the global pointer to it, moves the epoch on and
+   frees the old struct only once no slot shows an earlier epoch. So
+   readers never wait for a reload, and never see a struct freed under
+   them. Readers must not nest, and must not hold one across a wait.
+
+   The file has one setting per line, '#' starting a comment:
+
+   	slo <ms>		latency objective for a reply, 0 to not search
+   	rated <percent>		of it that a rated game's reply may search
+   	casual <percent>	... and a casual game's
+   	analyze <ms>		time for an ANALYZE that asks for none
+   	stats <n>		every n'th search into the search metrics,
+   				0 for none (see c4sched.h)
+   	book <moves> <column>	answer the moves, e.g. "book 44 3"
+
+   A reload happens on SIGHUP or the admin command "reload"; a file that
+   does not parse leaves the settings as they were.
+
+   To compile: gcc -c c4conf.c -pthread
+*/
+
+#ifndef C4CONF_H
+#define C4CONF_H
+
+#include <stdint.h>
+#include "c4game.h"
+
+	/* threads that can read without a lock; any more take one */
+#define C4CONF_READERS	512
+
+	/* longest book */
+#define C4CONF_BOOK	65536
+
+struct c4book_entry {
+	uint64_t key;		/* cur + mask of the position */
+	int move;
+};
+
+struct c4conf {
+	uint64_t version;	/* 1 for the settings started with */
+	int slo_ms;
+	int rated, casual;	/* percent of slo_ms */
+	int analyze_ms;
+	int stats;		/* sample every stats'th search, 0 none */
+	int nbook;
+	struct c4book_entry *book;	/* sorted by key */
+};
+
+int c4conf_init(const char *path, int slo_ms);
+int c4conf_reload(char *err, int len);
+int c4conf_watch(void);
+const struct c4conf *c4conf_enter(void);
+void c4conf_leave(void);
+int c4conf_book(const struct c4conf *conf, const struct c4bb *pos);
+int c4conf_command(const char *cmd, char *out, int len);
+
+#endif
@@ -0,0 +1,35 @@
+/* Sharded statistics counters, see c4counter.h
+
+   To compile: gcc -c c4counter.c
+*/
+
+#include "c4counter.h"
+
+_Thread_local int c4counter_slot;
+
+static atomic_int nslots;
+
+/* Give the calling thread its slot, the shared one once all the rest
+ * are taken
+ */
+int
+c4counter_attach(void) {
+	int i = atomic_fetch_add(&nslots, 1);
+
+	if (i >= C4COUNTER_SLOTS) {
+		i = C4COUNTER_SLOTS;
+	}
+	c4counter_slot = i + 1;
+	return i;
+}
+
+uint64_t
+c4counter_read(struct c4counter *c) {
+	uint64_t n = 0;
+	int i;
+
+	for (i=0; i<=C4COUNTER_SLOTS; i++) {
+		n += atomic_load_explicit(&c->slot[i].n, memory_order_relaxed);
+	}
+	return n;
+}
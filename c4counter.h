@@ -0,0 +1,60 @@
+/* Sharded statistics counters
+
+   A c4counter is one cache line per thread, each written only by the
+   thread it belongs to with a plain load and store, so bumping it costs
+   about what bumping a local variable does however many threads share
+   the counter; reading it adds up the lines. This is what the threads
+   benchmark (thread2.c) found fastest once more than one thread counts,
+   against a mutex, a spinlock and a shared atomic add, and it is how
+   the shards of c4metrics.h work too; a c4counter is for a module that
+   keeps a count of its own outside that fixed list.
+
+   Threads take slots in the order they first count, across all the
+   counters, and keep them. Those beyond C4COUNTER_SLOTS share one last
+   line with an atomic add. A read while threads are counting is not a
+   snapshot, but never goes backwards.
+
+   To compile: gcc -c c4counter.c
+*/
+
+#ifndef C4COUNTER_H
+#define C4COUNTER_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+	/* threads that get a line of their own */
+#define C4COUNTER_SLOTS		64
+
+struct c4counter {
+	struct {
+		_Alignas(64) _Atomic uint64_t n;
+	} slot[C4COUNTER_SLOTS + 1];
+};
+
+	/* the calling thread's slot, plus one; 0 until it first counts.
+	 * A thread may set its own if no other thread counts in that slot
+	 */
+extern _Thread_local int c4counter_slot;
+
+int c4counter_attach(void);
+uint64_t c4counter_read(struct c4counter *c);
+
+static inline void
+c4counter_add(struct c4counter *c, uint64_t n) {
+	int i = c4counter_slot - 1;
+	_Atomic uint64_t *p;
+
+	if (i < 0) {
+		i = c4counter_attach();
+	}
+	p = &c->slot[i].n;
+	if (i == C4COUNTER_SLOTS) {
+		atomic_fetch_add_explicit(p, n, memory_order_relaxed);
+	} else {
+		atomic_store_explicit(p, atomic_load_explicit(p,
+			memory_order_relaxed) + n, memory_order_relaxed);
+	}
+}
+
+#endif
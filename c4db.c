@@ -0,0 +1,131 @@
+/* Database of searched positions, see c4db.h
+
+   To compile: gcc -c c4db.c
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "c4db.h"
+#include "c4map.h"
+
+/* Map the database at path; NULL with errno set if it cannot be, or
+ * EINVAL if it is not one
+ */
+struct c4db *
+c4db_open(const char *path) {
+	struct c4db *db;
+	const struct c4db_hdr *h;
+	size_t size;
+	void *p;
+
+	if ((p = c4map_open(path, sizeof(*h), MADV_RANDOM, &size)) == NULL) {
+		return NULL;
+	}
+	/* every section inside the file, as big as a probe may read */
+	h = p;
+	if (h->magic != C4DB_MAGIC || h->version != C4DB_VERSION
+			|| h->lowbits >= 64 || h->n > size
+			|| h->nhigh < h->n || h->nhigh / 8 > size
+			|| (h->off_samples | h->off_high | h->off_low
+				| h->off_values) % 8
+			|| !c4map_fits(size, h->off_samples, h->nsamples, 8)
+			|| (h->nhigh - h->n + C4DB_SAMPLE - 1) / C4DB_SAMPLE
+				> h->nsamples
+			|| !c4map_fits(size, h->off_high,
+				(h->nhigh + 63) / 64, 8)
+			|| !c4map_fits(size, h->off_low,
+				(h->n * h->lowbits + 63) / 64, 8)
+			|| !c4map_fits(size, h->off_values,
+				(h->n * C4DB_VALBITS + 63) / 64, 8)
+			|| (db = calloc(1, sizeof(*db))) == NULL) {
+		munmap(p, size);
+		errno = EINVAL;
+		return NULL;
+	}
+	db->map = p;
+	db->size = size;
+	db->hdr = h;
+	db->samples = (const uint64_t *)((const char *)p + h->off_samples);
+	db->high = (const uint64_t *)((const char *)p + h->off_high);
+	db->low = (const uint64_t *)((const char *)p + h->off_low);
+	db->values = (const uint64_t *)((const char *)p + h->off_values);
+	return db;
+}
+
+/* Position in the high bits of the z'th zero, counting from 0
+ */
+static uint64_t
+select0(const struct c4db *db, uint64_t z) {
+	uint64_t pos = db->samples[z / C4DB_SAMPLE], w;
+	uint64_t left = z % C4DB_SAMPLE;
+	int k;
+
+	/* the rest of the word the sample is in, then whole words */
+	w = ~db->high[pos >> 6] & (~(uint64_t)0 << (pos & 63));
+	for (;;) {
+		k = __builtin_popcountll(w);
+		if ((uint64_t)k > left) {
+			break;
+		}
+		left -= k;
+		pos = (pos | 63) + 1;
+		w = ~db->high[pos >> 6];
+	}
+	/* the left'th zero of w */
+	while (left-- > 0) {
+		w &= w - 1;
+	}
+	return (pos & ~(uint64_t)63) + __builtin_ctzll(w);
+}
+
+/* Look pos up; 0 with e filled in if it is there, else -1
+ */
+int
+c4db_probe(const struct c4db *db, const struct c4bb *pos,
+		struct c4db_entry *e) {
+	const struct c4db_hdr *h = db->hdr;
+	uint64_t key = c4db_key(pos), m = c4db_mirror(key), hi, lo, bit, i;
+	uint64_t v;
+	int l = h->lowbits, flip = 0;
+
+	if (m < key) {
+		key = m;
+		flip = 1;
+	}
+	hi = key >> l;
+	lo = key & (((uint64_t)1 << l) - 1);
+	if (hi + h->n >= h->nhigh) {
+		return -1;
+	}
+	/* entries with these high bits follow the hi'th zero */
+	bit = hi == 0 ? 0 : select0(db, hi - 1) + 1;
+	for (i = bit - hi; bit < h->nhigh
+			&& (db->high[bit >> 6] >> (bit & 63) & 1); bit++, i++) {
+		v = c4db_bits(db->low, i * l, l);
+		if (v == lo) {
+			v = c4db_bits(db->values, i * C4DB_VALBITS,
+				C4DB_VALBITS);
+			e->move = v & 7;
+			e->score = (int)((v >> 3) & 63) - C4DB_BIAS;
+			e->exact = (v >> 9) & 1;
+			if (flip) {
+				e->move = WIDTH + 1 - e->move;
+			}
+			return 0;
+		}
+		if (v > lo) {
+			break;
+		}
+	}
+	return -1;
+}
+
+void
+c4db_close(struct c4db *db) {
+	if (db != NULL) {
+		munmap(db->map, db->size);
+		free(db);
+	}
+}
@@ -0,0 +1,116 @@
+/* Database of searched positions, built offline by c4dbbuild.c
+
+   Every position reachable in up to some number of moves, searched
+   ahead of time, with its score and best move. Positions are stored
+   once for a board and its mirror image, under the smaller of their
+   two keys (cur + mask, as in c4search.c), the move mirrored back when
+   a probe finds the other.
+
+   The keys, sorted, are an Elias-Fano sequence: each splits into its
+   low l bits, packed into an array, and its high bits, coded in unary
+   in a bit array where entry i sets bit (key >> l) + i. A probe goes
+   to the first entry with its high bits by a sampled select of the
+   (key >> l)'th zero, then looks through the few entries after it for
+   its low bits. With the score and move of entry i packed into
+   C4DB_VALBITS bits at i * C4DB_VALBITS, a probe touches the sample
+   table, a word or two of the high bits, and the low bits and value
+   of the entries it compares: a few cache misses, about 2 + l + 10
+   bits an entry all told.
+
+   The file is mapped read-only and shared, so the page cache holds one
+   copy however many worker processes map it. Its sections are, in
+   order, each 64-byte aligned: the header below, the samples, the high
+   bits, the low bits, the values.
+
+   A value is the score of c4search.h for the side to move, and
+   whether it is exact: a win or loss proven, or a draw searched to the
+   end of the game. Otherwise it holds to the depth the database was
+   built with.
+
+   To compile: gcc -c c4db.c
+*/
+
+#ifndef C4DB_H
+#define C4DB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "c4game.h"
+
+#define C4DB_MAGIC	0x42443443	/* "C4DB" */
+#define C4DB_VERSION	1
+
+	/* a zero of the high bits is sampled every so many */
+#define C4DB_SAMPLE	256
+
+	/* bits in a value: move, score + C4DB_BIAS, exact */
+#define C4DB_VALBITS	10
+#define C4DB_BIAS	32
+
+struct c4db_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t n;		/* entries */
+	uint32_t lowbits;	/* l */
+	uint32_t plies;		/* every position of up to this many moves */
+	uint32_t depth;		/* searched to, 0 for the end of the game */
+	uint32_t pad;
+	uint64_t nhigh;		/* bits of high bits */
+	uint64_t nsamples;
+	uint64_t off_samples;	/* sections, in bytes from the start */
+	uint64_t off_high;
+	uint64_t off_low;
+	uint64_t off_values;
+	uint8_t pad2[8];
+};
+
+struct c4db {
+	void *map;
+	size_t size;
+	const struct c4db_hdr *hdr;
+	const uint64_t *samples;
+	const uint64_t *high;
+	const uint64_t *low;
+	const uint64_t *values;
+};
+
+	/* what a probe finds */
+struct c4db_entry {
+	int move;		/* 1..WIDTH */
+	int score;
+	int exact;
+};
+
+struct c4db *c4db_open(const char *path);
+int c4db_probe(const struct c4db *db, const struct c4bb *pos,
+	struct c4db_entry *e);
+void c4db_close(struct c4db *db);
+
+	/* a position's key, and its mirror image's */
+static inline uint64_t
+c4db_key(const struct c4bb *b) {
+	return b->cur + b->mask;
+}
+
+static inline uint64_t
+c4db_mirror(uint64_t bits) {
+	uint64_t m = 0, col = ((uint64_t)1 << C4BB_H) - 1;
+	int c;
+
+	for (c=0; c<WIDTH; c++) {
+		m |= ((bits >> c*C4BB_H) & col) << (WIDTH-1-c)*C4BB_H;
+	}
+	return m;
+}
+
+	/* n bits at bit i of a packed array, n < 64 */
+static inline uint64_t
+c4db_bits(const uint64_t *a, uint64_t i, int n) {
+	uint64_t w = a[i >> 6] >> (i & 63);
+	if ((i & 63) + n > 64) {
+		w |= a[(i >> 6) + 1] << (64 - (i & 63));
+	}
+	return w & (((uint64_t)1 << n) - 1);
+}
+
+#endif
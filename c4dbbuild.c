@@ -0,0 +1,412 @@
+/* Build the database of searched positions read by c4db.c
+
+   Every position reachable in up to -p moves (default 8) in which the
+   game is not already over is found a level at a time, each kept once
+   for itself and its mirror image, and then searched by c4search.c on
+   -j threads (default 1): to the end of the game, or to -d plies if
+   given. With -t a position gets at most that many ms, and one whose
+   search is not done by then is left out of the database, as is every
+   position with no more than -m moves when -m is given (the book covers
+   those, or the search finds them cheap enough). The entries, sorted
+   by key, are written to the output as c4db.h lays it out, and then
+   probed back, every one, to check the file.
+
+   Progress goes to standard error; at the end one JSON object is
+   printed on standard output: positions found, entries written and how
+   many are exact, the size of the file, bits per entry, and the time
+   the build took.
+
+   To compile: gcc -O2 c4dbbuild.c c4db.c c4map.c c4search.c c4steal.c
+   		c4ring.c c4game.c -o c4dbbuild -pthread
+
+   To run: c4dbbuild [-p plies] [-d depth] [-t ms] [-m moves]
+   		[-j threads] output
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "c4game.h"
+#include "c4search.h"
+#include "c4db.h"
+#include "c4map.h"
+
+	/* most threads searching */
+#define MAX_THREADS	256
+
+	/* positions searched between progress reports */
+#define REPORT		10000
+
+struct pos {
+	uint64_t key;		/* canonical: the smaller of the two */
+	uint64_t cur, mask;	/* of the board with that key */
+	int16_t score;
+	uint8_t move;		/* 0 if left out */
+	uint8_t exact;
+};
+
+static struct pos *pos;
+static size_t npos;
+static int plies = 8, depth, limit_ms, min_moves = -1;
+static atomic_size_t next_pos, done_pos;
+
+static void usage(char *prog);
+
+static int
+by_key(const void *a, const void *b) {
+	uint64_t x = ((const struct pos *)a)->key;
+	uint64_t y = ((const struct pos *)b)->key;
+	return x < y ? -1 : x > y;
+}
+
+/* Add b, mirrored if that gives the smaller key, to the end of pos
+ */
+static int
+add(struct c4bb *b, size_t *cap) {
+	uint64_t key = c4db_key(b), m = c4db_mirror(key);
+	struct pos *p;
+
+	if (npos == *cap) {
+		*cap = *cap ? *cap * 2 : 1024;
+		if ((p = realloc(pos, *cap * sizeof(*pos))) == NULL) {
+			return -1;
+		}
+		pos = p;
+	}
+	p = &pos[npos++];
+	memset(p, 0, sizeof(*p));
+	if (m < key) {
+		p->key = m;
+		p->cur = c4db_mirror(b->cur);
+		p->mask = c4db_mirror(b->mask);
+	} else {
+		p->key = key;
+		p->cur = b->cur;
+		p->mask = b->mask;
+	}
+	return 0;
+}
+
+/* Sort pos[from..] and drop repeats; returns how many are left there
+ */
+static size_t
+unique(size_t from) {
+	size_t i, k = from;
+
+	qsort(pos + from, npos - from, sizeof(*pos), by_key);
+	for (i=from; i<npos; i++) {
+		if (k == from || pos[i].key != pos[k-1].key) {
+			pos[k++] = pos[i];
+		}
+	}
+	npos = k;
+	return k - from;
+}
+
+/* Find every position of up to plies moves, a level at a time
+ */
+static int
+enumerate(void) {
+	struct c4bb b, child;
+	size_t cap = 0, first = 0, last, i;
+	int c, level;
+
+	c4bb_init(&b);
+	if (add(&b, &cap) < 0) {
+		return -1;
+	}
+	for (level=1; level<=plies; level++) {
+		last = npos;
+		for (i=first; i<last; i++) {
+			b.cur = pos[i].cur;
+			b.mask = pos[i].mask;
+			b.nmoves = level - 1;
+			for (c=1; c<=WIDTH; c++) {
+				if (!c4bb_can_play(&b, c)) {
+					continue;
+				}
+				child = b;
+				c4bb_play(&child, c);
+				if (!c4bb_won(&child) && !c4bb_full(&child)
+						&& add(&child, &cap) < 0) {
+					return -1;
+				}
+			}
+		}
+		first = last;
+		fprintf(stderr, "level %d: %zu positions\n", level,
+			unique(first));
+	}
+	qsort(pos, npos, sizeof(*pos), by_key);
+	return 0;
+}
+
+static void *
+search_main(void *param) {
+	struct c4search s;
+	_Atomic uint64_t deadline;
+	struct pos *p;
+	size_t i, d;
+
+	(void)param;
+	memset(&s, 0, sizeof(s));
+	if ((s.tt = c4search_thread_tt()) == NULL) {
+		perror("ERROR allocating transposition table");
+		exit(1);
+	}
+	s.maxdepth = depth;
+	s.deadline = &deadline;
+	while ((i = atomic_fetch_add(&next_pos, 1)) < npos) {
+		p = &pos[i];
+		s.pos.cur = p->cur;
+		s.pos.mask = p->mask;
+		s.pos.nmoves = __builtin_popcountll(p->mask);
+		if (s.pos.nmoves <= min_moves) {
+			continue;
+		}
+		atomic_store(&deadline, limit_ms > 0
+			? c4search_now() + limit_ms * 1000000ull : 0);
+		c4search_run(&s);
+		if (s.best != 0 && (s.solved
+				|| (depth > 0 && s.depth == depth))) {
+			p->move = s.best;
+			p->score = s.score[s.best-1];
+			p->exact = s.solved;
+		}
+		d = atomic_fetch_add(&done_pos, 1) + 1;
+		if (d % REPORT == 0) {
+			fprintf(stderr, "searched %zu of %zu\n", d, npos);
+		}
+	}
+	return NULL;
+}
+
+static void
+put_bits(uint64_t *a, uint64_t i, int n, uint64_t v) {
+	if (n == 0) {
+		return;
+	}
+	a[i >> 6] |= v << (i & 63);
+	if ((i & 63) + n > 64) {
+		a[(i >> 6) + 1] |= v >> (64 - (i & 63));
+	}
+}
+
+static uint64_t
+align(uint64_t off) {
+	return (off + 63) & ~(uint64_t)63;
+}
+
+/* Write the entries kept to path; returns the bytes written or -1
+ */
+static long
+write_db(const char *path, size_t *nkept, size_t *nexact) {
+	struct c4db_hdr h;
+	uint64_t *samples, *high, *low, *values;
+	uint64_t n = 0, maxkey = 0, u, i, k, z, nzeros, bit, hi;
+	uint64_t nwsamples, nwhigh, nwlow, nwvalues;
+	struct c4map_part part[5];
+	long size;
+	int l = 0;
+
+	*nexact = 0;
+	for (i=0; i<npos; i++) {
+		if (pos[i].move != 0) {
+			n++;
+			maxkey = pos[i].key;
+			*nexact += pos[i].exact;
+		}
+	}
+	*nkept = n;
+	/* low bits: about log2 of the universe over the number of keys */
+	u = n > 0 ? (maxkey + 1) / n : 0;
+	while (u > 1) {
+		u >>= 1;
+		l++;
+	}
+	nzeros = (maxkey >> l) + 1;
+
+	memset(&h, 0, sizeof(h));
+	h.magic = C4DB_MAGIC;
+	h.version = C4DB_VERSION;
+	h.n = n;
+	h.lowbits = l;
+	h.plies = plies;
+	h.depth = depth;
+	h.nhigh = n + nzeros;
+	h.nsamples = (nzeros + C4DB_SAMPLE - 1) / C4DB_SAMPLE;
+	/* a spare word after each packed array, for c4db_bits */
+	nwsamples = h.nsamples;
+	nwhigh = h.nhigh / 64 + 2;
+	nwlow = n * l / 64 + 2;
+	nwvalues = n * C4DB_VALBITS / 64 + 2;
+	h.off_samples = align(sizeof(h));
+	h.off_high = align(h.off_samples + nwsamples * 8);
+	h.off_low = align(h.off_high + nwhigh * 8);
+	h.off_values = align(h.off_low + nwlow * 8);
+	size = h.off_values + nwvalues * 8;
+
+	samples = calloc(nwsamples + 1, 8);
+	high = calloc(nwhigh, 8);
+	low = calloc(nwlow, 8);
+	values = calloc(nwvalues, 8);
+	if (samples == NULL || high == NULL || low == NULL || values == NULL) {
+		free(samples);
+		free(high);
+		free(low);
+		free(values);
+		return -1;
+	}
+	for (i=k=0; i<npos; i++) {
+		if (pos[i].move == 0) {
+			continue;
+		}
+		hi = pos[i].key >> l;
+		high[(hi + k) >> 6] |= (uint64_t)1 << ((hi + k) & 63);
+		put_bits(low, k * l, l,
+			pos[i].key & (((uint64_t)1 << l) - 1));
+		put_bits(values, k * C4DB_VALBITS, C4DB_VALBITS,
+			pos[i].move | (uint64_t)(pos[i].score + C4DB_BIAS) << 3
+			| (uint64_t)pos[i].exact << 9);
+		k++;
+	}
+	for (bit=z=0; bit<h.nhigh; bit++) {
+		if (!(high[bit >> 6] >> (bit & 63) & 1)) {
+			if (z % C4DB_SAMPLE == 0) {
+				samples[z / C4DB_SAMPLE] = bit;
+			}
+			z++;
+		}
+	}
+
+	part[0] = (struct c4map_part){ 0, &h, sizeof(h) };
+	part[1] = (struct c4map_part){ h.off_samples, samples, nwsamples*8 };
+	part[2] = (struct c4map_part){ h.off_high, high, nwhigh*8 };
+	part[3] = (struct c4map_part){ h.off_low, low, nwlow*8 };
+	part[4] = (struct c4map_part){ h.off_values, values, nwvalues*8 };
+	if (c4map_save(path, part, 5) < 0) {
+		size = -1;
+	}
+	free(samples);
+	free(high);
+	free(low);
+	free(values);
+	return size;
+}
+
+/* Probe every position back, mirrored too; the number that came back
+ * wrong
+ */
+static size_t
+verify(const char *path) {
+	struct c4db *db;
+	struct c4db_entry e;
+	struct c4bb b;
+	size_t i, bad = 0;
+	int r, want;
+
+	if ((db = c4db_open(path)) == NULL) {
+		perror("ERROR opening database");
+		exit(1);
+	}
+	for (i=0; i<npos; i++) {
+		b.cur = pos[i].cur;
+		b.mask = pos[i].mask;
+		b.nmoves = __builtin_popcountll(b.mask);
+		r = c4db_probe(db, &b, &e);
+		if (pos[i].move == 0 ? r == 0 : (r < 0 || e.move != pos[i].move
+				|| e.score != pos[i].score
+				|| e.exact != pos[i].exact)) {
+			bad++;
+			continue;
+		}
+		b.cur = c4db_mirror(b.cur);
+		b.mask = c4db_mirror(b.mask);
+		/* a board that is its own mirror image keeps its move */
+		want = c4db_mirror(pos[i].key) == pos[i].key ? pos[i].move
+			: WIDTH + 1 - pos[i].move;
+		r = c4db_probe(db, &b, &e);
+		if (pos[i].move != 0 && (r < 0 || e.move != want)) {
+			bad++;
+		}
+	}
+	c4db_close(db);
+	return bad;
+}
+
+int
+main(int argc, char *argv[]) {
+	pthread_t tid[MAX_THREADS];
+	uint64_t start = c4search_now();
+	size_t kept, exact, bad;
+	long size;
+	int opt, nthreads = 1, i;
+
+	while ((opt = getopt(argc, argv, "p:d:t:m:j:")) != -1) {
+		switch (opt) {
+		case 'p':
+			plies = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 't':
+			limit_ms = atoi(optarg);
+			break;
+		case 'm':
+			min_moves = atoi(optarg);
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 1 || plies < 0 || plies >= WIDTH*HEIGHT
+			|| depth < 0 || nthreads < 1
+			|| nthreads > MAX_THREADS) {
+		usage(argv[0]);
+	}
+
+	if (enumerate() < 0) {
+		perror("ERROR finding positions");
+		exit(1);
+	}
+	for (i=0; i<nthreads; i++) {
+		if (pthread_create(&tid[i], NULL, search_main, NULL)) {
+			perror("ERROR creating thread");
+			exit(1);
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		pthread_join(tid[i], NULL);
+	}
+	if ((size = write_db(argv[optind], &kept, &exact)) < 0) {
+		perror("ERROR writing database");
+		exit(1);
+	}
+	if ((bad = verify(argv[optind])) != 0) {
+		fprintf(stderr, "ERROR %zu positions probed back wrong\n", bad);
+		exit(1);
+	}
+
+	printf("{\"plies\": %d, \"depth\": %d, \"positions\": %zu, "
+		"\"entries\": %zu, \"exact\": %zu, \"bytes\": %ld, "
+		"\"bits_per_entry\": %.2f, \"seconds\": %.1f}\n",
+		plies, depth, npos, kept, exact, size,
+		kept ? size * 8.0 / kept : 0,
+		(c4search_now() - start) / 1e9);
+	return 0;
+}
+
+static void
+usage(char *prog) {
+	fprintf(stderr, "usage: %s [-p plies] [-d depth] [-t ms] [-m moves] "
+		"[-j threads] output\n", prog);
+	exit(1);
+}
@@ -0,0 +1,201 @@
+/* epoll I/O backend for server1's workers, see struct c4io in
+   c4server.h
+
+   Readiness based: the listening socket, the inbox eventfd and every
+   client are in one epoll set per worker, and each ready socket costs
+   a read() or accept4() and each reply a write(). The unix-domain
+   listener, if any, is shared by all the workers and added to each
+   set as EPOLLEXCLUSIVE, so a connection wakes only one of them.
+
+   To compile: gcc -c c4epoll.c
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include "c4server.h"
+#include "c4metrics.h"
+#include "c4trace.h"
+
+	/* most events taken from epoll in one go */
+#define EVENTS		64
+
+static void accept_clients(struct worker *w, int fd);
+static void input(struct worker *w, struct session *s);
+
+static int
+ep_init(struct worker *w) {
+	struct epoll_event ev;
+
+	if ((w->epfd = epoll_create1(0)) < 0) {
+		perror("ERROR creating epoll");
+		return -1;
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = &w->listenfd;
+	if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->listenfd, &ev) < 0) {
+		perror("ERROR adding listener to epoll");
+		return -1;
+	}
+	ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+	ev.data.ptr = &w->unixfd;
+	if (w->unixfd >= 0
+			&& epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->unixfd, &ev) < 0) {
+		perror("ERROR adding unix listener to epoll");
+		return -1;
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = w;
+	if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, w->evfd, &ev) < 0) {
+		perror("ERROR adding eventfd to epoll");
+		return -1;
+	}
+	return 0;
+}
+
+/* Wait up to timeout ms and act on whatever is ready; -1 if epoll
+ * itself has failed
+ */
+static int
+ep_wait(struct worker *w, int timeout) {
+	struct epoll_event ev[EVENTS];
+	uint64_t t_wake;
+	int i, n, slept = 0;
+
+	/* look before sleeping, to know whether what comes is new */
+	n = epoll_wait(w->epfd, ev, EVENTS, 0);
+	if (n == 0 && timeout != 0) {
+		slept = 1;
+		n = epoll_wait(w->epfd, ev, EVENTS, timeout);
+	}
+	if (n < 0) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		perror("ERROR on epoll_wait");
+		return -1;
+	}
+	t_wake = c4m_now();
+	worker_woke(w, slept, t_wake, n == EVENTS);
+	for (i=0; i<n; i++) {
+		/* time spent ready but behind earlier events */
+		c4m_record(C4M_QUEUE_WAIT, c4m_now() - t_wake);
+		C4TRACE_WAIT(t_wake, "queue_wait", i);
+		if (ev[i].data.ptr == &w->listenfd) {
+			accept_clients(w, w->listenfd);
+		} else if (ev[i].data.ptr == &w->unixfd) {
+			accept_clients(w, w->unixfd);
+		} else if (ev[i].data.ptr == w) {
+			watch_inbox(w);
+		} else {
+			if (ev[i].events & EPOLLOUT) {
+				watch_output(w, ev[i].data.ptr);
+			}
+			if (ev[i].events & ~EPOLLOUT) {
+				input(w, ev[i].data.ptr);
+			}
+		}
+	}
+	return 0;
+}
+
+static int
+ep_add(struct worker *w, struct session *s) {
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = s;
+	return epoll_ctl(w->epfd, EPOLL_CTL_ADD, s->fd, &ev);
+}
+
+static void
+ep_remove(struct worker *w, struct session *s) {
+	epoll_ctl(w->epfd, EPOLL_CTL_DEL, s->fd, NULL);
+}
+
+/* Replies are tiny, so anything short of the whole thing going
+ * straight into the socket buffer counts as failure
+ */
+static int
+ep_send(struct worker *w, struct session *s, const char *buf, int len) {
+	return write(s->fd, buf, len) == len ? 0 : -1;
+}
+
+static void
+ep_close(struct worker *w, struct session *s) {
+	close(s->fd);
+}
+
+static void
+ep_want_output(struct worker *w, struct session *s, int on) {
+	struct epoll_event ev;
+	ev.events = EPOLLIN | (on ? EPOLLOUT : 0);
+	ev.data.ptr = s;
+	epoll_ctl(w->epfd, EPOLL_CTL_MOD, s->fd, &ev);
+}
+
+/* Take every connection waiting on a listening socket; those on the
+ * unix-domain one have no address to log
+ */
+static void
+accept_clients(struct worker *w, int fd) {
+	struct sockaddr_in cli_addr;
+	socklen_t clilen;
+	int newsockfd;
+
+	for (;;) {
+		clilen = sizeof(cli_addr);
+
+		/* Accept a connection, if one is ready. Get back a new
+		 file descriptor to communicate on. */
+
+		newsockfd = accept4(fd, (struct sockaddr *) &cli_addr,
+			&clilen, SOCK_NONBLOCK);
+
+		if (newsockfd < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK
+					&& errno != EINTR && errno != ECONNABORTED)
+			{
+				perror("ERROR on accept");
+			}
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			return;
+		}
+		session_open(w, newsockfd, fd == w->listenfd
+			? cli_addr.sin_addr.s_addr : 0);
+	}
+}
+
+/* Read what the client has sent into the session
+ */
+static void
+input(struct worker *w, struct session *s) {
+	int n;
+
+	if (s->fd < 0) {
+		/* closed earlier in this batch of events, with its peer */
+		return;
+	}
+	n = read(s->fd, s->in + s->inlen, LEN - 1 - s->inlen);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+		return;
+	}
+	session_data(w, s, n);
+}
+
+const struct c4io c4io_epoll = {
+	"epoll",
+	ep_init,
+	ep_wait,
+	ep_add,
+	ep_remove,
+	ep_send,
+	ep_close,
+	ep_want_output,
+};
@@ -0,0 +1,190 @@
+/* Rules of connect-4, see c4game.h
+
+   To compile: gcc -c c4game.c
+*/
+
+#include <stdlib.h>
+#include "c4game.h"
+
+/* Initialise the playing array to empty cells */
+void
+init_empty(c4_t board) {
+	int r, c;
+	for (r=HEIGHT-1; r>=0; r--) {
+		for (c=0; c<WIDTH; c++) {
+			board[r][c] = EMPTY;
+		}
+	}
+}
+
+/* Apply the specified move to the board
+ */
+int
+do_move(c4_t board, int c, char colour) {
+	int r=0;
+	/* first, find the next empty slot in that column */
+	while ((r<HEIGHT) && (board[r][c-1]!=EMPTY)) {
+		r += 1;
+	}
+	if (r==HEIGHT) {
+		/* no move is possible */
+		return 0;
+	}
+	/* otherwise, do the assignment */
+	board[r][c-1] = colour;
+	return 1;
+}
+
+/* Remove the top token from the specified column c
+ */
+void
+undo_move(c4_t board, int c) {
+	int r=0;
+	/* first, find the next empty slot in that column, but be
+	 * careful not to run over the top of the array
+	 */
+	while ((r<HEIGHT) && board[r][c-1] != EMPTY) {
+		r += 1;
+	}
+	/* then do the assignment, assuming that r>=1 */
+	board[r-1][c-1] = EMPTY;
+	return;
+}
+
+/* Check board to see if it is full or not */
+int
+move_possible(c4_t board) {
+	int c;
+	/* check that a move is possible */
+	for (c=0; c<WIDTH; c++) {
+		if (board[HEIGHT-1][c] == EMPTY) {
+			/* this move is possible */
+			return 1;
+		}
+	}
+	/* if here and loop is finished, and no move possible */
+	return 0;
+}
+
+/* Is there a winning position on the current board?
+ */
+char
+winner_found(c4_t board) {
+	int r, c;
+	/* check exhaustively from every position on the board
+	 * to see if there is a winner starting at that position.
+	 * could probably short-circuit some of the computatioin,
+	 * but hey, the computer has plenty of time to do the tesing
+	 */
+	for (r=0; r<HEIGHT; r++) {
+		for (c=0; c<WIDTH; c++) {
+			if ((board[r][c]!=EMPTY) && rowformed(board,r,c)) {
+				return board[r][c];
+			}
+		}
+	}
+	/* ok, went right through all positions and if we are still
+	 * here then there isn't a solution to be found
+	 */
+	return EMPTY;
+}
+
+/* Is there a row in any direction starting at [r][c]?
+ */
+int
+rowformed(c4_t board, int r, int c) {
+	return
+		explore(board, r, c, +1,  0) ||
+		explore(board, r, c, -1,  0) ||
+		explore(board, r, c,  0, +1) ||
+		explore(board, r, c,  0, -1) ||
+		explore(board, r, c, -1, -1) ||
+		explore(board, r, c, -1, +1) ||
+		explore(board, r, c, +1, -1) ||
+		explore(board, r, c, +1, +1);
+}
+
+/* Nitty-gritty detail of looking for a set of straight-line
+ * items all the same colour. Need to be very careful not to step
+ * over the edge of the array
+ */
+int
+explore(c4_t board, int r_fix, int c_fix, int r_off, int c_off) {
+	int r_lim, c_lim;
+	int r, c, i;
+	r_lim = r_fix + (STRAIGHT-1)*r_off;
+	c_lim = c_fix + (STRAIGHT-1)*c_off;
+	/* can we go in the specified direction?
+	 */
+	if (r_lim<0 || r_lim>=HEIGHT || c_lim<0 || c_lim>=WIDTH) {
+		/* no, not enough space */
+		return 0;
+	}
+	/* can, so check the colours for all the same */
+	for (i=1; i<STRAIGHT; i++) {
+		r = r_fix + i*r_off;
+		c = c_fix + i*c_off;
+		if (board[r][c] != board[r_fix][c_fix]) {
+			/* found one different, so cannotbe a row */
+			return 0;
+		}
+	}
+	/* by now, a straight row all the same colour has been found */
+	return 1;
+}
+
+/* Try to find a good move for the specified colour
+ */
+int
+suggest_move(c4_t board, char colour) {
+	unsigned h = 2166136261u;
+	int c, r;
+	/* look for a winning move for colour */
+	for (c=0; c<WIDTH; c++) {
+		/* temporarily move in column c... */
+		if (do_move(board, c+1, colour)) {
+			/* ... and check to see the outcome */
+			if (winner_found(board) == colour) {
+				/* it is good, so unassign and return c */
+				undo_move(board, c+1);
+				return c+1;
+			} else {
+				undo_move(board, c+1);
+			}
+		}
+	}
+	/* ok, no winning move, look for a blocking move */
+	if (colour == RED) {
+		colour = YELLOW;
+	} else {
+		colour = RED;
+	}
+	for (c=0; c<WIDTH; c++) {
+		/* temporarily move in column c... */
+		if (do_move(board, c+1, colour)) {
+			/* ... and check to see the outcome */
+			if (winner_found(board) == colour) {
+				/* it is good, so unassign and return c */
+				undo_move(board, c+1);
+				return c+1;
+			} else {
+				undo_move(board, c+1);
+			}
+		}
+	}
+	/* no moves found? then pick one as good as at random, but the
+	 * same one every time the position comes up, so that a server
+	 * playing many games at once answers a replayed game just as it
+	 * did the first time
+	 */
+	for (r=0; r<HEIGHT; r++) {
+		for (c=0; c<WIDTH; c++) {
+			h = (h ^ (unsigned char)board[r][c]) * 16777619u;
+		}
+	}
+	c = h % WIDTH;
+	while (board[HEIGHT-1][c]!=EMPTY) {
+		c = (c+1) % WIDTH;
+	}
+	return c+1;
+}
@@ -0,0 +1,104 @@
+/* Rules of connect-4, shared by server1.c and the offline tools
+
+   To compile: gcc -c c4game.c
+*/
+
+#ifndef C4GAME_H
+#define C4GAME_H
+
+#include <stdint.h>
+
+	/* number of columns in the game */
+#define WIDTH		7
+
+	/* number of slots in each column */
+#define HEIGHT		6
+
+	/* number in row required for victory */
+#define STRAIGHT	4
+
+	/* sign that a cell is still empty */
+#define EMPTY		' '
+
+	/* the two colours used in the game */
+#define RED		'R'
+#define YELLOW		'Y'
+
+typedef char c4_t[HEIGHT][WIDTH];
+
+void init_empty(c4_t);
+int do_move(c4_t, int, char);
+void undo_move(c4_t, int);
+int move_possible(c4_t);
+char winner_found(c4_t);
+int rowformed(c4_t,  int r, int c);
+int explore(c4_t, int r_fix, int c_fix, int r_off, int c_off);
+int suggest_move(c4_t board, char colour);
+
+	/* The same game as bitboards: each column takes HEIGHT+1 bits,
+	 * the spare top bit keeping lines from wrapping into the next
+	 * column. cur holds the stones of the side to move and mask all
+	 * stones, so cur^mask is the side that just moved.
+	 */
+#define C4BB_H		(HEIGHT+1)
+
+struct c4bb {
+	uint64_t cur;
+	uint64_t mask;
+	int nmoves;
+};
+
+#define c4bb_bottom(c)	((uint64_t)1 << ((c)-1)*C4BB_H)
+#define c4bb_top(c)	((uint64_t)1 << (HEIGHT-1 + ((c)-1)*C4BB_H))
+#define c4bb_column(c)	((((uint64_t)1 << HEIGHT) - 1) << ((c)-1)*C4BB_H)
+
+static inline void
+c4bb_init(struct c4bb *b) {
+	b->cur = b->mask = 0;
+	b->nmoves = 0;
+}
+
+	/* is column c (1..WIDTH) open? */
+static inline int
+c4bb_can_play(const struct c4bb *b, int c) {
+	return (b->mask & c4bb_top(c)) == 0;
+}
+
+	/* drop a stone for the side to move into column c */
+static inline void
+c4bb_play(struct c4bb *b, int c) {
+	b->cur ^= b->mask;
+	b->mask |= b->mask + c4bb_bottom(c);
+	b->nmoves++;
+}
+
+	/* does this set of stones contain STRAIGHT in a row? */
+static inline int
+c4bb_aligned(uint64_t p) {
+	static const int dir[4] = { 1, C4BB_H-1, C4BB_H, C4BB_H+1 };
+	uint64_t m;
+	int d, i;
+	for (d=0; d<4; d++) {
+		m = p;
+		for (i=1; i<STRAIGHT; i++) {
+			m &= p >> (i*dir[d]);
+		}
+		if (m) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+	/* did the move just played win? only the mover can have won */
+static inline int
+c4bb_won(const struct c4bb *b) {
+	return c4bb_aligned(b->cur ^ b->mask);
+}
+
+static inline int
+c4bb_full(const struct c4bb *b) {
+	return b->nmoves == WIDTH*HEIGHT;
+}
+
+#endif
@@ -0,0 +1,374 @@
+/* Append-only binary game journal, see c4journal.h
+
+   To compile: gcc -c c4journal.c -pthread
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "c4journal.h"
+
+	/* records are copied into chunks of this size while they wait */
+#define CHUNK		(64*1024)
+
+	/* most chunks in one batch, i.e. one writev() */
+#define MAXCHUNKS	64
+
+	/* the flusher writes at least this often, in ms */
+#define FLUSH_MS	1000
+
+struct batch {
+	char *chunk[MAXCHUNKS];
+	size_t used[MAXCHUNKS];
+	int n;
+};
+
+struct c4journal {
+	char dir[PATH_MAX];
+	int writer;
+	size_t seglimit;
+
+	int fd;			/* current segment, or -1 before the first */
+	uint32_t seq;
+	size_t segsize;
+
+	pthread_mutex_t lock;	/* guards fill and stop */
+	pthread_cond_t wake;
+	struct batch a, b;
+	struct batch *fill;	/* appended to by the server */
+	int stop;
+	pthread_t tid;
+};
+
+static void *flusher(void *param);
+
+/* Highest segment number already used by this writer in dir
+ */
+static uint32_t
+last_seq(const char *dir, int writer) {
+	DIR *d;
+	struct dirent *e;
+	int w;
+	unsigned s, max = 0;
+	if ((d = opendir(dir)) == NULL) {
+		return 0;
+	}
+	while ((e = readdir(d)) != NULL) {
+		if (sscanf(e->d_name, "%d-%u.c4j", &w, &s) == 2
+				&& w == writer && s > max) {
+			max = s;
+		}
+	}
+	closedir(d);
+	return max;
+}
+
+struct c4journal *
+c4journal_open(const char *dir, int writer, size_t seglimit) {
+	struct c4journal *j;
+
+	if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+		return NULL;
+	}
+	if ((j = calloc(1, sizeof(*j))) == NULL) {
+		return NULL;
+	}
+	snprintf(j->dir, sizeof(j->dir), "%s", dir);
+	j->writer = writer;
+	j->seglimit = seglimit ? seglimit : C4J_SEGMENT;
+	j->fd = -1;
+	j->seq = last_seq(dir, writer);
+	j->fill = &j->a;
+	pthread_mutex_init(&j->lock, NULL);
+	pthread_cond_init(&j->wake, NULL);
+	if (pthread_create(&j->tid, NULL, flusher, j)) {
+		free(j);
+		return NULL;
+	}
+	return j;
+}
+
+/* Copy a finished game into the pending batch; the disk work is all
+ * done later by the flusher thread
+ */
+int
+c4journal_append(struct c4journal *j, const struct c4j_rec *rec) {
+	struct batch *b;
+	int i;
+
+	pthread_mutex_lock(&j->lock);
+	b = j->fill;
+	i = b->n - 1;
+	if (i < 0 || b->used[i] + rec->len > CHUNK) {
+		if (b->n == MAXCHUNKS) {
+			/* flusher is far behind, so give up on this one */
+			pthread_mutex_unlock(&j->lock);
+			return -1;
+		}
+		i = b->n;
+		if (b->chunk[i] == NULL
+				&& (b->chunk[i] = malloc(CHUNK)) == NULL) {
+			pthread_mutex_unlock(&j->lock);
+			return -1;
+		}
+		b->used[i] = 0;
+		b->n++;
+		if (b->n > MAXCHUNKS/2) {
+			pthread_cond_signal(&j->wake);
+		}
+	}
+	memcpy(b->chunk[i] + b->used[i], rec, rec->len);
+	b->used[i] += rec->len;
+	pthread_mutex_unlock(&j->lock);
+	return 0;
+}
+
+static int
+next_segment(struct c4journal *j) {
+	char path[PATH_MAX+32];
+	struct c4j_seghdr h;
+
+	if (j->fd >= 0) {
+		close(j->fd);
+	}
+	j->seq++;
+	snprintf(path, sizeof(path), "%s/%04d-%08u.c4j",
+		j->dir, j->writer, j->seq);
+	j->fd = open(path, O_WRONLY|O_CREAT|O_EXCL|O_APPEND, 0644);
+	if (j->fd < 0) {
+		perror("ERROR opening journal segment");
+		return -1;
+	}
+	memset(&h, 0, sizeof(h));
+	h.magic = C4J_MAGIC;
+	h.version = 1;
+	h.writer = j->writer;
+	h.seq = j->seq;
+	if (write(j->fd, &h, sizeof(h)) != sizeof(h)) {
+		perror("ERROR writing journal segment");
+		return -1;
+	}
+	j->segsize = sizeof(h);
+	return 0;
+}
+
+/* Write a whole batch with one writev() and make it durable
+ */
+static void
+write_batch(struct c4journal *j, struct batch *b) {
+	struct iovec iov[MAXCHUNKS];
+	size_t total = 0;
+	ssize_t n;
+	int i, k = 0;
+
+	for (i=0; i<b->n; i++) {
+		if (b->used[i] > 0) {
+			iov[k].iov_base = b->chunk[i];
+			iov[k].iov_len = b->used[i];
+			total += b->used[i];
+			k++;
+		}
+	}
+	b->n = 0;
+	if (k == 0) {
+		return;
+	}
+	if ((j->fd < 0 || j->segsize >= j->seglimit)
+			&& next_segment(j) < 0) {
+		return;
+	}
+	i = 0;
+	while (i < k) {
+		n = writev(j->fd, iov+i, k-i);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("ERROR writing journal");
+			return;
+		}
+		j->segsize += n;
+		/* step over whatever was written, in case it was short */
+		while (i < k && (size_t)n >= iov[i].iov_len) {
+			n -= iov[i].iov_len;
+			i++;
+		}
+		if (i < k) {
+			iov[i].iov_base = (char *)iov[i].iov_base + n;
+			iov[i].iov_len -= n;
+		}
+	}
+	fdatasync(j->fd);
+}
+
+static void *
+flusher(void *param) {
+	struct c4journal *j = param;
+	struct batch *b;
+	struct timespec until;
+	int stop;
+
+	pthread_mutex_lock(&j->lock);
+	for (;;) {
+		clock_gettime(CLOCK_REALTIME, &until);
+		until.tv_sec += FLUSH_MS/1000;
+		while (!j->stop && j->fill->n <= MAXCHUNKS/2) {
+			if (pthread_cond_timedwait(&j->wake, &j->lock, &until)
+					== ETIMEDOUT) {
+				break;
+			}
+		}
+		/* swap batches so the server keeps appending meanwhile */
+		b = j->fill;
+		j->fill = (b == &j->a) ? &j->b : &j->a;
+		stop = j->stop;
+		pthread_mutex_unlock(&j->lock);
+
+		write_batch(j, b);
+
+		pthread_mutex_lock(&j->lock);
+		if (stop && j->fill->n == 0) {
+			break;
+		}
+	}
+	pthread_mutex_unlock(&j->lock);
+	return NULL;
+}
+
+void
+c4journal_close(struct c4journal *j) {
+	int i;
+	if (j == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&j->lock);
+	j->stop = 1;
+	pthread_cond_signal(&j->wake);
+	pthread_mutex_unlock(&j->lock);
+	pthread_join(j->tid, NULL);
+	if (j->fd >= 0) {
+		close(j->fd);
+	}
+	for (i=0; i<MAXCHUNKS; i++) {
+		free(j->a.chunk[i]);
+		free(j->b.chunk[i]);
+	}
+	free(j);
+}
+
+/* Map a segment for reading, positioned at its first record
+ */
+int
+c4jseg_open(struct c4jseg *s, const char *path) {
+	struct stat st;
+	const struct c4j_seghdr *h;
+	int fd;
+	void *p;
+
+	memset(s, 0, sizeof(*s));
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*h)) {
+		close(fd);
+		return -1;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		return -1;
+	}
+	madvise(p, st.st_size, MADV_SEQUENTIAL);
+	h = p;
+	if (h->magic != C4J_MAGIC) {
+		munmap(p, st.st_size);
+		return -1;
+	}
+	s->base = p;
+	s->size = st.st_size;
+	s->off = sizeof(*h);
+	return 0;
+}
+
+/* Next record of the segment, straight out of the mapping, or NULL
+ * at the end; a torn record left by a crash also ends the segment
+ */
+const struct c4j_rec *
+c4jseg_next(struct c4jseg *s) {
+	const struct c4j_rec *r;
+	if (s->off + sizeof(*r) > s->size) {
+		return NULL;
+	}
+	r = (const struct c4j_rec *)(s->base + s->off);
+	if (r->nmoves > C4J_MAXMOVES || r->len != C4J_RECLEN(r->nmoves)
+			|| s->off + r->len > s->size) {
+		return NULL;
+	}
+	s->off += r->len;
+	return r;
+}
+
+void
+c4jseg_close(struct c4jseg *s) {
+	if (s->base != NULL) {
+		munmap((void *)s->base, s->size);
+	}
+	memset(s, 0, sizeof(*s));
+}
+
+static int
+by_name(const void *a, const void *b) {
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* All segment paths in a journal directory, in writer then seq order
+ */
+int
+c4journal_list(const char *dir, char ***paths) {
+	DIR *d;
+	struct dirent *e;
+	char **p = NULL, **q;
+	size_t len;
+	int n = 0;
+
+	*paths = NULL;
+	if ((d = opendir(dir)) == NULL) {
+		return -1;
+	}
+	while ((e = readdir(d)) != NULL) {
+		len = strlen(e->d_name);
+		if (len < 4 || strcmp(e->d_name+len-4, ".c4j") != 0) {
+			continue;
+		}
+		if ((q = realloc(p, (n+1)*sizeof(*p))) == NULL) {
+			break;
+		}
+		p = q;
+		p[n] = malloc(strlen(dir) + len + 2);
+		sprintf(p[n], "%s/%s", dir, e->d_name);
+		n++;
+	}
+	closedir(d);
+	qsort(p, n, sizeof(*p), by_name);
+	*paths = p;
+	return n;
+}
+
+void
+c4journal_free_list(char **paths, int n) {
+	int i;
+	for (i=0; i<n; i++) {
+		free(paths[i]);
+	}
+	free(paths);
+}
@@ -0,0 +1,95 @@
+/* Append-only binary journal of finished games
+
+   The server appends one compact record per game; a flusher thread
+   writes them out in batches with writev() and fdatasync(), starting
+   a new segment file once the current one passes a size limit.
+   Readers mmap() whole segments and walk the records in place.
+
+   Segments are named <dir>/<writer>-<seq>.c4j so that several server
+   processes can share one journal directory.
+
+   To compile: gcc -c c4journal.c -pthread
+*/
+
+#ifndef C4JOURNAL_H
+#define C4JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define C4J_MAGIC	0x314a3443	/* "C4J1" */
+
+	/* default size at which a segment is closed and a new one begun */
+#define C4J_SEGMENT	(64*1024*1024)
+
+	/* most moves a game can have, and bytes to hold them as nibbles */
+#define C4J_MAXMOVES	42
+#define C4J_MOVEBYTES	((C4J_MAXMOVES+1)/2)
+
+	/* first bytes of every segment file */
+struct c4j_seghdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t writer;
+	uint32_t seq;
+	uint32_t reserved;
+};
+
+	/* one game; len is the whole record rounded up to 8 bytes */
+struct c4j_rec {
+	uint16_t len;
+	uint8_t nmoves;
+	uint8_t result;		/* YELLOW, RED, EMPTY for a draw, 0 unfinished */
+	uint32_t yellow;	/* IPv4 of the player who moved first */
+	uint32_t red;		/* IPv4 of the second player, 0 for the server */
+	uint32_t dur_ms;	/* time from connect to the last move */
+	uint64_t start_ns;	/* wall clock at connect, ns since the epoch */
+	uint8_t moves[];	/* columns 1..WIDTH, two per byte, low nibble first */
+};
+
+#define C4J_RECLEN(nmoves) \
+	((sizeof(struct c4j_rec) + ((nmoves)+1)/2 + 7) & ~(size_t)7)
+
+	/* column of the i'th move of a record */
+static inline int
+c4j_move(const struct c4j_rec *r, int i) {
+	return (r->moves[i>>1] >> ((i&1)*4)) & 0xf;
+}
+
+	/* record a column as the i'th move of a record being built */
+static inline void
+c4j_set_move(struct c4j_rec *r, int i, int c) {
+	if (i & 1) {
+		r->moves[i>>1] = (r->moves[i>>1] & 0x0f) | (c << 4);
+	} else {
+		r->moves[i>>1] = (r->moves[i>>1] & 0xf0) | c;
+	}
+}
+
+	/* a record with room for a whole game, for building one on the stack */
+struct c4j_game {
+	struct c4j_rec rec;
+	uint8_t space[C4J_MOVEBYTES];
+};
+
+struct c4journal;
+
+struct c4journal *c4journal_open(const char *dir, int writer, size_t seglimit);
+int c4journal_append(struct c4journal *j, const struct c4j_rec *rec);
+void c4journal_close(struct c4journal *j);
+
+	/* one segment mapped for reading */
+struct c4jseg {
+	const uint8_t *base;
+	size_t size;
+	size_t off;
+};
+
+int c4jseg_open(struct c4jseg *s, const char *path);
+const struct c4j_rec *c4jseg_next(struct c4jseg *s);
+void c4jseg_close(struct c4jseg *s);
+
+int c4journal_list(const char *dir, char ***paths);
+void c4journal_free_list(char **paths, int n);
+
+#endif
@@ -0,0 +1,678 @@
+/* Headless load generator for server1
+
+   Opens n connections to a server on this machine, over TCP to
+   127.0.0.1 or over its unix-domain socket (-U), and plays games
+   against the server's bot on all of them from one epoll loop. Each
+   connection plays a game to the end, then reconnects for the next.
+   Moves are random legal ones, taken from a script (falling back to
+   random once the script runs out or is illegal), or chosen by the same
+   engine the server uses.
+
+   Connections are opened evenly over the ramp-up time. After each reply
+   a connection thinks for the given time, jittered by up to half either
+   way so that connections do not move in lockstep, and a target rate
+   spreads moves across the whole run however many connections are
+   ready. The latency of a move is from its write to the whole of the
+   server's reply being read. A reply, or the close that should follow
+   a game's last move, that does not come in -w ms (default 5000) is
+   counted as an error and timed out, and the connection starts over.
+
+   At the end one JSON object is printed on standard output: games and
+   moves played, moves per second, errors and timeouts, and the mean,
+   median, 99th, 99.9th percentile and worst move latency in
+   microseconds.
+
+   Given the server's admin socket (-A), its metrics are read before and
+   after the run, and what its searches did in between is added under
+   "search": searches, those sampled (see c4sched.h), and over the
+   sampled ones the mean nodes, depth, nodes a second, effective
+   branching factor and time of a depth in microseconds, with the TT
+   hit and first-move cut-off rates over all of them.
+
+   To compile: gcc -O2 c4load.c c4game.c -o c4load
+
+   To run: c4load [-n connections] [-r moves-per-second] [-R ramp-ms]
+   		[-t think-ms] [-w reply-ms] [-d seconds] [-g games]
+   		[-m random|script|engine] [-s columns] [-U unix-socket]
+   		[-A admin-socket] [port]
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "c4game.h"
+
+	/* most events taken from epoll in one go */
+#define EVENTS		256
+
+	/* how long to wait before trying a failed connection again, in ms */
+#define RETRY		100
+
+	/* how long to wait for a reply when not told, in ms */
+#define REPLY_WAIT	5000
+
+	/* most of the admin socket's metrics page that is read */
+#define METRICS		(1 << 20)
+
+	/* how a connection's move is chosen */
+#define PICK_RANDOM	0
+#define PICK_SCRIPT	1
+#define PICK_ENGINE	2
+
+	/* what a connection is doing */
+#define C_IDLE		0	/* not connected, will connect at due */
+#define C_CONNECTING	1
+#define C_THINK		2	/* will move at due */
+#define C_WAIT		3	/* waiting for the server's reply */
+#define C_CLOSING	4	/* game over, waiting for the server to close */
+
+struct conn {
+	int fd;
+	int state;
+	uint64_t due;
+	uint64_t t_sent;
+	int heap;		/* place in the timer heap, or -1 */
+	struct c4bb bb;
+	c4_t board;
+	int played;		/* our moves in this game */
+	int inlen;
+	char in[32];
+};
+
+static struct conn *conns;
+static int nconns = 100;
+static int *heap, nheap;
+
+static int pick = PICK_RANDOM;
+static char *script = "";
+static char *unixpath;
+static int portno = 5000;
+static uint64_t think_ns, slot_ns, next_slot;
+static uint64_t reply_ns = REPLY_WAIT * 1000000ull;
+
+static int epfd;
+static unsigned long games, moves, errors, connect_errors, max_games;
+static unsigned long timeouts;
+static uint64_t *lat;
+static size_t nlat, maxlat;
+
+	/* server metrics the search summary is worked out from */
+#define S_SEARCHES	0
+#define S_SAMPLED	1
+#define S_PROBES	2
+#define S_HITS		3
+#define S_CUTOFFS	4
+#define S_FIRST		5
+#define S_NODES		6	/* sums over the sampled, then counts */
+#define S_DEPTH		8
+#define S_NPS		10
+#define S_EBF		12
+#define S_ITERATION	14
+#define S_N		16
+
+static const char *search_metric[S_N] = {
+	"c4_searches_total", "c4_searches_sampled_total",
+	"c4_tt_probes_total", "c4_tt_hits_total", "c4_cutoffs_total",
+	"c4_first_move_cutoffs_total",
+	"c4_search_nodes_sum", "c4_search_nodes_count",
+	"c4_search_depth_sum", "c4_search_depth_count",
+	"c4_search_nodes_per_second_sum", "c4_search_nodes_per_second_count",
+	"c4_search_ebf_x100_sum", "c4_search_ebf_x100_count",
+	"c4_search_iteration_ns_sum", "c4_search_iteration_ns_count",
+};
+
+static char *adminpath;
+static double search_before[S_N], search_after[S_N];
+
+static void usage(char *prog);
+static uint64_t now_ns(void);
+static void schedule(struct conn *c, uint64_t due);
+static void open_conn(struct conn *c, uint64_t now);
+static void connected(struct conn *c, uint64_t now);
+static void send_move(struct conn *c, uint64_t now);
+static void input(struct conn *c, uint64_t now);
+static void finish(struct conn *c, uint64_t now, int ok);
+static void ready(struct conn *c, uint64_t now);
+static int choose(struct conn *c);
+static void report(double secs);
+static int read_metrics(double *v);
+
+int
+main(int argc, char **argv) {
+	struct epoll_event ev[EVENTS];
+	struct rlimit rl;
+	uint64_t t0, now, end, ramp_ns = 0;
+	double rate = 0, secs = 10;
+	int opt, i, n, timeout;
+	struct conn *c;
+
+	while ((opt = getopt(argc, argv, "n:r:R:t:w:d:g:m:s:U:A:")) != -1) {
+		if (opt == 'n') {
+			nconns = atoi(optarg);
+		} else if (opt == 'r') {
+			rate = atof(optarg);
+		} else if (opt == 'R') {
+			ramp_ns = strtoull(optarg, NULL, 10) * 1000000ull;
+		} else if (opt == 't') {
+			think_ns = strtoull(optarg, NULL, 10) * 1000000ull;
+		} else if (opt == 'w') {
+			reply_ns = strtoull(optarg, NULL, 10) * 1000000ull;
+		} else if (opt == 'd') {
+			secs = atof(optarg);
+		} else if (opt == 'g') {
+			max_games = strtoul(optarg, NULL, 10);
+		} else if (opt == 'm' && strcmp(optarg, "random") == 0) {
+			pick = PICK_RANDOM;
+		} else if (opt == 'm' && strcmp(optarg, "script") == 0) {
+			pick = PICK_SCRIPT;
+		} else if (opt == 'm' && strcmp(optarg, "engine") == 0) {
+			pick = PICK_ENGINE;
+		} else if (opt == 's') {
+			script = optarg;
+			pick = PICK_SCRIPT;
+		} else if (opt == 'U') {
+			unixpath = optarg;
+		} else if (opt == 'A') {
+			adminpath = optarg;
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (optind < argc) {
+		portno = atoi(argv[optind]);
+	} else if (unixpath == NULL) {
+		usage(argv[0]);
+	}
+	if (nconns < 1 || secs <= 0 || rate < 0 || reply_ns == 0) {
+		usage(argv[0]);
+	}
+
+	/* a connection is a descriptor, so ask for as many as allowed */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	conns = calloc(nconns, sizeof(*conns));
+	heap = calloc(nconns, sizeof(*heap));
+	maxlat = 1 << 20;
+	lat = malloc(maxlat * sizeof(*lat));
+	if (conns == NULL || heap == NULL || lat == NULL) {
+		perror("ERROR allocating connections");
+		exit(1);
+	}
+	if ((epfd = epoll_create1(0)) < 0) {
+		perror("ERROR creating epoll");
+		exit(1);
+	}
+	srand(time(NULL));
+	if (adminpath != NULL && read_metrics(search_before) < 0) {
+		perror(adminpath);
+		exit(1);
+	}
+
+	t0 = now_ns();
+	end = t0 + (uint64_t)(secs * 1e9);
+	slot_ns = rate > 0 ? (uint64_t)(1e9 / rate) : 0;
+	next_slot = t0;
+	for (i=0; i<nconns; i++) {
+		conns[i].fd = -1;
+		conns[i].heap = -1;
+		conns[i].state = C_IDLE;
+		schedule(&conns[i], t0 + ramp_ns * i / nconns);
+	}
+
+	for (;;) {
+		now = now_ns();
+		if (now >= end || (max_games && games >= max_games)) {
+			break;
+		}
+		/* everything that has come due */
+		while (nheap > 0 && conns[heap[0]].due <= now) {
+			c = &conns[heap[0]];
+			schedule(c, 0);
+			if (c->state == C_IDLE) {
+				open_conn(c, now);
+			} else if (c->state == C_THINK) {
+				send_move(c, now);
+			} else if (c->state == C_WAIT
+					|| c->state == C_CLOSING) {
+				/* the server has gone quiet on us */
+				timeouts++;
+				finish(c, now, 0);
+			}
+		}
+		timeout = 100;
+		if (nheap > 0) {
+			timeout = (conns[heap[0]].due - now + 999999) / 1000000;
+			if (timeout > 100) {
+				timeout = 100;
+			}
+		}
+		n = epoll_wait(epfd, ev, EVENTS, timeout);
+		if (n < 0 && errno != EINTR) {
+			perror("ERROR on epoll_wait");
+			exit(1);
+		}
+		now = now_ns();
+		for (i=0; i<n; i++) {
+			c = &conns[ev[i].data.u32];
+			if (c->state == C_CONNECTING) {
+				connected(c, now);
+			} else {
+				input(c, now);
+			}
+		}
+	}
+
+	secs = (now_ns() - t0) / 1e9;
+	if (adminpath != NULL && read_metrics(search_after) < 0) {
+		perror(adminpath);
+		adminpath = NULL;
+	}
+	report(secs);
+	return 0;
+}
+
+static void
+usage(char *prog) {
+	fprintf(stderr, "usage: %s [-n connections] [-r moves-per-second] "
+		"[-R ramp-ms] [-t think-ms] [-w reply-ms] [-d seconds] "
+		"[-g games] [-m random|script|engine] [-s columns] "
+		"[-U unix-socket] "
+		"[-A admin-socket] [port]\n", prog);
+	exit(1);
+}
+
+static uint64_t
+now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+
+/* The timer heap: a binary min-heap of connections by due time
+ */
+static void
+heap_set(int i, int k) {
+	heap[i] = k;
+	conns[k].heap = i;
+}
+
+static void
+heap_up(int i) {
+	int k = heap[i], p;
+	while (i > 0 && conns[heap[p = (i-1)/2]].due > conns[k].due) {
+		heap_set(i, heap[p]);
+		i = p;
+	}
+	heap_set(i, k);
+}
+
+static void
+heap_down(int i) {
+	int k = heap[i], j;
+	while ((j = 2*i + 1) < nheap) {
+		if (j+1 < nheap && conns[heap[j+1]].due < conns[heap[j]].due) {
+			j++;
+		}
+		if (conns[heap[j]].due >= conns[k].due) {
+			break;
+		}
+		heap_set(i, heap[j]);
+		i = j;
+	}
+	heap_set(i, k);
+}
+
+/* Wake the connection at due, or never if due is 0
+ */
+static void
+schedule(struct conn *c, uint64_t due) {
+	int i = c->heap, k;
+	if (i >= 0) {
+		c->heap = -1;
+		if (--nheap > i) {
+			k = heap[nheap];
+			heap_set(i, k);
+			heap_up(i);
+			heap_down(conns[k].heap);
+		}
+	}
+	if (due == 0) {
+		return;
+	}
+	c->due = due;
+	heap_set(nheap++, c - conns);
+	heap_up(nheap - 1);
+}
+
+static void
+open_conn(struct conn *c, uint64_t now) {
+	struct sockaddr_in in;
+	struct sockaddr_un un;
+	struct epoll_event ev;
+	int fd, r, on = 1;
+
+	if (unixpath != NULL) {
+		memset(&un, 0, sizeof(un));
+		un.sun_family = AF_UNIX;
+		strncpy(un.sun_path, unixpath, sizeof(un.sun_path)-1);
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		r = fd < 0 ? -1 : connect(fd, (struct sockaddr *)&un,
+			sizeof(un));
+	} else {
+		memset(&in, 0, sizeof(in));
+		in.sin_family = AF_INET;
+		in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		in.sin_port = htons(portno);
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (fd >= 0) {
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on,
+				sizeof(on));
+		}
+		r = fd < 0 ? -1 : connect(fd, (struct sockaddr *)&in,
+			sizeof(in));
+	}
+	if (r < 0 && errno != EINPROGRESS) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		connect_errors++;
+		schedule(c, now + RETRY*1000000ull);
+		return;
+	}
+	c->fd = fd;
+	c->state = C_CONNECTING;
+	ev.events = EPOLLOUT;
+	ev.data.u32 = c - conns;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+	if (r == 0) {
+		connected(c, now);
+	}
+}
+
+static void
+connected(struct conn *c, uint64_t now) {
+	struct epoll_event ev;
+	socklen_t len = sizeof(int);
+	int err = 0;
+
+	getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+	if (err != 0) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+		close(c->fd);
+		c->fd = -1;
+		c->state = C_IDLE;
+		connect_errors++;
+		schedule(c, now + RETRY*1000000ull);
+		return;
+	}
+	ev.events = EPOLLIN;
+	ev.data.u32 = c - conns;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+
+	c4bb_init(&c->bb);
+	init_empty(c->board);
+	c->played = 0;
+	c->inlen = 0;
+	c->state = C_THINK;
+	/* the first move goes as soon as the rate allows */
+	schedule(c, next_slot > now ? next_slot : now);
+	next_slot = c->due + slot_ns;
+}
+
+/* A reply is in: think, then move when the rate allows
+ */
+static void
+ready(struct conn *c, uint64_t now) {
+	uint64_t due = now;
+	if (think_ns > 0) {
+		due += think_ns/2 + (uint64_t)rand() % (think_ns + 1);
+	}
+	if (slot_ns > 0) {
+		if (due < next_slot) {
+			due = next_slot;
+		}
+		next_slot = due + slot_ns;
+	}
+	c->state = C_THINK;
+	schedule(c, due);
+}
+
+static int
+choose(struct conn *c) {
+	int col, k, open[WIDTH];
+
+	if (pick == PICK_ENGINE) {
+		return suggest_move(c->board, YELLOW);
+	}
+	if (pick == PICK_SCRIPT && c->played < (int)strlen(script)) {
+		col = script[c->played] - '0';
+		if (col >= 1 && col <= WIDTH && c4bb_can_play(&c->bb, col)) {
+			return col;
+		}
+	}
+	for (k=0, col=1; col<=WIDTH; col++) {
+		if (c4bb_can_play(&c->bb, col)) {
+			open[k++] = col;
+		}
+	}
+	return open[rand() % k];
+}
+
+static void
+send_move(struct conn *c, uint64_t now) {
+	char buf[8];
+	int col = choose(c), len;
+
+	len = sprintf(buf, "%d\n", col);
+	c->t_sent = now_ns();
+	if (write(c->fd, buf, len) != len) {
+		finish(c, now, 0);
+		return;
+	}
+	c4bb_play(&c->bb, col);
+	do_move(c->board, col, YELLOW);
+	c->played++;
+	moves++;
+	/* a winning or last move gets no reply: the server just closes */
+	c->state = (c4bb_won(&c->bb) || c4bb_full(&c->bb)) ? C_CLOSING
+		: C_WAIT;
+	schedule(c, now + reply_ns);
+}
+
+static void
+input(struct conn *c, uint64_t now) {
+	char *end;
+	int n, col;
+
+	n = read(c->fd, c->in + c->inlen, sizeof(c->in) - 1 - c->inlen);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+		return;
+	}
+	if (n <= 0) {
+		finish(c, now, c->state == C_CLOSING);
+		return;
+	}
+	if (c->state != C_WAIT) {
+		/* nothing is owed to us */
+		finish(c, now, 0);
+		return;
+	}
+	c->inlen += n;
+	c->in[c->inlen] = '\0';
+	if ((end = strchr(c->in, '\n')) == NULL) {
+		if (c->inlen == sizeof(c->in) - 1) {
+			finish(c, now, 0);
+		}
+		return;
+	}
+	if (nlat == maxlat && (lat = realloc(lat,
+			(maxlat *= 2) * sizeof(*lat))) == NULL) {
+		perror("ERROR allocating samples");
+		exit(1);
+	}
+	lat[nlat++] = now - c->t_sent;
+
+	col = atoi(c->in);
+	n = c->inlen;
+	c->inlen = 0;
+	if (end != c->in + n - 1 || col < 1 || col > WIDTH
+			|| !c4bb_can_play(&c->bb, col)) {
+		/* more than one line, or not a move we could have had */
+		finish(c, now, 0);
+		return;
+	}
+	c4bb_play(&c->bb, col);
+	do_move(c->board, col, RED);
+	moves++;
+	if (c4bb_won(&c->bb) || c4bb_full(&c->bb)) {
+		c->state = C_CLOSING;
+		schedule(c, now + reply_ns);
+		return;
+	}
+	ready(c, now);
+}
+
+/* The connection's game is over, well (ok) or not: connect again
+ */
+static void
+finish(struct conn *c, uint64_t now, int ok) {
+	if (ok) {
+		games++;
+	} else {
+		errors++;
+	}
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+	c->state = C_IDLE;
+	schedule(c, ok ? now : now + RETRY*1000000ull);
+}
+
+static int
+cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static double
+quantile(double q) {
+	size_t i;
+	if (nlat == 0) {
+		return 0;
+	}
+	i = (size_t)(q * (nlat - 1) + 0.5);
+	return lat[i] / 1e3;
+}
+
+/* The search metrics from the admin socket into v, by search_metric
+ */
+static int
+read_metrics(double *v) {
+	struct sockaddr_un un;
+	char *buf, *line, name[128];
+	double x;
+	int fd, n = 0, r, i;
+
+	memset(&un, 0, sizeof(un));
+	un.sun_family = AF_UNIX;
+	strncpy(un.sun_path, adminpath, sizeof(un.sun_path)-1);
+	if ((buf = malloc(METRICS)) == NULL) {
+		return -1;
+	}
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+			|| connect(fd, (struct sockaddr *)&un, sizeof(un)) < 0
+			|| write(fd, "metrics\n", 8) != 8) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		free(buf);
+		return -1;
+	}
+	shutdown(fd, SHUT_WR);
+	while (n < METRICS-1 && (r = read(fd, buf+n, METRICS-1-n)) > 0) {
+		n += r;
+	}
+	close(fd);
+	buf[n] = '\0';
+
+	memset(v, 0, S_N * sizeof(*v));
+	for (line=strtok(buf, "\n"); line!=NULL; line=strtok(NULL, "\n")) {
+		if (sscanf(line, "%127s %lf", name, &x) != 2) {
+			continue;
+		}
+		for (i=0; i<S_N; i++) {
+			if (strcmp(name, search_metric[i]) == 0) {
+				v[i] = x;
+			}
+		}
+	}
+	free(buf);
+	return 0;
+}
+
+	/* the mean over the run of a sum and count pair of metrics */
+static double
+search_mean(int i) {
+	double count = search_after[i+1] - search_before[i+1];
+	return count > 0 ? (search_after[i] - search_before[i]) / count : 0;
+}
+
+static double
+search_ratio(int i, int j) {
+	double d = search_after[j] - search_before[j];
+	return d > 0 ? (search_after[i] - search_before[i]) / d : 0;
+}
+
+static void
+report(double secs) {
+	double sum = 0;
+	size_t i;
+
+	qsort(lat, nlat, sizeof(*lat), cmp_u64);
+	for (i=0; i<nlat; i++) {
+		sum += lat[i];
+	}
+	printf("{\"connections\": %d, \"transport\": \"%s\", "
+		"\"moves_from\": \"%s\", \"seconds\": %.3f, "
+		"\"games\": %lu, \"moves\": %lu, \"moves_per_second\": %.1f, "
+		"\"errors\": %lu, \"timeouts\": %lu, \"connect_errors\": %lu, "
+		"\"latency_us\": {\"samples\": %zu, \"mean\": %.1f, "
+		"\"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, "
+		"\"max\": %.1f}",
+		nconns, unixpath ? "unix" : "tcp",
+		pick == PICK_ENGINE ? "engine"
+			: pick == PICK_SCRIPT ? "script" : "random",
+		secs, games, moves, moves / secs, errors, timeouts,
+		connect_errors,
+		nlat, nlat ? sum / nlat / 1e3 : 0, quantile(0.5),
+		quantile(0.99), quantile(0.999), nlat ? lat[nlat-1] / 1e3 : 0);
+	if (adminpath != NULL) {
+		printf(", \"search\": {\"searches\": %.0f, \"sampled\": %.0f, "
+			"\"nodes\": %.0f, \"depth\": %.2f, "
+			"\"nodes_per_second\": %.0f, \"ebf\": %.2f, "
+			"\"iteration_us\": %.1f, \"tt_hit_rate\": %.3f, "
+			"\"first_cutoff_rate\": %.3f}",
+			search_after[S_SEARCHES] - search_before[S_SEARCHES],
+			search_after[S_SAMPLED] - search_before[S_SAMPLED],
+			search_mean(S_NODES), search_mean(S_DEPTH),
+			search_mean(S_NPS), search_mean(S_EBF) / 100,
+			search_mean(S_ITERATION) / 1e3,
+			search_ratio(S_HITS, S_PROBES),
+			search_ratio(S_FIRST, S_CUTOFFS));
+	}
+	printf("}\n");
+}
@@ -0,0 +1,311 @@
+/* Asynchronous game logger, see c4log.h
+
+   Each logging thread owns a c4spsc ring (see c4ring.h); the log thread
+   is the only consumer of all of them, so no locks are needed anywhere.
+   With C4LOG_BLOCK the rings are made waitable, so that a thread whose
+   ring is full sleeps until the log thread has taken some.
+
+   To compile: gcc -c c4log.c -pthread
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "c4log.h"
+#include "c4counter.h"
+#include "c4ring.h"
+#include "c4trace.h"
+
+	/* size of the formatting buffer handed to each write() */
+#define OUTBUF		(64*1024)
+
+	/* most events merged and sorted by one pass of the log thread */
+#define BATCH		8192
+
+	/* how long the log thread sleeps when every ring is empty */
+#define IDLE_NS		1000000
+
+struct ring {
+	struct c4spsc q;
+};
+
+static struct ring *rings[C4LOG_MAX_THREADS];
+static atomic_int nrings;
+static _Thread_local struct ring *my_ring;
+
+	/* events thrown away because a ring was full */
+static struct c4counter dropped;
+
+static int logfd = -1;
+static int policy;
+static atomic_int stopping;
+static pthread_t log_tid;
+
+	/* wall clock and monotonic clock sampled at the same moment */
+static uint64_t mono0, real0;
+
+	/* formatted "YYYY-mm-dd HH:MM:SS" of the last second seen */
+static time_t cached_sec = -1;
+static char cached_stamp[32];
+
+static struct c4log_event batch[BATCH];
+static char outbuf[OUTBUF];
+static size_t outlen;
+
+static void *log_thread(void *param);
+
+static uint64_t
+now_ns(clockid_t clk) {
+	struct timespec ts;
+	clock_gettime(clk, &ts);
+	return (uint64_t)ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+
+/* Open the log file for appending and start the log thread
+ */
+int
+c4log_open(const char *path, int pol) {
+	logfd = open(path, O_WRONLY|O_CREAT|O_APPEND, 0644);
+	if (logfd < 0) {
+		return -1;
+	}
+	policy = pol;
+	mono0 = now_ns(CLOCK_MONOTONIC);
+	real0 = now_ns(CLOCK_REALTIME);
+	atomic_store(&stopping, 0);
+	if (pthread_create(&log_tid, NULL, log_thread, NULL)) {
+		close(logfd);
+		logfd = -1;
+		return -1;
+	}
+	/* so that the many exit() calls still flush what was logged */
+	atexit(c4log_close);
+	return 0;
+}
+
+/* Give the calling thread a ring of its own on its first event
+ */
+static struct ring *
+attach_ring(void) {
+	struct ring *r;
+	int i;
+	if (atomic_load_explicit(&nrings, memory_order_relaxed)
+			>= C4LOG_MAX_THREADS) {
+		return NULL;
+	}
+	r = aligned_alloc(64, sizeof(*r));
+	if (r == NULL) {
+		return NULL;
+	}
+	memset(r, 0, sizeof(*r));
+	if (c4spsc_init(&r->q, C4LOG_RING, sizeof(struct c4log_event),
+			policy == C4LOG_BLOCK ? C4RING_WAIT : 0) < 0) {
+		free(r);
+		return NULL;
+	}
+	i = atomic_fetch_add(&nrings, 1);
+	if (i >= C4LOG_MAX_THREADS) {
+		c4spsc_free(&r->q);
+		free(r);
+		return NULL;
+	}
+	__atomic_store_n(&rings[i], r, __ATOMIC_RELEASE);
+	my_ring = r;
+	return r;
+}
+
+/* Record one event; this is the only call made on the move hot path
+ */
+void
+c4log_event(int type, int sock, uint32_t ip, int arg) {
+	struct ring *r = my_ring;
+	struct c4log_event e;
+	C4TRACE_BEGIN(t);
+
+	if (logfd < 0) {
+		return;
+	}
+	if (r == NULL && (r = attach_ring()) == NULL) {
+		return;
+	}
+	e.ns = now_ns(CLOCK_MONOTONIC);
+	e.ip = ip;
+	e.sock = sock;
+	e.type = type;
+	e.arg = arg;
+	if (policy == C4LOG_BLOCK) {
+		c4spsc_push_wait(&r->q, &e, -1);
+	} else if (c4spsc_push(&r->q, &e) < 0) {
+		c4counter_add(&dropped, 1);
+	}
+	C4TRACE_END(t, "log", type);
+}
+
+/* Total events thrown away because a ring was full
+ */
+unsigned long
+c4log_dropped(void) {
+	return c4counter_read(&dropped);
+}
+
+/* Stop the log thread once it has written out everything queued
+ */
+void
+c4log_close(void) {
+	if (logfd < 0) {
+		return;
+	}
+	atomic_store(&stopping, 1);
+	pthread_join(log_tid, NULL);
+	close(logfd);
+	logfd = -1;
+}
+
+static void
+flush_out(void) {
+	size_t off = 0;
+	ssize_t n;
+	while (off < outlen) {
+		n = write(logfd, outbuf+off, outlen-off);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("ERROR writing log");
+			break;
+		}
+		off += n;
+	}
+	outlen = 0;
+}
+
+/* Append "[stamp] " for a monotonic time, redoing the expensive
+ * localtime/strftime work only when the second changes
+ */
+static char *
+put_stamp(char *p, uint64_t ns) {
+	uint64_t wall = real0 + (ns - mono0);
+	time_t sec = wall / 1000000000u;
+	unsigned usec = (wall % 1000000000u) / 1000;
+	struct tm tm;
+	int i;
+
+	if (sec != cached_sec) {
+		localtime_r(&sec, &tm);
+		strftime(cached_stamp, sizeof(cached_stamp),
+			"%Y-%m-%d %H:%M:%S", &tm);
+		cached_sec = sec;
+	}
+	*p++ = '[';
+	p = stpcpy(p, cached_stamp);
+	*p++ = '.';
+	for (i=5; i>=0; i--) {
+		p[i] = '0' + usec%10;
+		usec /= 10;
+	}
+	p += 6;
+	*p++ = ']';
+	*p++ = ' ';
+	return p;
+}
+
+static void
+format_event(const struct c4log_event *e) {
+	char ip[INET_ADDRSTRLEN];
+	char *p;
+
+	if (OUTBUF - outlen < 256) {
+		flush_out();
+	}
+	p = put_stamp(outbuf+outlen, e->ns);
+	inet_ntop(AF_INET, &e->ip, ip, sizeof(ip));
+	switch (e->type) {
+	case C4LOG_CONNECT:
+		p += sprintf(p, "(%s) (soc_id %d) client connected\n",
+			ip, e->sock);
+		break;
+	case C4LOG_CLIENT_MOVE:
+		p += sprintf(p, "(%s) (soc_id %d) client's move=%d\n",
+			ip, e->sock, e->arg);
+		break;
+	case C4LOG_SERVER_MOVE:
+		p += sprintf(p, "(0.0.0.0) (soc_id %d) server's move=%d\n",
+			e->sock, e->arg);
+		break;
+	case C4LOG_GAME_OVER:
+		p += sprintf(p, "(%s) (soc_id %d) game over, result=%c\n",
+			ip, e->sock, e->arg);
+		break;
+	case C4LOG_DISCONNECT:
+		p += sprintf(p, "(%s) (soc_id %d) client disconnected\n",
+			ip, e->sock);
+		break;
+	default:
+		p += sprintf(p, "(%s) (soc_id %d) event %d arg=%d\n",
+			ip, e->sock, e->type, e->arg);
+		break;
+	}
+	outlen = p - outbuf;
+}
+
+static int
+by_time(const void *a, const void *b) {
+	const struct c4log_event *x = a, *y = b;
+	return (x->ns > y->ns) - (x->ns < y->ns);
+}
+
+/* Pull whatever is queued in every ring into the batch, then sort
+ * it so lines from different threads come out in time order
+ */
+static int
+collect(void) {
+	int i, k, n = 0;
+	struct ring *r;
+
+	k = atomic_load(&nrings);
+	for (i=0; i<k && i<C4LOG_MAX_THREADS && n<BATCH; i++) {
+		r = __atomic_load_n(&rings[i], __ATOMIC_ACQUIRE);
+		if (r == NULL) {
+			continue;
+		}
+		n += c4spsc_pop_n(&r->q, batch + n, BATCH - n);
+	}
+	if (n > 1) {
+		qsort(batch, n, sizeof(batch[0]), by_time);
+	}
+	return n;
+}
+
+static void *
+log_thread(void *param) {
+	struct timespec idle = { 0, IDLE_NS };
+	int i, n, stop;
+
+	for (;;) {
+		stop = atomic_load(&stopping);
+		n = collect();
+		for (i=0; i<n; i++) {
+			format_event(&batch[i]);
+		}
+		if (n < BATCH) {
+			/* caught up: write what we have and rest a little */
+			if (outlen > 0) {
+				flush_out();
+			}
+			if (stop && n == 0) {
+				break;
+			}
+			if (n == 0) {
+				nanosleep(&idle, NULL);
+			}
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,46 @@
+/* Asynchronous game logger for server1.c
+
+   Hot paths push fixed-size binary events into a ring buffer owned by
+   the calling thread; a background thread drains every ring, formats
+   the events and appends them to the log file in large batches.
+
+   To compile: gcc -c c4log.c -pthread
+*/
+
+#ifndef C4LOG_H
+#define C4LOG_H
+
+#include <stdint.h>
+
+	/* kinds of event that can be logged */
+#define C4LOG_CONNECT		1
+#define C4LOG_CLIENT_MOVE	2
+#define C4LOG_SERVER_MOVE	3
+#define C4LOG_GAME_OVER		4
+#define C4LOG_DISCONNECT	5
+
+	/* what to do when the calling thread's ring is full */
+#define C4LOG_DROP	0
+#define C4LOG_BLOCK	1
+
+	/* events per thread ring, must be a power of two */
+#define C4LOG_RING	4096
+
+	/* most threads that may ever log */
+#define C4LOG_MAX_THREADS	256
+
+	/* one fixed-size event, formatted later by the log thread */
+struct c4log_event {
+	uint64_t ns;		/* CLOCK_MONOTONIC time of the event */
+	uint32_t ip;		/* peer IPv4 address, network byte order */
+	int32_t sock;		/* socket the event happened on */
+	int32_t type;		/* one of C4LOG_* above */
+	int32_t arg;		/* move column, or result colour */
+};
+
+int c4log_open(const char *path, int policy);
+void c4log_event(int type, int sock, uint32_t ip, int arg);
+unsigned long c4log_dropped(void);
+void c4log_close(void);
+
+#endif
@@ -0,0 +1,107 @@
+/* Files mapped read-only and shared, and written whole, see c4map.h
+
+   To compile: gcc -c c4map.c
+*/
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "c4map.h"
+
+/* Map path, advised with advice (MADV_RANDOM and so on), and set *size;
+ * NULL with errno set if it cannot be, or EINVAL if it is shorter than
+ * min bytes
+ */
+void *
+c4map_open(const char *path, size_t min, int advice, size_t *size) {
+	struct stat st;
+	void *p;
+	int fd, e;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0) {
+		e = errno;
+		close(fd);
+		errno = e;
+		return NULL;
+	}
+	if ((size_t)st.st_size < min) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	e = errno;
+	close(fd);
+	if (p == MAP_FAILED) {
+		errno = e;
+		return NULL;
+	}
+	madvise(p, st.st_size, advice);
+	*size = st.st_size;
+	return p;
+}
+
+/* Write all of len bytes at off
+ */
+static int
+put(int fd, const char *data, size_t len, uint64_t off) {
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = pwrite(fd, data, len, off)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		data += n;
+		len -= n;
+		off += n;
+	}
+	return 0;
+}
+
+/* Write the n parts to path by way of a synced temporary file, so that
+ * path is either all there or not at all; -1 with errno set if any of
+ * it fails, and the temporary file gone
+ */
+int
+c4map_save(const char *path, const struct c4map_part *part, int n) {
+	char tmp[512];
+	int fd, i, e;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path)
+			>= (int)sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return -1;
+	}
+	for (i=0; i<n; i++) {
+		if (put(fd, part[i].data, part[i].len, part[i].off) < 0) {
+			break;
+		}
+	}
+	if (i < n || fsync(fd) < 0) {
+		e = errno;
+		close(fd);
+		unlink(tmp);
+		errno = e;
+		return -1;
+	}
+	if (close(fd) < 0 || rename(tmp, path) < 0) {
+		e = errno;
+		unlink(tmp);
+		errno = e;
+		return -1;
+	}
+	return 0;
+}
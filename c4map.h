@@ -0,0 +1,42 @@
+/* Files mapped read-only and shared, and written whole
+
+   The database of c4db.h, the tables of c4tb.h and the weights of
+   c4ntuple.h are each a header and sections at offsets it gives, built
+   offline and mapped by the server read-only and shared, so the page
+   cache holds one copy however many processes map them.
+
+   c4map_open maps a file of at least a header's size and advises the
+   kernel how it will be read; the caller checks the header, and with
+   c4map_fits that each section lies inside the file, before believing
+   any of it. c4map_save writes a file as parts at their offsets, the
+   gaps between them read back as zeros, to a temporary file beside it
+   that is synced and then renamed into place: a reader, or a run
+   carrying on after a crash, finds the old file or the whole new one,
+   never a part of it.
+
+   To compile: gcc -c c4map.c
+*/
+
+#ifndef C4MAP_H
+#define C4MAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+	/* a piece of a file to write */
+struct c4map_part {
+	uint64_t off;		/* in bytes from the start */
+	const void *data;
+	size_t len;
+};
+
+void *c4map_open(const char *path, size_t min, int advice, size_t *size);
+int c4map_save(const char *path, const struct c4map_part *part, int n);
+
+	/* whether n items of each bytes from off fit in a file of size */
+static inline int
+c4map_fits(size_t size, uint64_t off, uint64_t n, size_t each) {
+	return off <= size && (size - off) / each >= n;
+}
+
+#endif
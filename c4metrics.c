@@ -0,0 +1,365 @@
+/* Server metrics, see c4metrics.h
+
+   The admin socket is a local (AF_UNIX) stream socket: a scraper
+   connects, optionally sends one command line, and reads back plain
+   text until the server closes the connection. An empty command or
+   "metrics" returns the metrics; anything else goes to the server's
+   own command handler.
+
+   To compile: gcc -c c4metrics.c -pthread
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "c4metrics.h"
+#include "c4log.h"
+
+	/* how long the admin thread waits for a command line, in ms */
+#define CMD_WAIT	100
+
+	/* largest reply the admin socket sends */
+#define REPLY		(256*1024)
+
+_Thread_local struct c4m_shard *c4m_my_shard;
+
+static struct c4m_shard *shards[C4M_MAX_SHARDS];
+static atomic_int nshards;
+
+static const char *counter_name[C4M_NCOUNTERS] = {
+	"sessions_opened", "sessions_closed", "games_started",
+	"games_finished", "moves", "nodes", "tt_probes", "tt_hits",
+	"moves_shed", "db_hits", "tb_hits", "searches", "searches_sampled",
+	"cutoffs", "first_move_cutoffs",
+};
+
+static const char *hist_name[C4M_NHISTS] = {
+	"accept_to_first_move_ns", "move_engine_ns", "queue_wait_ns",
+	"socket_write_ns", "move_latency_ns", "search_nodes",
+	"search_depth", "search_nodes_per_second", "search_ebf_x100",
+	"search_iteration_ns",
+};
+
+static uint64_t start_ns;
+static int admin_fd = -1;
+static char admin_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static c4m_command_fn admin_extra;
+static pthread_t admin_tid;
+
+	/* totals at the previous scrape, for the per-second rates */
+static uint64_t last_ns, last_games, last_moves, last_nodes;
+
+/* Give the calling thread its own shard; name labels it in the
+ * per-shard lines and may be NULL
+ */
+struct c4m_shard *
+c4m_attach(const char *name) {
+	struct c4m_shard *s = c4m_my_shard;
+	int i;
+
+	if (s == NULL) {
+		if (atomic_load(&nshards) >= C4M_MAX_SHARDS) {
+			return NULL;
+		}
+		s = aligned_alloc(64, sizeof(*s));
+		if (s == NULL) {
+			return NULL;
+		}
+		memset(s, 0, sizeof(*s));
+		i = atomic_fetch_add(&nshards, 1);
+		if (i >= C4M_MAX_SHARDS) {
+			free(s);
+			return NULL;
+		}
+		snprintf(s->name, sizeof(s->name), "thread%d", i);
+		__atomic_store_n(&shards[i], s, __ATOMIC_RELEASE);
+		c4m_my_shard = s;
+	}
+	if (name != NULL) {
+		snprintf(s->name, sizeof(s->name), "%s", name);
+	}
+	return s;
+}
+
+static struct c4m_shard *
+shard_at(int i) {
+	return __atomic_load_n(&shards[i], __ATOMIC_ACQUIRE);
+}
+
+static uint64_t
+total(int counter) {
+	uint64_t n = 0;
+	int i, k = atomic_load(&nshards);
+	struct c4m_shard *s;
+	for (i=0; i<k && i<C4M_MAX_SHARDS; i++) {
+		if ((s = shard_at(i)) != NULL) {
+			n += atomic_load_explicit(&s->counter[counter],
+				memory_order_relaxed);
+		}
+	}
+	return n;
+}
+
+/* Upper edge of a histogram bucket
+ */
+static uint64_t
+bucket_top(int b) {
+	int msb, sub;
+	if (b < C4M_SUB) {
+		return b;
+	}
+	msb = b / C4M_SUB + C4M_SUBBITS - 1;
+	sub = b % C4M_SUB;
+	return ((uint64_t)(C4M_SUB + sub + 1) << (msb - C4M_SUBBITS)) - 1;
+}
+
+static uint64_t
+quantile(const uint64_t *bucket, uint64_t count, double q) {
+	uint64_t want = (uint64_t)(q * count + 0.5), seen = 0;
+	int b;
+	if (want == 0) {
+		want = 1;
+	}
+	for (b=0; b<C4M_BUCKETS; b++) {
+		seen += bucket[b];
+		if (seen >= want) {
+			return bucket_top(b);
+		}
+	}
+	return bucket_top(C4M_BUCKETS-1);
+}
+
+static int
+format_hist(char *buf, int len, int h) {
+	static const double qs[] = { 0.5, 0.9, 0.99, 0.999 };
+	uint64_t bucket[C4M_BUCKETS];
+	uint64_t count = 0, sum = 0, max = 0, v;
+	int i, b, k = atomic_load(&nshards), n = 0;
+	struct c4m_shard *s;
+
+	memset(bucket, 0, sizeof(bucket));
+	for (i=0; i<k && i<C4M_MAX_SHARDS; i++) {
+		if ((s = shard_at(i)) == NULL) {
+			continue;
+		}
+		count += atomic_load_explicit(&s->hist[h].count,
+			memory_order_relaxed);
+		sum += atomic_load_explicit(&s->hist[h].sum,
+			memory_order_relaxed);
+		v = atomic_load_explicit(&s->hist[h].max,
+			memory_order_relaxed);
+		if (v > max) {
+			max = v;
+		}
+		for (b=0; b<C4M_BUCKETS; b++) {
+			bucket[b] += atomic_load_explicit(
+				&s->hist[h].bucket[b], memory_order_relaxed);
+		}
+	}
+	n += snprintf(buf+n, len-n, "c4_%s_count %llu\n",
+		hist_name[h], (unsigned long long)count);
+	if (n < len) {
+		n += snprintf(buf+n, len-n, "c4_%s_sum %llu\n",
+			hist_name[h], (unsigned long long)sum);
+	}
+	if (count == 0 || n >= len) {
+		return n < len ? n : len;
+	}
+	for (i=0; i<(int)(sizeof(qs)/sizeof(qs[0])) && n<len; i++) {
+		n += snprintf(buf+n, len-n, "c4_%s{quantile=\"%g\"} %llu\n",
+			hist_name[h], qs[i], (unsigned long long)
+			quantile(bucket, count, qs[i]));
+	}
+	if (n < len) {
+		n += snprintf(buf+n, len-n, "c4_%s_max %llu\n",
+			hist_name[h], (unsigned long long)max);
+	}
+	return n < len ? n : len;
+}
+
+static double
+rate(uint64_t now, uint64_t then, uint64_t dt) {
+	return dt ? (now - then) * 1e9 / dt : 0;
+}
+
+/* Write the whole metrics page into buf, returning its length
+ */
+int
+c4metrics_format(char *buf, int len) {
+	uint64_t now = c4m_now(), dt;
+	uint64_t c[C4M_NCOUNTERS];
+	int i, k, n = 0;
+	struct c4m_shard *s;
+
+	if (start_ns == 0) {
+		start_ns = last_ns = now;
+	}
+	for (i=0; i<C4M_NCOUNTERS; i++) {
+		c[i] = total(i);
+	}
+	dt = now - last_ns;
+
+	n += snprintf(buf+n, len-n, "c4_uptime_seconds %.3f\n",
+		(now - start_ns) / 1e9);
+	for (i=0; i<C4M_NCOUNTERS && n<len; i++) {
+		n += snprintf(buf+n, len-n, "c4_%s_total %llu\n",
+			counter_name[i], (unsigned long long)c[i]);
+	}
+	n += snprintf(buf+n, len-n, "c4_active_sessions %lld\n",
+		(long long)(c[C4M_SESSIONS_OPENED] - c[C4M_SESSIONS_CLOSED]));
+	n += snprintf(buf+n, len-n, "c4_games_per_second %.2f\n",
+		rate(c[C4M_GAMES_FINISHED], last_games, dt));
+	n += snprintf(buf+n, len-n, "c4_moves_per_second %.2f\n",
+		rate(c[C4M_MOVES], last_moves, dt));
+	n += snprintf(buf+n, len-n, "c4_nodes_per_second %.0f\n",
+		rate(c[C4M_NODES], last_nodes, dt));
+	n += snprintf(buf+n, len-n, "c4_tt_hit_ratio %.4f\n",
+		c[C4M_TT_PROBES] ? (double)c[C4M_TT_HITS]/c[C4M_TT_PROBES] : 0);
+	n += snprintf(buf+n, len-n, "c4_first_cutoff_ratio %.4f\n",
+		c[C4M_CUTOFFS] ? (double)c[C4M_FIRST_CUTOFFS]/c[C4M_CUTOFFS]
+		: 0);
+	n += snprintf(buf+n, len-n, "c4_log_dropped_total %lu\n",
+		c4log_dropped());
+	for (i=0; i<C4M_NHISTS && n<len; i++) {
+		n += format_hist(buf+n, len-n, i);
+	}
+
+	/* per-shard load, to see how evenly the work is spread */
+	k = atomic_load(&nshards);
+	for (i=0; i<k && i<C4M_MAX_SHARDS && n<len; i++) {
+		if ((s = shard_at(i)) == NULL) {
+			continue;
+		}
+		n += snprintf(buf+n, len-n,
+			"c4_shard_sessions_total{shard=\"%s\"} %llu\n"
+			"c4_shard_moves_total{shard=\"%s\"} %llu\n",
+			s->name, (unsigned long long)atomic_load_explicit(
+			&s->counter[C4M_SESSIONS_OPENED], memory_order_relaxed),
+			s->name, (unsigned long long)atomic_load_explicit(
+			&s->counter[C4M_MOVES], memory_order_relaxed));
+	}
+
+	last_ns = now;
+	last_games = c[C4M_GAMES_FINISHED];
+	last_moves = c[C4M_MOVES];
+	last_nodes = c[C4M_NODES];
+	return n < len ? n : len-1;
+}
+
+static void
+write_all(int fd, const char *buf, int len) {
+	int n;
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return;
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+/* Serve one admin connection: read an optional command, reply, close
+ */
+static void
+admin_request(int fd, char *reply) {
+	struct pollfd p = { fd, POLLIN, 0 };
+	char cmd[256];
+	int n = 0, len;
+
+	if (poll(&p, 1, CMD_WAIT) > 0) {
+		n = read(fd, cmd, sizeof(cmd)-1);
+		if (n < 0) {
+			n = 0;
+		}
+	}
+	cmd[n] = '\0';
+	while (n > 0 && (cmd[n-1] == '\n' || cmd[n-1] == '\r'
+			|| cmd[n-1] == ' ')) {
+		cmd[--n] = '\0';
+	}
+	if (n == 0 || strcmp(cmd, "metrics") == 0) {
+		len = c4metrics_format(reply, REPLY);
+	} else if (admin_extra == NULL
+			|| (len = admin_extra(cmd, reply, REPLY)) < 0) {
+		len = snprintf(reply, REPLY, "unknown command: %s\n", cmd);
+	}
+	write_all(fd, reply, len);
+}
+
+static void *
+admin_thread(void *param) {
+	char *reply = malloc(REPLY);
+	int fd;
+
+	c4m_attach("admin");
+	while (reply != NULL) {
+		fd = accept(admin_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			break;
+		}
+		admin_request(fd, reply);
+		close(fd);
+	}
+	free(reply);
+	return NULL;
+}
+
+/* Start answering scrapes on a local socket at path
+ */
+int
+c4metrics_serve(const char *path, c4m_command_fn extra) {
+	struct sockaddr_un addr;
+
+	if (start_ns == 0) {
+		start_ns = last_ns = c4m_now();
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	strcpy(admin_path, path);
+	unlink(path);
+	if ((admin_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		return -1;
+	}
+	if (bind(admin_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+			|| listen(admin_fd, 16) < 0) {
+		close(admin_fd);
+		admin_fd = -1;
+		return -1;
+	}
+	admin_extra = extra;
+	if (pthread_create(&admin_tid, NULL, admin_thread, NULL)) {
+		close(admin_fd);
+		admin_fd = -1;
+		return -1;
+	}
+	pthread_detach(admin_tid);
+	return 0;
+}
+
+void
+c4metrics_stop(void) {
+	if (admin_fd >= 0) {
+		shutdown(admin_fd, SHUT_RDWR);
+		close(admin_fd);
+		admin_fd = -1;
+		unlink(admin_path);
+	}
+}
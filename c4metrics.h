@@ -0,0 +1,144 @@
+/* Server metrics: counters and latency histograms
+
+   Every thread that records a metric gets a shard of its own, aligned
+   to a cache line, and is the only writer of it; readers add up all
+   the shards when the metrics are scraped. Recording is therefore a
+   plain load and store with no lock and no shared cache line.
+
+   Histograms are log-linear in the style of HdrHistogram: each power
+   of two is split into C4M_SUB buckets, keeping the relative error of
+   any quantile below 1/C4M_SUB.
+
+   To compile: gcc -c c4metrics.c -pthread
+*/
+
+#ifndef C4METRICS_H
+#define C4METRICS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+	/* counters */
+#define C4M_SESSIONS_OPENED	0
+#define C4M_SESSIONS_CLOSED	1
+#define C4M_GAMES_STARTED	2
+#define C4M_GAMES_FINISHED	3
+#define C4M_MOVES		4
+#define C4M_NODES		5
+#define C4M_TT_PROBES		6
+#define C4M_TT_HITS		7
+#define C4M_SHED		8	/* replies not searched, see c4sched.h */
+#define C4M_DB_HITS		9	/* replies from c4db.h */
+#define C4M_TB_HITS		10	/* nodes scored by c4tb.h */
+#define C4M_SEARCHES		11	/* replies and analyses searched */
+#define C4M_SAMPLED		12	/* ... of them in the histograms */
+#define C4M_CUTOFFS		13	/* beta cut-offs */
+#define C4M_FIRST_CUTOFFS	14	/* ... by the first move tried */
+#define C4M_NCOUNTERS		15
+
+	/* histograms, in nanoseconds unless they say */
+#define C4M_FIRST_MOVE		0	/* accept to the client's first move */
+#define C4M_ENGINE		1	/* choosing the server's reply */
+#define C4M_QUEUE_WAIT		2	/* accepted but not yet being served */
+#define C4M_WRITE		3	/* writing a reply to the socket */
+#define C4M_MOVE		4	/* woken for a move to its reply sent */
+#define C4M_SEARCH_NODES	5	/* of a sampled search, see c4sched.h */
+#define C4M_SEARCH_DEPTH	6	/* ... the depth it completed */
+#define C4M_SEARCH_NPS		7	/* ... its nodes a second */
+#define C4M_SEARCH_EBF		8	/* ... branching factor, times 100 */
+#define C4M_SEARCH_ITERATION	9	/* ... each depth it completed */
+#define C4M_NHISTS		10
+
+	/* sub-buckets per power of two, and how many powers are kept */
+#define C4M_SUBBITS	4
+#define C4M_SUB		(1 << C4M_SUBBITS)
+#define C4M_POWERS	40
+#define C4M_BUCKETS	((C4M_POWERS - C4M_SUBBITS + 1) * C4M_SUB)
+
+	/* most threads that may ever record metrics */
+#define C4M_MAX_SHARDS	256
+
+struct c4m_hist {
+	_Atomic uint64_t count;
+	_Atomic uint64_t sum;
+	_Atomic uint64_t max;
+	_Atomic uint64_t bucket[C4M_BUCKETS];
+};
+
+struct c4m_shard {
+	_Alignas(64) _Atomic uint64_t counter[C4M_NCOUNTERS];
+	char name[32];
+	_Alignas(64) struct c4m_hist hist[C4M_NHISTS];
+};
+
+extern _Thread_local struct c4m_shard *c4m_my_shard;
+
+struct c4m_shard *c4m_attach(const char *name);
+int c4metrics_format(char *buf, int len);
+
+	/* extra admin commands, answered into out; return bytes or -1 */
+typedef int (*c4m_command_fn)(const char *cmd, char *out, int len);
+
+int c4metrics_serve(const char *path, c4m_command_fn extra);
+void c4metrics_stop(void);
+
+	/* bump a value that only this thread ever writes */
+static inline void
+c4m_bump(_Atomic uint64_t *p, uint64_t n) {
+	atomic_store_explicit(p, atomic_load_explicit(p,
+		memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline struct c4m_shard *
+c4m_shard(void) {
+	struct c4m_shard *s = c4m_my_shard;
+	return s ? s : c4m_attach(NULL);
+}
+
+static inline void
+c4m_inc(int counter, uint64_t n) {
+	struct c4m_shard *s = c4m_shard();
+	if (s) {
+		c4m_bump(&s->counter[counter], n);
+	}
+}
+
+static inline int
+c4m_bucket(uint64_t v) {
+	int msb;
+	if (v < C4M_SUB) {
+		return v;
+	}
+	msb = 63 - __builtin_clzll(v);
+	if (msb >= C4M_POWERS) {
+		return C4M_BUCKETS - 1;
+	}
+	return (msb - C4M_SUBBITS + 1) * C4M_SUB
+		+ ((v >> (msb - C4M_SUBBITS)) & (C4M_SUB-1));
+}
+
+static inline void
+c4m_record(int hist, uint64_t ns) {
+	struct c4m_shard *s = c4m_shard();
+	struct c4m_hist *h;
+	if (s == NULL) {
+		return;
+	}
+	h = &s->hist[hist];
+	c4m_bump(&h->count, 1);
+	c4m_bump(&h->sum, ns);
+	c4m_bump(&h->bucket[c4m_bucket(ns)], 1);
+	if (ns > atomic_load_explicit(&h->max, memory_order_relaxed)) {
+		atomic_store_explicit(&h->max, ns, memory_order_relaxed);
+	}
+}
+
+static inline uint64_t
+c4m_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+
+#endif
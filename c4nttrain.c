@@ -0,0 +1,311 @@
+/* Train the n-tuple network of c4ntuple.h by self-play
+
+   The network plays -g games (default 100000) against itself, each
+   move the one whose position it values least for the opponent, or
+   a win if it has one, or one at random a fraction -e of the time
+   (default 0.1) so that it sees positions it would not choose. After
+   every move it learns by temporal difference, TD(0): the value of
+   the position the move was made in is pulled toward the negated
+   value of the one it led to, or toward 1 for a move that won and 0
+   for one that filled the board, by -a (default 0.005) times the
+   error, through tanh. Each position's mirror image is taught the
+   same. -i starts from weights written before, rather than zero.
+
+   Every -t games (default 10000) the weights are written to the output
+   and the network is tested: -n games (default 200) of c4nt_move at
+   -d plies (default C4NT_DEPTH) against suggest_move, the heuristic
+   the server falls back on, and as many against c4search.c searching
+   to the same depth, half of them as each colour and each opened with
+   two random moves. Progress goes to standard error; at the end one
+   JSON object is printed on standard output with the last test's
+   wins, draws and losses, and the time c4nt_move took a move.
+
+   To compile: gcc -O2 -march=native c4nttrain.c c4ntuple.c c4map.c
+   		c4search.c c4steal.c c4ring.c c4game.c -o c4nttrain -lm
+   		-pthread
+
+   To run: c4nttrain [-g games] [-a rate] [-e epsilon] [-s seed]
+   		[-i weights] [-t every] [-n test-games] [-d depth] output
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "c4game.h"
+#include "c4search.h"
+#include "c4ntuple.h"
+#include "c4db.h"
+
+#define SIZE		(WIDTH*HEIGHT)
+
+	/* opponents a test plays against */
+#define HEURISTIC	0
+#define SEARCH		1
+
+struct score {
+	int win, draw, loss;
+};
+
+static struct c4nt *net;
+static unsigned seed = 1;
+static float rate = 0.005f, epsilon = 0.1f;
+static int depth = C4NT_DEPTH;
+static struct c4tt_entry *tt;
+static uint64_t move_ns, nmoves_timed;
+
+static void usage(char *prog);
+
+static int
+random_move(const struct c4bb *b) {
+	int move[WIDTH], n = 0, c;
+
+	for (c=1; c<=WIDTH; c++) {
+		if (c4bb_can_play(b, c)) {
+			move[n++] = c;
+		}
+	}
+	return move[rand_r(&seed) % n];
+}
+
+/* The move self-play makes in b
+ */
+static int
+train_move(const struct c4bb *b) {
+	struct c4bb child;
+	float v, best = 2;
+	int c, move = 0;
+
+	if (rand_r(&seed) < epsilon * ((float)RAND_MAX + 1)) {
+		return random_move(b);
+	}
+	for (c=1; c<=WIDTH; c++) {
+		if (!c4bb_can_play(b, c)) {
+			continue;
+		}
+		child = *b;
+		c4bb_play(&child, c);
+		if (c4bb_won(&child)) {
+			return c;
+		}
+		v = c4bb_full(&child) ? 0 : c4nt_eval(net, &child);
+		if (v < best) {
+			best = v;
+			move = c;
+		}
+	}
+	return move;
+}
+
+/* Pull the value of b toward target
+ */
+static void
+learn(const struct c4bb *b, float target) {
+	int32_t idx[C4NT_PADDED];
+	struct c4bb m;
+	float v, g;
+	int t, k;
+
+	m.cur = c4db_mirror(b->cur);
+	m.mask = c4db_mirror(b->mask);
+	m.nmoves = b->nmoves;
+	for (k=0; k<2; k++) {
+		c4nt_index(k == 0 ? b : &m, idx);
+		v = tanhf(c4nt_sum(net, idx));
+		g = rate * (target - v) * (1 - v*v);
+		for (t=0; t<C4NT_TUPLES; t++) {
+			net->w[idx[t]] += g;
+		}
+		if (k == 0 && m.cur == b->cur && m.mask == b->mask) {
+			break;
+		}
+	}
+}
+
+static void
+self_play(void) {
+	struct c4bb b, prev;
+	int c;
+
+	c4bb_init(&b);
+	for (;;) {
+		prev = b;
+		c = train_move(&b);
+		c4bb_play(&b, c);
+		if (c4bb_won(&b)) {
+			learn(&prev, 1);
+			return;
+		}
+		if (c4bb_full(&b)) {
+			learn(&prev, 0);
+			return;
+		}
+		learn(&prev, -c4nt_eval(net, &b));
+	}
+}
+
+/* The opponent's move in b, also given as board
+ */
+static int
+opponent_move(int opponent, const struct c4bb *b, c4_t board,
+		char colour) {
+	struct c4search s;
+
+	if (opponent == HEURISTIC) {
+		return suggest_move(board, colour);
+	}
+	memset(&s, 0, sizeof(s));
+	s.pos = *b;
+	s.maxdepth = depth;
+	s.tt = tt;
+	return c4search_run(&s);
+}
+
+/* One test game, the network playing first if first is set; 1 if it
+ * won, 0 for a draw and -1 if it lost
+ */
+static int
+test_game(int opponent, int first) {
+	struct c4bb b;
+	c4_t board;
+	char colour = YELLOW;
+	uint64_t t;
+	int c, ours;
+
+	c4bb_init(&b);
+	init_empty(board);
+	for (;;) {
+		ours = (b.nmoves & 1) == !first;
+		if (b.nmoves < 2) {
+			c = random_move(&b);
+		} else if (ours) {
+			t = c4search_now();
+			c = c4nt_move(net, &b, depth);
+			move_ns += c4search_now() - t;
+			nmoves_timed++;
+		} else {
+			c = opponent_move(opponent, &b, board, colour);
+		}
+		c4bb_play(&b, c);
+		do_move(board, c, colour);
+		colour = colour == YELLOW ? RED : YELLOW;
+		if (c4bb_won(&b)) {
+			return ours ? 1 : -1;
+		}
+		if (c4bb_full(&b)) {
+			return 0;
+		}
+	}
+}
+
+static void
+test(int ngames, struct score *sc) {
+	int k, i, r;
+
+	memset(sc, 0, 2 * sizeof(*sc));
+	for (k=HEURISTIC; k<=SEARCH; k++) {
+		for (i=0; i<ngames; i++) {
+			r = test_game(k, i & 1);
+			sc[k].win += r > 0;
+			sc[k].draw += r == 0;
+			sc[k].loss += r < 0;
+		}
+	}
+}
+
+int
+main(int argc, char *argv[]) {
+	struct score sc[2];
+	struct c4nt *old;
+	char *from = NULL;
+	uint64_t start;
+	int opt, ngames = 100000, every = 10000, ntest = 200, g;
+
+	while ((opt = getopt(argc, argv, "g:a:e:s:i:t:n:d:")) != -1) {
+		switch (opt) {
+		case 'g':
+			ngames = atoi(optarg);
+			break;
+		case 'a':
+			rate = atof(optarg);
+			break;
+		case 'e':
+			epsilon = atof(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		case 'i':
+			from = optarg;
+			break;
+		case 't':
+			every = atoi(optarg);
+			break;
+		case 'n':
+			ntest = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 1 || ngames < 0 || every < 1 || ntest < 0
+			|| depth < 1) {
+		usage(argv[0]);
+	}
+	if ((net = c4nt_new()) == NULL || (tt = c4search_tt()) == NULL) {
+		perror("ERROR allocating");
+		exit(1);
+	}
+	if (from != NULL) {
+		if ((old = c4nt_open(from)) == NULL) {
+			perror(from);
+			exit(1);
+		}
+		memcpy(net->w, old->w, C4NT_WEIGHTS * sizeof(float));
+		net->hdr.games = old->hdr.games;
+		c4nt_close(old);
+	}
+
+	start = c4search_now();
+	memset(sc, 0, sizeof(sc));
+	for (g=1; g<=ngames; g++) {
+		self_play();
+		net->hdr.games++;
+		if (g % every != 0 && g != ngames) {
+			continue;
+		}
+		if (c4nt_save(net, argv[optind]) < 0) {
+			perror("ERROR writing weights");
+			exit(1);
+		}
+		test(ntest, sc);
+		fprintf(stderr, "%d games: against heuristic %d-%d-%d, "
+			"against search %d-%d-%d\n", g,
+			sc[HEURISTIC].win, sc[HEURISTIC].draw,
+			sc[HEURISTIC].loss, sc[SEARCH].win, sc[SEARCH].draw,
+			sc[SEARCH].loss);
+	}
+
+	printf("{\"games\": %u, \"depth\": %d, "
+		"\"heuristic\": {\"wins\": %d, \"draws\": %d, "
+		"\"losses\": %d}, \"search\": {\"wins\": %d, \"draws\": %d, "
+		"\"losses\": %d}, \"move_us\": %.2f, \"seconds\": %.1f}\n",
+		net->hdr.games, depth, sc[HEURISTIC].win, sc[HEURISTIC].draw,
+		sc[HEURISTIC].loss, sc[SEARCH].win, sc[SEARCH].draw,
+		sc[SEARCH].loss,
+		nmoves_timed ? move_ns / 1e3 / nmoves_timed : 0,
+		(c4search_now() - start) / 1e9);
+	return 0;
+}
+
+static void
+usage(char *prog) {
+	fprintf(stderr, "usage: %s [-g games] [-a rate] [-e epsilon] "
+		"[-s seed] [-i weights] [-t every] [-n test-games] "
+		"[-d depth] output\n", prog);
+	exit(1);
+}
@@ -0,0 +1,314 @@
+/* N-tuple network evaluation, see c4ntuple.h
+
+   To compile: gcc -O2 -march=native -c c4ntuple.c -pthread
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#if defined(__AVX2__) || defined(__BMI2__)
+#include <immintrin.h>
+#endif
+#include "c4ntuple.h"
+#include "c4map.h"
+
+	/* what a search scores a win by, above any value of the network */
+#define WIN		2.0f
+
+	/* the cells of each tuple, and where its weights start in a set */
+static uint64_t tuple_mask[C4NT_TUPLES];
+static int32_t tuple_off[C4NT_TUPLES];
+
+	/* k bits as the k digits of a base 3 number */
+static uint16_t base3[256];
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+	/* the bit of row r (0 at the bottom) of column c (0 at the left) */
+#define CELL(r, c)	((uint64_t)1 << ((c)*C4BB_H + (r)))
+
+static void
+init_tuples(void) {
+	int r, c, i, k, t = 0, off = 0, p;
+
+	for (r=0; r+1<HEIGHT; r++) {
+		for (c=0; c+4<=WIDTH; c++, t++) {
+			for (i=0; i<4; i++) {
+				tuple_mask[t] |= CELL(r, c+i) | CELL(r+1, c+i);
+			}
+		}
+	}
+	for (r=0; r+4<=HEIGHT; r++) {
+		for (c=0; c+1<WIDTH; c++, t++) {
+			for (i=0; i<4; i++) {
+				tuple_mask[t] |= CELL(r+i, c) | CELL(r+i, c+1);
+			}
+		}
+	}
+	for (r=0; r+4<=HEIGHT; r++) {
+		for (c=0; c+4<=WIDTH; c++) {
+			for (i=0; i<4; i++) {
+				tuple_mask[t] |= CELL(r+i, c+i);
+				tuple_mask[t+1] |= CELL(r+i, c+3-i);
+			}
+			t += 2;
+		}
+	}
+	for (t=0; t<C4NT_TUPLES; t++) {
+		tuple_off[t] = off;
+		for (i=0, p=1; i<__builtin_popcountll(tuple_mask[t]); i++) {
+			p *= 3;
+		}
+		off += p;
+	}
+	for (i=0; i<256; i++) {
+		for (k=7, p=0; k>=0; k--) {
+			p = p*3 + (i >> k & 1);
+		}
+		base3[i] = p;
+	}
+}
+
+static inline uint64_t
+pext(uint64_t x, uint64_t m) {
+#ifdef __BMI2__
+	return _pext_u64(x, m);
+#else
+	uint64_t r = 0, bit = 1;
+
+	for (; m != 0; m &= m - 1, bit <<= 1) {
+		if (x & m & -m) {
+			r |= bit;
+		}
+	}
+	return r;
+#endif
+}
+
+/* Map the weights at path; NULL with errno set if they cannot be, or
+ * EINVAL if the file is not a network of this build's tuples
+ */
+struct c4nt *
+c4nt_open(const char *path) {
+	struct c4nt *net;
+	const struct c4nt_hdr *h;
+	size_t size;
+	void *p;
+
+	pthread_once(&once, init_tuples);
+	if ((p = c4map_open(path, sizeof(*h), MADV_NORMAL, &size)) == NULL) {
+		return NULL;
+	}
+	h = p;
+	if (h->magic != C4NT_MAGIC || h->version != C4NT_VERSION
+			|| h->ntuples != C4NT_TUPLES
+			|| h->nweights != C4NT_WEIGHTS || h->off_weights % 64
+			|| !c4map_fits(size, h->off_weights, C4NT_WEIGHTS,
+				sizeof(float))
+			|| (net = calloc(1, sizeof(*net))) == NULL) {
+		munmap(p, size);
+		errno = EINVAL;
+		return NULL;
+	}
+	net->map = p;
+	net->size = size;
+	net->hdr = *h;
+	net->w = (float *)((char *)p + h->off_weights);
+	return net;
+}
+
+/* A network of all-zero weights, for c4nttrain.c to write to
+ */
+struct c4nt *
+c4nt_new(void) {
+	struct c4nt *net;
+	size_t len = (C4NT_WEIGHTS * sizeof(float) + 63) & ~(size_t)63;
+
+	pthread_once(&once, init_tuples);
+	if ((net = calloc(1, sizeof(*net))) == NULL) {
+		return NULL;
+	}
+	if ((net->w = aligned_alloc(64, len)) == NULL) {
+		free(net);
+		return NULL;
+	}
+	memset(net->w, 0, len);
+	net->hdr.magic = C4NT_MAGIC;
+	net->hdr.version = C4NT_VERSION;
+	net->hdr.ntuples = C4NT_TUPLES;
+	net->hdr.nweights = C4NT_WEIGHTS;
+	net->hdr.off_weights = (sizeof(net->hdr) + 63) & ~(uint64_t)63;
+	return net;
+}
+
+/* Write the network to path, by way of a temporary file
+ */
+int
+c4nt_save(const struct c4nt *net, const char *path) {
+	struct c4map_part part[2] = {
+		{ 0, &net->hdr, sizeof(net->hdr) },
+		{ net->hdr.off_weights, net->w, C4NT_WEIGHTS * sizeof(float) },
+	};
+
+	return c4map_save(path, part, 2);
+}
+
+void
+c4nt_close(struct c4nt *net) {
+	if (net == NULL) {
+		return;
+	}
+	if (net->map != NULL) {
+		munmap(net->map, net->size);
+	} else {
+		free(net->w);
+	}
+	free(net);
+}
+
+/* The weight each tuple gives b, as an index into the weights; idx has
+ * room for C4NT_PADDED
+ */
+void
+c4nt_index(const struct c4bb *b, int32_t *idx) {
+	uint64_t cur = b->cur, opp = b->cur ^ b->mask;
+	int32_t set = (b->nmoves & 1) * C4NT_SET;
+	int t;
+
+	for (t=0; t<C4NT_TUPLES; t++) {
+		idx[t] = set + tuple_off[t] + base3[pext(cur, tuple_mask[t])]
+			+ 2*base3[pext(opp, tuple_mask[t])];
+	}
+	for (; t<C4NT_PADDED; t++) {
+		idx[t] = C4NT_WEIGHTS - 1;
+	}
+}
+
+/* The sum of the weights at idx
+ */
+float
+c4nt_sum(const struct c4nt *net, const int32_t *idx) {
+#ifdef __AVX2__
+	__m256 acc = _mm256_setzero_ps();
+	__m128 lo;
+	int t;
+
+	for (t=0; t<C4NT_PADDED; t+=8) {
+		acc = _mm256_add_ps(acc, _mm256_i32gather_ps(net->w,
+			_mm256_loadu_si256((const __m256i *)(idx + t)), 4));
+	}
+	lo = _mm_add_ps(_mm256_castps256_ps128(acc),
+		_mm256_extractf128_ps(acc, 1));
+	lo = _mm_hadd_ps(lo, lo);
+	lo = _mm_hadd_ps(lo, lo);
+	return _mm_cvtss_f32(lo);
+#else
+	float sum = 0;
+	int t;
+
+	for (t=0; t<C4NT_TUPLES; t++) {
+		sum += net->w[idx[t]];
+	}
+	return sum;
+#endif
+}
+
+/* The value of b for the side to move, from -1 for a sure loss to 1
+ * for a sure win
+ */
+float
+c4nt_eval(const struct c4nt *net, const struct c4bb *b) {
+	int32_t idx[C4NT_PADDED];
+
+	c4nt_index(b, idx);
+	return tanhf(c4nt_sum(net, idx));
+}
+
+	/* the i-th column to try: from the centre outwards */
+static inline int
+column(int i) {
+	return WIDTH/2 + 1 + ((i & 1) ? -(i+1)/2 : i/2);
+}
+
+static inline int
+wins(const struct c4bb *b, int c) {
+	struct c4bb t = *b;
+	c4bb_play(&t, c);
+	return c4bb_won(&t);
+}
+
+static float
+negamax(const struct c4nt *net, const struct c4bb *b, int depth,
+		float alpha, float beta) {
+	struct c4bb child;
+	float v, best = -2*WIN;
+	int c, i;
+
+	for (c=1; c<=WIDTH; c++) {
+		if (c4bb_can_play(b, c) && wins(b, c)) {
+			/* sooner is better */
+			return WIN - b->nmoves / 100.0f;
+		}
+	}
+	if (depth == 0) {
+		return c4nt_eval(net, b);
+	}
+	for (i=0; i<WIDTH; i++) {
+		c = column(i);
+		if (!c4bb_can_play(b, c)) {
+			continue;
+		}
+		child = *b;
+		c4bb_play(&child, c);
+		v = c4bb_full(&child) ? 0
+			: -negamax(net, &child, depth-1, -beta, -alpha);
+		if (v > best) {
+			best = v;
+		}
+		if (v > alpha) {
+			alpha = v;
+		}
+		if (alpha >= beta) {
+			break;
+		}
+	}
+	return best;
+}
+
+/* The network's move in b, looking depth plies ahead; 0 if the game is
+ * over
+ */
+int
+c4nt_move(const struct c4nt *net, const struct c4bb *b, int depth) {
+	struct c4bb child;
+	float v, best = -2*WIN;
+	int c, i, move = 0;
+
+	if ((b->nmoves > 0 && c4bb_won(b)) || c4bb_full(b)) {
+		return 0;
+	}
+	for (i=0; i<WIDTH; i++) {
+		c = column(i);
+		if (c4bb_can_play(b, c) && wins(b, c)) {
+			return c;
+		}
+	}
+	for (i=0; i<WIDTH; i++) {
+		c = column(i);
+		if (!c4bb_can_play(b, c)) {
+			continue;
+		}
+		child = *b;
+		c4bb_play(&child, c);
+		v = c4bb_full(&child) ? 0 : -negamax(net, &child,
+			depth > 1 ? depth-1 : 0, -2*WIN, -best);
+		if (v > best) {
+			best = v;
+			move = c;
+		}
+	}
+	return move;
+}
@@ -0,0 +1,84 @@
+/* N-tuple network evaluation of connect-4 positions
+
+   The value of a position for the side to move is tanh of a sum of
+   weights, one from each of C4NT_TUPLES tables. Each table belongs to
+   a tuple, a small fixed set of cells: every 2x4 block of the board
+   lying flat, every 4x2 block standing up, and every diagonal line of
+   four. The weight a tuple gives is the one its table holds for what
+   is in its cells, each empty, the mover's or the opponent's: with
+   the cells as a bitboard mask, PEXT takes the mover's stones and the
+   opponent's out of cur and cur^mask as two k-bit numbers, and a table
+   of 2^k entries turns each into base 3, the opponent's counting
+   double. There is a set of tables for an even number of stones on
+   the board and one for an odd, the first player's position not being
+   the second's.
+
+   The indices are worked out one tuple at a time, and the weights
+   summed with AVX2 gathers, eight tuples at once, when built for it
+   (-mavx2 -mbmi2, or -march=native on a machine that has them), else
+   one at a time; without BMI2, PEXT is done bit by bit.
+
+   The weights come from a file written by c4nttrain.c, which learns
+   them by self-play, and which c4nt_open maps read-only and shared:
+   a header, then C4NT_WEIGHTS floats from off_weights, the last of them
+   0 for the padding tuples to index.
+
+   c4nt_move plays by the network: a search of a few plies, taking any
+   win and scoring the positions at its horizon by their value. At
+   C4NT_DEPTH it costs microseconds.
+
+   To compile: gcc -O2 -march=native -c c4ntuple.c -pthread
+*/
+
+#ifndef C4NTUPLE_H
+#define C4NTUPLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "c4game.h"
+
+#define C4NT_MAGIC	0x544e3443	/* "C4NT" */
+#define C4NT_VERSION	1
+
+	/* tuples: 20 flat blocks, 18 standing, 24 diagonals */
+#define C4NT_TUPLES	62
+
+	/* ... padded to a multiple of eight for the gathers */
+#define C4NT_PADDED	64
+
+	/* weights in a set: 3^8 for each block, 3^4 for each line */
+#define C4NT_SET	(38*6561 + 24*81)
+
+	/* both sets, and the 0 the padding reads */
+#define C4NT_WEIGHTS	(2*C4NT_SET + 1)
+
+	/* plies c4nt_move looks ahead when not told */
+#define C4NT_DEPTH	2
+
+struct c4nt_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t ntuples;
+	uint32_t games;		/* of self-play it was trained on */
+	uint64_t nweights;
+	uint64_t off_weights;	/* in bytes from the start */
+	uint8_t pad[32];
+};
+
+struct c4nt {
+	void *map;		/* NULL if the weights are c4nt_new's */
+	size_t size;
+	struct c4nt_hdr hdr;
+	float *w;		/* read-only when mapped */
+};
+
+struct c4nt *c4nt_open(const char *path);
+struct c4nt *c4nt_new(void);
+int c4nt_save(const struct c4nt *net, const char *path);
+void c4nt_close(struct c4nt *net);
+void c4nt_index(const struct c4bb *b, int32_t *idx);
+float c4nt_sum(const struct c4nt *net, const int32_t *idx);
+float c4nt_eval(const struct c4nt *net, const struct c4bb *b);
+int c4nt_move(const struct c4nt *net, const struct c4bb *b, int depth);
+
+#endif
@@ -0,0 +1,1088 @@
+/* Plays traffic captured by server1 -X back against a server
+
+   Reads one or more capture files (see c4capture.h; with -P the server
+   writes one per process) and sends every connection's lines again, to
+   a server on this machine, at the times they were first sent (-x 1),
+   some multiple faster (-x 10), or as fast as the server answers
+   (-x max, keeping at most -n connections open, default 256). At any
+   speed a line waits for the server's answer to the one before it, as
+   the client had to: for a move in a game against the server, its
+   reply; for ANALYZE, the BEST at the end; for JOIN,
+   the START; in a relayed game, the opponent's move when it is not our
+   turn. An answer that does not come in -w ms is counted as timed out
+   and the connection carries on. A RESUME is sent with the token the
+   replayed HELLO was given in place of the one captured.
+
+   Each answer's latency, from the write to its first line being read,
+   is kept by kind: "move", "open" (HELLO, RESUME, SPEC and SHM),
+   "join" and "analysis". The server's moves, and each BEST, are kept
+   too, numbered by connection and line, which are the same from run
+   to run. With -o they are written to a results file; given an earlier
+   results file with -b, the latencies are set against that run's and
+   the moves compared one by one. Moves only match where the server's
+   choice does not depend on time, e.g. with -L 0 on both builds, or a
+   book; relayed games only pair up the same, and a RESUME only finds
+   its game as it did, when played at -x 1 or so.
+
+   At the end one JSON object is printed on standard output, as c4load
+   does.
+
+   To compile: gcc -O2 c4playback.c c4game.c -o c4playback
+
+   To run: c4playback [-x speed|max] [-w reply-ms] [-n connections]
+   		[-o results] [-b baseline-results] [-U unix-socket]
+   		port capture ...
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "c4game.h"
+#include "c4capture.h"
+
+	/* most events taken from epoll in one go */
+#define EVENTS		256
+
+	/* how often a connection held up on another looks again, in ns */
+#define POLL_NS		1000000
+
+	/* longest line read from the server */
+#define INBUF		512
+
+	/* what a connection is doing */
+#define C_IDLE		0	/* not connected, will connect at due */
+#define C_CONNECTING	1
+#define C_OPEN		2
+#define C_DONE		3
+
+	/* what the client was doing, as far as the server is concerned */
+#define M_NEW		0
+#define M_BOT		1
+#define M_RELAY		2
+#define M_ANALYZE	3
+#define M_WATCH		4
+
+	/* what answer the last line is waiting for */
+#define W_NONE		0
+#define W_LINE		1	/* the next line */
+#define W_BEST		2	/* BEST, BADPOS or BUSY */
+
+	/* kinds of answer, for their latencies */
+#define K_MOVE		0
+#define K_OPEN		1
+#define K_JOIN		2
+#define K_ANALYSIS	3
+#define NKINDS		4
+
+static const char *kinds[NKINDS] = { "move", "open", "join", "analysis" };
+
+struct step {
+	uint64_t t;		/* us since the earliest capture began */
+	int type;		/* C4CAP_LINE, C4CAP_TOKEN or C4CAP_CLOSE */
+	char *text;
+};
+
+struct conn {
+	uint64_t t_open;
+	struct step *steps;
+	int nsteps, room;
+	int next;		/* step to take next */
+	int fd;
+	int state;
+	int mode;
+	int wait, kind;		/* answer waited for, and its kind */
+	uint64_t t_sent, due, t_blocked;
+	int heap;		/* place in the timer heap, or -1 */
+	char colour;		/* in a relayed game, once started */
+	int sent, got;		/* ... moves sent and moves relayed to us */
+	struct c4bb bb;		/* a game against the server */
+	char *token;		/* the token HELLO was given when captured */
+	char newtoken[64];	/* ... and in this run */
+	int inlen;
+	char in[INBUF];
+};
+
+	/* a record as read, before it is a connection's step */
+struct rec {
+	uint64_t t;
+	int file;
+	int sock;
+	int type;
+	char *text;
+	size_t seq;
+};
+
+	/* the server's move, or BEST, at a connection's line */
+struct result {
+	int conn, step;
+	char text[24];
+};
+
+struct kind {
+	uint64_t *lat;
+	size_t n, room;
+	double base[4];		/* p50, p99, p999, max from the baseline */
+	int based;
+};
+
+static struct conn *conns;
+static int nconns;
+static int *heap, nheap;
+static int *bytoken, ntokens;
+
+static double speed = 1;
+static uint64_t reply_ns = 10000000000ull;
+static int maxopen = 256, nopen, nextopen;
+static char *unixpath;
+static int portno;
+static uint64_t t_start, tmin;
+
+static int epfd;
+static unsigned long lines, errors, connect_errors, timeouts, cut_short;
+static int ndone;
+static struct kind lat[NKINDS];
+static struct result *results, *baseline;
+static size_t nresults, maxresults, nbaseline;
+
+static void usage(char *prog);
+static uint64_t now_ns(void);
+static void load(const char *path, int file, struct rec **recs,
+	size_t *nrecs, size_t *room);
+static void build(struct rec *recs, size_t n);
+static void schedule(struct conn *c, uint64_t due);
+static void open_conn(struct conn *c, uint64_t now);
+static void connected(struct conn *c, uint64_t now);
+static void advance(struct conn *c, uint64_t now);
+static void input(struct conn *c, uint64_t now);
+static void finish(struct conn *c, uint64_t now);
+static void launch(uint64_t now);
+static void read_baseline(const char *path);
+static void write_results(const char *path);
+static void report(double secs);
+
+int
+main(int argc, char **argv) {
+	struct epoll_event ev[EVENTS];
+	struct rlimit rl;
+	struct rec *recs = NULL;
+	size_t nrecs = 0, room = 0;
+	uint64_t now;
+	char *outpath = NULL, *basepath = NULL;
+	int opt, i, n, timeout;
+	struct conn *c;
+
+	while ((opt = getopt(argc, argv, "x:w:n:o:b:U:")) != -1) {
+		if (opt == 'x' && strcmp(optarg, "max") == 0) {
+			speed = 0;
+		} else if (opt == 'x') {
+			speed = atof(optarg);
+			if (speed <= 0) {
+				usage(argv[0]);
+			}
+		} else if (opt == 'w') {
+			reply_ns = strtoull(optarg, NULL, 10) * 1000000ull;
+		} else if (opt == 'n') {
+			maxopen = atoi(optarg);
+		} else if (opt == 'o') {
+			outpath = optarg;
+		} else if (opt == 'b') {
+			basepath = optarg;
+		} else if (opt == 'U') {
+			unixpath = optarg;
+		} else {
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind < 2 || maxopen < 1) {
+		usage(argv[0]);
+	}
+	portno = atoi(argv[optind++]);
+	for (i=optind; i<argc; i++) {
+		load(argv[i], i - optind, &recs, &nrecs, &room);
+	}
+	build(recs, nrecs);
+	if (nconns == 0) {
+		fprintf(stderr, "ERROR, nothing was captured\n");
+		exit(1);
+	}
+	if (basepath != NULL) {
+		read_baseline(basepath);
+	}
+
+	/* a connection is a descriptor, so ask for as many as allowed */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+	heap = calloc(nconns, sizeof(*heap));
+	if (heap == NULL) {
+		perror("ERROR allocating connections");
+		exit(1);
+	}
+	if ((epfd = epoll_create1(0)) < 0) {
+		perror("ERROR creating epoll");
+		exit(1);
+	}
+
+	t_start = now_ns();
+	launch(t_start);
+	while (ndone < nconns) {
+		now = now_ns();
+		/* everything that has come due */
+		while (nheap > 0 && conns[heap[0]].due <= now) {
+			c = &conns[heap[0]];
+			schedule(c, 0);
+			if (c->state == C_IDLE) {
+				open_conn(c, now);
+			} else if (c->state == C_CONNECTING) {
+				/* the server never took it */
+				connect_errors++;
+				finish(c, now);
+			} else if (c->state == C_OPEN) {
+				if (c->wait != W_NONE
+						&& now - c->t_sent >= reply_ns) {
+					timeouts++;
+					c->wait = W_NONE;
+				}
+				advance(c, now);
+			}
+		}
+		timeout = 100;
+		if (nheap > 0) {
+			timeout = (conns[heap[0]].due - now + 999999) / 1000000;
+			if (timeout > 100) {
+				timeout = 100;
+			}
+		}
+		n = epoll_wait(epfd, ev, EVENTS, timeout);
+		if (n < 0 && errno != EINTR) {
+			perror("ERROR on epoll_wait");
+			exit(1);
+		}
+		now = now_ns();
+		for (i=0; i<n; i++) {
+			c = &conns[ev[i].data.u32];
+			if (c->state == C_CONNECTING) {
+				connected(c, now);
+			} else if (c->state == C_OPEN) {
+				input(c, now);
+			}
+		}
+	}
+
+	if (outpath != NULL) {
+		write_results(outpath);
+	}
+	report((now_ns() - t_start) / 1e9);
+	return 0;
+}
+
+static void
+usage(char *prog) {
+	fprintf(stderr, "usage: %s [-x speed|max] [-w reply-ms] "
+		"[-n connections] [-o results] [-b baseline-results] "
+		"[-U unix-socket] port capture ...\n", prog);
+	exit(1);
+}
+
+static uint64_t
+now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+
+/* Read one capture file's records onto the end of recs
+ */
+static void
+load(const char *path, int file, struct rec **recs, size_t *nrecs,
+		size_t *room) {
+	FILE *f;
+	char line[2048], *p;
+	unsigned long long start, t;
+	struct rec *r;
+	int sock, len;
+	char type;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		perror(path);
+		exit(1);
+	}
+	if (fgets(line, sizeof(line), f) == NULL
+			|| sscanf(line, "# c4capture 1 start %llu", &start) != 1) {
+		fprintf(stderr, "ERROR, %s is not a capture\n", path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if ((p = strchr(line, '\n')) == NULL) {
+			/* cut short by the server being killed */
+			break;
+		}
+		*p = '\0';
+		if (sscanf(line, "%llu %d %c%n", &t, &sock, &type, &len) != 3) {
+			fprintf(stderr, "ERROR, %s: bad record\n", path);
+			exit(1);
+		}
+		if (*nrecs == *room) {
+			*room = *room ? *room * 2 : 65536;
+			if ((*recs = realloc(*recs, *room * sizeof(**recs)))
+					== NULL) {
+				perror("ERROR allocating records");
+				exit(1);
+			}
+		}
+		r = &(*recs)[*nrecs];
+		r->t = start + t;
+		r->file = file;
+		r->sock = sock;
+		r->type = type;
+		r->text = NULL;
+		if (line[len] == ' ') {
+			r->text = strdup(line + len + 1);
+		}
+		r->seq = (*nrecs)++;
+	}
+	fclose(f);
+}
+
+static int
+by_time(const void *a, const void *b) {
+	const struct rec *x = a, *y = b;
+	if (x->t != y->t) {
+		return x->t < y->t ? -1 : 1;
+	}
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static int
+by_token(const void *a, const void *b) {
+	return strcmp(conns[*(const int *)a].token,
+		conns[*(const int *)b].token);
+}
+
+static void
+add_step(struct conn *c, struct rec *r) {
+	if (c->nsteps == c->room) {
+		c->room = c->room ? c->room * 2 : 8;
+		if ((c->steps = realloc(c->steps, c->room * sizeof(*c->steps)))
+				== NULL) {
+			perror("ERROR allocating steps");
+			exit(1);
+		}
+	}
+	c->steps[c->nsteps].t = r->t - tmin;
+	c->steps[c->nsteps].type = r->type;
+	c->steps[c->nsteps++].text = r->text;
+}
+
+/* Sort the records by time and deal them out to connections: a socket
+ * is a new connection from each O, or from its first record if the
+ * capture began after it opened
+ */
+static void
+build(struct rec *recs, size_t n) {
+	uint64_t *keys, key;
+	int *vals, room = 0;
+	size_t i, size = 16, h;
+	struct conn *c;
+
+	qsort(recs, n, sizeof(*recs), by_time);
+	tmin = n > 0 ? recs[0].t : 0;
+	while (size < 2*n) {
+		size *= 2;
+	}
+	keys = malloc(size * sizeof(*keys));
+	vals = malloc(size * sizeof(*vals));
+	if (keys == NULL || vals == NULL) {
+		perror("ERROR allocating records");
+		exit(1);
+	}
+	memset(keys, 0xff, size * sizeof(*keys));
+
+	for (i=0; i<n; i++) {
+		key = (uint64_t)recs[i].file << 32 | (uint32_t)recs[i].sock;
+		for (h = (key * 0x9e3779b97f4a7c15ull) & (size-1);
+				keys[h] != ~0ull && keys[h] != key;
+				h = (h+1) & (size-1)) {
+			;
+		}
+		if (keys[h] != key || vals[h] < 0
+				|| recs[i].type == C4CAP_OPEN) {
+			if (recs[i].type != C4CAP_OPEN
+					&& recs[i].type != C4CAP_LINE) {
+				/* the end of something we never saw begin */
+				continue;
+			}
+			if (nconns == room) {
+				room = room ? room * 2 : 1024;
+				if ((conns = realloc(conns, room
+						* sizeof(*conns))) == NULL) {
+					perror("ERROR allocating connections");
+					exit(1);
+				}
+			}
+			c = &conns[nconns];
+			memset(c, 0, sizeof(*c));
+			c->t_open = recs[i].t - tmin;
+			c->fd = -1;
+			c->heap = -1;
+			keys[h] = key;
+			vals[h] = nconns++;
+			if (recs[i].type == C4CAP_OPEN) {
+				continue;
+			}
+		}
+		c = &conns[vals[h]];
+		if (recs[i].type == C4CAP_TOKEN) {
+			c->token = recs[i].text;
+			continue;
+		}
+		add_step(c, &recs[i]);
+		if (recs[i].type == C4CAP_CLOSE) {
+			vals[h] = -1;
+		}
+	}
+	free(keys);
+	free(vals);
+	free(recs);
+
+	/* where each captured token went, to find it again for RESUME */
+	if ((bytoken = malloc((nconns + 1) * sizeof(*bytoken))) == NULL) {
+		perror("ERROR allocating tokens");
+		exit(1);
+	}
+	for (i=0; i<(size_t)nconns; i++) {
+		if (conns[i].token != NULL) {
+			bytoken[ntokens++] = i;
+		}
+	}
+	qsort(bytoken, ntokens, sizeof(*bytoken), by_token);
+}
+
+/* The connection that was given token when captured, or NULL
+ */
+static struct conn *
+token_conn(const char *token) {
+	int lo = 0, hi = ntokens - 1, mid, d;
+
+	while (lo <= hi) {
+		mid = (lo + hi) / 2;
+		d = strcmp(token, conns[bytoken[mid]].token);
+		if (d == 0) {
+			return &conns[bytoken[mid]];
+		}
+		if (d < 0) {
+			hi = mid - 1;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return NULL;
+}
+
+/* When a step captured at t is due in this run
+ */
+static uint64_t
+when(uint64_t t) {
+	if (speed == 0) {
+		return t_start;
+	}
+	return t_start + (uint64_t)(t * 1000.0 / speed);
+}
+
+/* Open connections whose time has come: all of them on their own
+ * schedule, or at -x max as many as -n allows, in order
+ */
+static void
+launch(uint64_t now) {
+	while (nextopen < nconns && (speed > 0 || nopen < maxopen)) {
+		schedule(&conns[nextopen], speed > 0
+			? when(conns[nextopen].t_open) : now);
+		nextopen++;
+		nopen++;
+	}
+}
+
+/* The timer heap: a binary min-heap of connections by due time
+ */
+static void
+heap_set(int i, int k) {
+	heap[i] = k;
+	conns[k].heap = i;
+}
+
+static void
+heap_up(int i) {
+	int k = heap[i], p;
+	while (i > 0 && conns[heap[p = (i-1)/2]].due > conns[k].due) {
+		heap_set(i, heap[p]);
+		i = p;
+	}
+	heap_set(i, k);
+}
+
+static void
+heap_down(int i) {
+	int k = heap[i], j;
+	while ((j = 2*i + 1) < nheap) {
+		if (j+1 < nheap && conns[heap[j+1]].due < conns[heap[j]].due) {
+			j++;
+		}
+		if (conns[heap[j]].due >= conns[k].due) {
+			break;
+		}
+		heap_set(i, heap[j]);
+		i = j;
+	}
+	heap_set(i, k);
+}
+
+/* Wake the connection at due, or never if due is 0
+ */
+static void
+schedule(struct conn *c, uint64_t due) {
+	int i = c->heap, k;
+	if (i >= 0) {
+		c->heap = -1;
+		if (--nheap > i) {
+			k = heap[nheap];
+			heap_set(i, k);
+			heap_up(i);
+			heap_down(conns[k].heap);
+		}
+	}
+	if (due == 0) {
+		return;
+	}
+	c->due = due;
+	heap_set(nheap++, c - conns);
+	heap_up(nheap - 1);
+}
+
+static void
+open_conn(struct conn *c, uint64_t now) {
+	struct sockaddr_in in;
+	struct sockaddr_un un;
+	struct epoll_event ev;
+	int fd, r, on = 1;
+
+	if (unixpath != NULL) {
+		memset(&un, 0, sizeof(un));
+		un.sun_family = AF_UNIX;
+		strncpy(un.sun_path, unixpath, sizeof(un.sun_path)-1);
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		r = fd < 0 ? -1 : connect(fd, (struct sockaddr *)&un,
+			sizeof(un));
+	} else {
+		memset(&in, 0, sizeof(in));
+		in.sin_family = AF_INET;
+		in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		in.sin_port = htons(portno);
+		fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (fd >= 0) {
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on,
+				sizeof(on));
+		}
+		r = fd < 0 ? -1 : connect(fd, (struct sockaddr *)&in,
+			sizeof(in));
+	}
+	if (r < 0 && errno != EINPROGRESS) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		connect_errors++;
+		finish(c, now);
+		return;
+	}
+	c->fd = fd;
+	c->state = C_CONNECTING;
+	ev.events = EPOLLOUT;
+	ev.data.u32 = c - conns;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+	if (r == 0) {
+		connected(c, now);
+	} else {
+		schedule(c, now + reply_ns);
+	}
+}
+
+static void
+connected(struct conn *c, uint64_t now) {
+	struct epoll_event ev;
+	socklen_t len = sizeof(int);
+	int err = 0;
+
+	getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+	if (err != 0) {
+		connect_errors++;
+		finish(c, now);
+		return;
+	}
+	ev.events = EPOLLIN;
+	ev.data.u32 = c - conns;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+	schedule(c, 0);
+	c->state = C_OPEN;
+	c->mode = M_NEW;
+	c4bb_init(&c->bb);
+	advance(c, now);
+}
+
+/* Whether the line must wait for something on another connection or
+ * from the server before it goes
+ */
+static int
+held_up(struct conn *c, const char *text) {
+	struct conn *h;
+
+	if (c->mode == M_RELAY && *text >= '1' && *text <= '9') {
+		/* not our turn until the opponent's move is in */
+		return c->got < c->sent + (c->colour == 'R');
+	}
+	if (c->mode == M_NEW && strncmp(text, "RESUME ", 7) == 0
+			&& (h = token_conn(text + 7)) != NULL
+			&& h->newtoken[0] == '\0' && h->state != C_DONE) {
+		/* the game to resume has not been given its token yet */
+		return 1;
+	}
+	return 0;
+}
+
+/* Keep a sample of how long an answer took
+ */
+static void
+sample(int kind, uint64_t ns) {
+	struct kind *k = &lat[kind];
+
+	if (k->n == k->room) {
+		k->room = k->room ? k->room * 2 : 4096;
+		if ((k->lat = realloc(k->lat, k->room * sizeof(*k->lat)))
+				== NULL) {
+			perror("ERROR allocating samples");
+			exit(1);
+		}
+	}
+	k->lat[k->n++] = ns;
+}
+
+static void
+keep_result(struct conn *c, const char *text) {
+	struct result *r;
+
+	if (nresults == maxresults) {
+		maxresults = maxresults ? maxresults * 2 : 4096;
+		if ((results = realloc(results, maxresults * sizeof(*results)))
+				== NULL) {
+			perror("ERROR allocating results");
+			exit(1);
+		}
+	}
+	r = &results[nresults++];
+	r->conn = c - conns;
+	r->step = c->next - 1;
+	snprintf(r->text, sizeof(r->text), "%s", text);
+}
+
+/* Send the line, and note what it waits for
+ */
+static void
+send_line(struct conn *c, const char *text, uint64_t now) {
+	struct conn *h;
+	char buf[INBUF + 64];
+	int len, col;
+
+	if (c->mode == M_NEW && strncmp(text, "RESUME ", 7) == 0
+			&& (h = token_conn(text + 7)) != NULL
+			&& h->newtoken[0] != '\0') {
+		len = snprintf(buf, sizeof(buf), "RESUME %s\n", h->newtoken);
+	} else {
+		len = snprintf(buf, sizeof(buf), "%s\n", text);
+	}
+	c->next++;
+	/* the server may have hung up, which is no reason to die */
+	if (send(c->fd, buf, len, MSG_NOSIGNAL) != len) {
+		errors++;
+		finish(c, now);
+		return;
+	}
+	lines++;
+	c->t_sent = now;
+	c->wait = W_NONE;
+
+	if (c->mode == M_NEW) {
+		if (strncmp(text, "SPEC", 4) == 0
+				|| strncmp(text, "HELLO", 5) == 0
+				|| strncmp(text, "SHM ", 4) == 0) {
+			c->wait = W_LINE;
+			c->kind = K_OPEN;
+			return;
+		}
+		if (strncmp(text, "RESUME ", 7) == 0) {
+			c->wait = W_LINE;
+			c->kind = K_OPEN;
+			c->mode = M_BOT;
+			return;
+		}
+		if (strncmp(text, "JOIN", 4) == 0) {
+			c->wait = W_LINE;
+			c->kind = K_JOIN;
+			c->mode = M_RELAY;
+			return;
+		}
+		if (strncmp(text, "WATCH ", 6) == 0) {
+			c->mode = M_WATCH;
+			return;
+		}
+		if (strncmp(text, "ANALYZE", 7) == 0) {
+			c->mode = M_ANALYZE;
+		} else if (strncmp(text, "RATED", 5) != 0) {
+			c->mode = M_BOT;
+		}
+	}
+	if (c->mode == M_BOT) {
+		col = atoi(text);
+		if (col < 1 || col > WIDTH || !c4bb_can_play(&c->bb, col)) {
+			/* the server will hang up on that */
+			return;
+		}
+		c4bb_play(&c->bb, col);
+		/* a winning or last move gets no reply */
+		if (!c4bb_won(&c->bb) && !c4bb_full(&c->bb)) {
+			c->wait = W_LINE;
+			c->kind = K_MOVE;
+		}
+	} else if (c->mode == M_RELAY) {
+		c->sent++;
+	} else if (c->mode == M_ANALYZE && strncmp(text, "ANALYZE", 7) == 0) {
+		c->wait = W_BEST;
+		c->kind = K_ANALYSIS;
+	}
+}
+
+/* Take the connection's steps for as long as nothing holds it up
+ */
+static void
+advance(struct conn *c, uint64_t now) {
+	struct step *st;
+	uint64_t due;
+
+	while (c->state == C_OPEN && c->wait == W_NONE) {
+		if (c->next == c->nsteps) {
+			/* the capture ends with the connection still open */
+			finish(c, now);
+			return;
+		}
+		st = &c->steps[c->next];
+		if ((due = when(st->t)) > now) {
+			schedule(c, due);
+			return;
+		}
+		if (st->type == C4CAP_CLOSE) {
+			c->next++;
+			finish(c, now);
+			return;
+		}
+		if (held_up(c, st->text)) {
+			if (c->t_blocked == 0) {
+				c->t_blocked = now;
+			}
+			if (now - c->t_blocked < reply_ns) {
+				schedule(c, now + POLL_NS);
+				return;
+			}
+			timeouts++;
+		}
+		c->t_blocked = 0;
+		send_line(c, st->text, now);
+	}
+	if (c->state == C_OPEN) {
+		schedule(c, c->t_sent + reply_ns);
+	}
+}
+
+/* A line from the server
+ */
+static void
+answer(struct conn *c, char *line, uint64_t now) {
+	int col, done;
+
+	done = c->wait == W_LINE || (c->wait == W_BEST
+		&& (strncmp(line, "BEST", 4) == 0
+			|| strncmp(line, "BADPOS", 6) == 0
+			|| strncmp(line, "BUSY", 4) == 0));
+	if (done) {
+		sample(c->kind, now - c->t_sent);
+	}
+	if (strncmp(line, "TOKEN ", 6) == 0) {
+		snprintf(c->newtoken, sizeof(c->newtoken), "%s", line + 6);
+	} else if (strncmp(line, "RESUMED", 7) == 0) {
+		/* the game so far, to follow it from here */
+		c4bb_init(&c->bb);
+		for (line += 7; *line; line++) {
+			col = *line - '0';
+			if (col >= 1 && col <= WIDTH
+					&& c4bb_can_play(&c->bb, col)) {
+				c4bb_play(&c->bb, col);
+			}
+		}
+	} else if (strncmp(line, "START ", 6) == 0) {
+		c->colour = line[6];
+	} else if (strncmp(line, "BEST", 4) == 0 && done) {
+		keep_result(c, line);
+	} else if (*line >= '1' && *line <= '9') {
+		col = atoi(line);
+		if (c->mode == M_RELAY) {
+			c->got++;
+		} else if (c->mode == M_BOT && done) {
+			keep_result(c, line);
+			if (col <= WIDTH && c4bb_can_play(&c->bb, col)) {
+				c4bb_play(&c->bb, col);
+			}
+		}
+	}
+	if (done) {
+		c->wait = W_NONE;
+		schedule(c, 0);
+	}
+}
+
+static void
+input(struct conn *c, uint64_t now) {
+	char *line, *end;
+	int n;
+
+	n = read(c->fd, c->in + c->inlen, sizeof(c->in) - 1 - c->inlen);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+		return;
+	}
+	if (n <= 0) {
+		finish(c, now);
+		return;
+	}
+	c->inlen += n;
+	c->in[c->inlen] = '\0';
+	line = c->in;
+	while ((end = strchr(line, '\n')) != NULL) {
+		*end = '\0';
+		answer(c, line, now);
+		line = end + 1;
+	}
+	c->inlen -= line - c->in;
+	memmove(c->in, line, c->inlen);
+	if (c->inlen == sizeof(c->in) - 1) {
+		/* a line too long to be anything we look at */
+		c->inlen = 0;
+	}
+	advance(c, now);
+}
+
+/* The connection is over, by the server or by the capture
+ */
+static void
+finish(struct conn *c, uint64_t now) {
+	int i;
+
+	schedule(c, 0);
+	if (c->fd >= 0) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+		close(c->fd);
+		c->fd = -1;
+	}
+	for (i=c->next; i<c->nsteps; i++) {
+		if (c->steps[i].type == C4CAP_LINE) {
+			/* the server hung up before the client had done */
+			cut_short++;
+			break;
+		}
+	}
+	c->state = C_DONE;
+	ndone++;
+	nopen--;
+	launch(now);
+}
+
+static int
+by_step(const void *a, const void *b) {
+	const struct result *x = a, *y = b;
+	if (x->conn != y->conn) {
+		return x->conn < y->conn ? -1 : 1;
+	}
+	return x->step < y->step ? -1 : x->step > y->step;
+}
+
+static int
+cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+static double
+quantile(struct kind *k, double q) {
+	size_t i;
+	if (k->n == 0) {
+		return 0;
+	}
+	i = (size_t)(q * (k->n - 1) + 0.5);
+	return k->lat[i] / 1e3;
+}
+
+/* Read the latencies and moves of an earlier run
+ */
+static void
+read_baseline(const char *path) {
+	FILE *f;
+	char line[256], name[32];
+	double v[4];
+	size_t room = 0;
+	int i, conn, step, len;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		perror(path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		line[strcspn(line, "\n")] = '\0';
+		if (sscanf(line, "latency %31s %*u %lf %lf %lf %lf", name,
+				&v[0], &v[1], &v[2], &v[3]) == 5) {
+			for (i=0; i<NKINDS; i++) {
+				if (strcmp(name, kinds[i]) == 0) {
+					memcpy(lat[i].base, v, sizeof(v));
+					lat[i].based = 1;
+				}
+			}
+		} else if (sscanf(line, "move %d %d %n", &conn, &step, &len)
+				== 2) {
+			if (nbaseline == room) {
+				room = room ? room * 2 : 4096;
+				if ((baseline = realloc(baseline, room
+						* sizeof(*baseline))) == NULL) {
+					perror("ERROR allocating baseline");
+					exit(1);
+				}
+			}
+			baseline[nbaseline].conn = conn;
+			baseline[nbaseline].step = step;
+			strncpy(baseline[nbaseline].text, line + len,
+				sizeof(baseline->text) - 1);
+			baseline[nbaseline++].text[sizeof(baseline->text) - 1]
+				= '\0';
+		}
+	}
+	fclose(f);
+	qsort(baseline, nbaseline, sizeof(*baseline), by_step);
+}
+
+static void
+write_results(const char *path) {
+	FILE *f;
+	struct kind *k;
+	size_t i;
+	int j;
+
+	if ((f = fopen(path, "w")) == NULL) {
+		perror(path);
+		exit(1);
+	}
+	fprintf(f, "# c4playback 1, latencies in us: samples p50 p99 "
+		"p99.9 max\n");
+	for (j=0; j<NKINDS; j++) {
+		k = &lat[j];
+		qsort(k->lat, k->n, sizeof(*k->lat), cmp_u64);
+		if (k->n > 0) {
+			fprintf(f, "latency %s %zu %.1f %.1f %.1f %.1f\n",
+				kinds[j], k->n, quantile(k, 0.5),
+				quantile(k, 0.99), quantile(k, 0.999),
+				k->lat[k->n-1] / 1e3);
+		}
+	}
+	qsort(results, nresults, sizeof(*results), by_step);
+	for (i=0; i<nresults; i++) {
+		fprintf(f, "move %d %d %s\n", results[i].conn,
+			results[i].step, results[i].text);
+	}
+	if (fclose(f) != 0) {
+		perror(path);
+		exit(1);
+	}
+}
+
+static void
+report(double secs) {
+	struct kind *k;
+	size_t i = 0, b = 0, compared = 0, differ = 0;
+	int j, d, first = 1;
+	char pace[32];
+
+	if (speed > 0) {
+		snprintf(pace, sizeof(pace), "%gx", speed);
+	} else {
+		snprintf(pace, sizeof(pace), "max");
+	}
+	printf("{\"connections\": %d, \"transport\": \"%s\", "
+		"\"speed\": \"%s\", \"seconds\": %.3f, \"lines\": %lu, "
+		"\"errors\": %lu, \"connect_errors\": %lu, "
+		"\"timeouts\": %lu, \"cut_short\": %lu, \"latency_us\": {",
+		nconns, unixpath ? "unix" : "tcp", pace, secs, lines, errors,
+		connect_errors, timeouts, cut_short);
+	for (j=0; j<NKINDS; j++) {
+		k = &lat[j];
+		qsort(k->lat, k->n, sizeof(*k->lat), cmp_u64);
+		if (k->n == 0) {
+			continue;
+		}
+		printf("%s\"%s\": {\"samples\": %zu, \"p50\": %.1f, "
+			"\"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f",
+			first ? "" : ", ", kinds[j], k->n, quantile(k, 0.5),
+			quantile(k, 0.99), quantile(k, 0.999),
+			k->lat[k->n-1] / 1e3);
+		if (k->based) {
+			printf(", \"baseline\": {\"p50\": %.1f, \"p99\": %.1f, "
+				"\"p999\": %.1f, \"max\": %.1f}, "
+				"\"p99_change_pct\": %.1f", k->base[0],
+				k->base[1], k->base[2], k->base[3],
+				k->base[1] > 0 ? (quantile(k, 0.99)
+					/ k->base[1] - 1) * 100 : 0);
+		}
+		printf("}");
+		first = 0;
+	}
+	printf("}");
+
+	if (baseline != NULL) {
+		qsort(results, nresults, sizeof(*results), by_step);
+		while (i < nresults && b < nbaseline) {
+			d = by_step(&results[i], &baseline[b]);
+			if (d == 0) {
+				compared++;
+				if (strcmp(results[i].text,
+						baseline[b].text) != 0) {
+					if (differ++ < 10) {
+						fprintf(stderr, "connection %d "
+							"line %d: %s, was %s\n",
+							results[i].conn,
+							results[i].step,
+							results[i].text,
+							baseline[b].text);
+					}
+				}
+			}
+			i += d <= 0;
+			b += d >= 0;
+		}
+		printf(", \"moves\": %zu, \"baseline_moves\": %zu, "
+			"\"moves_compared\": %zu, \"moves_differ\": %zu",
+			nresults, nbaseline, compared, differ);
+	}
+	printf("}\n");
+}
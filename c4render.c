@@ -0,0 +1,179 @@
+/* Board renderer, see c4render.h
+
+   To compile: gcc -c c4render.c
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "c4render.h"
+#include "c4trace.h"
+
+	/* the picture of an empty board */
+static char frame[C4R_FRAME];
+static int framelen;
+
+	/* offset in frame of the first character of each row of a cell */
+static int cellpos[HEIGHT][WIDTH][HGRID];
+
+	/* screen line (from 1) of each row of a cell, counted from the
+	 * top of the picture, and the screen column of its first character
+	 */
+#define CELL_LINE(r, i)	(2 + (HEIGHT-1-(r))*HGRID + (i))
+#define CELL_COL(c)	(8 + 2 + (c)*(WGRID+1))
+
+static void
+write_all(const char *buf, int len) {
+	int n;
+	fflush(stdout);
+	while (len > 0) {
+		if ((n = write(1, buf, len)) <= 0) {
+			return;
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+/* Lay out the empty board once, with the same layout print_config
+ * always used, and note where each cell lives in it
+ */
+void
+c4render_init(void) {
+	char *p = frame;
+	int r, c, i, j;
+
+	*p++ = '\n';
+	/* cells starting from the top, each spread over several rows */
+	for (r=HEIGHT-1; r>=0; r--) {
+		for (i=0; i<HGRID; i++) {
+			*p++ = '\t';
+			*p++ = '|';
+			for (c=0; c<WIDTH; c++) {
+				cellpos[r][c][i] = p - frame;
+				for (j=0; j<WGRID; j++) {
+					*p++ = EMPTY;
+				}
+				*p++ = '|';
+			}
+			*p++ = '\n';
+		}
+	}
+	/* now the bottom line */
+	*p++ = '\t';
+	*p++ = '+';
+	for (c=0; c<WIDTH; c++) {
+		for (j=0; j<WGRID; j++) {
+			*p++ = '-';
+		}
+		*p++ = '+';
+	}
+	*p++ = '\n';
+	/* and the bottom legend */
+	*p++ = '\t';
+	*p++ = ' ';
+	for (c=0; c<WIDTH; c++) {
+		for (j=0; j<(WGRID-1)/2; j++) {
+			*p++ = ' ';
+		}
+		*p++ = '0' + (c+1) % 10;
+		*p++ = ' ';
+		for (j=0; j<WGRID-1-(WGRID-1)/2; j++) {
+			*p++ = ' ';
+		}
+	}
+	*p++ = '\n';
+	*p++ = '\n';
+	framelen = p - frame;
+}
+
+/* Fill buf with the picture of board; returns its length
+ */
+int
+c4render_frame(char *buf, c4_t board) {
+	int r, c, i;
+
+	memcpy(buf, frame, framelen);
+	for (r=0; r<HEIGHT; r++) {
+		for (c=0; c<WIDTH; c++) {
+			if (board[r][c] == EMPTY) {
+				continue;
+			}
+			for (i=0; i<HGRID; i++) {
+				memset(buf + cellpos[r][c][i], board[r][c], WGRID);
+			}
+		}
+	}
+	return framelen;
+}
+
+/* Fill buf with what a diff-mode terminal needs to show board: the
+ * whole picture at the top of the screen the first time, and after
+ * that only the cells that changed, drawn in place
+ */
+int
+c4render_diff(char *buf, struct c4render *r, c4_t board) {
+	char *p = buf;
+	int row, c, i;
+
+	if (!r->valid) {
+		/* clear the screen and draw it all from the top */
+		p += sprintf(p, "\033[H\033[2J");
+		p += c4render_frame(p, board);
+		if (r->rows > C4R_LINES) {
+			/* everything else scrolls beneath the board */
+			p += sprintf(p, "\033[%d;%dr\033[%d;1H", C4R_LINES+1,
+				r->rows, C4R_LINES+1);
+		}
+		memcpy(r->shown, board, sizeof(c4_t));
+		r->valid = 1;
+		return p - buf;
+	}
+
+	/* save the cursor, redraw changed cells, put the cursor back */
+	p += sprintf(p, "\0337");
+	for (row=0; row<HEIGHT; row++) {
+		for (c=0; c<WIDTH; c++) {
+			if (board[row][c] == r->shown[row][c]) {
+				continue;
+			}
+			for (i=0; i<HGRID; i++) {
+				p += sprintf(p, "\033[%d;%dH", CELL_LINE(row, i),
+					CELL_COL(c));
+				memset(p, board[row][c], WGRID);
+				p += WGRID;
+			}
+			r->shown[row][c] = board[row][c];
+		}
+	}
+	p += sprintf(p, "\0338");
+	return p - buf;
+}
+
+/* Give the terminal its whole screen back
+ */
+int
+c4render_end(char *buf, struct c4render *r) {
+	if (r->valid && r->rows > C4R_LINES) {
+		return sprintf(buf, "\033[r\033[%d;1H", r->rows);
+	}
+	return 0;
+}
+
+/* Draw board on standard output with a single write
+ */
+void
+c4render_print(c4_t board) {
+	char buf[C4R_FRAME];
+	C4TRACE_BEGIN(t);
+	write_all(buf, c4render_frame(buf, board));
+	C4TRACE_END(t, "render", 0);
+}
+
+/* Bring a diff-mode terminal up to date with board
+ */
+void
+c4render_update(struct c4render *r, c4_t board) {
+	char buf[C4R_DIFF];
+	write_all(buf, c4render_diff(buf, r, board));
+}
@@ -0,0 +1,48 @@
+/* Board renderer shared by connect4.c, client1.c and server1.c
+
+   The picture of an empty board is laid out once, by c4render_init,
+   together with where every cell's characters sit in it. Drawing a
+   board is then a copy of that template with the cells filled in, all
+   into the caller's buffer, and one write() to put it on the screen.
+
+   The diff mode keeps the board at the top of the terminal, below
+   which everything else scrolls, and for each new board sends only
+   the ANSI cursor moves and characters for cells that have changed.
+
+   To compile: gcc -c c4render.c
+*/
+
+#ifndef C4RENDER_H
+#define C4RENDER_H
+
+#include "c4game.h"
+
+	/* horizontal size of each cell in the display grid */
+#define WGRID	5
+
+	/* vertical size of each cell in the display grid */
+#define HGRID	3
+
+	/* characters in one line of the picture, newline included */
+#define C4R_LINE	(2 + WIDTH*(WGRID+1) + 1)
+
+	/* lines in the picture, and a buffer big enough for any frame */
+#define C4R_LINES	(HEIGHT*HGRID + 4)
+#define C4R_FRAME	(C4R_LINES*C4R_LINE + 16)
+#define C4R_DIFF	(WIDTH*HEIGHT*HGRID*(WGRID+12) + C4R_FRAME + 64)
+
+	/* what a terminal in diff mode is showing */
+struct c4render {
+	int valid;		/* 0 until the first full frame is drawn */
+	int rows;		/* terminal height, 0 if unknown */
+	c4_t shown;
+};
+
+void c4render_init(void);
+int c4render_frame(char *buf, c4_t board);
+int c4render_diff(char *buf, struct c4render *r, c4_t board);
+int c4render_end(char *buf, struct c4render *r);
+void c4render_print(c4_t board);
+void c4render_update(struct c4render *r, c4_t board);
+
+#endif
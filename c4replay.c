@@ -0,0 +1,155 @@
+/* Re-simulate games stored in the journal and check their results
+
+   Every record is played again through do_move()/winner_found(): each
+   move must be legal, no one may have won before the last move, and
+   the stored result must match what the board says.
+
+   To compile: gcc c4replay.c c4journal.c c4game.c -o c4replay -pthread
+
+   To run: c4replay [-c] [-v] journal-dir|segment.c4j ...
+   	-c	only count records, to time the reader on its own
+   	-v	print every game that fails to check out
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "c4game.h"
+#include "c4journal.h"
+
+static int verbose, count_only;
+static unsigned long games, moves, bad;
+
+/* Play one record again, returning NULL if it is consistent or a
+ * description of the first problem found
+ */
+static const char *
+check_game(const struct c4j_rec *r) {
+	c4_t board;
+	char colour = YELLOW, won = EMPTY;
+	int i, c;
+
+	init_empty(board);
+	for (i=0; i<r->nmoves; i++) {
+		if (won != EMPTY) {
+			return "moves after the game was won";
+		}
+		c = c4j_move(r, i);
+		if (c < 1 || c > WIDTH || !do_move(board, c, colour)) {
+			return "illegal move";
+		}
+		won = winner_found(board);
+		colour = (colour == YELLOW) ? RED : YELLOW;
+	}
+	moves += r->nmoves;
+	if (r->result == 0) {
+		/* abandoned games have no result to check, but one
+		 * cannot have been played to the end
+		 */
+		if (won != EMPTY) {
+			return "unfinished game has a winner";
+		}
+		return move_possible(board) ? NULL
+			: "draw recorded as abandoned";
+	}
+	if (won != EMPTY) {
+		return won == r->result ? NULL : "wrong winner recorded";
+	}
+	if (move_possible(board)) {
+		return r->result == EMPTY ? "draw recorded on open board"
+			: "win recorded without four in a row";
+	}
+	return r->result == EMPTY ? NULL : "win recorded for a drawn board";
+}
+
+static void
+print_game(const char *path, const struct c4j_rec *r, const char *why) {
+	int i;
+	printf("%s: game %lu: %s: result '%c' moves ", path, games, why,
+		r->result ? r->result : '?');
+	for (i=0; i<r->nmoves; i++) {
+		printf("%d", c4j_move(r, i));
+	}
+	printf("\n");
+}
+
+static void
+replay_segment(const char *path) {
+	struct c4jseg seg;
+	const struct c4j_rec *r;
+	const char *why;
+
+	if (c4jseg_open(&seg, path) < 0) {
+		fprintf(stderr, "%s: not a journal segment\n", path);
+		return;
+	}
+	while ((r = c4jseg_next(&seg)) != NULL) {
+		games++;
+		if (count_only) {
+			moves += r->nmoves;
+			continue;
+		}
+		if ((why = check_game(r)) != NULL) {
+			bad++;
+			if (verbose) {
+				print_game(path, r, why);
+			}
+		}
+	}
+	if (seg.off != seg.size) {
+		fprintf(stderr, "%s: %zu trailing bytes ignored\n",
+			path, seg.size - seg.off);
+	}
+	c4jseg_close(&seg);
+}
+
+int
+main(int argc, char **argv) {
+	struct stat st;
+	struct timespec t0, t1;
+	char **paths;
+	double secs;
+	int opt, i, k, n;
+
+	while ((opt = getopt(argc, argv, "cv")) != -1) {
+		if (opt == 'c') {
+			count_only = 1;
+		} else if (opt == 'v') {
+			verbose = 1;
+		} else {
+			fprintf(stderr, "usage: %s [-c] [-v] journal ...\n",
+				argv[0]);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "usage: %s [-c] [-v] journal ...\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i=optind; i<argc; i++) {
+		if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+			n = c4journal_list(argv[i], &paths);
+			for (k=0; k<n; k++) {
+				replay_segment(paths[k]);
+			}
+			c4journal_free_list(paths, n);
+		} else {
+			replay_segment(argv[i]);
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec)/1e9;
+	printf("%lu games, %lu moves, %lu inconsistent, %.3f s", games,
+		moves, bad, secs);
+	if (secs > 0) {
+		printf(", %.0f games/s", games/secs);
+	}
+	printf("\n");
+	return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
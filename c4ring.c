@@ -0,0 +1,435 @@
+/* Lock-free bounded queues, see c4ring.h
+
+   To compile: gcc -c c4ring.c
+*/
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "c4ring.h"
+
+static long
+futex(_Atomic uint32_t *addr, int op, uint32_t val,
+		const struct timespec *ts) {
+	return syscall(SYS_futex, addr, op, val, ts, NULL, 0);
+}
+
+/* How long to spin before sleeping: not at all with one CPU, where
+ * the other side cannot run while we spin
+ */
+static int
+spin_limit(void) {
+	static int limit = -1;
+	if (limit < 0) {
+		limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? C4RING_SPIN : 0;
+	}
+	return limit;
+}
+
+static inline void
+relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+static uint64_t
+now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+
+/* The other side has pushed or popped: wake whoever sleeps on w. Only
+ * the first push or pop after someone settles pays for the system
+ * call, which wakes them all; the rest see nobody waiting
+ */
+static void
+wake(struct c4ring_wait *w) {
+	/* against the sleeper's arm-then-look: either it sees what was
+	 * just done, or we see it armed
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&w->armed, memory_order_relaxed)
+			&& atomic_exchange(&w->armed, 0)) {
+		atomic_fetch_add(&w->seq, 1);
+		futex(&w->seq, FUTEX_WAKE_PRIVATE, 0x7fffffff, NULL);
+	}
+}
+
+/* Begin to sleep on w: returns what to sleep on, once the caller has
+ * armed it; it must look again before calling doze
+ */
+static uint32_t
+settle(struct c4ring_wait *w) {
+	uint32_t seen = atomic_load(&w->seq);
+	atomic_store(&w->armed, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+	return seen;
+}
+
+/* Sleep on w until woken, or until end (0 for never); -1 once end has
+ * passed
+ */
+static int
+doze(struct c4ring_wait *w, uint32_t seen, uint64_t end) {
+	struct timespec ts;
+	uint64_t now;
+
+	if (end != 0) {
+		if ((now = now_ns()) >= end) {
+			return -1;
+		}
+		ts.tv_sec = (end - now) / 1000000000u;
+		ts.tv_nsec = (end - now) % 1000000000u;
+	}
+	futex(&w->seq, FUTEX_WAIT_PRIVATE, seen, end != 0 ? &ts : NULL);
+	return 0;
+}
+
+static uint64_t
+deadline(int ms) {
+	return ms < 0 ? 0 : now_ns() + ms * 1000000ull;
+}
+
+/* Set up a queue of size cells, which must be a power of two
+ */
+int
+c4mpmc_init(struct c4mpmc *q, size_t size, int flags) {
+	size_t i;
+	if (size < 2 || (size & (size-1)) != 0) {
+		return -1;
+	}
+	q->cell = aligned_alloc(64, size * sizeof(*q->cell));
+	if (q->cell == NULL) {
+		return -1;
+	}
+	for (i=0; i<size; i++) {
+		atomic_init(&q->cell[i].seq, i);
+		q->cell[i].data = NULL;
+	}
+	q->mask = size - 1;
+	q->flags = flags;
+	atomic_init(&q->tail, 0);
+	atomic_init(&q->head, 0);
+	atomic_init(&q->nonempty.seq, 0);
+	atomic_init(&q->nonempty.armed, 0);
+	atomic_init(&q->nonfull.seq, 0);
+	atomic_init(&q->nonfull.armed, 0);
+	return 0;
+}
+
+/* Add up to n items to the queue, as many as there is room for, and
+ * return how many
+ */
+size_t
+c4mpmc_push_n(struct c4mpmc *q, void *const *data, size_t n) {
+	struct c4mpmc_cell *c;
+	size_t pos, seq = 0, i, k;
+
+	pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	for (;;) {
+		/* how many cells from pos on are free for this lap */
+		for (k=0; k<n && k<=q->mask; k++) {
+			c = &q->cell[(pos+k) & q->mask];
+			seq = atomic_load_explicit(&c->seq,
+				memory_order_acquire);
+			if (seq != pos+k) {
+				break;
+			}
+		}
+		if (k > 0) {
+			/* claim them, or learn where tail went */
+			if (atomic_compare_exchange_weak_explicit(&q->tail,
+					&pos, pos+k, memory_order_relaxed,
+					memory_order_relaxed)) {
+				break;
+			}
+		} else if ((intptr_t)seq - (intptr_t)pos < 0) {
+			/* cell still holds an item from a lap ago */
+			return 0;
+		} else {
+			pos = atomic_load_explicit(&q->tail,
+				memory_order_relaxed);
+		}
+	}
+	for (i=0; i<k; i++) {
+		c = &q->cell[(pos+i) & q->mask];
+		c->data = data[i];
+		atomic_store_explicit(&c->seq, pos+i+1, memory_order_release);
+	}
+	if (q->flags & C4RING_WAIT) {
+		wake(&q->nonempty);
+	}
+	return k;
+}
+
+/* Take up to n of the oldest items off the queue, as many as there
+ * are, and return how many
+ */
+size_t
+c4mpmc_pop_n(struct c4mpmc *q, void **data, size_t n) {
+	struct c4mpmc_cell *c;
+	size_t pos, seq = 0, i, k;
+
+	pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+	for (;;) {
+		for (k=0; k<n && k<=q->mask; k++) {
+			c = &q->cell[(pos+k) & q->mask];
+			seq = atomic_load_explicit(&c->seq,
+				memory_order_acquire);
+			if (seq != pos+k+1) {
+				break;
+			}
+		}
+		if (k > 0) {
+			if (atomic_compare_exchange_weak_explicit(&q->head,
+					&pos, pos+k, memory_order_relaxed,
+					memory_order_relaxed)) {
+				break;
+			}
+		} else if ((intptr_t)seq - (intptr_t)(pos+1) < 0) {
+			/* nothing has been pushed into this cell yet */
+			return 0;
+		} else {
+			pos = atomic_load_explicit(&q->head,
+				memory_order_relaxed);
+		}
+	}
+	for (i=0; i<k; i++) {
+		c = &q->cell[(pos+i) & q->mask];
+		data[i] = c->data;
+		/* hand the cell back to producers for their next lap */
+		atomic_store_explicit(&c->seq, pos+i + q->mask + 1,
+			memory_order_release);
+	}
+	if (q->flags & C4RING_WAIT) {
+		wake(&q->nonfull);
+	}
+	return k;
+}
+
+/* Add data to the queue; returns -1 if it is full
+ */
+int
+c4mpmc_push(struct c4mpmc *q, void *data) {
+	return c4mpmc_push_n(q, &data, 1) == 1 ? 0 : -1;
+}
+
+/* Take the oldest item off the queue, or NULL if it is empty
+ */
+void *
+c4mpmc_pop(struct c4mpmc *q) {
+	void *data;
+	return c4mpmc_pop_n(q, &data, 1) == 1 ? data : NULL;
+}
+
+/* Add data, waiting up to ms (-1 for ever) for room; -1 on timing out
+ */
+int
+c4mpmc_push_wait(struct c4mpmc *q, void *data, int ms) {
+	uint64_t end = deadline(ms);
+	uint32_t seen;
+	int spin = spin_limit(), r;
+
+	for (;;) {
+		if (c4mpmc_push(q, data) == 0) {
+			return 0;
+		}
+		if (spin-- > 0) {
+			relax();
+			continue;
+		}
+		seen = settle(&q->nonfull);
+		r = c4mpmc_push(q, data) == 0 ? 1
+			: doze(&q->nonfull, seen, end);
+		if (r != 0) {
+			return r > 0 ? 0 : -1;
+		}
+	}
+}
+
+/* Take the oldest item, waiting up to ms (-1 for ever) for one; NULL
+ * on timing out
+ */
+void *
+c4mpmc_pop_wait(struct c4mpmc *q, int ms) {
+	uint64_t end = deadline(ms);
+	uint32_t seen;
+	int spin = spin_limit();
+	void *data;
+
+	for (;;) {
+		if ((data = c4mpmc_pop(q)) != NULL) {
+			return data;
+		}
+		if (spin-- > 0) {
+			relax();
+			continue;
+		}
+		seen = settle(&q->nonempty);
+		if ((data = c4mpmc_pop(q)) == NULL
+				&& doze(&q->nonempty, seen, end) < 0) {
+			return NULL;
+		}
+		if (data != NULL) {
+			return data;
+		}
+	}
+}
+
+void
+c4mpmc_free(struct c4mpmc *q) {
+	free(q->cell);
+	q->cell = NULL;
+}
+
+/* Set up a ring of n items of size bytes each; n must be a power of
+ * two
+ */
+int
+c4spsc_init(struct c4spsc *q, size_t n, size_t size, int flags) {
+	size_t bytes = (n * size + 63) & ~(size_t)63;
+
+	if (n < 2 || (n & (n-1)) != 0 || size == 0) {
+		return -1;
+	}
+	if ((q->slot = aligned_alloc(64, bytes)) == NULL) {
+		return -1;
+	}
+	q->mask = n - 1;
+	q->size = size;
+	q->flags = flags;
+	q->head_seen = q->tail_seen = 0;
+	atomic_init(&q->tail, 0);
+	atomic_init(&q->head, 0);
+	atomic_init(&q->nonempty.seq, 0);
+	atomic_init(&q->nonempty.armed, 0);
+	atomic_init(&q->nonfull.seq, 0);
+	atomic_init(&q->nonfull.armed, 0);
+	return 0;
+}
+
+/* Copy up to n items in, as many as there is room for, and return how
+ * many; the producer's side only
+ */
+size_t
+c4spsc_push_n(struct c4spsc *q, const void *items, size_t n) {
+	size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	size_t room = q->mask + 1, k, at, first;
+
+	if (tail - q->head_seen + n > room) {
+		q->head_seen = atomic_load_explicit(&q->head,
+			memory_order_acquire);
+	}
+	k = room - (tail - q->head_seen);
+	if (k > n) {
+		k = n;
+	}
+	if (k == 0) {
+		return 0;
+	}
+	at = tail & q->mask;
+	first = k < room - at ? k : room - at;
+	memcpy(q->slot + at * q->size, items, first * q->size);
+	memcpy(q->slot, (const char *)items + first * q->size,
+		(k - first) * q->size);
+	atomic_store_explicit(&q->tail, tail + k, memory_order_release);
+	if (q->flags & C4RING_WAIT) {
+		wake(&q->nonempty);
+	}
+	return k;
+}
+
+/* Copy up to n of the oldest items out, as many as there are, and
+ * return how many; the consumer's side only
+ */
+size_t
+c4spsc_pop_n(struct c4spsc *q, void *items, size_t n) {
+	size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+	size_t room = q->mask + 1, k, at, first;
+
+	if (q->tail_seen - head < n) {
+		q->tail_seen = atomic_load_explicit(&q->tail,
+			memory_order_acquire);
+	}
+	k = q->tail_seen - head;
+	if (k > n) {
+		k = n;
+	}
+	if (k == 0) {
+		return 0;
+	}
+	at = head & q->mask;
+	first = k < room - at ? k : room - at;
+	memcpy(items, q->slot + at * q->size, first * q->size);
+	memcpy((char *)items + first * q->size, q->slot,
+		(k - first) * q->size);
+	atomic_store_explicit(&q->head, head + k, memory_order_release);
+	if (q->flags & C4RING_WAIT) {
+		wake(&q->nonfull);
+	}
+	return k;
+}
+
+/* Copy an item in, waiting up to ms (-1 for ever) for room; -1 on
+ * timing out
+ */
+int
+c4spsc_push_wait(struct c4spsc *q, const void *item, int ms) {
+	uint64_t end = deadline(ms);
+	uint32_t seen;
+	int spin = spin_limit(), r;
+
+	for (;;) {
+		if (c4spsc_push(q, item) == 0) {
+			return 0;
+		}
+		if (spin-- > 0) {
+			relax();
+			continue;
+		}
+		seen = settle(&q->nonfull);
+		r = c4spsc_push(q, item) == 0 ? 1
+			: doze(&q->nonfull, seen, end);
+		if (r != 0) {
+			return r > 0 ? 0 : -1;
+		}
+	}
+}
+
+/* Copy the oldest item out, waiting up to ms (-1 for ever) for one; -1
+ * on timing out
+ */
+int
+c4spsc_pop_wait(struct c4spsc *q, void *item, int ms) {
+	uint64_t end = deadline(ms);
+	uint32_t seen;
+	int spin = spin_limit(), r;
+
+	for (;;) {
+		if (c4spsc_pop(q, item) == 0) {
+			return 0;
+		}
+		if (spin-- > 0) {
+			relax();
+			continue;
+		}
+		seen = settle(&q->nonempty);
+		r = c4spsc_pop(q, item) == 0 ? 1
+			: doze(&q->nonempty, seen, end);
+		if (r != 0) {
+			return r > 0 ? 0 : -1;
+		}
+	}
+}
+
+void
+c4spsc_free(struct c4spsc *q) {
+	free(q->slot);
+	q->slot = NULL;
+}
@@ -0,0 +1,105 @@
+/* Lock-free bounded queues
+
+   c4mpmc is a multi-producer, multi-consumer ring of pointers after
+   Dmitry Vyukov's bounded queue: each cell carries a sequence number
+   that tells producers and consumers whether it is theirs to use, so
+   the only shared writes are one CAS on the head or tail index. A
+   batch of n items costs one CAS too: the cells are checked first, and
+   the index moved past all of them at once.
+
+   c4spsc is a ring of fixed-size items, copied in and out, for one
+   producer and one consumer. Each side owns its index, on a cache line
+   of its own beside its last look at the other side's, so it reads the
+   other's line only when the ring looks full (or empty) by what it saw
+   last.
+
+   Made with C4RING_WAIT, either kind can also be waited on: the _wait
+   calls spin for a while, given a CPU to spare, then sleep on a futex
+   until the other side makes room or pushes something. Every push and
+   pop on such a queue then pays a fence to see whether anyone sleeps,
+   and a system call only if someone does; queues made without it pay
+   nothing, and their _wait calls wake only on their timeouts.
+
+   To compile: gcc -c c4ring.c
+*/
+
+#ifndef C4RING_H
+#define C4RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+	/* flags for c4mpmc_init and c4spsc_init */
+#define C4RING_WAIT	1	/* the _wait calls will be used */
+
+	/* how many times a waiter looks before sleeping, given a CPU to
+	 * spare
+	 */
+#define C4RING_SPIN	2000
+
+	/* where a _wait call sleeps: seq is bumped by whoever wakes it,
+	 * armed set by anyone about to sleep and cleared by the waker
+	 */
+struct c4ring_wait {
+	_Atomic uint32_t seq;
+	atomic_int armed;
+};
+
+struct c4mpmc_cell {
+	atomic_size_t seq;
+	void *data;
+};
+
+struct c4mpmc {
+	_Alignas(64) atomic_size_t tail;	/* next cell to push into */
+	_Alignas(64) atomic_size_t head;	/* next cell to pop from */
+	_Alignas(64) size_t mask;
+	int flags;
+	struct c4mpmc_cell *cell;
+	_Alignas(64) struct c4ring_wait nonempty;
+	_Alignas(64) struct c4ring_wait nonfull;
+};
+
+struct c4spsc {
+	_Alignas(64) atomic_size_t tail;	/* next slot to fill */
+	size_t head_seen;		/* the producer's last look at head */
+	_Alignas(64) atomic_size_t head;	/* next slot to empty */
+	size_t tail_seen;		/* the consumer's last look at tail */
+	_Alignas(64) size_t mask;
+	size_t size;			/* bytes in an item */
+	int flags;
+	char *slot;
+	_Alignas(64) struct c4ring_wait nonempty;
+	_Alignas(64) struct c4ring_wait nonfull;
+};
+
+int c4mpmc_init(struct c4mpmc *q, size_t size, int flags);
+int c4mpmc_push(struct c4mpmc *q, void *data);
+void *c4mpmc_pop(struct c4mpmc *q);
+size_t c4mpmc_push_n(struct c4mpmc *q, void *const *data, size_t n);
+size_t c4mpmc_pop_n(struct c4mpmc *q, void **data, size_t n);
+int c4mpmc_push_wait(struct c4mpmc *q, void *data, int ms);
+void *c4mpmc_pop_wait(struct c4mpmc *q, int ms);
+void c4mpmc_free(struct c4mpmc *q);
+
+int c4spsc_init(struct c4spsc *q, size_t n, size_t size, int flags);
+size_t c4spsc_push_n(struct c4spsc *q, const void *items, size_t n);
+size_t c4spsc_pop_n(struct c4spsc *q, void *items, size_t n);
+int c4spsc_push_wait(struct c4spsc *q, const void *item, int ms);
+int c4spsc_pop_wait(struct c4spsc *q, void *item, int ms);
+void c4spsc_free(struct c4spsc *q);
+
+/* One item in or out, -1 if the ring is full or empty
+ */
+static inline int
+c4spsc_push(struct c4spsc *q, const void *item) {
+	return c4spsc_push_n(q, item, 1) == 1 ? 0 : -1;
+}
+
+static inline int
+c4spsc_pop(struct c4spsc *q, void *item) {
+	return c4spsc_pop_n(q, item, 1) == 1 ? 0 : -1;
+}
+
+#endif
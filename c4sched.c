@@ -0,0 +1,247 @@
+/* Engine-time scheduler, see c4sched.h
+
+   To compile: gcc -c c4sched.c
+*/
+
+#include <string.h>
+#include <stdatomic.h>
+#include "c4sched.h"
+#include "c4search.h"
+#include "c4ntuple.h"
+#include "c4metrics.h"
+#include "c4trace.h"
+
+	/* each worker's scale, for analysis to go by; 0 if unused */
+static _Atomic int scales[C4SCHED_WORKERS];
+static atomic_int nscales;
+
+	/* every thread that searches has a table of its own */
+static _Thread_local struct c4tt_entry *tt;
+
+	/* searches this thread has run since it last sampled one */
+static _Thread_local int unsampled;
+
+void
+c4sched_init(struct c4sched *c, int id) {
+	int n;
+
+	memset(c, 0, sizeof(*c));
+	c->id = id < C4SCHED_WORKERS ? id : -1;
+	c->scale = C4SCHED_ONE;
+	c->t_window = c4m_now();
+	if (c->id >= 0) {
+		atomic_store(&scales[c->id], c->scale);
+		n = atomic_load(&nscales);
+		while (n <= c->id
+				&& !atomic_compare_exchange_weak(&nscales, &n,
+					c->id + 1)) {
+			;
+		}
+	}
+}
+
+/* Close the window if its time is up, and rescale by how it went
+ */
+static void
+roll(struct c4sched *c, uint64_t now) {
+	if (now - c->t_window < C4SCHED_WINDOW*1000000ull) {
+		return;
+	}
+	if (c->late * 100 > c->moves || c->busy * 100
+			> C4SCHED_WINDOW*1000000ull * C4SCHED_SHARE) {
+		/* over the objective at the 99th percentile, or over
+		 * the share of the CPU
+		 */
+		c->scale -= c->scale / 4;
+		if (c->scale < 1) {
+			c->scale = 1;
+		}
+	} else if (c->warm * 100 <= c->moves) {
+		/* well inside it, or idle */
+		c->scale += C4SCHED_ONE / 16;
+		if (c->scale > C4SCHED_ONE) {
+			c->scale = C4SCHED_ONE;
+		}
+	}
+	if (c->id >= 0) {
+		atomic_store_explicit(&scales[c->id], c->scale,
+			memory_order_relaxed);
+	}
+	c->t_window = now;
+	c->moves = c->late = c->warm = 0;
+	c->busy = 0;
+}
+
+/* The network's move if there is one, or else the one-ply move, for a
+ * reply not searched
+ */
+static int
+heuristic(struct c4sched *c, const struct c4bb *pos, c4_t board,
+		char colour) {
+	int move;
+	C4TRACE_BEGIN(t);
+	if (c->net != NULL) {
+		move = c4nt_move(c->net, pos, C4NT_DEPTH);
+	} else {
+		move = suggest_move(board, colour);
+	}
+	C4TRACE_END(t, "heuristic", move);
+	return move;
+}
+
+/* How long a move of this class may be searched for, in ns; 0 for not
+ * at all
+ */
+static uint64_t
+budget(struct c4sched *c, const struct c4conf *conf, int class,
+		uint64_t t_wake, uint64_t now) {
+	uint64_t b, slo = conf->slo_ms * 1000000ull;
+
+	if (slo == 0 || class == C4SCHED_ANALYSIS
+			|| (class == C4SCHED_CASUAL
+				&& c->scale < C4SCHED_ONE / 4)) {
+		return 0;
+	}
+	b = slo / 100 * (class == C4SCHED_RATED ? conf->rated : conf->casual)
+		* c->scale / C4SCHED_ONE;
+	/* keep half of what is left for whoever woke with us */
+	if (now - t_wake >= slo) {
+		return 0;
+	}
+	if (b > (slo - (now - t_wake)) / 2) {
+		b = (slo - (now - t_wake)) / 2;
+	}
+	return b < C4SCHED_MIN_US * 1000ull ? 0 : b;
+}
+
+#ifdef C4TRACE
+/* A depth of the search is done: trace it from the end of the last
+ */
+static void
+traced_depth(const struct c4search *s, void *arg) {
+	uint64_t *t = arg;
+	c4trace_span(0, "depth", *t, s->depth);
+	*t = c4trace_now();
+}
+#endif
+
+/* Choose colour's move in the position pos, also given as board, for
+ * whatever time the worker can spare it
+ */
+int
+c4sched_move(struct c4sched *c, const struct c4conf *conf, int class,
+		uint64_t t_wake, const struct c4bb *pos, c4_t board,
+		char colour) {
+	struct c4search s;
+	_Atomic uint64_t deadline;
+	uint64_t now = c4m_now(), b, t_depth = now;
+
+	roll(c, now);
+	b = budget(c, conf, class, t_wake, now);
+	if (b > 0 && tt == NULL) {
+		tt = c4search_tt();
+	}
+	if (b == 0 || tt == NULL) {
+		c4m_inc(C4M_SHED, 1);
+		return heuristic(c, pos, board, colour);
+	}
+
+	atomic_init(&deadline, now + b);
+	s.pos = *pos;
+	s.maxdepth = 0;
+	s.stop = NULL;
+	s.deadline = &deadline;
+	s.tt = tt;
+	s.report = NULL;
+	s.pool = NULL;
+	s.tb = c->tb;
+#ifdef C4TRACE
+	if (atomic_load_explicit(&c4trace_on, memory_order_relaxed)) {
+		s.report = traced_depth;
+	}
+#endif
+	s.arg = &t_depth;
+	c4search_run(&s);
+	C4TRACE_SINCE(now, "search", s.depth);
+	c->busy += c4m_now() - now;
+	c4sched_searched(&s, conf->stats);
+
+	/* too shallow to have seen the opponent's threats: the
+	 * heuristic at least blocks those
+	 */
+	if (s.best == 0 || (s.depth < 2 && !s.solved)) {
+		c4m_inc(C4M_SHED, 1);
+		return heuristic(c, pos, board, colour);
+	}
+	return s.best;
+}
+
+/* A reply has gone, latency ns after the worker woke for it
+ */
+void
+c4sched_done(struct c4sched *c, const struct c4conf *conf,
+		uint64_t latency) {
+	uint64_t slo = (conf->slo_ms > 0 ? conf->slo_ms : C4SCHED_SLO)
+		* 1000000ull;
+
+	roll(c, c4m_now());
+	c->moves++;
+	if (latency > slo) {
+		c->late++;
+	}
+	if (latency > slo / 2) {
+		c->warm++;
+	}
+}
+
+/* The time an analysis asking for ms may have, or 0 if the workers
+ * are too pressed for any
+ */
+long
+c4sched_analysis(const struct c4conf *conf, long ms) {
+	int i, n = atomic_load(&nscales), v, low = C4SCHED_ONE;
+
+	if (ms <= 0 || conf->slo_ms <= 0) {
+		return ms > 0 ? ms : 0;
+	}
+	for (i=0; i<n; i++) {
+		v = atomic_load_explicit(&scales[i], memory_order_relaxed);
+		if (v > 0 && v < low) {
+			low = v;
+		}
+	}
+	if (low < C4SCHED_ONE / 8) {
+		return 0;
+	}
+	ms = ms * low / C4SCHED_ONE;
+	return ms > 0 ? ms : 1;
+}
+
+/* Count a search just run into the metrics, and if it is the every'th
+ * on this thread record it in full
+ */
+void
+c4sched_searched(const struct c4search *s, int every) {
+	int d;
+
+	c4m_inc(C4M_SEARCHES, 1);
+	c4m_inc(C4M_NODES, s->nodes);
+	c4m_inc(C4M_TT_PROBES, s->tt_probes);
+	c4m_inc(C4M_TT_HITS, s->tt_hits);
+	c4m_inc(C4M_TB_HITS, s->tb_hits);
+	c4m_inc(C4M_CUTOFFS, s->cutoffs);
+	c4m_inc(C4M_FIRST_CUTOFFS, s->first_cutoffs);
+	if (every <= 0 || ++unsampled < every || s->depth == 0) {
+		return;
+	}
+	unsampled = 0;
+	c4m_inc(C4M_SAMPLED, 1);
+	c4m_record(C4M_SEARCH_NODES, s->nodes);
+	c4m_record(C4M_SEARCH_DEPTH, s->depth);
+	c4m_record(C4M_SEARCH_NPS, s->ns ? s->nodes * 1000000000 / s->ns
+		: 0);
+	c4m_record(C4M_SEARCH_EBF, c4search_ebf(s) * 100);
+	for (d=0; d<s->depth; d++) {
+		c4m_record(C4M_SEARCH_ITERATION, s->iter_ns[d]);
+	}
+}
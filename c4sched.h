@@ -0,0 +1,95 @@
+/* Engine-time scheduler
+
+   The server's replies are searched by c4search.c for as long as the
+   box can afford rather than to a fixed depth. Each worker holds a
+   scale, in 1/C4SCHED_ONE of the full budgets, and every
+   C4SCHED_WINDOW ms compares the moves it replied to in that time with
+   the latency objective (-L): if more than one in a hundred took longer
+   than the objective, or searching took more than C4SCHED_SHARE percent
+   of the window, the scale is cut by a quarter; if none came near the
+   objective it grows by a sixteenth, and otherwise it is left alone.
+   The share keeps a busy worker from taking the whole CPU from the
+   accept path and whatever else runs on the box.
+
+   A move's budget is its class's full budget times the scale, and
+   never more than what is left of the objective since the worker woke
+   for it. The objective and the full budgets, as percentages of it,
+   are settings (see c4conf.h): by default rated games get half the
+   objective, casual ones an eighth. Casual games stop being searched
+   once the scale falls below a quarter, rated ones only once their
+   budget is under C4SCHED_MIN_US. A move not searched is played by suggest_move, the
+   one-ply heuristic the server always used, or by the n-tuple network
+   of c4ntuple.h when the worker has one, in microseconds, and counted
+   as shed. With the network, "casual 0" in the settings plays every
+   casual game by it alone.
+
+   Analysis (c4analyze.c) runs on threads of its own, at a lower
+   priority; the time it is given is scaled by the lowest of the
+   workers' scales and it is refused outright when that is under an
+   eighth.
+
+   Every search, a reply's or an analysis, is counted into the metrics
+   by c4sched_searched: its nodes, table probes and beta cut-offs. One
+   in every "stats" of them (a setting, by default 16) a thread also
+   records in full, into histograms of nodes, depth, nodes a second,
+   effective branching factor and the time each depth took, which
+   costs a few stores a depth; "stats 0" turns that off.
+
+   To compile: gcc -c c4sched.c
+*/
+
+#ifndef C4SCHED_H
+#define C4SCHED_H
+
+#include <stdint.h>
+#include "c4game.h"
+#include "c4conf.h"
+
+	/* classes of engine work, most important first */
+#define C4SCHED_RATED		0
+#define C4SCHED_CASUAL		1
+#define C4SCHED_ANALYSIS	2
+
+	/* latency objective for a move when not set, in ms */
+#define C4SCHED_SLO		50
+
+	/* how often each worker rescales its budgets, in ms */
+#define C4SCHED_WINDOW		100
+
+	/* most of each window a worker may spend searching, in percent */
+#define C4SCHED_SHARE		50
+
+	/* scales are in 1/C4SCHED_ONE of the full budget */
+#define C4SCHED_ONE		1024
+
+	/* a search given less than this, in us, is not worth starting */
+#define C4SCHED_MIN_US		300
+
+	/* most workers whose scales analysis looks at */
+#define C4SCHED_WORKERS		256
+
+struct c4tb;
+struct c4nt;
+struct c4search;
+
+struct c4sched {
+	int id;			/* worker, or -1 to keep the scale private */
+	const struct c4tb *tb;	/* endgame tables to search with, or NULL */
+	const struct c4nt *net;	/* to play what is not searched, or NULL */
+	int scale;
+	uint64_t t_window;	/* when this window began, ns */
+	int moves;		/* replies in the window */
+	int late;		/* ... that took longer than the objective */
+	int warm;		/* ... or more than half of it */
+	uint64_t busy;		/* ns spent searching in the window */
+};
+
+void c4sched_init(struct c4sched *c, int id);
+int c4sched_move(struct c4sched *c, const struct c4conf *conf, int class,
+	uint64_t t_wake, const struct c4bb *pos, c4_t board, char colour);
+void c4sched_done(struct c4sched *c, const struct c4conf *conf,
+	uint64_t latency);
+long c4sched_analysis(const struct c4conf *conf, long ms);
+void c4sched_searched(const struct c4search *s, int every);
+
+#endif
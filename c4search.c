@@ -0,0 +1,434 @@
+/* Iterative-deepening alpha-beta search, see c4search.h
+
+   To compile: gcc -c c4search.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "c4search.h"
+#include "c4steal.h"
+
+#define SIZE		(WIDTH*HEIGHT)
+
+	/* beyond any score a position can have */
+#define INF		64
+
+	/* one move of a split node, searched as a task of its own */
+struct split {
+	struct c4task task;		/* first, to find the rest from */
+	struct c4search s;		/* the task's own counts and lines */
+	struct c4bb b;			/* after the move */
+	int depth, alpha, beta;		/* as the node would search it */
+	int v;				/* the move's score */
+};
+
+	/* the table c4search_thread_tt gives this thread */
+static _Thread_local struct c4tt_entry *thread_tt;
+
+static int negamax(struct c4search *s, const struct c4bb *b, int depth,
+	int alpha, int beta);
+
+uint64_t
+c4search_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+
+/* A transposition table for one searching thread at a time
+ */
+struct c4tt_entry *
+c4search_tt(void) {
+	return calloc(C4S_TTSIZE, sizeof(struct c4tt_entry));
+}
+
+/* The calling thread's own table, made on first use; NULL if it could
+ * not be
+ */
+struct c4tt_entry *
+c4search_thread_tt(void) {
+	if (thread_tt == NULL) {
+		thread_tt = c4search_tt();
+	}
+	return thread_tt;
+}
+
+void
+c4search_clear(struct c4tt_entry *tt) {
+	memset(tt, 0, C4S_TTSIZE * sizeof(*tt));
+}
+
+static int
+should_stop(struct c4search *s) {
+	uint64_t d;
+	if (s->stop != NULL && atomic_load_explicit(s->stop,
+			memory_order_relaxed)) {
+		return 1;
+	}
+	if (s->deadline != NULL) {
+		d = atomic_load_explicit(s->deadline, memory_order_relaxed);
+		return d != 0 && c4search_now() >= d;
+	}
+	return 0;
+}
+
+	/* the i-th column to try: from the centre outwards */
+static inline int
+column(int i) {
+	return WIDTH/2 + 1 + ((i & 1) ? -(i+1)/2 : i/2);
+}
+
+	/* would the side to move win by playing column c? */
+static inline int
+wins(const struct c4bb *b, int c) {
+	struct c4bb t = *b;
+	c4bb_play(&t, c);
+	return c4bb_won(&t);
+}
+
+static void
+split_run(struct c4task *t) {
+	struct split *sp = (struct split *)t;
+	struct c4search *s = &sp->s;
+	int ply = sp->b.nmoves - s->pos.nmoves;
+
+	s->nline[ply] = 0;
+	if (c4bb_won(&sp->b)) {
+		/* only at the root, which looks for wins itself */
+		sp->v = (SIZE + 2 - sp->b.nmoves) / 2;
+	} else if ((s->tt = c4search_thread_tt()) == NULL) {
+		s->aborted = 1;
+	} else {
+		sp->v = -negamax(s, &sp->b, sp->depth, -sp->beta, -sp->alpha);
+	}
+}
+
+/* Search the n moves of b on the pool, each to depth with the window
+ * alpha..beta b would search it with, and wait for them all; NULL if
+ * there was no memory, for the caller to search them itself
+ */
+static struct split *
+split(struct c4search *s, const struct c4bb *b, const int *move, int n,
+		int depth, int alpha, int beta) {
+	struct split *sp = malloc(n * sizeof(*sp));
+	int k;
+
+	if (sp == NULL) {
+		return NULL;
+	}
+	for (k=0; k<n; k++) {
+		sp[k].task.fn = split_run;
+		sp[k].task.detached = 0;
+		sp[k].b = *b;
+		c4bb_play(&sp[k].b, move[k]);
+		sp[k].depth = depth;
+		sp[k].alpha = alpha;
+		sp[k].beta = beta;
+		sp[k].v = 0;
+		sp[k].s.pos = s->pos;
+		sp[k].s.stop = s->stop;
+		sp[k].s.deadline = s->deadline;
+		sp[k].s.pool = s->pool;
+		sp[k].s.tb = s->tb;
+		sp[k].s.nodes = sp[k].s.tt_probes = sp[k].s.tt_hits = 0;
+		sp[k].s.tb_hits = 0;
+		sp[k].s.cutoffs = sp[k].s.first_cutoffs = 0;
+		sp[k].s.aborted = 0;
+		c4steal_spawn(s->pool, &sp[k].task);
+	}
+	for (k=0; k<n; k++) {
+		c4steal_join(s->pool, &sp[k].task);
+		s->nodes += sp[k].s.nodes;
+		s->tt_probes += sp[k].s.tt_probes;
+		s->tt_hits += sp[k].s.tt_hits;
+		s->tb_hits += sp[k].s.tb_hits;
+		s->cutoffs += sp[k].s.cutoffs;
+		s->first_cutoffs += sp[k].s.first_cutoffs;
+		if (sp[k].s.aborted) {
+			s->aborted = 1;
+		}
+	}
+	return sp;
+}
+
+static int
+negamax(struct c4search *s, const struct c4bb *b, int depth, int alpha,
+		int beta) {
+	struct c4tt_entry *e;
+	struct c4search *from;
+	struct c4bb child;
+	struct split *sp = NULL;
+	uint64_t key = b->cur + b->mask;
+	int ply = b->nmoves - s->pos.nmoves;
+	int move[WIDTH], n = 0;
+	int c, i, v, m = 0, best = -INF, bestmove = 0, hi, a0;
+
+	s->nline[ply] = 0;
+	if ((++s->nodes & (C4S_CHECK-1)) == 0 && should_stop(s)) {
+		s->aborted = 1;
+	}
+	if (s->aborted || c4bb_full(b)) {
+		return 0;
+	}
+	for (c=1; c<=WIDTH; c++) {
+		if (c4bb_can_play(b, c) && wins(b, c)) {
+			s->line[ply][0] = c;
+			s->nline[ply] = 1;
+			return (SIZE + 1 - b->nmoves) / 2;
+		}
+	}
+	if (s->tb != NULL && c4tb_probe(s->tb, b, &v) == 0) {
+		s->tb_hits++;
+		return v;
+	}
+	if (depth == 0) {
+		return 0;
+	}
+	/* nothing better than winning with our next stone but one */
+	hi = (SIZE - 1 - b->nmoves) / 2;
+	if (beta > hi) {
+		beta = hi;
+		if (alpha >= beta) {
+			return beta;
+		}
+	}
+
+	e = &s->tt[key & (C4S_TTSIZE-1)];
+	s->tt_probes++;
+	if (e->key == key) {
+		s->tt_hits++;
+		m = e->move;
+		if (e->depth >= depth) {
+			if (e->lower >= beta || e->lower == e->upper) {
+				return e->lower;
+			}
+			if (e->upper <= alpha) {
+				return e->upper;
+			}
+			if (e->lower > alpha) {
+				alpha = e->lower;
+			}
+			if (e->upper < beta) {
+				beta = e->upper;
+			}
+		}
+	}
+
+	/* the table's move first, then from the centre out */
+	for (i=-1; i<WIDTH; i++) {
+		c = i < 0 ? m : column(i);
+		if (c != 0 && (i < 0 || c != m) && c4bb_can_play(b, c)) {
+			move[n++] = c;
+		}
+	}
+	a0 = alpha;
+	for (i=0; i<n; i++) {
+		/* the eldest searched, its brothers may go in parallel */
+		if (i == 1 && s->pool != NULL && ply < C4S_SPLIT_PLY
+				&& depth-1 >= C4S_SPLIT_DEPTH) {
+			sp = split(s, b, move+1, n-1, depth-1, alpha, beta);
+		}
+		if (sp != NULL) {
+			v = sp[i-1].v;
+			from = &sp[i-1].s;
+		} else {
+			child = *b;
+			c4bb_play(&child, move[i]);
+			v = -negamax(s, &child, depth-1, -beta, -alpha);
+			from = s;
+		}
+		if (s->aborted) {
+			free(sp);
+			return 0;
+		}
+		if (v > best) {
+			best = v;
+			bestmove = move[i];
+			s->line[ply][0] = move[i];
+			memcpy(&s->line[ply][1], from->line[ply+1],
+				from->nline[ply+1] * sizeof(int));
+			s->nline[ply] = 1 + from->nline[ply+1];
+		}
+		if (v > alpha) {
+			alpha = v;
+		}
+		if (alpha >= beta) {
+			s->cutoffs++;
+			s->first_cutoffs += i == 0;
+			break;
+		}
+	}
+	free(sp);
+
+	/* fail low: an upper bound; fail high: a lower one; else exact */
+	e->key = key;
+	e->depth = depth;
+	e->move = bestmove;
+	e->lower = best > a0 ? best : -INF;
+	e->upper = best < beta ? best : INF;
+	return best;
+}
+
+/* Lengthen a principal variation cut short by a table hit with the
+ * table's own moves, for as far as they go
+ */
+static void
+principal(struct c4search *s, int depth) {
+	struct c4bb b = s->pos;
+	struct c4tt_entry *e;
+	uint64_t key;
+	int c, i;
+
+	for (i=0; i<s->npv; i++) {
+		c4bb_play(&b, s->pv[i]);
+	}
+	while (s->npv < depth && !c4bb_won(&b) && !c4bb_full(&b)) {
+		key = b.cur + b.mask;
+		e = &s->tt[key & (C4S_TTSIZE-1)];
+		c = e->key == key ? e->move : 0;
+		if (c == 0 || !c4bb_can_play(&b, c)) {
+			break;
+		}
+		s->pv[s->npv++] = c;
+		c4bb_play(&b, c);
+	}
+}
+
+/* Search s->pos one ply deeper at a time, reporting after each;
+ * returns the best column of the deepest search completed, or 0 if the
+ * game is already over or not even one ply could be searched
+ */
+int
+c4search_run(struct c4search *s) {
+	struct c4search *from;
+	struct c4bb child;
+	struct split *sp;
+	int score[WIDTH], pv[SIZE], move[WIDTH];
+	int c, i, d, v, n, best, npv = 0, maxd = SIZE - s->pos.nmoves;
+	uint64_t t_iter, n_iter;
+
+	if (s->maxdepth > 0 && s->maxdepth < maxd) {
+		maxd = s->maxdepth;
+	}
+	s->t_start = c4search_now();
+	s->depth = s->best = s->npv = s->solved = s->aborted = 0;
+	s->nodes = s->tt_probes = s->tt_hits = s->tb_hits = 0;
+	s->cutoffs = s->first_cutoffs = s->ns = 0;
+	for (c=0; c<WIDTH; c++) {
+		s->score[c] = C4S_NONE;
+	}
+	if ((s->pos.nmoves > 0 && c4bb_won(&s->pos)) || c4bb_full(&s->pos)) {
+		return 0;
+	}
+	for (i=n=0; i<WIDTH; i++) {
+		if (c4bb_can_play(&s->pos, column(i))) {
+			move[n++] = column(i);
+		}
+	}
+
+	for (d=1; d<=maxd && !s->aborted; d++) {
+		best = 0;
+		t_iter = c4search_now();
+		n_iter = s->nodes;
+		for (c=1; c<=WIDTH; c++) {
+			score[c-1] = C4S_NONE;
+		}
+		/* every column on a full window, for its own score; ties
+		 * go to the one nearest the centre. With a pool they are
+		 * all searched at once, none needing another's window
+		 */
+		sp = NULL;
+		if (s->pool != NULL && d-1 >= C4S_SPLIT_DEPTH) {
+			sp = split(s, &s->pos, move, n, d-1, -INF, INF);
+		}
+		for (i=0; i<n && !s->aborted; i++) {
+			c = move[i];
+			from = sp != NULL ? &sp[i].s : s;
+			if (sp != NULL) {
+				v = sp[i].v;
+			} else {
+				child = s->pos;
+				c4bb_play(&child, c);
+				s->nline[1] = 0;
+				if (c4bb_won(&child)) {
+					v = (SIZE + 1 - s->pos.nmoves) / 2;
+				} else {
+					v = -negamax(s, &child, d-1, -INF, INF);
+				}
+			}
+			if (s->aborted) {
+				break;
+			}
+			score[c-1] = v;
+			if (best == 0 || v > score[best-1]) {
+				best = c;
+				pv[0] = c;
+				memcpy(&pv[1], from->line[1],
+					from->nline[1] * sizeof(int));
+				npv = 1 + from->nline[1];
+			}
+		}
+		free(sp);
+		if (s->aborted) {
+			break;
+		}
+		s->iter_ns[d-1] = c4search_now() - t_iter;
+		s->iter_nodes[d-1] = s->nodes - n_iter;
+		memcpy(s->score, score, sizeof(score));
+		memcpy(s->pv, pv, npv * sizeof(int));
+		s->npv = npv;
+		s->best = best;
+		s->depth = d;
+		s->solved = score[best-1] != 0 || d == SIZE - s->pos.nmoves;
+		principal(s, d);
+		if (s->report != NULL) {
+			s->report(s, s->arg);
+		}
+		if (s->solved) {
+			break;
+		}
+	}
+	s->ns = c4search_now() - s->t_start;
+	return s->best;
+}
+
+/* Nodes of the deepest iteration over those of the one before, 0 with
+ * fewer than two done
+ */
+double
+c4search_ebf(const struct c4search *s) {
+	if (s->depth < 2 || s->iter_nodes[s->depth-2] == 0) {
+		return 0;
+	}
+	return (double)s->iter_nodes[s->depth-1] / s->iter_nodes[s->depth-2];
+}
+
+/* The search just run as one line of JSON, as c4search.h describes;
+ * returns its length
+ */
+int
+c4search_stats(const struct c4search *s, char *buf, int len) {
+	int d, n;
+
+	n = snprintf(buf, len, "{\"depth\": %d, \"solved\": %d, "
+		"\"nodes\": %llu, \"us\": %llu, \"nodes_per_second\": %.0f, "
+		"\"ebf\": %.2f, \"tt_probes\": %llu, \"tt_hits\": %llu, "
+		"\"cutoffs\": %llu, \"first_cutoff_rate\": %.3f, "
+		"\"iteration_us\": [", s->depth, s->solved,
+		(unsigned long long)s->nodes, (unsigned long long)s->ns / 1000,
+		s->ns ? s->nodes * 1e9 / s->ns : 0, c4search_ebf(s),
+		(unsigned long long)s->tt_probes,
+		(unsigned long long)s->tt_hits,
+		(unsigned long long)s->cutoffs,
+		s->cutoffs ? (double)s->first_cutoffs / s->cutoffs : 0);
+	for (d=0; d<s->depth && n<len; d++) {
+		n += snprintf(buf+n, len-n, "%s%llu", d ? ", " : "",
+			(unsigned long long)s->iter_ns[d] / 1000);
+	}
+	if (n < len) {
+		n += snprintf(buf+n, len-n, "]}\n");
+	}
+	return n < len ? n : len-1;
+}
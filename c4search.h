@@ -0,0 +1,121 @@
+/* Iterative-deepening alpha-beta search of connect-4 positions
+
+   Negamax over the bitboards of c4game.h, one ply deeper each
+   iteration, with a transposition table carried from one iteration to
+   the next for move ordering and cut-offs. After every depth completed
+   the caller's report function is given the score of each column, the
+   best move, the principal variation, nodes searched and time taken,
+   so that an answer is available as early as it is wanted. The search
+   stops at the depth limit, when the position is solved, when *stop is
+   set or when the monotonic clock passes *deadline; both may be changed
+   from another thread while it runs.
+
+   Scores are for the side to move: 0 for a draw or a position not
+   decided within the depth searched, otherwise positive for a win and
+   negative for a loss, larger the sooner it comes: winning with a stone
+   played onto a board of k stones scores (WIDTH*HEIGHT+1-k)/2. A score
+   other than 0 is therefore proven, and the search stops there.
+
+   Given a c4steal pool, the search splits near the root in the Young
+   Brothers Wait style: a node searches its first move itself, then
+   spawns its other moves as tasks on the pool with the window that
+   left, and joins them. At the root every column is searched on a full
+   window anyway, so there they are all spawned. A task searches with
+   the transposition table of the thread that runs it, so tables are
+   never shared; the pool's workers should search with theirs too, from
+   c4search_thread_tt.
+
+   Given endgame tables (c4tb.h), every node that might be in them is
+   looked up there first, and one that is scores what the table says,
+   searched no further.
+
+   Besides nodes and table probes a search counts its beta cut-offs,
+   and of those the ones the first move tried made, which shows how
+   well moves are ordered; and the time and nodes each depth took.
+   c4search_stats writes all that up as one line of JSON, with nodes a
+   second and the effective branching factor: the nodes of the last
+   depth over the nodes of the one before. The counting costs an add
+   here and there, so it is always on.
+
+   To compile: gcc -c c4search.c
+*/
+
+#ifndef C4SEARCH_H
+#define C4SEARCH_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "c4game.h"
+#include "c4tb.h"
+
+	/* score of a column that cannot be played */
+#define C4S_NONE	(-1000)
+
+	/* entries in a transposition table, a power of two */
+#define C4S_TTSIZE	(1 << 20)
+
+	/* nodes searched between looks at stop and the deadline */
+#define C4S_CHECK	1024
+
+	/* nodes nearer the root than this are split, see above, */
+#define C4S_SPLIT_PLY	2
+
+	/* and only with this many plies still to search below them */
+#define C4S_SPLIT_DEPTH	8
+
+struct c4steal;
+
+struct c4tt_entry {
+	uint64_t key;		/* cur + mask, unique to the position */
+	int8_t lower, upper;	/* bounds on its score */
+	uint8_t depth;		/* they hold to this depth */
+	uint8_t move;		/* best column found, or 0 */
+};
+
+struct c4search {
+	/* set by the caller */
+	struct c4bb pos;
+	int maxdepth;			/* 0 for as deep as the game goes */
+	_Atomic int *stop;		/* may be NULL */
+	_Atomic uint64_t *deadline;	/* CLOCK_MONOTONIC ns, 0 none */
+	struct c4tt_entry *tt;		/* C4S_TTSIZE entries */
+	void (*report)(const struct c4search *s, void *arg);
+	void *arg;
+	struct c4steal *pool;		/* to split on, may be NULL */
+	const struct c4tb *tb;		/* endgame tables, may be NULL */
+
+	/* results of the deepest iteration completed */
+	int depth;
+	int score[WIDTH];		/* by column, C4S_NONE if full */
+	int best;			/* column, 1..WIDTH */
+	int pv[WIDTH*HEIGHT];
+	int npv;
+	int solved;			/* score is exact, not a horizon */
+
+	/* counts so far, all iterations */
+	uint64_t nodes;
+	uint64_t tt_probes, tt_hits;
+	uint64_t tb_hits;
+	uint64_t cutoffs;		/* beta cut-offs, */
+	uint64_t first_cutoffs;		/* ... of them by the first move */
+	uint64_t iter_ns[WIDTH*HEIGHT];	/* each depth completed took, */
+	uint64_t iter_nodes[WIDTH*HEIGHT];	/* ... and searched */
+	uint64_t t_start;		/* ns */
+	uint64_t ns;			/* the whole search took */
+
+	int aborted;
+
+	/* the best line found below each ply of the current search */
+	int line[WIDTH*HEIGHT+1][WIDTH*HEIGHT];
+	int nline[WIDTH*HEIGHT+1];
+};
+
+struct c4tt_entry *c4search_tt(void);
+struct c4tt_entry *c4search_thread_tt(void);
+void c4search_clear(struct c4tt_entry *tt);
+int c4search_run(struct c4search *s);
+uint64_t c4search_now(void);
+double c4search_ebf(const struct c4search *s);
+int c4search_stats(const struct c4search *s, char *buf, int len);
+
+#endif
@@ -0,0 +1,223 @@
+/* Sessions and workers shared by the parts of server1
+
+   server1.c owns the workers' event loops, the bot and relay games and
+   the lobby; c4watch.c streams games to spectators; c4snap.c keeps
+   the games that can be resumed after a restart; c4epoll.c and
+   c4uring.c are the two ways a worker can do its I/O, c4shmio.c
+   serves clients that have moved to shared memory and c4analyze.c runs
+   searches for analysis clients.
+*/
+
+#ifndef C4SERVER_H
+#define C4SERVER_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "c4game.h"
+#include "c4journal.h"
+#include "c4ring.h"
+#include "c4buf.h"
+#include "c4snap.h"
+#include "c4shm.h"
+#include "c4sched.h"
+
+#define LEN 256
+
+	/* what a session is doing */
+#define MODE_NEW	0	/* connected, nothing read yet */
+#define MODE_BOT	1	/* playing against the server */
+#define MODE_RELAY	2	/* playing another client via the server */
+#define MODE_WATCH	3	/* watching someone else's game */
+#define MODE_PARKED	4	/* game waiting for its client to resume */
+#define MODE_ANALYZE	5	/* having positions searched */
+
+	/* buffers a spectator may have queued before it is resynced */
+#define WATCH_QUEUE	32
+
+struct worker;
+struct c4usend;
+struct c4ajob;
+
+	/* one connected client and the game it is playing */
+struct session {
+	int fd;
+	uint32_t ip;
+	int inlen;
+	int mode;
+	char colour;		/* the client's colour in a relayed game */
+	struct session *peer;	/* the opponent, or the game being watched */
+	uint64_t t_accept;	/* when accepted, 0 once the first move is in */
+	uint64_t t_start;	/* when the game began, for its duration */
+	struct session *next;	/* free list link */
+	uint32_t gen;		/* bumped for every game begun in this slot */
+	c4_t board;
+	struct c4bb bb;		/* a relayed game, kept by the Y session */
+	struct c4j_game game;
+
+	/* a game that can be resumed: its token and snapshot slot, and
+	 * when it was parked to wait for the client to come back
+	 */
+	uint64_t token;
+	struct c4snap_slot *snap;
+	uint64_t t_parked;
+
+	/* with SPEC, the server's answer to each column the client could
+	 * play next, as sent to it; 0 where there is none
+	 */
+	int specon;
+	signed char spec[WIDTH];
+
+	/* opened with RATED: its replies come before casual games' */
+	int rated;
+
+	/* an analysis client's search, running or finished */
+	struct c4ajob *job;
+
+	/* a game's spectators, and a spectator's place among them */
+	struct session *watchers;
+	struct session *wnext, *wprev;
+	int nwatchers;
+
+	/* a spectator's queue of shared buffers still to be sent */
+	int outhead, outcount, outoff, wantout;
+	struct c4buf *outq[WATCH_QUEUE];
+
+	/* what the io_uring backend has in hand for the session */
+	uint32_t ioseq;		/* bumped whenever it lets go of its socket */
+	int iopoll;		/* a poll for room to write is armed */
+	struct c4usend *iopend;	/* output waiting for the next submit */
+	struct c4usend *ioflight;	/* output the kernel is sending */
+	struct session *iodirty;	/* next session with output to submit */
+
+	char in[LEN];		/* bytes read but not yet a whole line */
+};
+
+	/* a client between workers: waiting in the lobby, or on its way
+	 * to the worker that owns the game it wants to watch or resume
+	 */
+struct seat {
+	int fd;
+	uint32_t ip;
+	int bucket;
+	uint64_t t_accept;
+	int index;		/* game to watch: slot in the worker's pool */
+	uint32_t gen;		/* ... and which game in that slot */
+	uint64_t token;		/* game to resume, or 0 to watch */
+};
+
+	/* How a worker waits for events and moves bytes: epoll in
+	 * c4epoll.c, io_uring in c4uring.c, or a shared-memory ring
+	 * for a lane of c4shmio.c. The backend calls back
+	 * with session_open for each new connection, session_data once
+	 * bytes have been put in a session's in[] (n <= 0 when the client
+	 * has gone), watch_inbox when the inbox eventfd fires and
+	 * watch_output when a spectator's socket has room again.
+	 */
+struct c4io {
+	const char *name;
+	int (*init)(struct worker *w);
+	int (*wait)(struct worker *w, int timeout);
+	int (*add)(struct worker *w, struct session *s);
+	void (*remove)(struct worker *w, struct session *s);
+	int (*send)(struct worker *w, struct session *s, const char *buf,
+		int len);
+	void (*close)(struct worker *w, struct session *s);
+	void (*want_output)(struct worker *w, struct session *s, int on);
+};
+
+extern const struct c4io c4io_epoll, c4io_uring, c4io_shm;
+
+	/* one shard: a listening socket, an event loop and its sessions;
+	 * a shared-memory lane is a worker of one session and id -1
+	 */
+struct worker {
+	int id;
+	int listenfd;
+	int unixfd;		/* the unix-domain listener, or -1 */
+	const struct c4io *io;
+	int epfd;
+	struct c4uring *uring;
+	struct c4shm *shm;
+	struct session *pool;
+	struct session *free;
+	pthread_t tid;
+
+	/* clients handed over by other workers, and the eventfd that
+	 * wakes this worker up to collect them
+	 */
+	struct c4mpmc inbox;
+	int evfd;
+
+	/* per slot: game generation, spectators and moves, published
+	 * for the admin socket's "games" list
+	 */
+	_Atomic uint64_t *live;
+
+	/* this worker's slots in the snapshot, and how many of its
+	 * sessions are parked waiting for their clients
+	 */
+	struct c4snap_slot *snap;
+	int parked;
+
+	/* how long ago the work in hand may have come in (see
+	 * worker_woke), and the engine time this worker can give each
+	 * reply
+	 */
+	uint64_t t_wake, t_woke, t_next;
+	struct c4sched sched;
+};
+
+extern struct worker *workers;
+extern int nworkers, nsessions;
+extern struct c4tb *endgame;		/* tables searched with, or NULL */
+
+	/* the backend has woken at now with work to do: if it had to
+	 * sleep for it, the first of it has only just come, and if not,
+	 * it came in while the last lot was being done and may be as old
+	 * as the last wake; more says this wake is leaving some ready
+	 * work behind, to be done first next time, which is then taken
+	 * to be a wake older
+	 */
+static inline void
+worker_woke(struct worker *w, int slept, uint64_t now, int more) {
+	w->t_wake = slept || w->t_next == 0 ? now : w->t_next;
+	w->t_next = more && w->t_woke != 0 ? w->t_woke : now;
+	w->t_woke = now;
+}
+
+	/* the session holding the game state a session takes part in */
+static inline struct session *
+game_of(struct session *s) {
+	return (s->mode == MODE_RELAY && s->colour != YELLOW) ? s->peer : s;
+}
+
+void session_open(struct worker *w, int fd, uint32_t ip);
+void session_data(struct worker *w, struct session *s, int n);
+struct session *session_get(struct worker *w);
+struct seat *session_detach(struct worker *w, struct session *s);
+void session_free(struct worker *w, struct session *s, int result);
+void session_resume(struct worker *w, struct seat *seat);
+void session_close(struct worker *w, struct session *s, int result);
+int session_send(struct worker *w, struct session *s, char *buffer);
+int seat_write(int fd, const char *buf, int len);
+int seat_send(int fd, const char *line);
+
+int shm_request(struct worker *w, struct session *s, char *name);
+
+int analyze_start(int n);
+int analyze_request(struct worker *w, struct session *s, char *arg);
+int analyze_line(struct worker *w, struct session *s, char *line, int len);
+void analyze_drop(struct session *s);
+int analyze_stats(char *out, int len);
+
+void watch_request(struct worker *w, struct session *s, char *arg);
+void watch_inbox(struct worker *w);
+void watch_move(struct worker *w, struct session *g, int move);
+void watch_end(struct worker *w, struct session *g, int result);
+void watch_output(struct worker *w, struct session *s);
+void watch_close(struct worker *w, struct session *s);
+void watch_publish(struct worker *w, struct session *g);
+int watch_games(const char *cmd, char *out, int len);
+
+#endif
@@ -0,0 +1,203 @@
+/* Shared-memory transport, see c4shm.h
+
+   To compile: gcc -c c4shm.c
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "c4shm.h"
+
+static long
+futex(_Atomic uint32_t *addr, int op, uint32_t val,
+		const struct timespec *ts) {
+	return syscall(SYS_futex, addr, op, val, ts, NULL, 0);
+}
+
+/* How long to spin before sleeping: not at all with one CPU, where
+ * the other side cannot run while we spin
+ */
+static int
+spin_limit(void) {
+	static int limit = -1;
+	if (limit < 0) {
+		limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? C4SHM_SPIN : 0;
+	}
+	return limit;
+}
+
+static inline void
+relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+/* Make a fresh segment for this process, and put its name in name
+ */
+struct c4shm *
+c4shm_create(char *name, int len) {
+	static int made;
+	struct c4shm *m;
+	int fd;
+
+	snprintf(name, len, "%s%d.%d", C4SHM_PREFIX, (int)getpid(), made++);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		return NULL;
+	}
+	if (ftruncate(fd, sizeof(*m)) < 0) {
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+	m = mmap(NULL, sizeof(*m), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) {
+		shm_unlink(name);
+		return NULL;
+	}
+	/* a new object is all zeroes: empty rings, nobody asleep */
+	m->magic = C4SHM_MAGIC;
+	return m;
+}
+
+/* Map a segment the client has made, once it is sure to be one
+ */
+struct c4shm *
+c4shm_attach(const char *name) {
+	struct c4shm *m;
+	struct stat st;
+	int fd;
+
+	if (strncmp(name, C4SHM_PREFIX, strlen(C4SHM_PREFIX)) != 0
+			|| strchr(name + 1, '/') != NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if ((fd = shm_open(name, O_RDWR, 0)) < 0) {
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size != sizeof(*m)) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	m = mmap(NULL, sizeof(*m), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (m == MAP_FAILED) {
+		return NULL;
+	}
+	if (m->magic != C4SHM_MAGIC || atomic_load(&m->closed)) {
+		munmap(m, sizeof(*m));
+		errno = EINVAL;
+		return NULL;
+	}
+	return m;
+}
+
+/* Let go of a segment, waking the other side if it is asleep on it
+ */
+void
+c4shm_close(struct c4shm *m) {
+	if (m == NULL) {
+		return;
+	}
+	atomic_store(&m->closed, 1);
+	futex(&m->up.tail, FUTEX_WAKE, 1, NULL);
+	futex(&m->down.tail, FUTEX_WAKE, 1, NULL);
+	munmap(m, sizeof(*m));
+}
+
+/* Put len bytes on the ring, all or none; -1 if there is no room or
+ * the other side has gone
+ */
+int
+c4shm_write(struct c4shm *m, struct c4shm_ring *r, const char *buf,
+		int len) {
+	uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+	uint32_t k = tail & (C4SHM_SIZE - 1);
+	int first;
+
+	if (atomic_load_explicit(&m->closed, memory_order_relaxed)
+			|| tail - head > C4SHM_SIZE
+			|| len > C4SHM_SIZE - (int)(tail - head)) {
+		return -1;
+	}
+	first = len < (int)(C4SHM_SIZE - k) ? len : (int)(C4SHM_SIZE - k);
+	memcpy(r->data + k, buf, first);
+	memcpy(r->data, buf + first, len - first);
+
+	/* seq_cst on both sides: either the reader sees this tail
+	 * before it sleeps, or we see that it is asleep
+	 */
+	atomic_store(&r->tail, tail + len);
+	if (atomic_load(&r->sleeping)) {
+		futex(&r->tail, FUTEX_WAKE, 1, NULL);
+	}
+	return 0;
+}
+
+/* Take up to len bytes from the ring, waiting up to timeout ms (-1
+ * for ever) for some to arrive; 0 once the other side has closed and
+ * the ring is empty, or has set a tail no ring could have, -1 on
+ * timing out
+ */
+int
+c4shm_read(struct c4shm *m, struct c4shm_ring *r, char *buf, int len,
+		int timeout) {
+	uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	uint32_t tail, k;
+	struct timespec ts;
+	int spin = spin_limit(), slept = 0, n, first;
+
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = (timeout % 1000) * 1000000L;
+	for (;;) {
+		tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+		if (tail != head) {
+			break;
+		}
+		if (atomic_load(&m->closed)) {
+			return 0;
+		}
+		if (spin > 0) {
+			spin--;
+			relax();
+			continue;
+		}
+		if (slept && timeout >= 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		atomic_store(&r->sleeping, 1);
+		if (atomic_load(&r->tail) == head && !atomic_load(&m->closed)) {
+			futex(&r->tail, FUTEX_WAIT, head,
+				timeout < 0 ? NULL : &ts);
+		}
+		atomic_store(&r->sleeping, 0);
+		slept = 1;
+	}
+
+	/* the other side writes tail, and may be broken or hostile */
+	if (tail - head > C4SHM_SIZE) {
+		atomic_store(&m->closed, 1);
+		return 0;
+	}
+	n = (int)(tail - head) < len ? (int)(tail - head) : len;
+	k = head & (C4SHM_SIZE - 1);
+	first = n < (int)(C4SHM_SIZE - k) ? n : (int)(C4SHM_SIZE - k);
+	memcpy(buf, r->data + k, first);
+	memcpy(buf + first, r->data, n - first);
+	atomic_store_explicit(&r->head, head + n, memory_order_release);
+	return n;
+}
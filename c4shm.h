@@ -0,0 +1,62 @@
+/* Shared-memory transport between a client and server1 on one machine
+
+   A segment made by the client with shm_open() holds two byte rings,
+   one each way, of the same lines the client would otherwise send over
+   its socket. Each ring has a single writer and a single reader, so a
+   line costs a copy and a release store of the tail; the reader spins
+   on the tail for a while and only then sleeps on it with a futex,
+   which the writer wakes only if the reader says it is asleep. A bot
+   that answers quickly therefore never enters the kernel at all.
+
+   The client names the segment to the server with "SHM <name>" on an
+   ordinary connection, TCP or unix-domain, which stays open beside
+   the rings so that either side can tell when the other has gone.
+
+   To compile: gcc -c c4shm.c
+*/
+
+#ifndef C4SHM_H
+#define C4SHM_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define C4SHM_MAGIC	0x4d485334	/* "4SHM" */
+
+	/* segment names must start with this, so that a client cannot
+	 * have the server map just any shared memory object
+	 */
+#define C4SHM_PREFIX	"/c4shm."
+
+	/* bytes in each ring, a power of two */
+#define C4SHM_SIZE	4096
+
+	/* how many times a reader looks at an empty ring before sleeping,
+	 * given a CPU to spare
+	 */
+#define C4SHM_SPIN	20000
+
+	/* one direction: written at tail, read from head */
+struct c4shm_ring {
+	_Alignas(64) _Atomic uint32_t tail;
+	_Atomic uint32_t sleeping;	/* the reader waits on tail */
+	_Alignas(64) _Atomic uint32_t head;
+	_Alignas(64) char data[C4SHM_SIZE];
+};
+
+struct c4shm {
+	uint32_t magic;
+	_Atomic uint32_t closed;	/* either side has let go */
+	struct c4shm_ring up;		/* client to server */
+	struct c4shm_ring down;		/* server to client */
+};
+
+struct c4shm *c4shm_create(char *name, int len);
+struct c4shm *c4shm_attach(const char *name);
+void c4shm_close(struct c4shm *m);
+int c4shm_write(struct c4shm *m, struct c4shm_ring *r, const char *buf,
+	int len);
+int c4shm_read(struct c4shm *m, struct c4shm_ring *r, char *buf, int len,
+	int timeout);
+
+#endif
@@ -0,0 +1,245 @@
+/* Shared-memory lanes for bots on the same machine as server1, see
+   c4shm.h
+
+   A client that opens with "SHM <name>" leaves its worker for a lane:
+   a thread that serves that one session alone, as a worker with a pool
+   of one whose I/O backend is the segment's pair of rings. The lane
+   spins on the ring between moves, so a bot that answers at once is
+   answered at once, with no system call on either side. Only games
+   against the server are played this way; lobby, spectator and resume
+   requests still go over a socket.
+
+   Lanes are started as they are first needed, up to SHM_LANES, and
+   then kept for the next client, so each keeps its one log ring and
+   metrics shard. When all are busy the client is told "NOSHM" and can
+   carry on over its socket.
+
+   To compile: gcc -c c4shmio.c -pthread
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "c4server.h"
+#include "c4metrics.h"
+#include "c4trace.h"
+
+	/* most shared-memory sessions at once */
+#define SHM_LANES	16
+
+	/* how often a quiet lane checks its client's socket, in ms */
+#define SHM_CHECK	1000
+
+struct lane {
+	pthread_t tid;
+	int started;
+	int busy;
+	pthread_cond_t go;
+	struct seat *seat;	/* the client to serve next */
+	struct c4shm *shm;
+	struct worker w;
+	struct session s;
+};
+
+static struct lane lanes[SHM_LANES];
+static pthread_mutex_t lanes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *lane_main(void *param);
+
+/* Move a client onto a lane, with the segment it has named; returns -1
+ * as the session is no longer this worker's, or 0 if it was told
+ * NOSHM and stays here to play over its socket
+ */
+int
+shm_request(struct worker *w, struct session *s, char *name) {
+	struct c4shm *m;
+	struct seat *seat;
+	struct lane *l = NULL;
+	int i, ok = 1;
+
+	pthread_mutex_lock(&lanes_lock);
+	for (i=0; i<SHM_LANES && l == NULL; i++) {
+		if (!lanes[i].busy) {
+			l = &lanes[i];
+			l->busy = 1;
+		}
+	}
+	pthread_mutex_unlock(&lanes_lock);
+
+	if (l == NULL || (m = c4shm_attach(name)) == NULL) {
+		if (l != NULL) {
+			pthread_mutex_lock(&lanes_lock);
+			l->busy = 0;
+			pthread_mutex_unlock(&lanes_lock);
+		}
+		/* the client carries on over its socket, as it was */
+		if (session_send(w, s, "NOSHM\n") < 0) {
+			session_free(w, s, -1);
+			return -1;
+		}
+		return 0;
+	}
+	if ((seat = session_detach(w, s)) == NULL) {
+		c4shm_close(m);
+		pthread_mutex_lock(&lanes_lock);
+		l->busy = 0;
+		pthread_mutex_unlock(&lanes_lock);
+		return -1;
+	}
+
+	pthread_mutex_lock(&lanes_lock);
+	l->seat = seat;
+	l->shm = m;
+	if (!l->started) {
+		pthread_cond_init(&l->go, NULL);
+		if (pthread_create(&l->tid, NULL, lane_main, l) == 0) {
+			pthread_detach(l->tid);
+			l->started = 1;
+		} else {
+			l->seat = NULL;
+			l->busy = 0;
+			ok = 0;
+		}
+	} else {
+		pthread_cond_signal(&l->go);
+	}
+	pthread_mutex_unlock(&lanes_lock);
+
+	if (!ok) {
+		perror("ERROR creating shm lane");
+		c4shm_close(m);
+		close(seat->fd);
+		c4m_inc(C4M_SESSIONS_CLOSED, 1);
+		free(seat);
+	}
+	return -1;
+}
+
+/* Play one client's game to the end, then let the lane go
+ */
+static void
+lane_serve(struct lane *l, struct seat *seat) {
+	struct worker *w = &l->w;
+	struct session *s = &l->s;
+
+	memset(w, 0, sizeof(*w));
+	w->id = -1;
+	w->listenfd = w->unixfd = w->epfd = w->evfd = -1;
+	w->io = &c4io_shm;
+	w->shm = l->shm;
+	w->pool = s;
+	c4sched_init(&w->sched, -1);
+
+	memset(s, 0, sizeof(*s));
+	s->fd = seat->fd;
+	s->ip = seat->ip;
+	s->mode = MODE_NEW;
+	s->t_accept = seat->t_accept;
+	free(seat);
+
+	/* the client waits for this before it turns to the rings */
+	if (seat_send(s->fd, "SHM OK\n") < 0) {
+		session_close(w, s, -1);
+	}
+	while (s->fd >= 0) {
+		w->io->wait(w, SHM_CHECK);
+	}
+	c4shm_close(l->shm);
+	l->shm = NULL;
+}
+
+static void *
+lane_main(void *param) {
+	struct lane *l = param;
+	struct seat *seat;
+	char name[32];
+
+	snprintf(name, sizeof(name), "shm%d", (int)(l - lanes));
+	c4m_attach(name);
+	C4TRACE_ATTACH(name);
+
+	pthread_mutex_lock(&lanes_lock);
+	for (;;) {
+		while (l->seat == NULL) {
+			pthread_cond_wait(&l->go, &lanes_lock);
+		}
+		seat = l->seat;
+		l->seat = NULL;
+		pthread_mutex_unlock(&lanes_lock);
+
+		lane_serve(l, seat);
+
+		pthread_mutex_lock(&lanes_lock);
+		l->busy = 0;
+	}
+	return NULL;
+}
+
+static int
+sh_init(struct worker *w) {
+	return 0;
+}
+
+/* Play whatever the client has put on the ring, waiting up to timeout
+ * ms for it; if nothing comes, check that the client's socket is still
+ * open, as a client that dies leaves the ring as it was
+ */
+static int
+sh_wait(struct worker *w, int timeout) {
+	struct session *s = w->pool;
+	char c;
+	int n;
+
+	n = c4shm_read(w->shm, &w->shm->up, s->in + s->inlen,
+		LEN - 1 - s->inlen, timeout);
+	if (n >= 0) {
+		w->t_wake = c4m_now();
+		session_data(w, s, n);
+		return 0;
+	}
+	n = recv(s->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK
+			&& errno != EINTR)) {
+		session_data(w, s, 0);
+	}
+	return 0;
+}
+
+static int
+sh_add(struct worker *w, struct session *s) {
+	return 0;
+}
+
+static void
+sh_remove(struct worker *w, struct session *s) {
+}
+
+static int
+sh_send(struct worker *w, struct session *s, const char *buf, int len) {
+	return c4shm_write(w->shm, &w->shm->down, buf, len);
+}
+
+static void
+sh_close(struct worker *w, struct session *s) {
+	close(s->fd);
+}
+
+static void
+sh_want_output(struct worker *w, struct session *s, int on) {
+}
+
+const struct c4io c4io_shm = {
+	"shm",
+	sh_init,
+	sh_wait,
+	sh_add,
+	sh_remove,
+	sh_send,
+	sh_close,
+	sh_want_output,
+};
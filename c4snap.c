@@ -0,0 +1,90 @@
+/* Crash-safe snapshot of live sessions, see c4snap.h
+
+   To compile: gcc -c c4snap.c
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include "c4snap.h"
+
+/* Map the snapshot file for nworkers pools of nsessions, creating it
+ * if need be. Slots left by a server of the same shape are kept, and
+ * adopted set; anything else found there is wiped
+ */
+struct c4snap *
+c4snap_open(const char *path, int nworkers, int nsessions) {
+	struct c4snap *s;
+	struct stat st;
+	size_t size = sizeof(struct c4snap_hdr)
+		+ (size_t)nworkers * nsessions * sizeof(struct c4snap_slot);
+	void *p;
+	int keep;
+
+	if ((s = calloc(1, sizeof(*s))) == NULL) {
+		return NULL;
+	}
+	if ((s->fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+		free(s);
+		return NULL;
+	}
+	keep = fstat(s->fd, &st) == 0 && (size_t)st.st_size == size;
+	if (!keep && (ftruncate(s->fd, 0) < 0
+			|| ftruncate(s->fd, size) < 0)) {
+		close(s->fd);
+		free(s);
+		return NULL;
+	}
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+	if (p == MAP_FAILED) {
+		close(s->fd);
+		free(s);
+		return NULL;
+	}
+	s->size = size;
+	s->hdr = p;
+	s->slot = (struct c4snap_slot *)(s->hdr + 1);
+
+	if (keep && s->hdr->magic == C4SNAP_MAGIC
+			&& s->hdr->version == C4SNAP_VERSION
+			&& s->hdr->nworkers == (uint32_t)nworkers
+			&& s->hdr->nsessions == (uint32_t)nsessions) {
+		s->adopted = 1;
+		return s;
+	}
+	if (keep) {
+		/* same size but not ours to resume: start afresh */
+		memset(p, 0, size);
+	}
+	s->hdr->magic = C4SNAP_MAGIC;
+	s->hdr->version = C4SNAP_VERSION;
+	s->hdr->nworkers = nworkers;
+	s->hdr->nsessions = nsessions;
+	return s;
+}
+
+void
+c4snap_close(struct c4snap *s) {
+	if (s == NULL) {
+		return;
+	}
+	munmap(s->hdr, s->size);
+	close(s->fd);
+	free(s);
+}
+
+/* A fresh token, never 0, that a client could not easily guess
+ */
+uint64_t
+c4snap_token(void) {
+	uint64_t t = 0;
+	if (getrandom(&t, sizeof(t), GRND_NONBLOCK) != sizeof(t)) {
+		t = ((uint64_t)rand() << 32) ^ rand();
+	}
+	return t ? t : 1;
+}
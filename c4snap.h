@@ -0,0 +1,113 @@
+/* Crash-safe snapshot of live sessions
+
+   A file of fixed-size slots, one per session in the server's pools,
+   mapped shared into memory. Each slot holds the token a client can
+   resume its game with and the moves so far, packed two to a byte as
+   in the journal. Workers update their slots in place on every move,
+   so the file is never more than a store behind and costs no system
+   calls; the kernel writes it back. If the server dies, even by
+   exit(), the next one to open the file with the same shape finds
+   every game that was in progress and can hand each back to the
+   client holding its token.
+
+   A slot is checksummed, so one half written when the machine went
+   down is dropped rather than resumed.
+
+   To compile: gcc -c c4snap.c
+*/
+
+#ifndef C4SNAP_H
+#define C4SNAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "c4journal.h"
+
+#define C4SNAP_MAGIC	0x53344330	/* "0C4S" */
+#define C4SNAP_VERSION	1
+
+	/* first bytes of the file: which pools the slots belong to */
+struct c4snap_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t nworkers;
+	uint32_t nsessions;
+	uint8_t pad[48];
+};
+
+	/* one session: token 0 means the slot is free */
+struct c4snap_slot {
+	uint64_t token;
+	uint32_t check;
+	uint8_t nmoves;
+	uint8_t pad[3];
+	uint8_t moves[24];
+};
+
+struct c4snap {
+	int fd;
+	size_t size;
+	struct c4snap_hdr *hdr;
+	struct c4snap_slot *slot;
+	int adopted;		/* slots were kept from an earlier run */
+};
+
+struct c4snap *c4snap_open(const char *path, int nworkers, int nsessions);
+void c4snap_close(struct c4snap *s);
+uint64_t c4snap_token(void);
+
+static inline uint32_t
+c4snap_sum(const struct c4snap_slot *p) {
+	uint32_t h = 2166136261u ^ (uint32_t)p->token
+		^ (uint32_t)(p->token >> 32);
+	int i;
+	h = (h ^ p->nmoves) * 16777619u;
+	for (i=0; i<(p->nmoves+1)/2; i++) {
+		h = (h ^ p->moves[i]) * 16777619u;
+	}
+	return h | 1;
+}
+
+static inline int
+c4snap_move(const struct c4snap_slot *p, int i) {
+	return (p->moves[i>>1] >> ((i&1)*4)) & 0xf;
+}
+
+	/* does the slot hold a game that can be resumed? */
+static inline int
+c4snap_valid(const struct c4snap_slot *p) {
+	return p->token != 0 && p->nmoves <= C4J_MAXMOVES
+		&& p->check == c4snap_sum(p);
+}
+
+	/* a resumable game begins in this slot */
+static inline void
+c4snap_claim(struct c4snap_slot *p, uint64_t token) {
+	p->nmoves = 0;
+	p->token = token;
+	p->check = c4snap_sum(p);
+}
+
+	/* column c has just been played in the slot's game */
+static inline void
+c4snap_play(struct c4snap_slot *p, int c) {
+	int i = p->nmoves;
+	if (i >= C4J_MAXMOVES) {
+		return;
+	}
+	if (i & 1) {
+		p->moves[i>>1] = (p->moves[i>>1] & 0x0f) | (c << 4);
+	} else {
+		p->moves[i>>1] = c;
+	}
+	p->nmoves = i + 1;
+	p->check = c4snap_sum(p);
+}
+
+static inline void
+c4snap_clear(struct c4snap_slot *p) {
+	p->token = 0;
+	p->check = 0;
+}
+
+#endif
@@ -0,0 +1,389 @@
+/* Work-stealing thread pool, see c4steal.h
+
+   The deque is the C11 one of Le, Pop, Cohen and Zappa Nardelli,
+   "Correct and Efficient Work-Stealing for Weak Memory Models" (2013),
+   bounded rather than grown.
+
+   To compile: gcc -c c4steal.c -pthread
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "c4steal.h"
+
+	/* longest an idle worker sleeps before looking again, in ms; a
+	 * wake is never missed, this only bounds a stop
+	 */
+#define NAP_MS		100
+
+	/* the worker this thread is, in the pool it belongs to */
+static _Thread_local struct c4steal_worker *self;
+
+static long
+futex(_Atomic uint32_t *addr, int op, uint32_t val,
+		const struct timespec *ts) {
+	return syscall(SYS_futex, addr, op, val, ts, NULL, 0);
+}
+
+static uint64_t
+now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+
+	/* add to a count that only this thread writes */
+static inline void
+bump(_Atomic uint64_t *p, uint64_t n) {
+	atomic_store_explicit(p, atomic_load_explicit(p,
+		memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/* Push t at the owner's end; -1 if the deque is full
+ */
+static int
+push(struct c4deque *d, struct c4task *t) {
+	int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+	int64_t top = atomic_load_explicit(&d->top, memory_order_acquire);
+
+	if (b - top >= C4STEAL_DEQUE) {
+		return -1;
+	}
+	atomic_store_explicit(&d->slot[b & (C4STEAL_DEQUE-1)], t,
+		memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&d->bottom, b+1, memory_order_relaxed);
+	return 0;
+}
+
+/* Pop the newest task at the owner's end, racing thieves only for the
+ * last one
+ */
+static struct c4task *
+pop(struct c4deque *d) {
+	int64_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+	int64_t top;
+	struct c4task *t = NULL;
+
+	atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	top = atomic_load_explicit(&d->top, memory_order_relaxed);
+	if (top <= b) {
+		t = atomic_load_explicit(&d->slot[b & (C4STEAL_DEQUE-1)],
+			memory_order_relaxed);
+		if (top == b) {
+			if (!atomic_compare_exchange_strong_explicit(&d->top,
+					&top, top+1, memory_order_seq_cst,
+					memory_order_relaxed)) {
+				t = NULL;
+			}
+			atomic_store_explicit(&d->bottom, b+1,
+				memory_order_relaxed);
+		}
+	} else {
+		atomic_store_explicit(&d->bottom, b+1, memory_order_relaxed);
+	}
+	return t;
+}
+
+/* Take the oldest task from someone else's deque; NULL if it is empty
+ * or another thief got there first
+ */
+static struct c4task *
+steal(struct c4deque *d) {
+	int64_t top = atomic_load_explicit(&d->top, memory_order_acquire);
+	int64_t b;
+	struct c4task *t;
+
+	atomic_thread_fence(memory_order_seq_cst);
+	b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+	if (top >= b) {
+		return NULL;
+	}
+	t = atomic_load_explicit(&d->slot[top & (C4STEAL_DEQUE-1)],
+		memory_order_relaxed);
+	if (!atomic_compare_exchange_strong_explicit(&d->top, &top, top+1,
+			memory_order_seq_cst, memory_order_relaxed)) {
+		return NULL;
+	}
+	return t;
+}
+
+static void
+run(struct c4steal_worker *w, struct c4task *t) {
+	int detached = t->detached;
+
+	if (w != NULL) {
+		bump(&w->tasks, 1);
+	}
+	t->fn(t);
+	if (!detached) {
+		atomic_store_explicit(&t->done, 1, memory_order_release);
+	}
+}
+
+/* Something is there to do: wake a sleeping worker to do it
+ */
+static void
+wake(struct c4steal *p) {
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&p->sleepers, memory_order_relaxed) > 0) {
+		atomic_fetch_add(&p->seq, 1);
+		futex(&p->seq, FUTEX_WAKE_PRIVATE, 1, NULL);
+	}
+}
+
+/* One round of stealing, from every other worker in turn starting at
+ * a random one; w is NULL for a thread outside the pool
+ */
+static struct c4task *
+steal_round(struct c4steal *p, struct c4steal_worker *w) {
+	struct c4task *t;
+	int i, k, start;
+
+	if (w != NULL) {
+		/* xorshift */
+		w->rng ^= w->rng << 13;
+		w->rng ^= w->rng >> 17;
+		w->rng ^= w->rng << 5;
+		start = w->rng % p->n;
+	} else {
+		start = 0;
+	}
+	for (i=0; i<p->n; i++) {
+		k = (start + i) % p->n;
+		if (&p->w[k] == w) {
+			continue;
+		}
+		if ((t = steal(&p->w[k].deque)) != NULL) {
+			if (w != NULL) {
+				bump(&w->steals, 1);
+			}
+			return t;
+		}
+		if (w != NULL) {
+			bump(&w->misses, 1);
+		}
+	}
+	return NULL;
+}
+
+/* Anything this worker could run: its own, stolen, or from outside
+ */
+static struct c4task *
+find(struct c4steal *p, struct c4steal_worker *w) {
+	struct c4task *t;
+
+	if ((t = pop(&w->deque)) == NULL
+			&& (t = steal_round(p, w)) == NULL) {
+		t = c4mpmc_pop(&p->inject);
+	}
+	return t;
+}
+
+static void *
+worker_main(void *param) {
+	struct c4steal_worker *w = param;
+	struct c4steal *p = w->pool;
+	struct timespec ts = { NAP_MS / 1000, (NAP_MS % 1000) * 1000000L };
+	struct c4task *t;
+	uint64_t idle;
+	uint32_t seen;
+	int spin;
+
+	self = w;
+	if (p->start != NULL) {
+		p->start(w->id);
+	}
+	while (!atomic_load(&p->stopping)) {
+		if ((t = find(p, w)) != NULL) {
+			run(w, t);
+			continue;
+		}
+		idle = now_ns();
+		for (spin=0; spin<C4STEAL_SPIN && t == NULL; spin++) {
+			sched_yield();
+			t = find(p, w);
+		}
+		while (t == NULL && !atomic_load(&p->stopping)) {
+			/* counted, then look once more: either we see what
+			 * was just pushed, or its pusher sees us counted
+			 */
+			seen = atomic_load(&p->seq);
+			atomic_fetch_add(&p->sleepers, 1);
+			atomic_thread_fence(memory_order_seq_cst);
+			if ((t = find(p, w)) == NULL) {
+				bump(&w->sleeps, 1);
+				futex(&p->seq, FUTEX_WAIT_PRIVATE, seen, &ts);
+			}
+			atomic_fetch_sub(&p->sleepers, 1);
+			if (t == NULL) {
+				t = find(p, w);
+			}
+		}
+		bump(&w->idle_ns, now_ns() - idle);
+		if (t != NULL) {
+			run(w, t);
+		}
+	}
+	return NULL;
+}
+
+/* Start a pool of n workers, each calling start with its number first
+ * if start is not NULL
+ */
+struct c4steal *
+c4steal_start(int n, void (*start)(int id)) {
+	struct c4steal *p;
+	int i;
+
+	if (n < 1 || n > C4STEAL_WORKERS
+			|| (p = calloc(1, sizeof(*p))) == NULL) {
+		return NULL;
+	}
+	if ((p->w = aligned_alloc(64, n * sizeof(*p->w))) == NULL
+			|| c4mpmc_init(&p->inject, C4STEAL_INJECT, 0) < 0) {
+		free(p->w);
+		free(p);
+		return NULL;
+	}
+	memset(p->w, 0, n * sizeof(*p->w));
+	p->start = start;
+	for (i=0; i<n; i++) {
+		p->w[i].pool = p;
+		p->w[i].id = i;
+		p->w[i].rng = 2654435761u * (i + 1);
+	}
+	/* the workers steal from all n as soon as they start */
+	p->n = n;
+	for (i=0; i<n; i++) {
+		if (pthread_create(&p->w[i].tid, NULL, worker_main, &p->w[i])) {
+			p->n = i;
+			c4steal_stop(p);
+			return NULL;
+		}
+	}
+	return p;
+}
+
+/* Hand the pool a task from outside it; -1 if too many are waiting
+ */
+int
+c4steal_submit(struct c4steal *p, struct c4task *t) {
+	atomic_store_explicit(&t->done, 0, memory_order_relaxed);
+	if (c4mpmc_push(&p->inject, t) < 0) {
+		return -1;
+	}
+	wake(p);
+	return 0;
+}
+
+/* Let t run alongside the caller, to be waited for with c4steal_join.
+ * Called from a task of p's it goes on that worker's deque; from
+ * anywhere else, or with the deque full, it runs here and now
+ */
+void
+c4steal_spawn(struct c4steal *p, struct c4task *t) {
+	struct c4steal_worker *w = self;
+
+	atomic_store_explicit(&t->done, 0, memory_order_relaxed);
+	if (w == NULL || w->pool != p || push(&w->deque, t) < 0) {
+		run(w != NULL && w->pool == p ? w : NULL, t);
+		return;
+	}
+	wake(p);
+}
+
+/* Wait for a spawned task to be done, running whatever else can be run
+ * meanwhile: the caller's own tasks first, then anyone else's. Tasks
+ * from outside the pool are left for idle workers, so that a search
+ * waiting on its columns is not held up behind another whole search
+ */
+void
+c4steal_join(struct c4steal *p, struct c4task *t) {
+	struct c4steal_worker *w = self;
+	struct c4task *x;
+	uint64_t idle = 0;
+
+	if (w != NULL && w->pool != p) {
+		w = NULL;
+	}
+	while (!atomic_load_explicit(&t->done, memory_order_acquire)) {
+		x = w != NULL ? pop(&w->deque) : NULL;
+		if (x == NULL) {
+			x = steal_round(p, w);
+		}
+		if (x != NULL) {
+			if (idle != 0 && w != NULL) {
+				bump(&w->idle_ns, now_ns() - idle);
+				idle = 0;
+			}
+			run(w, x);
+			continue;
+		}
+		/* t is being run by a thief that has nothing to spare */
+		if (idle == 0) {
+			idle = now_ns();
+		}
+		sched_yield();
+	}
+	if (idle != 0 && w != NULL) {
+		bump(&w->idle_ns, now_ns() - idle);
+	}
+}
+
+/* The calling thread's number in p, or -1 if it is not one of p's
+ */
+int
+c4steal_worker_id(struct c4steal *p) {
+	return self != NULL && self->pool == p ? self->id : -1;
+}
+
+/* One line per worker of what it has done, as c4metrics_format does
+ */
+int
+c4steal_format(struct c4steal *p, char *buf, int len) {
+	struct c4steal_worker *w;
+	int i, n = 0;
+
+	for (i=0; i<p->n && n<len; i++) {
+		w = &p->w[i];
+		n += snprintf(buf+n, len-n,
+			"c4_steal_tasks_total{worker=\"%d\"} %llu\n"
+			"c4_steal_steals_total{worker=\"%d\"} %llu\n"
+			"c4_steal_misses_total{worker=\"%d\"} %llu\n"
+			"c4_steal_idle_seconds{worker=\"%d\"} %.3f\n"
+			"c4_steal_sleeps_total{worker=\"%d\"} %llu\n",
+			i, (unsigned long long)atomic_load(&w->tasks),
+			i, (unsigned long long)atomic_load(&w->steals),
+			i, (unsigned long long)atomic_load(&w->misses),
+			i, atomic_load(&w->idle_ns) / 1e9,
+			i, (unsigned long long)atomic_load(&w->sleeps));
+	}
+	return n < len ? n : len;
+}
+
+/* Stop the workers once they have finished what they are running, and
+ * free the pool; tasks still queued are never run
+ */
+void
+c4steal_stop(struct c4steal *p) {
+	int i;
+
+	atomic_store(&p->stopping, 1);
+	atomic_fetch_add(&p->seq, 1);
+	futex(&p->seq, FUTEX_WAKE_PRIVATE, 0x7fffffff, NULL);
+	for (i=0; i<p->n; i++) {
+		pthread_join(p->w[i].tid, NULL);
+	}
+	c4mpmc_free(&p->inject);
+	free(p->w);
+	free(p);
+}
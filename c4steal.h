@@ -0,0 +1,95 @@
+/* Work-stealing thread pool
+
+   Each worker owns a Chase-Lev deque of tasks. It pushes and pops at
+   one end without taking a lock or, unless the deque is down to its
+   last task, doing any atomic read-modify-write; a worker with nothing
+   of its own to do steals from the other end of someone else's, with
+   one CAS. Tasks from outside the pool go into a shared c4mpmc that
+   idle workers take from after they have failed to steal.
+
+   A task spawned from inside a task goes onto the deque of the worker
+   running it, and c4steal_join waits for it by working: popping its
+   own deque and stealing from others until the task is done, so that
+   a worker is never left blocked while there are tasks to run. This
+   is what split-point search needs (see c4search.h): a node searches
+   its first move itself, spawns the rest and joins them.
+
+   Workers with nothing to do spin for a while, then sleep on a futex
+   until more work comes in. Each keeps counts of tasks run, steals
+   and failed steals, and the time it spent idle, for c4steal_format.
+
+   To compile: gcc -c c4steal.c -pthread
+*/
+
+#ifndef C4STEAL_H
+#define C4STEAL_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "c4ring.h"
+
+	/* tasks a worker's deque holds; a spawn into a full one runs the
+	 * task at once instead
+	 */
+#define C4STEAL_DEQUE	1024
+
+	/* tasks from outside the pool waiting for a worker */
+#define C4STEAL_INJECT	256
+
+	/* most workers in a pool */
+#define C4STEAL_WORKERS	64
+
+	/* rounds of stealing an idle worker tries before it sleeps */
+#define C4STEAL_SPIN	64
+
+struct c4task {
+	void (*fn)(struct c4task *t);
+	atomic_int done;		/* set once fn has returned */
+	int detached;			/* fn frees it, so done is never
+					 * set; 0 for a task to be joined
+					 */
+};
+
+struct c4deque {
+	_Alignas(64) _Atomic int64_t top;	/* stolen from */
+	_Alignas(64) _Atomic int64_t bottom;	/* the owner's end */
+	_Alignas(64) _Atomic(struct c4task *) slot[C4STEAL_DEQUE];
+};
+
+struct c4steal_worker {
+	struct c4deque deque;
+	struct c4steal *pool;
+	int id;
+	pthread_t tid;
+	uint32_t rng;			/* picks whom to steal from */
+
+	/* written only by the worker itself */
+	_Alignas(64) _Atomic uint64_t tasks;	/* run, all told */
+	_Atomic uint64_t steals;		/* of those, stolen */
+	_Atomic uint64_t misses;		/* steals that found nothing */
+	_Atomic uint64_t idle_ns;		/* with nothing to run */
+	_Atomic uint64_t sleeps;
+};
+
+struct c4steal {
+	int n;
+	struct c4steal_worker *w;
+	struct c4mpmc inject;
+	void (*start)(int id);
+	atomic_int stopping;
+
+	/* where idle workers sleep, as in c4ring.c */
+	_Alignas(64) _Atomic uint32_t seq;
+	atomic_int sleepers;
+};
+
+struct c4steal *c4steal_start(int n, void (*start)(int id));
+int c4steal_submit(struct c4steal *p, struct c4task *t);
+void c4steal_spawn(struct c4steal *p, struct c4task *t);
+void c4steal_join(struct c4steal *p, struct c4task *t);
+int c4steal_worker_id(struct c4steal *p);
+int c4steal_format(struct c4steal *p, char *buf, int len);
+void c4steal_stop(struct c4steal *p);
+
+#endif
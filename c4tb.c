@@ -0,0 +1,52 @@
+/* Endgame tables, see c4tb.h
+
+   To compile: gcc -c c4tb.c
+*/
+
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "c4tb.h"
+#include "c4map.h"
+
+/* Map the tables at path; NULL with errno set if they cannot be, or
+ * EINVAL if the file is not one
+ */
+struct c4tb *
+c4tb_open(const char *path) {
+	struct c4tb *tb;
+	const struct c4tb_hdr *h;
+	size_t size;
+	void *p;
+
+	if ((p = c4map_open(path, sizeof(*h), MADV_RANDOM, &size)) == NULL) {
+		return NULL;
+	}
+	/* a probe stops only at an empty slot, so there must be some */
+	h = p;
+	if (h->magic != C4TB_MAGIC || h->version != C4TB_VERSION
+			|| h->nslots == 0 || (h->nslots & (h->nslots - 1))
+			|| h->n > h->nslots / 2
+			|| h->off_slots % 8
+			|| !c4map_fits(size, h->off_slots, h->nslots, 8)
+			|| (tb = calloc(1, sizeof(*tb))) == NULL) {
+		munmap(p, size);
+		errno = EINVAL;
+		return NULL;
+	}
+	tb->map = p;
+	tb->size = size;
+	tb->hdr = h;
+	tb->slot = (const uint64_t *)((const char *)p + h->off_slots);
+	tb->mask = h->nslots - 1;
+	tb->minply = h->minply;
+	return tb;
+}
+
+void
+c4tb_close(struct c4tb *tb) {
+	if (tb != NULL) {
+		munmap(tb->map, tb->size);
+		free(tb);
+	}
+}
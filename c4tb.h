@@ -0,0 +1,86 @@
+/* Endgame tables, built offline by c4tbgen.c
+
+   Every position of at least some number of stones below a set of
+   root positions, solved backward from the end of the game: the score
+   of c4search.h, exact, for the side to move. Like c4db.h a board and
+   its mirror image are stored once, under the smaller of their keys.
+
+   The file is an open-addressed hash table of 64-bit slots, mapped
+   read-only and shared. A slot holds a key in its high bits and the
+   score plus C4TB_BIAS in its low C4TB_VALBITS, or is 0 if empty; no
+   key is 0, a position with stones in it having mask bits. The table
+   is at most half full, so that a probe, inline below for c4search.c
+   to make at every node that might be in it, looks at one or two
+   slots, from one cache line or two, whether it finds the position or
+   not.
+
+   To compile: gcc -c c4tb.c
+*/
+
+#ifndef C4TB_H
+#define C4TB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "c4game.h"
+#include "c4db.h"
+
+#define C4TB_MAGIC	0x42543443	/* "C4TB" */
+#define C4TB_VERSION	1
+
+	/* bits of a slot holding the score, and what is added to it */
+#define C4TB_VALBITS	8
+#define C4TB_BIAS	64
+
+struct c4tb_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t n;		/* positions */
+	uint32_t minply;	/* the fewest stones of any of them */
+	uint32_t nroots;
+	uint64_t nslots;	/* a power of two */
+	uint64_t off_slots;	/* in bytes from the start */
+	uint8_t pad[24];
+};
+
+struct c4tb {
+	void *map;
+	size_t size;
+	const struct c4tb_hdr *hdr;
+	const uint64_t *slot;
+	uint64_t mask;		/* nslots - 1 */
+	int minply;
+};
+
+struct c4tb *c4tb_open(const char *path);
+void c4tb_close(struct c4tb *tb);
+
+	/* the first slot a key is looked for in */
+static inline uint64_t
+c4tb_hash(uint64_t key, uint64_t mask) {
+	return (key * 0x9e3779b97f4a7c15ull >> 17) & mask;
+}
+
+	/* 0 with *score set if pos is in the table, else -1 */
+static inline int
+c4tb_probe(const struct c4tb *tb, const struct c4bb *pos, int *score) {
+	uint64_t key = c4db_key(pos), m, i, e;
+
+	if (pos->nmoves < tb->minply) {
+		return -1;
+	}
+	if ((m = c4db_mirror(key)) < key) {
+		key = m;
+	}
+	for (i = c4tb_hash(key, tb->mask); (e = tb->slot[i]) != 0;
+			i = (i + 1) & tb->mask) {
+		if (e >> C4TB_VALBITS == key) {
+			*score = (int)(e & ((1 << C4TB_VALBITS) - 1))
+				- C4TB_BIAS;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+#endif
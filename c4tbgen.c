@@ -0,0 +1,698 @@
+/* Build the endgame tables read by c4tb.c
+
+   Every position of at least -m stones (default 30) is far too many
+   to solve, so the tables cover those below a set of roots: positions
+   of exactly -m stones taken from the games in the file given with -g,
+   one game a line as the columns played (e.g. "4453..."), and -r more
+   (default 100) from random games, -s seeding them, that play any
+   move but one that wins. Each is kept once for itself and its mirror
+   image.
+
+   From the roots every position reachable in which the game is not
+   already over is found, a level of stones at a time. They are then
+   solved backward, from the last level to the roots: a position's
+   score is the best of its moves, a move that wins (winner_found, or
+   c4bb_won on the bitboards) scoring as in c4search.h, one that fills
+   the board (no move_possible after it) 0, and any other the negated
+   score of the position it leads to, already solved a level below.
+   Each level is split into partitions of PART positions that -j
+   threads (default one for each CPU online) take in turn.
+
+   Everything is checkpointed in the directory given with -w (default
+   "c4tb.work"): the roots, each level's positions once found, each
+   partition's scores once solved and each level's once they all are,
+   each written to a temporary file, synced and renamed into place.
+   Run again after being stopped, it carries on from what is there; the
+   roots come from the checkpoint then, not from -g and -r, so delete
+   the directory to start over.
+
+   The tables are written to the output as c4tb.h lays them out, every
+   root probed back from the file, mirrored too, and -v of the
+   positions (default 20) picked at random searched again by
+   c4search.c to check the scores. Progress goes to standard error;
+   at the end one JSON object is printed on standard output.
+
+   To compile: gcc -O2 c4tbgen.c c4tb.c c4map.c c4search.c c4steal.c
+   		c4ring.c c4game.c -o c4tbgen -pthread
+
+   To run: c4tbgen [-m stones] [-g games] [-r random-roots] [-s seed]
+   		[-j threads] [-w work-dir] [-v checks] output
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "c4game.h"
+#include "c4search.h"
+#include "c4db.h"
+#include "c4tb.h"
+#include "c4map.h"
+
+#define SIZE		(WIDTH*HEIGHT)
+
+	/* most threads solving */
+#define MAX_THREADS	256
+
+	/* positions in a partition of a level */
+#define PART		(1 << 16)
+
+	/* random games tried for each random root wanted */
+#define TRIES		1000
+
+struct level {
+	uint64_t *key;		/* sorted */
+	int8_t *score;		/* NULL until solved */
+	size_t n;
+};
+
+static struct level lv[SIZE+1];
+static int minply = 30, nthreads;
+static char *workdir = "c4tb.work";
+static atomic_size_t next_part, resumed;
+static int cur_level;
+
+static void usage(char *prog);
+
+static int
+by_key(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+	/* the smaller of a board's key and its mirror image's */
+static inline uint64_t
+canon(const struct c4bb *b) {
+	uint64_t key = c4db_key(b), m = c4db_mirror(key);
+	return m < key ? m : key;
+}
+
+/* The board with key: each column's bits are 2^h - 1 for a column h
+ * high, plus the side to move's stones in it
+ */
+static void
+decode(uint64_t key, struct c4bb *b) {
+	uint64_t v, col = ((uint64_t)1 << C4BB_H) - 1;
+	int c, h;
+
+	b->cur = b->mask = 0;
+	for (c=0; c<WIDTH; c++) {
+		v = key >> c*C4BB_H & col;
+		for (h=0; ((uint64_t)2 << h) - 1 <= v; h++) {
+		}
+		b->mask |= (((uint64_t)1 << h) - 1) << c*C4BB_H;
+		b->cur |= (v - (((uint64_t)1 << h) - 1)) << c*C4BB_H;
+	}
+	b->nmoves = __builtin_popcountll(b->mask);
+}
+
+/* Sort keys[0..n) and drop repeats; returns how many are left
+ */
+static size_t
+unique(uint64_t *keys, size_t n) {
+	size_t i, k = 0;
+
+	qsort(keys, n, sizeof(*keys), by_key);
+	for (i=0; i<n; i++) {
+		if (k == 0 || keys[i] != keys[k-1]) {
+			keys[k++] = keys[i];
+		}
+	}
+	return k;
+}
+
+static int
+append(uint64_t **keys, size_t *n, size_t *cap, uint64_t key) {
+	uint64_t *p;
+
+	if (*n == *cap) {
+		*cap = *cap ? *cap * 2 : 1024;
+		if ((p = realloc(*keys, *cap * sizeof(**keys))) == NULL) {
+			return -1;
+		}
+		*keys = p;
+	}
+	(*keys)[(*n)++] = key;
+	return 0;
+}
+
+	/* a file of the checkpoint */
+static void
+work_path(char *path, int len, const char *what, int level, long part) {
+	if (part < 0) {
+		snprintf(path, len, "%s/%s.%d", workdir, what, level);
+	} else {
+		snprintf(path, len, "%s/%s.%d.%ld", workdir, what, level, part);
+	}
+}
+
+/* Write len bytes to path by way of a temporary file, so that path is
+ * either all there or not at all
+ */
+static int
+save(const char *path, const void *data, size_t len) {
+	struct c4map_part part = { 0, data, len };
+
+	return c4map_save(path, &part, 1);
+}
+
+/* Read path into a new buffer; -1 if it is not there, or not want
+ * bytes long when want is not 0
+ */
+static int
+load(const char *path, void **data, size_t *len, size_t want) {
+	struct stat st;
+	FILE *f;
+
+	if (stat(path, &st) < 0
+			|| (want != 0 && (size_t)st.st_size != want)) {
+		return -1;
+	}
+	if ((f = fopen(path, "rb")) == NULL) {
+		return -1;
+	}
+	*len = st.st_size;
+	if ((*data = malloc(*len + 1)) == NULL
+			|| fread(*data, 1, *len, f) != *len) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+	return 0;
+}
+
+/* One root from a line of columns played, if the game gets to minply
+ * stones without ending
+ */
+static int
+game_root(const char *line, struct c4bb *b) {
+	int k, c;
+
+	c4bb_init(b);
+	for (k=0; k<minply; k++) {
+		c = line[k] - '0';
+		if (c < 1 || c > WIDTH || !c4bb_can_play(b, c)) {
+			return -1;
+		}
+		c4bb_play(b, c);
+		if (c4bb_won(b) || c4bb_full(b)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/* A root from a random game in which no move played wins, so that it
+ * lasts to minply stones unless a side has nothing else to play
+ */
+static int
+random_root(unsigned *seed, struct c4bb *b) {
+	struct c4bb t;
+	int move[WIDTH], n, c;
+
+	c4bb_init(b);
+	while (b->nmoves < minply) {
+		for (c=1, n=0; c<=WIDTH; c++) {
+			t = *b;
+			if (c4bb_can_play(b, c)) {
+				c4bb_play(&t, c);
+				if (!c4bb_won(&t) && !c4bb_full(&t)) {
+					move[n++] = c;
+				}
+			}
+		}
+		if (n == 0) {
+			return -1;
+		}
+		c4bb_play(b, move[rand_r(seed) % n]);
+	}
+	return 0;
+}
+
+/* The roots, from the checkpoint or else from games and random play
+ */
+static int
+roots(const char *games, int nrandom, unsigned seed) {
+	char path[512], line[256];
+	struct c4bb b;
+	size_t cap = 0, len;
+	void *data;
+	FILE *f;
+	long tries;
+
+	work_path(path, sizeof(path), "level", minply, -1);
+	if (load(path, &data, &len, 0) == 0) {
+		lv[minply].key = data;
+		lv[minply].n = len / sizeof(uint64_t);
+		fprintf(stderr, "resumed %zu roots\n", lv[minply].n);
+		return 0;
+	}
+	if (games != NULL) {
+		if ((f = fopen(games, "r")) == NULL) {
+			return -1;
+		}
+		while (fgets(line, sizeof(line), f) != NULL) {
+			if (game_root(line, &b) == 0 && append(&lv[minply].key,
+					&lv[minply].n, &cap, canon(&b)) < 0) {
+				fclose(f);
+				return -1;
+			}
+		}
+		fclose(f);
+	}
+	for (tries=0; nrandom > 0 && tries < (long)nrandom * TRIES;
+			tries++) {
+		if (random_root(&seed, &b) == 0) {
+			if (append(&lv[minply].key, &lv[minply].n, &cap,
+					canon(&b)) < 0) {
+				return -1;
+			}
+			nrandom--;
+		}
+	}
+	lv[minply].n = unique(lv[minply].key, lv[minply].n);
+	if (lv[minply].n == 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	fprintf(stderr, "%zu roots\n", lv[minply].n);
+	return save(path, lv[minply].key, lv[minply].n * sizeof(uint64_t));
+}
+
+struct slice {
+	const struct level *from;
+	size_t first, last;
+	uint64_t *keys;
+	size_t n, cap;
+	int err;
+};
+
+static void *
+children_main(void *param) {
+	struct slice *sl = param;
+	struct c4bb b, child;
+	size_t i;
+	int c;
+
+	for (i=sl->first; i<sl->last; i++) {
+		decode(sl->from->key[i], &b);
+		for (c=1; c<=WIDTH; c++) {
+			if (!c4bb_can_play(&b, c)) {
+				continue;
+			}
+			child = b;
+			c4bb_play(&child, c);
+			if (!c4bb_won(&child) && !c4bb_full(&child)
+					&& append(&sl->keys, &sl->n, &sl->cap,
+						canon(&child)) < 0) {
+				sl->err = 1;
+				return NULL;
+			}
+		}
+	}
+	return NULL;
+}
+
+/* Find level+1 from level: every position one move on in which the
+ * game goes on, each thread taking a slice of level
+ */
+static int
+children(int level) {
+	struct slice sl[MAX_THREADS];
+	pthread_t tid[MAX_THREADS];
+	struct level *to = &lv[level+1];
+	char path[512];
+	size_t len, n;
+	void *data;
+	int i;
+
+	work_path(path, sizeof(path), "level", level+1, -1);
+	if (load(path, &data, &len, 0) == 0) {
+		to->key = data;
+		to->n = len / sizeof(uint64_t);
+		return 0;
+	}
+	memset(sl, 0, sizeof(sl));
+	for (i=0; i<nthreads; i++) {
+		sl[i].from = &lv[level];
+		sl[i].first = lv[level].n * i / nthreads;
+		sl[i].last = lv[level].n * (i + 1) / nthreads;
+		if (pthread_create(&tid[i], NULL, children_main, &sl[i])) {
+			return -1;
+		}
+	}
+	for (i=0, n=0; i<nthreads; i++) {
+		pthread_join(tid[i], NULL);
+		if (sl[i].err) {
+			return -1;
+		}
+		n += sl[i].n;
+	}
+	to->n = 0;
+	if ((to->key = malloc((n + 1) * sizeof(uint64_t))) == NULL) {
+		return -1;
+	}
+	for (i=0; i<nthreads; i++) {
+		memcpy(to->key + to->n, sl[i].keys, sl[i].n * sizeof(uint64_t));
+		to->n += sl[i].n;
+		free(sl[i].keys);
+	}
+	to->n = unique(to->key, to->n);
+	return save(path, to->key, to->n * sizeof(uint64_t));
+}
+
+/* The score of b, its children's already known
+ */
+static int
+solve(const struct c4bb *b, const struct level *below) {
+	struct c4bb child;
+	uint64_t key, *k;
+	int c, v, best = -C4TB_BIAS;
+
+	for (c=1; c<=WIDTH; c++) {
+		if (!c4bb_can_play(b, c)) {
+			continue;
+		}
+		child = *b;
+		c4bb_play(&child, c);
+		if (c4bb_won(&child)) {
+			return (SIZE + 1 - b->nmoves) / 2;
+		}
+		if (c4bb_full(&child)) {
+			v = 0;
+		} else {
+			key = canon(&child);
+			k = bsearch(&key, below->key, below->n,
+				sizeof(*below->key), by_key);
+			/* not found cannot happen: children() put it there */
+			v = k != NULL ? -below->score[k - below->key] : 0;
+		}
+		if (v > best) {
+			best = v;
+		}
+	}
+	return best;
+}
+
+static void *
+solve_main(void *param) {
+	struct level *l = &lv[cur_level], *below = &lv[cur_level+1];
+	struct c4bb b;
+	char path[512];
+	size_t p, i, first, last, len;
+	void *data;
+
+	(void)param;
+	while ((p = atomic_fetch_add(&next_part, 1)) * PART < l->n) {
+		first = p * PART;
+		last = first + PART < l->n ? first + PART : l->n;
+		work_path(path, sizeof(path), "score", cur_level, p);
+		if (load(path, &data, &len, last - first) == 0) {
+			memcpy(l->score + first, data, len);
+			free(data);
+			atomic_fetch_add(&resumed, 1);
+			continue;
+		}
+		for (i=first; i<last; i++) {
+			decode(l->key[i], &b);
+			l->score[i] = solve(&b, below);
+		}
+		if (save(path, l->score + first, last - first) < 0) {
+			perror("ERROR writing checkpoint");
+			exit(1);
+		}
+	}
+	return NULL;
+}
+
+/* Solve level from the one below, a partition at a time on every
+ * thread, then checkpoint it whole and drop the partitions
+ */
+static int
+solve_level(int level) {
+	pthread_t tid[MAX_THREADS];
+	struct level *l = &lv[level];
+	char path[512];
+	size_t len, p;
+	void *data;
+	int i;
+
+	work_path(path, sizeof(path), "score", level, -1);
+	if (load(path, &data, &len, l->n) == 0) {
+		l->score = data;
+		return 0;
+	}
+	if ((l->score = malloc(l->n + 1)) == NULL) {
+		return -1;
+	}
+	cur_level = level;
+	atomic_store(&next_part, 0);
+	for (i=0; i<nthreads; i++) {
+		if (pthread_create(&tid[i], NULL, solve_main, NULL)) {
+			return -1;
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		pthread_join(tid[i], NULL);
+	}
+	if (save(path, l->score, l->n) < 0) {
+		return -1;
+	}
+	for (p=0; p*PART < l->n; p++) {
+		work_path(path, sizeof(path), "score", level, p);
+		unlink(path);
+	}
+	return 0;
+}
+
+/* Write every level, from the checkpoint, to path as c4tb.h lays it
+ * out; returns the bytes written or -1
+ */
+static long
+write_tb(const char *path, uint64_t n, int last) {
+	struct c4tb_hdr h;
+	struct level l;
+	char file[512];
+	uint64_t *slot, s;
+	size_t i, len;
+	struct c4map_part part[2];
+	void *data;
+	long size;
+	int level;
+
+	memset(&h, 0, sizeof(h));
+	h.magic = C4TB_MAGIC;
+	h.version = C4TB_VERSION;
+	h.n = n;
+	h.minply = minply;
+	h.nroots = lv[minply].n;
+	for (h.nslots=64; h.nslots < 2*n; h.nslots *= 2) {
+	}
+	h.off_slots = (sizeof(h) + 63) & ~(uint64_t)63;
+	size = h.off_slots + h.nslots * 8;
+	if ((slot = calloc(h.nslots, 8)) == NULL) {
+		return -1;
+	}
+	for (level=minply; level<=last; level++) {
+		work_path(file, sizeof(file), "level", level, -1);
+		if (load(file, &data, &len, 0) < 0) {
+			free(slot);
+			return -1;
+		}
+		l.key = data;
+		l.n = len / sizeof(uint64_t);
+		work_path(file, sizeof(file), "score", level, -1);
+		if (load(file, &data, &len, l.n) < 0) {
+			free(l.key);
+			free(slot);
+			return -1;
+		}
+		l.score = data;
+		for (i=0; i<l.n; i++) {
+			for (s = c4tb_hash(l.key[i], h.nslots - 1); slot[s];
+					s = (s + 1) & (h.nslots - 1)) {
+			}
+			slot[s] = l.key[i] << C4TB_VALBITS
+				| (uint64_t)(l.score[i] + C4TB_BIAS);
+		}
+		free(l.key);
+		free(l.score);
+	}
+
+	part[0] = (struct c4map_part){ 0, &h, sizeof(h) };
+	part[1] = (struct c4map_part){ h.off_slots, slot, h.nslots * 8 };
+	if (c4map_save(path, part, 2) < 0) {
+		size = -1;
+	}
+	free(slot);
+	return size;
+}
+
+/* Probe every root back, mirrored too, and search nsearch positions
+ * from the table again; the number that came back wrong
+ */
+static size_t
+verify(const char *path, int nsearch, unsigned seed) {
+	const struct level *roots = &lv[minply];
+	struct c4search s;
+	struct c4tb *tb;
+	struct c4bb b;
+	size_t i, bad = 0;
+	int v, w, k;
+
+	if ((tb = c4tb_open(path)) == NULL) {
+		perror("ERROR opening tables");
+		exit(1);
+	}
+	for (i=0; i<roots->n; i++) {
+		decode(roots->key[i], &b);
+		if (c4tb_probe(tb, &b, &v) < 0 || v != roots->score[i]) {
+			bad++;
+		}
+		b.cur = c4db_mirror(b.cur);
+		b.mask = c4db_mirror(b.mask);
+		if (c4tb_probe(tb, &b, &w) < 0 || w != roots->score[i]) {
+			bad++;
+		}
+	}
+
+	memset(&s, 0, sizeof(s));
+	if ((s.tt = c4search_thread_tt()) == NULL) {
+		perror("ERROR allocating transposition table");
+		exit(1);
+	}
+	for (k=0; k<nsearch; k++) {
+		/* any slot in use */
+		for (i=rand_r(&seed) & tb->mask; tb->slot[i] == 0;
+				i = (i + 1) & tb->mask) {
+		}
+		decode(tb->slot[i] >> C4TB_VALBITS, &s.pos);
+		c4search_clear(s.tt);
+		if (c4tb_probe(tb, &s.pos, &v) < 0 || c4search_run(&s) == 0
+				|| s.score[s.best-1] != v) {
+			bad++;
+		}
+	}
+	c4tb_close(tb);
+	return bad;
+}
+
+int
+main(int argc, char *argv[]) {
+	uint64_t start = c4search_now(), n = 0;
+	size_t bad, i, win = 0, loss = 0;
+	char *games = NULL;
+	unsigned seed = 1;
+	long size;
+	int opt, nrandom = 100, nsearch = 20, level, last;
+
+	while ((opt = getopt(argc, argv, "m:g:r:s:j:w:v:")) != -1) {
+		switch (opt) {
+		case 'm':
+			minply = atoi(optarg);
+			break;
+		case 'g':
+			games = optarg;
+			break;
+		case 'r':
+			nrandom = atoi(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			break;
+		case 'w':
+			workdir = optarg;
+			break;
+		case 'v':
+			nsearch = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nthreads == 0) {
+		/* one for each CPU, as many as may be asked for */
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (nthreads < 1) {
+			nthreads = 1;
+		} else if (nthreads > MAX_THREADS) {
+			nthreads = MAX_THREADS;
+		}
+	}
+	if (argc - optind != 1 || minply < 1 || minply >= SIZE
+			|| nrandom < 0 || nthreads < 1
+			|| nthreads > MAX_THREADS) {
+		usage(argv[0]);
+	}
+	if (mkdir(workdir, 0777) < 0 && errno != EEXIST) {
+		perror("ERROR making work directory");
+		exit(1);
+	}
+
+	if (roots(games, nrandom, seed) < 0) {
+		perror("ERROR finding roots");
+		exit(1);
+	}
+	for (level=minply; level<SIZE-1 && lv[level].n > 0; level++) {
+		if (children(level) < 0) {
+			perror("ERROR finding positions");
+			exit(1);
+		}
+		fprintf(stderr, "level %d: %zu positions\n", level+1,
+			lv[level+1].n);
+	}
+	last = lv[level].n > 0 ? level : level - 1;
+
+	/* a level is needed only until the one above it is solved */
+	for (level=last; level>=minply; level--) {
+		if (solve_level(level) < 0) {
+			perror("ERROR solving");
+			exit(1);
+		}
+		for (i=0; i<lv[level].n; i++) {
+			win += lv[level].score[i] > 0;
+			loss += lv[level].score[i] < 0;
+		}
+		n += lv[level].n;
+		fprintf(stderr, "solved level %d\n", level);
+		if (level < last) {
+			free(lv[level+1].key);
+			free(lv[level+1].score);
+			lv[level+1].n = 0;
+		}
+	}
+
+	if ((size = write_tb(argv[optind], n, last)) < 0) {
+		perror("ERROR writing tables");
+		exit(1);
+	}
+	if ((bad = verify(argv[optind], nsearch, seed)) != 0) {
+		fprintf(stderr, "ERROR %zu positions came back wrong\n", bad);
+		exit(1);
+	}
+
+	printf("{\"minply\": %d, \"roots\": %zu, \"positions\": %llu, "
+		"\"wins\": %zu, \"losses\": %zu, \"draws\": %llu, "
+		"\"partitions_resumed\": %zu, \"bytes\": %ld, "
+		"\"seconds\": %.1f}\n",
+		minply, lv[minply].n, (unsigned long long)n, win, loss,
+		(unsigned long long)(n - win - loss), atomic_load(&resumed),
+		size, (c4search_now() - start) / 1e9);
+	return 0;
+}
+
+static void
+usage(char *prog) {
+	fprintf(stderr, "usage: %s [-m stones] [-g games] [-r random-roots] "
+		"[-s seed] [-j threads] [-w work-dir] [-v checks] output\n",
+		prog);
+	exit(1);
+}
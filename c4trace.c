@@ -0,0 +1,256 @@
+/* Per-move trace spans, see c4trace.h
+
+   To compile: gcc -c c4trace.c -pthread
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "c4trace.h"
+
+	/* how long a closed window is left for spans already begun, ns */
+#define GRACE	10000000
+
+struct span {
+	const char *name;
+	uint64_t start;
+	uint64_t dur;
+	int32_t arg;
+	int32_t wait;		/* on the thread's waiting row */
+};
+
+struct tbuf {
+	char name[32];
+	uint32_t gen;		/* the window these spans are from */
+	_Atomic uint32_t n;
+	_Atomic uint32_t dropped;
+	struct span span[C4TRACE_SPANS];
+};
+
+_Atomic uint32_t c4trace_on;
+
+static struct tbuf *bufs[C4TRACE_THREADS];
+static atomic_int nbufs;
+static _Thread_local struct tbuf *mine;
+static _Thread_local char myname[32];
+static _Thread_local int failed;
+
+#ifdef C4TRACE
+static pthread_mutex_t window_lock = PTHREAD_MUTEX_INITIALIZER;
+static int open_window;		/* under window_lock */
+static uint32_t windows;
+#endif
+
+uint64_t
+c4trace_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+
+/* Name the calling thread's row in the trace
+ */
+void
+c4trace_attach(const char *name) {
+	snprintf(myname, sizeof(myname), "%s", name);
+	if (mine != NULL) {
+		memcpy(mine->name, myname, sizeof(myname));
+	}
+}
+
+/* The calling thread's buffer, made the first time it traces
+ */
+static struct tbuf *
+buffer(void) {
+	struct tbuf *b;
+	int i;
+
+	if (failed || atomic_load(&nbufs) >= C4TRACE_THREADS
+			|| (b = calloc(1, sizeof(*b))) == NULL) {
+		failed = 1;
+		return NULL;
+	}
+	i = atomic_fetch_add(&nbufs, 1);
+	if (i >= C4TRACE_THREADS) {
+		free(b);
+		failed = 1;
+		return NULL;
+	}
+	if (*myname) {
+		memcpy(b->name, myname, sizeof(myname));
+	} else {
+		snprintf(b->name, sizeof(b->name), "thread%d", i);
+	}
+	__atomic_store_n(&bufs[i], b, __ATOMIC_RELEASE);
+	return mine = b;
+}
+
+/* Record a span from start to now, as waiting or as work
+ */
+void
+c4trace_span(int wait, const char *name, uint64_t start, int arg) {
+	struct tbuf *b = mine;
+	struct span *s;
+	uint32_t gen, n;
+
+	gen = atomic_load_explicit(&c4trace_on, memory_order_acquire);
+	if (gen == 0 || (b == NULL && (b = buffer()) == NULL)) {
+		return;
+	}
+	if (b->gen != gen) {
+		/* the first span of a new window: forget the last one's */
+		atomic_store_explicit(&b->n, 0, memory_order_relaxed);
+		atomic_store_explicit(&b->dropped, 0, memory_order_relaxed);
+		b->gen = gen;
+	}
+	n = atomic_load_explicit(&b->n, memory_order_relaxed);
+	if (n >= C4TRACE_SPANS) {
+		atomic_store_explicit(&b->dropped, atomic_load_explicit(
+			&b->dropped, memory_order_relaxed) + 1,
+			memory_order_relaxed);
+		return;
+	}
+	s = &b->span[n];
+	s->name = name;
+	s->start = start;
+	s->dur = c4trace_now() - start;
+	s->arg = arg;
+	s->wait = wait;
+	atomic_store_explicit(&b->n, n + 1, memory_order_release);
+}
+
+#ifdef C4TRACE
+	/* a window being traced, by a thread of its own */
+struct window {
+	int ms;
+	uint32_t gen;
+	FILE *f;
+	char path[256];
+};
+
+/* Let the next window open
+ */
+static void
+close_window(void) {
+	pthread_mutex_lock(&window_lock);
+	open_window = 0;
+	pthread_mutex_unlock(&window_lock);
+}
+
+/* Record for the window's length, then write what every thread
+ * recorded; the outcome goes to standard error, the admin socket
+ * having been answered when the window opened
+ */
+static void *
+window_main(void *param) {
+	struct window *win = param;
+	struct timespec ts;
+	struct tbuf *b;
+	FILE *f = win->f;
+	uint64_t t0;
+	uint32_t gen = win->gen, n, k;
+	int i, nthreads = 0, spans = 0, dropped = 0, first = 1;
+
+	t0 = c4trace_now();
+	atomic_store(&c4trace_on, gen);
+	ts.tv_sec = win->ms / 1000;
+	ts.tv_nsec = (win->ms % 1000) * 1000000L;
+	nanosleep(&ts, NULL);
+	atomic_store(&c4trace_on, 0);
+	ts.tv_sec = 0;
+	ts.tv_nsec = GRACE;
+	nanosleep(&ts, NULL);
+
+	fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+	for (i=0; i<atomic_load(&nbufs) && i<C4TRACE_THREADS; i++) {
+		b = __atomic_load_n(&bufs[i], __ATOMIC_ACQUIRE);
+		if (b == NULL || b->gen != gen) {
+			continue;
+		}
+		n = atomic_load_explicit(&b->n, memory_order_acquire);
+		fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", "
+			"\"pid\": %d, \"tid\": %d, \"args\": {\"name\": "
+			"\"%s\"}},\n{\"name\": \"thread_name\", \"ph\": "
+			"\"M\", \"pid\": %d, \"tid\": %d, \"args\": "
+			"{\"name\": \"%s waiting\"}}", first ? "" : ",\n",
+			(int)getpid(), 2*i, b->name, (int)getpid(), 2*i + 1,
+			b->name);
+		first = 0;
+		for (k=0; k<n; k++) {
+			fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", "
+				"\"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, "
+				"\"tid\": %d, \"args\": {\"v\": %d}}",
+				b->span[k].name,
+				(int64_t)(b->span[k].start - t0) / 1000.0,
+				b->span[k].dur / 1000.0, (int)getpid(),
+				2*i + b->span[k].wait, b->span[k].arg);
+		}
+		nthreads++;
+		spans += n;
+		dropped += atomic_load(&b->dropped);
+	}
+	fprintf(f, "\n]}\n");
+	if (fclose(f) != 0) {
+		fprintf(stderr, "ERROR writing trace %s\n", win->path);
+	} else {
+		fprintf(stderr, "trace: wrote %d spans from %d threads to %s"
+			" (%d dropped)\n", spans, nthreads, win->path,
+			dropped);
+	}
+	free(win);
+	close_window();
+	return NULL;
+}
+#endif
+
+/* Trace every thread for ms and write what was recorded to path as
+ * Chrome trace JSON, on a thread of its own so that the admin socket
+ * is answered at once; the reply goes in out. One window at a time
+ */
+int
+c4trace_window(int ms, const char *path, char *out, int len) {
+#ifndef C4TRACE
+	return snprintf(out, len, "tracing is not built in "
+		"(build with -DC4TRACE)\n");
+#else
+	struct window *win;
+	pthread_t tid;
+	int busy;
+
+	if (ms <= 0 || ms > C4TRACE_MAX) {
+		return snprintf(out, len, "trace window must be 1 to %d ms\n",
+			C4TRACE_MAX);
+	}
+	pthread_mutex_lock(&window_lock);
+	busy = open_window;
+	open_window = 1;
+	pthread_mutex_unlock(&window_lock);
+	if (busy) {
+		return snprintf(out, len, "a trace is already running\n");
+	}
+	if ((win = calloc(1, sizeof(*win))) == NULL) {
+		close_window();
+		return snprintf(out, len, "out of memory\n");
+	}
+	win->ms = ms;
+	win->gen = ++windows;
+	snprintf(win->path, sizeof(win->path), "%s", path);
+	if ((win->f = fopen(path, "w")) == NULL) {
+		free(win);
+		close_window();
+		return snprintf(out, len, "cannot write %s\n", path);
+	}
+	if (pthread_create(&tid, NULL, window_main, win) != 0) {
+		fclose(win->f);
+		free(win);
+		close_window();
+		return snprintf(out, len, "cannot start tracing\n");
+	}
+	pthread_detach(tid);
+	return snprintf(out, len, "tracing for %d ms to %s\n", ms, path);
+#endif
+}
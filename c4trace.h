@@ -0,0 +1,86 @@
+/* Per-move trace spans, written out as Chrome trace JSON
+
+   Built with -DC4TRACE, the server can record what each thread spends
+   its time on: accepting, reading and parsing lines, waiting behind
+   other events, searching (one span per depth), drawing boards,
+   logging and sending. A span is the name of a static string, when it
+   began and how long it took, plus one number of context, and is kept
+   in a buffer of the recording thread's own, so nothing is shared on
+   the hot path. Tracing is off until c4trace_window turns it on for a
+   while, one window at a time, from a thread of its own so that the
+   caller is not held up for the window's length. That thread then
+   writes everything recorded in the window as a Chrome/Perfetto
+   "traceEvents" file, one row per thread for its work and one beside
+   it for the time events waited before it got to them (C4TRACE_WAIT),
+   which would otherwise overlap the work.
+
+   Built without C4TRACE the macros below are empty. Built with it but
+   not tracing, C4TRACE_BEGIN costs one load and one branch, and
+   C4TRACE_END one branch, both predicted not taken.
+
+   	C4TRACE_BEGIN(t);
+   	... the work ...
+   	C4TRACE_END(t, "send", s->fd);
+
+   To compile: gcc -c c4trace.c -pthread (add -DC4TRACE to everything
+   to build tracing in)
+*/
+
+#ifndef C4TRACE_H
+#define C4TRACE_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+	/* spans each thread can hold in one window */
+#define C4TRACE_SPANS	65536
+
+	/* most threads that may ever record spans */
+#define C4TRACE_THREADS	256
+
+	/* longest window, in ms */
+#define C4TRACE_MAX	60000
+
+	/* the current window's number while tracing, 0 when not */
+extern _Atomic uint32_t c4trace_on;
+
+void c4trace_attach(const char *name);
+void c4trace_span(int wait, const char *name, uint64_t start, int arg);
+uint64_t c4trace_now(void);
+int c4trace_window(int ms, const char *path, char *out, int len);
+
+#ifdef C4TRACE
+#define C4TRACE_BEGIN(t) \
+	uint64_t t = __builtin_expect(atomic_load_explicit(&c4trace_on, \
+		memory_order_relaxed) != 0, 0) ? c4trace_now() : 0
+#define C4TRACE_END(t, name, arg) \
+	do { \
+		if (__builtin_expect((t) != 0, 0)) { \
+			c4trace_span(0, (name), (t), (arg)); \
+		} \
+	} while (0)
+	/* working, or waiting, since t, a time taken anyway */
+#define C4TRACE_SINCE(t, name, arg) \
+	do { \
+		if (__builtin_expect(atomic_load_explicit(&c4trace_on, \
+				memory_order_relaxed) != 0, 0)) { \
+			c4trace_span(0, (name), (t), (arg)); \
+		} \
+	} while (0)
+#define C4TRACE_WAIT(t, name, arg) \
+	do { \
+		if (__builtin_expect(atomic_load_explicit(&c4trace_on, \
+				memory_order_relaxed) != 0, 0)) { \
+			c4trace_span(1, (name), (t), (arg)); \
+		} \
+	} while (0)
+#define C4TRACE_ATTACH(name)	c4trace_attach(name)
+#else
+#define C4TRACE_BEGIN(t)		do { } while (0)
+#define C4TRACE_END(t, name, arg)	do { } while (0)
+#define C4TRACE_SINCE(t, name, arg)	do { } while (0)
+#define C4TRACE_WAIT(t, name, arg)	do { } while (0)
+#define C4TRACE_ATTACH(name)		do { } while (0)
+#endif
+
+#endif
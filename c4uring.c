@@ -0,0 +1,678 @@
+/* io_uring I/O backend for server1's workers, see struct c4io in
+   c4server.h
+
+   Completion based, with the rings set up by hand from
+   <linux/io_uring.h> rather than through liburing. Each worker has
+   one ring, on which sit:
+
+   - a multishot accept on the listening socket, and on the
+     unix-domain one if there is one, so new connections arrive
+     without an accept call each;
+   - a multishot receive per client, filled from a ring of provided
+     buffers, so no read call is made and no buffer is tied up in a
+     quiet connection;
+   - a multishot poll on the inbox eventfd;
+   - sends, one per client per loop at most: replies made while
+     handling a batch of completions are gathered per session and
+     submitted together. A client that is being closed gets its last
+     send hard-linked to the close, so the reply goes out first.
+
+   The submissions and the wait for the next batch are one
+   io_uring_enter call per trip round the loop, however many moves
+   were played in it.
+
+   Sockets are left blocking: io_uring would answer a non-blocking one
+   with EAGAIN rather than waiting for it. Writes made outside the ring,
+   to spectators and to seats being handed over, use MSG_DONTWAIT.
+
+   To compile: gcc -c c4uring.c
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+#include "c4server.h"
+#include "c4metrics.h"
+#include "c4trace.h"
+
+	/* submission and completion queue sizes */
+#define SQ_ENTRIES	4096
+#define CQ_ENTRIES	16384
+
+	/* provided receive buffers: how many (a power of two) and how big */
+#define NBUFS		4096
+#define BUFSZ		512
+#define BGID		0
+
+	/* most output a session can have waiting to be sent */
+#define SEND_MAX	1024
+
+	/* what a completion is for, in the low three bits of user_data;
+	 * the rest is a session's index and ioseq, or for a send the
+	 * c4usend it came from
+	 */
+#define OP_ACCEPT	1
+#define OP_RECV		2
+#define OP_SEND		3
+#define OP_POLL		4
+#define OP_INBOX	5
+#define OP_IGNORE	6
+
+#define SEQ_MASK	0x1fffffffu
+#define UD(op, i, seq)	((uint64_t)(op) | (uint64_t)(i) << 3 \
+			| (uint64_t)((seq) & SEQ_MASK) << 35)
+#define UD_OP(ud)	((int)((ud) & 7))
+#define UD_INDEX(ud)	((int)(((ud) >> 3) & 0xffffffffu))
+#define UD_SEQ(ud)	((uint32_t)((ud) >> 35))
+
+	/* output for one session, gathered until the next submit */
+struct c4usend {
+	struct c4usend *next;	/* free list */
+	struct session *s;	/* NULL once the session has let go */
+	struct c4usend *then;	/* to send after this one, on closing */
+	int fd;
+	int closefd;		/* close this once sent, or -1 */
+	int len;
+	char data[SEND_MAX];
+};
+
+struct c4uring {
+	int fd;
+	unsigned sq_entries;
+	unsigned *sq_head, *sq_tail, *sq_mask;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned tail;		/* our copy of the submission tail */
+	unsigned unsubmitted;
+	int ext_arg;
+	struct __kernel_timespec timer;	/* without ext_arg, a wait's */
+
+	struct io_uring_buf_ring *br;
+	char *bufs;
+	unsigned short br_tail;
+
+	struct session *dirty;	/* sessions with output to submit */
+	struct c4usend *freesends;
+};
+
+static int
+enter(int fd, unsigned submit, unsigned wait, unsigned flags, void *arg,
+		size_t argsz) {
+	return syscall(__NR_io_uring_enter, fd, submit, wait, flags, arg,
+		argsz);
+}
+
+/* Hand what has been queued to the kernel without waiting
+ */
+static void
+submit(struct c4uring *u) {
+	int n;
+	__atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE);
+	while (u->unsubmitted > 0) {
+		n = enter(u->fd, u->unsubmitted, 0, 0, NULL, 0);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EBUSY || errno == EAGAIN) {
+				/* completions need reaping first */
+				enter(u->fd, 0, 0, IORING_ENTER_GETEVENTS,
+					NULL, 0);
+				continue;
+			}
+			perror("ERROR on io_uring_enter");
+			return;
+		}
+		u->unsubmitted -= n;
+	}
+}
+
+/* Room for n more submissions, submitting what is queued if need be
+ */
+static void
+reserve(struct c4uring *u, unsigned n) {
+	unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	if (u->tail - head + n > u->sq_entries) {
+		submit(u);
+	}
+}
+
+static struct io_uring_sqe *
+get_sqe(struct c4uring *u, int op, int fd, uint64_t ud) {
+	struct io_uring_sqe *sqe;
+
+	reserve(u, 1);
+	sqe = &u->sqes[u->tail & *u->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->fd = fd;
+	sqe->user_data = ud;
+	u->tail++;
+	u->unsubmitted++;
+	return sqe;
+}
+
+/* Give a receive buffer back to the kernel
+ */
+static void
+put_buf(struct c4uring *u, int bid) {
+	struct io_uring_buf *b = &u->br->bufs[u->br_tail & (NBUFS-1)];
+	b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid*BUFSZ);
+	b->len = BUFSZ;
+	b->bid = bid;
+	u->br_tail++;
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+/* Accept on the TCP listener (local 0) or the unix-domain one (1)
+ */
+static void
+arm_accept(struct worker *w, int local) {
+	struct io_uring_sqe *sqe;
+	sqe = get_sqe(w->uring, IORING_OP_ACCEPT,
+		local ? w->unixfd : w->listenfd, UD(OP_ACCEPT, local, 0));
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+}
+
+static void
+arm_inbox(struct worker *w) {
+	struct io_uring_sqe *sqe;
+	sqe = get_sqe(w->uring, IORING_OP_POLL_ADD, w->evfd,
+		UD(OP_INBOX, 0, 0));
+	sqe->poll32_events = POLLIN;
+	sqe->len = IORING_POLL_ADD_MULTI;
+}
+
+static void
+arm_recv(struct worker *w, struct session *s) {
+	struct io_uring_sqe *sqe;
+	sqe = get_sqe(w->uring, IORING_OP_RECV, s->fd,
+		UD(OP_RECV, s - w->pool, s->ioseq));
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = BGID;
+}
+
+/* Queue a send, and the close it is linked to if it is the last one
+ */
+static void
+submit_send(struct c4uring *u, struct c4usend *q) {
+	struct io_uring_sqe *sqe;
+
+	reserve(u, 2);
+	sqe = get_sqe(u, IORING_OP_SEND, q->fd,
+		(uint64_t)(uintptr_t)q | OP_SEND);
+	sqe->addr = (uint64_t)(uintptr_t)q->data;
+	sqe->len = q->len;
+	sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+	if (q->closefd >= 0) {
+		/* close even if the send fails */
+		sqe->flags = IOSQE_IO_HARDLINK;
+		get_sqe(u, IORING_OP_CLOSE, q->closefd, OP_IGNORE);
+		q->closefd = -1;
+	}
+}
+
+static struct c4usend *
+get_send(struct c4uring *u) {
+	struct c4usend *q = u->freesends;
+	if (q != NULL) {
+		u->freesends = q->next;
+	} else if ((q = malloc(sizeof(*q))) == NULL) {
+		return NULL;
+	}
+	q->s = NULL;
+	q->then = NULL;
+	q->closefd = -1;
+	q->len = 0;
+	return q;
+}
+
+static void
+put_send(struct c4uring *u, struct c4usend *q) {
+	q->next = u->freesends;
+	u->freesends = q;
+}
+
+	/* the dirty list ends with a session linked to itself */
+static void
+mark_dirty(struct c4uring *u, struct session *s) {
+	if (s->iodirty == NULL) {
+		s->iodirty = u->dirty ? u->dirty : s;
+		u->dirty = s;
+	}
+}
+
+/* Submit the output gathered for each session, one send apiece
+ */
+static void
+flush_sends(struct c4uring *u) {
+	struct session *s, *next;
+
+	for (s=u->dirty; s!=NULL; s=next) {
+		next = (s->iodirty == s) ? NULL : s->iodirty;
+		s->iodirty = NULL;
+		if (s->iopend != NULL && s->ioflight == NULL) {
+			/* one send in flight per socket keeps them in order */
+			s->ioflight = s->iopend;
+			s->iopend = NULL;
+			submit_send(u, s->ioflight);
+		}
+	}
+	u->dirty = NULL;
+}
+
+static int
+ur_init(struct worker *w) {
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	struct c4uring *u;
+	size_t sqsz, cqsz;
+	char *sq, *cq;
+	int i;
+
+	if ((u = calloc(1, sizeof(*u))) == NULL) {
+		perror("ERROR allocating io_uring");
+		return -1;
+	}
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+	p.cq_entries = CQ_ENTRIES;
+	u->fd = syscall(__NR_io_uring_setup, SQ_ENTRIES, &p);
+	if (u->fd < 0 && errno == EINVAL) {
+		/* an older kernel */
+		p.flags = IORING_SETUP_CQSIZE;
+		u->fd = syscall(__NR_io_uring_setup, SQ_ENTRIES, &p);
+	}
+	if (u->fd < 0) {
+		perror("ERROR creating io_uring");
+		return -1;
+	}
+	u->ext_arg = (p.features & IORING_FEAT_EXT_ARG) != 0;
+	u->sq_entries = p.sq_entries;
+
+	/* map the two queues and the submission entries */
+	sqsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cqsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		sqsz = cqsz = sqsz > cqsz ? sqsz : cqsz;
+	}
+	sq = mmap(NULL, sqsz, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED) {
+		perror("ERROR mapping io_uring");
+		return -1;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq = sq;
+	} else {
+		cq = mmap(NULL, cqsz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED) {
+			perror("ERROR mapping io_uring");
+			return -1;
+		}
+	}
+	u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+		IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) {
+		perror("ERROR mapping io_uring");
+		return -1;
+	}
+	u->sq_head = (unsigned *)(sq + p.sq_off.head);
+	u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	u->cq_head = (unsigned *)(cq + p.cq_off.head);
+	u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	/* entry i of the queue is always submission slot i */
+	for (i=0; i<(int)p.sq_entries; i++) {
+		((unsigned *)(sq + p.sq_off.array))[i] = i;
+	}
+	u->tail = *u->sq_tail;
+
+	/* the provided buffers receives are filled from */
+	u->br = mmap(NULL, NBUFS * sizeof(struct io_uring_buf),
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	u->bufs = malloc((size_t)NBUFS * BUFSZ);
+	if (u->br == MAP_FAILED || u->bufs == NULL) {
+		perror("ERROR allocating receive buffers");
+		return -1;
+	}
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+	reg.ring_entries = NBUFS;
+	reg.bgid = BGID;
+	if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING,
+			&reg, 1) < 0) {
+		perror("ERROR registering receive buffers");
+		return -1;
+	}
+	for (i=0; i<NBUFS; i++) {
+		put_buf(u, i);
+	}
+
+	w->uring = u;
+	arm_accept(w, 0);
+	if (w->unixfd >= 0) {
+		arm_accept(w, 1);
+	}
+	arm_inbox(w);
+	return 0;
+}
+
+/* Feed received bytes to the session a line buffer at a time, for as
+ * long as the session is still reading them
+ */
+static void
+feed(struct worker *w, struct session *s, const char *p, int n) {
+	uint32_t seq = s->ioseq;
+	int k;
+
+	while (n > 0 && s->ioseq == seq) {
+		k = LEN - 1 - s->inlen;
+		if (k > n) {
+			k = n;
+		}
+		memcpy(s->in + s->inlen, p, k);
+		session_data(w, s, k);
+		p += k;
+		n -= k;
+	}
+}
+
+static void
+complete(struct worker *w, struct io_uring_cqe *cqe) {
+	struct c4uring *u = w->uring;
+	struct session *s = NULL;
+	struct c4usend *q;
+	struct sockaddr_in addr;
+	socklen_t len;
+	uint64_t ud = cqe->user_data;
+	int more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+	int live = 0, bid;
+
+	if (UD_OP(ud) == OP_RECV || UD_OP(ud) == OP_POLL) {
+		s = &w->pool[UD_INDEX(ud)];
+		/* is this still the connection the request was made for? */
+		live = (s->ioseq & SEQ_MASK) == UD_SEQ(ud) && s->fd >= 0;
+	}
+
+	switch (UD_OP(ud)) {
+	case OP_ACCEPT:
+		if (cqe->res >= 0) {
+			len = sizeof(addr);
+			addr.sin_addr.s_addr = 0;
+			if (UD_INDEX(ud) == 0) {
+				getpeername(cqe->res, (struct sockaddr *)&addr,
+					&len);
+			}
+			session_open(w, cqe->res, addr.sin_addr.s_addr);
+		}
+		if (!more) {
+			arm_accept(w, UD_INDEX(ud));
+		}
+		break;
+
+	case OP_INBOX:
+		watch_inbox(w);
+		if (!more) {
+			arm_inbox(w);
+		}
+		break;
+
+	case OP_RECV:
+		if (cqe->flags & IORING_CQE_F_BUFFER) {
+			bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+			if (live && cqe->res > 0) {
+				feed(w, s, u->bufs + (size_t)bid*BUFSZ,
+					cqe->res);
+				live = (s->ioseq & SEQ_MASK) == UD_SEQ(ud)
+					&& s->fd >= 0;
+			}
+			put_buf(u, bid);
+		}
+		if (!live || more) {
+			break;
+		}
+		if (cqe->res > 0 || cqe->res == -ENOBUFS) {
+			/* the receive stopped, perhaps for want of buffers:
+			 * start it again, now that some are back
+			 */
+			arm_recv(w, s);
+		} else {
+			session_data(w, s, cqe->res == 0 ? 0 : -1);
+		}
+		break;
+
+	case OP_SEND:
+		q = (struct c4usend *)(uintptr_t)(ud & ~(uint64_t)7);
+		if ((s = q->s) != NULL) {
+			s->ioflight = NULL;
+			if (s->iopend != NULL) {
+				mark_dirty(u, s);
+			}
+		} else if (q->then != NULL) {
+			/* the session has closed: send what it left behind */
+			submit_send(u, q->then);
+		} else if (q->closefd >= 0) {
+			get_sqe(u, IORING_OP_CLOSE, q->closefd, OP_IGNORE);
+		}
+		put_send(u, q);
+		break;
+
+	case OP_POLL:
+		/* a poll left over from the slot's last connection says
+		 * nothing about the one using it now
+		 */
+		if (!live) {
+			break;
+		}
+		s->iopoll = 0;
+		if (s->wantout) {
+			watch_output(w, s);
+		}
+		break;
+	}
+}
+
+/* Submit the loop's output, wait up to timeout ms for completions and
+ * act on them
+ */
+static int
+ur_wait(struct worker *w, int timeout) {
+	struct c4uring *u = w->uring;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	struct io_uring_sqe *sqe;
+	unsigned head, tail;
+	uint64_t t_wake;
+	int n, slept;
+
+	flush_sends(u);
+	__atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE);
+
+	head = *u->cq_head;
+	tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	slept = head == tail;
+	if (head == tail || u->unsubmitted > 0) {
+		if (timeout >= 0 && u->ext_arg) {
+			memset(&arg, 0, sizeof(arg));
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = (timeout % 1000) * 1000000L;
+			arg.sigmask_sz = _NSIG / 8;
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+			n = enter(u->fd, u->unsubmitted, head == tail,
+				IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+				&arg, sizeof(arg));
+		} else {
+			if (head == tail && timeout >= 0) {
+				/* without EXT_ARG a timeout is a request of
+				 * its own, done when it expires or when any
+				 * other completion comes first
+				 */
+				u->timer.tv_sec = timeout / 1000;
+				u->timer.tv_nsec = (timeout % 1000) * 1000000L;
+				sqe = get_sqe(u, IORING_OP_TIMEOUT, -1,
+					OP_IGNORE);
+				sqe->addr = (uint64_t)(uintptr_t)&u->timer;
+				sqe->len = 1;
+				sqe->off = 1;
+				__atomic_store_n(u->sq_tail, u->tail,
+					__ATOMIC_RELEASE);
+			}
+			n = enter(u->fd, u->unsubmitted, head == tail,
+				IORING_ENTER_GETEVENTS, NULL, 0);
+		}
+		if (n < 0 && errno != EINTR && errno != ETIME
+				&& errno != EBUSY) {
+			perror("ERROR on io_uring_enter");
+			return -1;
+		}
+		if (n > 0) {
+			u->unsubmitted -= n;
+		}
+	}
+
+	t_wake = c4m_now();
+	worker_woke(w, slept, t_wake, 0);
+	head = *u->cq_head;
+	tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		/* time spent ready but behind earlier events */
+		c4m_record(C4M_QUEUE_WAIT, c4m_now() - t_wake);
+		C4TRACE_WAIT(t_wake, "queue_wait", 0);
+		complete(w, &u->cqes[head & *u->cq_mask]);
+		head++;
+		__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+static int
+ur_add(struct worker *w, struct session *s) {
+	s->ioseq++;
+	s->iopoll = 0;
+	s->iopend = s->ioflight = NULL;
+	arm_recv(w, s);
+	return 0;
+}
+
+/* The socket is going to another worker: stop receiving on it here
+ */
+static void
+ur_remove(struct worker *w, struct session *s) {
+	struct c4uring *u = w->uring;
+	struct io_uring_sqe *sqe;
+
+	if (s->iopend != NULL) {
+		/* a reply made just before leaving, such as TOKEN, goes
+		 * ahead of anything the socket's next owner sends; a
+		 * client that cannot take it is cut off, for whoever gets
+		 * the seat to find gone, rather than miss the line
+		 */
+		if (seat_write(s->fd, s->iopend->data, s->iopend->len) < 0) {
+			shutdown(s->fd, SHUT_RDWR);
+		}
+		put_send(u, s->iopend);
+		s->iopend = NULL;
+	}
+	if (s->ioflight != NULL) {
+		s->ioflight->s = NULL;
+		s->ioflight = NULL;
+	}
+	sqe = get_sqe(u, IORING_OP_ASYNC_CANCEL, -1, OP_IGNORE);
+	sqe->addr = UD(OP_RECV, s - w->pool, s->ioseq);
+	s->ioseq++;
+}
+
+/* Gather a reply for the next submit
+ */
+static int
+ur_send(struct worker *w, struct session *s, const char *buf, int len) {
+	struct c4uring *u = w->uring;
+	struct c4usend *q = s->iopend;
+
+	if (q == NULL) {
+		if ((q = get_send(u)) == NULL) {
+			return -1;
+		}
+		q->s = s;
+		q->fd = s->fd;
+		s->iopend = q;
+	}
+	if (q->len + len > SEND_MAX) {
+		/* client is not reading what it is sent */
+		return -1;
+	}
+	memcpy(q->data + q->len, buf, len);
+	q->len += len;
+	mark_dirty(u, s);
+	return 0;
+}
+
+/* Close once any output still owed has gone
+ */
+static void
+ur_close(struct worker *w, struct session *s) {
+	struct c4uring *u = w->uring;
+	struct c4usend *pend = s->iopend, *flight = s->ioflight;
+
+	/* ends the multishot receive, which holds the socket open */
+	shutdown(s->fd, SHUT_RD);
+	s->ioseq++;
+	s->iopend = s->ioflight = NULL;
+	if (pend != NULL) {
+		pend->s = NULL;
+		pend->closefd = s->fd;
+	}
+	if (flight != NULL) {
+		flight->s = NULL;
+		if (pend != NULL) {
+			flight->then = pend;
+		} else {
+			flight->closefd = s->fd;
+		}
+	} else if (pend != NULL) {
+		submit_send(u, pend);
+	} else {
+		get_sqe(u, IORING_OP_CLOSE, s->fd, OP_IGNORE);
+	}
+}
+
+static void
+ur_want_output(struct worker *w, struct session *s, int on) {
+	struct io_uring_sqe *sqe;
+
+	if (on && !s->iopoll) {
+		sqe = get_sqe(w->uring, IORING_OP_POLL_ADD, s->fd,
+			UD(OP_POLL, s - w->pool, s->ioseq));
+		sqe->poll32_events = POLLOUT;
+		s->iopoll = 1;
+	}
+}
+
+const struct c4io c4io_uring = {
+	"uring",
+	ur_init,
+	ur_wait,
+	ur_add,
+	ur_remove,
+	ur_send,
+	ur_close,
+	ur_want_output,
+};
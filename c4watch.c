@@ -0,0 +1,354 @@
+/* Spectators for server1
+
+   A client that opens with "WATCH <game>" is handed to the worker that
+   owns the game and follows it from there. It is first sent
+   "SNAP <moves>" with the game so far, then one line per move as it is
+   played (the column, as players see it) and finally "END <result>".
+
+   Each move is encoded once into a shared c4buf and the same buffer is
+   queued to every spectator. A spectator whose queue fills up has the
+   queued moves it has not started on thrown away and gets a fresh
+   SNAP instead, so a slow reader costs a bounded amount of memory.
+
+   Game names are <worker>-<slot>-<generation>; the admin socket's
+   "games" command lists the live ones.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include "c4server.h"
+#include "c4metrics.h"
+
+static void enqueue(struct worker *w, struct session *s, struct c4buf *b,
+	struct session *g, struct c4buf **snap);
+static void flush(struct worker *w, struct session *s);
+static struct c4buf *snapshot(struct session *g);
+
+/* Start following a game: directly if this worker owns it, otherwise
+ * by passing the connection to the worker that does
+ */
+void
+watch_request(struct worker *w, struct session *s, char *arg) {
+	struct seat *seat;
+	int gw, gi;
+	unsigned gg;
+	uint64_t one = 1;
+
+	if (sscanf(arg, "%d-%d-%u", &gw, &gi, &gg) != 3 || gw < 0
+			|| gw >= nworkers || gi < 0 || gi >= nsessions
+			|| workers[gw].live == NULL) {
+		session_send(w, s, "GONE\n");
+		session_free(w, s, -1);
+		return;
+	}
+	if ((seat = session_detach(w, s)) == NULL) {
+		return;
+	}
+	seat->index = gi;
+	seat->gen = gg;
+	if (c4mpmc_push(&workers[gw].inbox, seat) < 0) {
+		close(seat->fd);
+		c4m_inc(C4M_SESSIONS_CLOSED, 1);
+		free(seat);
+		return;
+	}
+	if (gw != w->id) {
+		write(workers[gw].evfd, &one, sizeof(one));
+	} else {
+		watch_inbox(w);
+	}
+}
+
+/* Take in every spectator other workers have handed over, and pass
+ * on clients come to resume a game
+ */
+void
+watch_inbox(struct worker *w) {
+	struct seat *seat;
+	struct session *g, *s;
+	uint64_t n;
+
+	read(w->evfd, &n, sizeof(n));
+	while ((seat = c4mpmc_pop(&w->inbox)) != NULL) {
+		if (seat->token != 0) {
+			session_resume(w, seat);
+			continue;
+		}
+		g = &w->pool[seat->index];
+		if (g->gen != seat->gen || g->fd < 0
+				|| (g->mode != MODE_BOT && g->mode != MODE_RELAY)
+				|| game_of(g) != g
+				|| (s = session_get(w)) == NULL) {
+			seat_send(seat->fd, "GONE\n");
+			close(seat->fd);
+			c4m_inc(C4M_SESSIONS_CLOSED, 1);
+			free(seat);
+			continue;
+		}
+		s->fd = seat->fd;
+		s->ip = seat->ip;
+		s->t_accept = 0;
+		free(seat);
+
+		s->mode = MODE_WATCH;
+		s->peer = g;
+		s->outhead = s->outcount = s->outoff = s->wantout = 0;
+		s->wprev = NULL;
+		s->wnext = g->watchers;
+		if (g->watchers != NULL) {
+			g->watchers->wprev = s;
+		}
+		g->watchers = s;
+		g->nwatchers++;
+		watch_publish(w, g);
+
+		if (w->io->add(w, s) < 0) {
+			watch_close(w, s);
+			continue;
+		}
+		if ((s->outq[0] = snapshot(g)) != NULL) {
+			s->outcount = 1;
+		}
+		flush(w, s);
+	}
+}
+
+/* Send a move just played in game g to everyone watching it
+ */
+void
+watch_move(struct worker *w, struct session *g, int move) {
+	struct session *s, *next;
+	struct c4buf *b, *snap = NULL;
+
+	watch_publish(w, g);
+	if (g->watchers == NULL) {
+		return;
+	}
+	if ((b = c4buf_printf("%d\n", move)) == NULL) {
+		return;
+	}
+	for (s=g->watchers; s!=NULL; s=next) {
+		next = s->wnext;
+		enqueue(w, s, b, g, &snap);
+	}
+	c4buf_put(b);
+	c4buf_put(snap);
+}
+
+/* Game g is over: tell its spectators, who are let go once their
+ * queues have drained
+ */
+void
+watch_end(struct worker *w, struct session *g, int result) {
+	struct session *s, *next;
+	struct c4buf *b;
+
+	if (w->live != NULL) {
+		atomic_store_explicit(&w->live[g - w->pool], 0,
+			memory_order_relaxed);
+	}
+	if (g->watchers == NULL) {
+		return;
+	}
+	b = c4buf_printf("END %c\n", result > 0 ? result : '?');
+	for (s=g->watchers; s!=NULL; s=next) {
+		next = s->wnext;
+		s->peer = NULL;
+		s->wnext = s->wprev = NULL;
+		if (b != NULL) {
+			enqueue(w, s, b, NULL, NULL);
+		} else {
+			flush(w, s);
+		}
+	}
+	c4buf_put(b);
+	g->watchers = NULL;
+	g->nwatchers = 0;
+}
+
+/* Socket has room again: carry on sending
+ */
+void
+watch_output(struct worker *w, struct session *s) {
+	if (s->fd >= 0 && s->mode == MODE_WATCH) {
+		flush(w, s);
+	}
+}
+
+/* Spectator leaves, or has been sent all it will get
+ */
+void
+watch_close(struct worker *w, struct session *s) {
+	struct session *g = s->peer;
+
+	if (g != NULL) {
+		if (s->wprev != NULL) {
+			s->wprev->wnext = s->wnext;
+		} else {
+			g->watchers = s->wnext;
+		}
+		if (s->wnext != NULL) {
+			s->wnext->wprev = s->wprev;
+		}
+		g->nwatchers--;
+		watch_publish(w, g);
+	}
+	while (s->outcount > 0) {
+		c4buf_put(s->outq[s->outhead]);
+		s->outhead = (s->outhead + 1) % WATCH_QUEUE;
+		s->outcount--;
+	}
+	s->wnext = s->wprev = NULL;
+	session_free(w, s, -1);
+}
+
+/* Publish a game's name and size for the admin socket
+ */
+void
+watch_publish(struct worker *w, struct session *g) {
+	uint64_t v;
+	if (w->live == NULL) {
+		return;
+	}
+	v = (uint64_t)g->gen << 32 | (uint64_t)(g->nwatchers & 0xffffff) << 8
+		| (g->game.rec.nmoves & 0xff);
+	atomic_store_explicit(&w->live[g - w->pool], v, memory_order_relaxed);
+}
+
+/* Admin command "games": one line per live game
+ */
+int
+watch_games(const char *cmd, char *out, int len) {
+	int i, k, n = 0;
+	uint64_t v;
+
+	if (strcmp(cmd, "games") != 0) {
+		return -1;
+	}
+	for (i=0; i<nworkers; i++) {
+		if (workers[i].live == NULL) {
+			continue;
+		}
+		for (k=0; k<nsessions && n<len-64; k++) {
+			v = atomic_load_explicit(&workers[i].live[k],
+				memory_order_relaxed);
+			if (v == 0) {
+				continue;
+			}
+			n += snprintf(out+n, len-n,
+				"%d-%d-%u moves=%u watchers=%u\n", i, k,
+				(unsigned)(v >> 32), (unsigned)(v & 0xff),
+				(unsigned)((v >> 8) & 0xffffff));
+		}
+	}
+	return n;
+}
+
+/* Queue a shared buffer for a spectator. If it has fallen too far
+ * behind, drop what it has not started sending and queue the state of
+ * the whole game instead, built at most once per move for all of them
+ */
+static void
+enqueue(struct worker *w, struct session *s, struct c4buf *b,
+		struct session *g, struct c4buf **snap) {
+	int keep, i;
+
+	if (s->outcount == WATCH_QUEUE) {
+		keep = s->outoff > 0;
+		for (i=keep; i<s->outcount; i++) {
+			c4buf_put(s->outq[(s->outhead + i) % WATCH_QUEUE]);
+		}
+		s->outcount = keep;
+		if (g != NULL && snap != NULL) {
+			if (*snap == NULL) {
+				*snap = snapshot(g);
+			}
+			b = *snap;
+		}
+		if (b == NULL) {
+			return;
+		}
+	}
+	s->outq[(s->outhead + s->outcount) % WATCH_QUEUE] = c4buf_get(b);
+	s->outcount++;
+	if (!s->wantout) {
+		/* socket was keeping up, so try to send right away */
+		flush(w, s);
+	}
+}
+
+/* Write as much of the queue as the socket will take in one go
+ */
+static void
+flush(struct worker *w, struct session *s) {
+	struct iovec iov[WATCH_QUEUE];
+	struct msghdr msg;
+	struct c4buf *b;
+	int i, k;
+	ssize_t n;
+
+	for (i=0; i<s->outcount; i++) {
+		b = s->outq[(s->outhead + i) % WATCH_QUEUE];
+		k = (i == 0) ? s->outoff : 0;
+		iov[i].iov_base = b->data + k;
+		iov[i].iov_len = b->len - k;
+	}
+	if (s->outcount > 0) {
+		/* the socket may be blocking, for io_uring's sake */
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = s->outcount;
+		n = sendmsg(s->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0 && errno != EAGAIN && errno != EINTR) {
+			watch_close(w, s);
+			return;
+		}
+		if (n < 0) {
+			n = 0;
+		}
+		/* let go of every buffer that went out completely */
+		while (s->outcount > 0) {
+			b = s->outq[s->outhead];
+			k = b->len - s->outoff;
+			if (n < k) {
+				s->outoff += n;
+				break;
+			}
+			n -= k;
+			c4buf_put(b);
+			s->outoff = 0;
+			s->outhead = (s->outhead + 1) % WATCH_QUEUE;
+			s->outcount--;
+		}
+	}
+
+	if (s->outcount == 0 && s->peer == NULL) {
+		/* game is over and everything has been sent */
+		watch_close(w, s);
+		return;
+	}
+	/* ask to be told when there is room only while we need it */
+	if ((s->outcount > 0) != s->wantout) {
+		s->wantout = s->outcount > 0;
+		w->io->want_output(w, s, s->wantout);
+	}
+}
+
+/* "SNAP <moves>" for the game so far
+ */
+static struct c4buf *
+snapshot(struct session *g) {
+	char moves[C4J_MAXMOVES+1];
+	int i;
+
+	for (i=0; i<g->game.rec.nmoves; i++) {
+		moves[i] = '0' + c4j_move(&g->game.rec, i);
+	}
+	moves[i] = '\0';
+	return c4buf_printf("SNAP %s\n", moves);
+}
@@ -1,18 +1,39 @@
 
 /* A simple client program for server.c
 
-   To compile: gcc client.c -o client -lsocket -lnsl
+   Boards are drawn by c4render.c and the rules come from c4game.c.
+   A hostname of unix:<path> connects to the server's unix-domain socket
+   instead (the port is then ignored), and -m plays the server over a
+   shared-memory segment (see c4shm.h) once connected. With -s the
+   server sends, ahead of each move, its answer to every column we
+   might play, so its reply is shown as soon as our move is made and
+   checked when the server's own reply arrives. With -a the client
+   plays nothing but has the server analyse the position after the
+   given moves ("-" for none), printing each depth's findings as they
+   arrive; typing "stop" ends the search, and a number of milliseconds
+   gives it that much longer.
+
+   To compile: gcc client1.c c4game.c c4render.c c4shm.c -o client1 \
+   					-lsocket -lnsl
    				      (-l links required on csse Unix machines)	
 
-   To run: start the server, then the client */
+   To run: start the server, then the client
+   	client1 [-m] [-s] hostname port [rating | -r token]
+   	client1 -a hostname port moves [ms] */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <poll.h>
+#include "c4game.h"
+#include "c4render.h"
+#include "c4shm.h"
 #ifdef __unix__
 #include <unistd.h>
 #elif defined _WIN32
@@ -20,126 +41,229 @@
 #define sleep(x) Sleep(1000 * x)
 #endif
 
-	/* number of columns in the game */
-#define WIDTH		7
-
-	/* number of slots in each column */
-#define HEIGHT		6
-
-	/* number in row required for victory */
-#define STRAIGHT	4
-
-	/* sign that a cell is still empty */
-#define EMPTY		' '
-
-	/* the two colours used in the game */
-#define RED		'R'
-#define YELLOW		'Y'
-
-	/* horizontal size of each cell in the display grid */
-#define WGRID	5
-
-	/* vertical size of each cell in the display grid */
-#define HGRID	3
-
 #define RSEED	876545678
 
 #define LEN 256
 
-typedef char c4_t[HEIGHT][WIDTH];
+	/* the segment moves go over once the server has agreed, or NULL */
+struct c4shm *shm;
+
+	/* with -s: the server's answer to each column, and our last move */
+int speculate;
+char table[WIDTH+1];
+int mine;
 
-void print_config(c4_t);
-void init_empty(c4_t);
-int do_move(c4_t, int, char);
-void undo_move(c4_t, int);
 int get_move(c4_t,char*,int);
-int move_possible(c4_t);
-char winner_found(c4_t);
-int rowformed(c4_t,  int r, int c);
-int explore(c4_t, int r_fix, int c_fix, int r_off, int c_off);
-int suggest_move(c4_t board, char colour);
 void qread(int newsockfd,char* buffer, int len);
+void qreadline(int newsockfd,char* buffer, int len);
 void qwrite(int newsockfd,char* buffer);
+int qrecv(int newsockfd,char* buffer, int len);
+int use_shm(int sockfd);
+void read_table(int sockfd);
+int qready(void);
+int analyze(int sockfd, char *moves, char *ms);
+void close_shm(void);
+int their_move(c4_t board, char* buffer, int sockfd, char them, int relay);
 
 
 int main(int argc, char**argv)
 {
 	int sockfd, portno, n;
 	struct sockaddr_in serv_addr;
+	struct sockaddr_un unix_addr;
 	struct hostent *server;
+	char *prog = argv[0];
+	int want_shm = 0, analysis = 0;
 
 	char buffer[256];
-
+	char me = YELLOW, them = RED;
+	int relay = 0, rating = 0, i, replayed = 0;
+	char *token = NULL;
+
+	while (argc > 1 && (strcmp(argv[1], "-m") == 0
+			|| strcmp(argv[1], "-s") == 0
+			|| strcmp(argv[1], "-a") == 0)) {
+		if (argv[1][1] == 'm') {
+			want_shm = 1;
+		} else if (argv[1][1] == 's') {
+			speculate = 1;
+		} else {
+			analysis = 1;
+		}
+		argv++;
+		argc--;
+	}
 	if (argc < 3) 
 	{
-		fprintf(stderr,"usage %s hostname port\n", argv[0]);
+		fprintf(stderr,"usage %s [-m] [-s] hostname port "
+			"[rating | -r token]\n"
+			"      %s -a hostname port moves [ms]\n", prog, prog);
+		exit(0);
+	}
+	if (analysis && argc < 4) {
+		fprintf(stderr,"-a needs the moves to analyse, - for none\n");
 		exit(0);
 	}
 
-	portno = atoi(argv[2]);
-
-	
-	/* Translate host name into peer's IP address ;
-	 * This is name translation service by the operating system 
+	/* with a token, carry on with a game against the server; with a
+	 * rating, play another person through the server's lobby
 	 */
-	server = gethostbyname(argv[1]);
-	
-	if (server == NULL) 
-	{
-		fprintf(stderr,"ERROR, no such host\n");
+	if (analysis) {
+		/* the moves, not a rating */
+	} else if (argc > 4 && strcmp(argv[3], "-r") == 0) {
+		token = argv[4];
+	} else if (argc > 3) {
+		relay = 1;
+		rating = atoi(argv[3]);
+	}
+	if ((want_shm || speculate) && (relay || token != NULL)) {
+		fprintf(stderr,"-m and -s are only for new games against "
+			"the server\n");
 		exit(0);
 	}
-	
-	/* Building data structures for socket */
 
-	bzero((char *) &serv_addr, sizeof(serv_addr));
+	portno = atoi(argv[2]);
 
-	serv_addr.sin_family = AF_INET;
+	if (strncmp(argv[1], "unix:", 5) == 0) {
+		/* a server on this machine, through its unix-domain socket */
+		bzero((char *) &unix_addr, sizeof(unix_addr));
+		unix_addr.sun_family = AF_UNIX;
+		strncpy(unix_addr.sun_path, argv[1]+5,
+			sizeof(unix_addr.sun_path)-1);
+		sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sockfd < 0) 
+		{
+			perror("ERROR opening socket");
+			exit(0);
+		}
+		if (connect(sockfd,(struct sockaddr *)&unix_addr,
+				sizeof(unix_addr)) < 0) 
+		{
+			perror("ERROR connecting");
+			exit(0);
+		}
+	} else {
+		/* Translate host name into peer's IP address ;
+		 * This is name translation service by the operating system 
+		 */
+		server = gethostbyname(argv[1]);
+
+		if (server == NULL) 
+		{
+			fprintf(stderr,"ERROR, no such host\n");
+			exit(0);
+		}
 
-	bcopy((char *)server->h_addr, 
-			(char *)&serv_addr.sin_addr.s_addr,
-			server->h_length);
+		/* Building data structures for socket */
 
-	serv_addr.sin_port = htons(portno);
+		bzero((char *) &serv_addr, sizeof(serv_addr));
 
-	/* Create TCP socket -- active open 
-	* Preliminary steps: Setup: creation of active open socket
-	*/
-	
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	
-	if (sockfd < 0) 
-	{
-		perror("ERROR opening socket");
-		exit(0);
-	}
-	
-	if (connect(sockfd,(struct sockaddr *)&serv_addr,sizeof(serv_addr)) < 0) 
-	{
-		perror("ERROR connecting");
-		exit(0);
+		serv_addr.sin_family = AF_INET;
+
+		bcopy((char *)server->h_addr, 
+				(char *)&serv_addr.sin_addr.s_addr,
+				server->h_length);
+
+		serv_addr.sin_port = htons(portno);
+
+		/* Create TCP socket -- active open 
+		* Preliminary steps: Setup: creation of active open socket
+		*/
+
+		sockfd = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (sockfd < 0) 
+		{
+			perror("ERROR opening socket");
+			exit(0);
+		}
+
+		if (connect(sockfd,(struct sockaddr *)&serv_addr,sizeof(serv_addr)) < 0) 
+		{
+			perror("ERROR connecting");
+			exit(0);
+		}
 	}
 
 	/* Do processing
 	*/
 	c4_t board;
 	int move;
-	char *ptr;
+
+	if (analysis) {
+		exit(analyze(sockfd, argv[3], argc > 4 ? argv[4] : NULL));
+	}
+
+	if (relay) {
+		sprintf(buffer,"JOIN %d\n",rating);
+		qwrite(sockfd,buffer);
+		printf("Waiting for an opponent...\n");
+		qreadline(sockfd,buffer,LEN);
+		if (strncmp(buffer,"START ",6) != 0) {
+			printf("Server said: %s\n",buffer);
+			exit(EXIT_FAILURE);
+		}
+		if (buffer[6] == RED) {
+			me = RED;
+			them = YELLOW;
+		}
+		printf("You are playing %c\n", me);
+	} else if (want_shm) {
+		/* moves go over shared memory from here on, if we can */
+		if (use_shm(sockfd) < 0) {
+			printf("Playing over the socket instead\n");
+		}
+	} else if (token == NULL) {
+		/* ask for a token, in case we need to come back */
+		qwrite(sockfd,"HELLO\n");
+		qreadline(sockfd,buffer,LEN);
+		if (strncmp(buffer,"TOKEN ",6) == 0) {
+			printf("To resume this game: %s %s %s -r %s\n",
+				prog, argv[1], argv[2], buffer+6);
+		}
+	}
 
 	srand(RSEED);
+	c4render_init();
 	init_empty(board);
-	print_config(board);
+	printf("Welcome to connect-4 \n\n");
 
-	while ((move = get_move(board,buffer,sockfd)) != EOF) {
+	if (token != NULL) {
+		sprintf(buffer,"RESUME %.200s\n",token);
+		qwrite(sockfd,buffer);
+		qreadline(sockfd,buffer,LEN);
+		if (strncmp(buffer,"RESUMED ",8) != 0) {
+			printf("Server said: %s\n",buffer);
+			exit(EXIT_FAILURE);
+		}
+		/* put back the moves made so far, Y and R in turn */
+		for (i=8; buffer[i]>='1' && buffer[i]<='0'+WIDTH; i++) {
+			do_move(board, buffer[i]-'0', (replayed&1) ? RED : YELLOW);
+			replayed++;
+		}
+		printf("Resuming after %d moves\n", replayed);
+	}
+	if (speculate) {
+		qwrite(sockfd,"SPEC\n");
+		read_table(sockfd);
+	}
+	c4render_print(board);
+
+	if ((me == RED || (replayed & 1))
+			&& their_move(board,buffer,sockfd,them,relay)) {
+		exit(EXIT_SUCCESS);
+	}
 
+	while ((move = get_move(board,buffer,sockfd)) != EOF) {
+		mine = move;
 
-		if (do_move(board, move, YELLOW)!=1) {
+		if (do_move(board, move, me)!=1) {
 			printf("Panic\n");
 			exit(EXIT_FAILURE);
 		}
-		print_config(board);
+		c4render_print(board);
 
-		if (winner_found(board) == YELLOW) {
+		if (winner_found(board) == me) {
 			/* rats, the person beat us! */
 			printf("Ok, you beat me, beginner's luck!\n");
 			exit(EXIT_SUCCESS);
@@ -150,25 +274,8 @@ int main(int argc, char**argv)
 			printf("An honourable draw\n");
 			exit(EXIT_SUCCESS);
 		}
-		/* otherwise, look for a move from the computer */
-		qread(sockfd,buffer,LEN);
-
-		move=strtol(buffer, &ptr, 10);
-
-		printf("Ok, let's see now....");
-		sleep(1);
-		/* then play the move */
-		printf(" I play in column %d\n", move);
-
-		if (do_move(board, move, RED)!=1) {
-			printf("Panic\n");
-			exit(EXIT_FAILURE);
-		}
-		print_config(board);
-
-		if (winner_found(board) == RED) {
-			/* yes!!! */
-			printf("I guess I have your measure!\n");
+		/* otherwise, wait for the computer or the other player */
+		if (their_move(board,buffer,sockfd,them,relay)) {
 			exit(EXIT_SUCCESS);
 		}
 
@@ -211,9 +318,176 @@ int main(int argc, char**argv)
 
 
 
+/* Read and play the opponent's move; returns 1 if the game is over.
+ * With a table from the server its answer is played straight away,
+ * and the reply that follows only confirms it
+ */
+int
+their_move(c4_t board, char *buffer, int sockfd, char them, int relay) {
+	int move, guess = 0;
+	char *ptr;
+
+	if (speculate && mine >= 1 && mine <= WIDTH
+			&& table[mine-1] >= '1' && table[mine-1] <= '0'+WIDTH) {
+		guess = table[mine-1] - '0';
+		printf("I play in column %d\n", guess);
+		do_move(board, guess, them);
+		c4render_print(board);
+	}
+
+	qreadline(sockfd,buffer,LEN);
+
+	move=strtol(buffer, &ptr, 10);
+
+	if (guess) {
+		if (move != guess) {
+			printf("... no, in column %d after all\n", move);
+			undo_move(board, guess);
+			guess = 0;
+		}
+	} else if (relay) {
+		printf("Your opponent plays in column %d\n", move);
+	} else {
+		printf("Ok, let's see now....");
+		sleep(1);
+		/* then play the move */
+		printf(" I play in column %d\n", move);
+	}
+
+	if (!guess) {
+		if (do_move(board, move, them)!=1) {
+			printf("Panic\n");
+			exit(EXIT_FAILURE);
+		}
+		c4render_print(board);
+	}
+
+	if (winner_found(board) == them) {
+		/* yes!!! */
+		printf("I guess I have your measure!\n");
+		return 1;
+	}
+	if (!move_possible(board)) {
+		printf("An honourable draw\n");
+		return 1;
+	}
+	if (speculate) {
+		read_table(sockfd);
+	}
+	return 0;
+}
+
+/* The server's answers for our next move, sent as "SPEC <table>"
+ */
+void read_table(int sockfd) {
+	char buffer[LEN];
+
+	qreadline(sockfd,buffer,LEN);
+	if (strncmp(buffer,"SPEC ",5) != 0 || strlen(buffer+5) != WIDTH) {
+		printf("Server said: %s\n",buffer);
+		exit(EXIT_FAILURE);
+	}
+	strcpy(table, buffer+5);
+}
+
+	/* what the server has sent past the last line read */
+static char pending[LEN];
+static int npending;
+
+/* Is there a whole line from the server already read?
+ */
+int qready(void) {
+	return memchr(pending, '\n', npending) != NULL;
+}
+
+/* Have the server analyse the position after moves, printing what it
+ * finds as it goes, until it gives its best move
+ */
+int analyze(int sockfd, char *moves, char *ms) {
+	struct pollfd pfd[2];
+	char buffer[LEN], line[LEN];
+
+	sprintf(buffer,"ANALYZE %.100s %.20s\n", moves, ms ? ms : "");
+	if (ms == NULL) {
+		sprintf(buffer,"ANALYZE %.100s\n", moves);
+	}
+	qwrite(sockfd,buffer);
+
+	pfd[0].fd = 0;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = sockfd;
+	pfd[1].events = POLLIN;
+	for (;;) {
+		pfd[0].revents = pfd[1].revents = 0;
+		if (!qready() && poll(pfd, 2, -1) < 0) {
+			continue;
+		}
+		if (qready() || pfd[1].revents) {
+			qreadline(sockfd,buffer,LEN);
+			printf("%s\n",buffer);
+			if (strncmp(buffer,"BEST ",5) == 0) {
+				return EXIT_SUCCESS;
+			}
+			if (strcmp(buffer,"BADPOS") == 0
+					|| strcmp(buffer,"BUSY") == 0) {
+				return EXIT_FAILURE;
+			}
+		}
+		if (pfd[0].revents) {
+			if (fgets(line, sizeof(line), stdin) == NULL) {
+				/* nothing more to say; wait for the answer */
+				pfd[0].fd = -1;
+			} else if (strncmp(line,"stop",4) == 0) {
+				qwrite(sockfd,"STOP\n");
+			} else if (atoi(line) > 0) {
+				sprintf(buffer,"EXTEND %d\n",atoi(line));
+				qwrite(sockfd,buffer);
+			}
+		}
+	}
+}
+
+/* Ask the server to play over a segment of shared memory; -1 if it
+ * cannot, and the socket is still to be used
+ */
+int use_shm(int sockfd) {
+	struct c4shm *m;
+	char name[64], buffer[LEN];
+
+	if ((m = c4shm_create(name, sizeof(name))) == NULL) {
+		perror("ERROR creating shared memory");
+		return -1;
+	}
+	sprintf(buffer,"SHM %s\n",name);
+	qwrite(sockfd,buffer);
+	qreadline(sockfd,buffer,LEN);
+	/* the server has it mapped by now, or never will */
+	shm_unlink(name);
+	if (strcmp(buffer,"SHM OK") != 0) {
+		c4shm_close(m);
+		return -1;
+	}
+	shm = m;
+	atexit(close_shm);
+	return 0;
+}
+
+void close_shm(void) {
+	c4shm_close(shm);
+	shm = NULL;
+}
+
 void qwrite(int newsockfd,char* buffer) {
 	int n;
 
+	if (shm != NULL) {
+		if (c4shm_write(shm, &shm->up, buffer, strlen(buffer)) < 0) {
+			printf("The server closed the connection\n");
+			exit(EXIT_FAILURE);
+		}
+		return;
+	}
+
 	n = write(newsockfd,buffer,strlen(buffer));
 	
 	if (n < 0) 
@@ -223,6 +497,27 @@ void qwrite(int newsockfd,char* buffer) {
 	}
 }
 
+/* Read what the server has sent, from the socket or the shared memory;
+ * 0 once it has gone
+ */
+int qrecv(int newsockfd,char* buffer, int len) {
+	char c;
+	int n;
+
+	if (shm == NULL) {
+		return read(newsockfd,buffer,len);
+	}
+	/* the socket stays open beside the rings; if the server dies it
+	 * is the only thing to say so
+	 */
+	while ((n = c4shm_read(shm, &shm->down, buffer, len, 1000)) < 0) {
+		if (recv(newsockfd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0) {
+			return 0;
+		}
+	}
+	return n;
+}
+
 
 void qread(int newsockfd,char* buffer, int len) {
 
@@ -242,68 +537,40 @@ void qread(int newsockfd,char* buffer, int len) {
 	}
 }
 
-/* Initialise the playing array to empty cells */
-void
-init_empty(c4_t board) {
-	int r, c;
-	for (r=HEIGHT-1; r>=0; r--) {
-		for (c=0; c<WIDTH; c++) {
-			board[r][c] = EMPTY;
-		}
-	}
-	printf("Welcome to connect-4 \n\n");
-}
-
-/* Apply the specified move to the board
+/* Read one whole line from the server, without its newline; lines
+ * that arrive together are kept for the following calls
  */
-int
-do_move(c4_t board, int c, char colour) {
-	int r=0;
-	/* first, find the next empty slot in that column */
-	while ((r<HEIGHT) && (board[r][c-1]!=EMPTY)) {
-		r += 1;
-	}
-	if (r==HEIGHT) {
-		/* no move is possible */
-		return 0;
-	}
-	/* otherwise, do the assignment */
-	board[r][c-1] = colour;
-	return 1;
-}
-
-/* Remove the top token from the specified column c
- */
-void
-undo_move(c4_t board, int c) {
-	int r=0;
-	/* first, find the next empty slot in that column, but be
-	 * careful not to run over the top of the array
-	 */
-	while ((r<HEIGHT) && board[r][c-1] != EMPTY) {
-		r += 1;
-	}
-	/* then do the assignment, assuming that r>=1 */
-	board[r-1][c-1] = EMPTY;
-	return;
-}
+void qreadline(int newsockfd,char* buffer, int len) {
+	char *end;
+	int n;
 
-/* Check board to see if it is full or not */
-int
-move_possible(c4_t board) {
-	int c;
-	/* check that a move is possible */
-	for (c=0; c<WIDTH; c++) {
-		if (board[HEIGHT-1][c] == EMPTY) {
-			/* this move is possible */
-			return 1;
+	while ((end = memchr(pending, '\n', npending)) == NULL) {
+		if (npending == LEN) {
+			/* too long to be a line we understand */
+			npending = 0;
+		}
+		n = qrecv(newsockfd, pending+npending, LEN-npending);
+		if (n < 0) 
+		{
+			perror("ERROR reading from socket");
+			exit(1);
 		}
+		if (n == 0) {
+			printf("The server closed the connection\n");
+			exit(EXIT_FAILURE);
+		}
+		npending += n;
 	}
-	/* if here and loop is finished, and no move possible */
-	return 0;
+	n = end - pending;
+	if (n >= len) {
+		n = len - 1;
+	}
+	memcpy(buffer, pending, n);
+	buffer[n] = '\0';
+	npending -= end + 1 - pending;
+	memmove(pending, end + 1, npending);
 }
 
-
 /* Read the next column number, and check for legality 
  */
 int
@@ -328,171 +595,8 @@ get_move(c4_t board,char* buffer, int newsockfd) {
 	}
 	/* now have a valid move */
 	bzero(buffer,256);
-	sprintf(buffer,"%d",c);
+	sprintf(buffer,"%d\n",c);
 	// printf("%s",buffer);
 	qwrite(newsockfd,buffer);
 	return c;
 }
-
-/* Print out the current configuration of the board 
- */
-void
-print_config(c4_t board) {
-	int r, c, i, j;
-	/* lots of complicated detail in here, mostly this function
-	 * is an exercise in attending to detail and working out the
-	 * exact layout that is required.
-	 */
-	printf("\n");
-	/* print cells starting from the top, each cell is spread over
-	 * several rows
-	 */
-	for (r=HEIGHT-1; r>=0; r--) {
-		for (i=0; i<HGRID; i++) {
-			printf("\t|");
-			/* next two loops step across one row */
-			for (c=0; c<WIDTH; c++) {
-				for (j=0; j<WGRID; j++) {
-					printf("%c", board[r][c]);
-				}
-				printf("|");
-			}
-			printf("\n");
-		}
-	}
-	/* now print the bottom line */
-	printf("\t+");
-	for (c=0; c<WIDTH; c++) {
-		for (j=0; j<WGRID; j++) {
-			printf("-");
-		}
-		printf("+");
-	}
-	printf("\n");
-	/* and the bottom legend */
-	printf("\t ");
-	for (c=0; c<WIDTH; c++) {
-		for (j=0; j<(WGRID-1)/2; j++) {
-			printf(" ");
-		}
-		printf("%1d ", c+1);
-		for (j=0; j<WGRID-1-(WGRID-1)/2; j++) {
-			printf(" ");
-		}
-	}
-	printf("\n\n");
-}
-
-/* Is there a winning position on the current board?
- */
-char
-winner_found(c4_t board) {
-	int r, c;
-	/* check exhaustively from every position on the board
-	 * to see if there is a winner starting at that position.
-	 * could probably short-circuit some of the computatioin,
-	 * but hey, the computer has plenty of time to do the tesing
-	 */
-	for (r=0; r<HEIGHT; r++) {
-		for (c=0; c<WIDTH; c++) {
-			if ((board[r][c]!=EMPTY) && rowformed(board,r,c)) {
-				return board[r][c];
-			}
-		}
-	}
-	/* ok, went right through all positions and if we are still
-	 * here then there isn't a solution to be found
-	 */
-	return EMPTY;
-}
-
-
-/* Is there a row in any direction starting at [r][c]?
- */
-int
-rowformed(c4_t board, int r, int c) {
-	return
-		explore(board, r, c, +1,  0) ||
-		explore(board, r, c, -1,  0) ||
-		explore(board, r, c,  0, +1) ||
-		explore(board, r, c,  0, -1) ||
-		explore(board, r, c, -1, -1) ||
-		explore(board, r, c, -1, +1) ||
-		explore(board, r, c, +1, -1) ||
-		explore(board, r, c, +1, +1);
-}
-
-/* Nitty-gritty detail of looking for a set of straight-line
- * items all the same colour. Need to be very careful not to step
- * over the edge of the array
- */
-int
-explore(c4_t board, int r_fix, int c_fix, int r_off, int c_off) {
-	int r_lim, c_lim;
-	int r, c, i;
-	r_lim = r_fix + (STRAIGHT-1)*r_off;
-	c_lim = c_fix + (STRAIGHT-1)*c_off;
-	/* can we go in the specified direction?
-	 */
-	if (r_lim<0 || r_lim>=HEIGHT || c_lim<0 || c_lim>=WIDTH) {
-		/* no, not enough space */
-		return 0;
-	}
-	/* can, so check the colours for all the same */
-	for (i=1; i<STRAIGHT; i++) {
-		r = r_fix + i*r_off;
-		c = c_fix + i*c_off;
-		if (board[r][c] != board[r_fix][c_fix]) {
-			/* found one different, so cannotbe a row */
-			return 0;
-		}
-	}
-	/* by now, a straight row all the same colour has been found */
-	return 1;
-}
-
-/* Try to find a good move for the specified colour
- */
-int
-suggest_move(c4_t board, char colour) {
-	int c;
-	/* look for a winning move for colour */
-	for (c=0; c<WIDTH; c++) {
-		/* temporarily move in column c... */
-		if (do_move(board, c+1, colour)) {
-			/* ... and check to see the outcome */
-			if (winner_found(board) == colour) {
-				/* it is good, so unassign and return c */
-				undo_move(board, c+1);
-				return c+1;
-			} else {
-				undo_move(board, c+1);
-			}
-		}
-	}
-	/* ok, no winning move, look for a blocking move */
-	if (colour == RED) {
-		colour = YELLOW;
-	} else {
-		colour = RED;
-	}
-	for (c=0; c<WIDTH; c++) {
-		/* temporarily move in column c... */
-		if (do_move(board, c+1, colour)) {
-			/* ... and check to see the outcome */
-			if (winner_found(board) == colour) {
-				/* it is good, so unassign and return c */
-				undo_move(board, c+1);
-				return c+1;
-			} else {
-				undo_move(board, c+1);
-			}
-		}
-	}
-	/* no moves found? then pick at random... */
-	c = rand()%WIDTH;
-	while (board[HEIGHT-1][c]!=EMPTY) {
-		c = rand()%WIDTH;
-	}
-	return c+1;
-}
\ No newline at end of file
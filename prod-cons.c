@@ -1,105 +1,425 @@
+/* Producer-consumer benchmark for the queues of c4ring.h
+
+   Producers push timestamps as fast as the queue takes them and
+   consumers pop them, for the given number of seconds; every SAMPLE'th
+   item popped is timed from its push to its pop. Items go through a
+   c4mpmc, a c4spsc (one producer and one consumer only), or, to compare
+   them with, a FIFO under a mutex and condition variable. With -b,
+   items are pushed and popped in batches of up to that many; with -w,
+   a thread that finds the queue full or empty sleeps in the queue's
+   _wait call instead of yielding and trying again.
+
+   Each configuration prints one JSON object on standard output: items
+   per second through the queue, and the median, 99th percentile and
+   worst latency of the items timed, in ns. With -s, every combination
+   of 1, 2, 4 ... up to the producers and consumers given is run in
+   turn.
+
+   To compile: gcc -O2 prod-cons.c c4ring.c -o prod-cons -pthread
+
+   To run: prod-cons [-q mpmc|spsc|lock] [-b batch] [-n size] [-w] [-s]
+   		seconds producers consumers
+*/
+
+#define _GNU_SOURCE
 #include <stdio.h>
-#include <malloc.h>
-#include <unistd.h>
-#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "c4ring.h"
 
-typedef int buffer_item;
-#define PROD_SLEEP 	1
-#define CONS_SLEEP 	1
-#define BUFFER_SIZE 5
-#define MAX_PROD	20
-#define MAX_CONS	20
+	/* which queue is measured */
+#define Q_MPMC		0
+#define Q_SPSC		1
+#define Q_LOCK		2
 
-buffer_item buffer[BUFFER_SIZE];
-unsigned int buff_idx;
+	/* time one item in so many */
+#define SAMPLE		64
 
-int insert_item(buffer_item item) {
-	if (buff_idx == BUFFER_SIZE) {
-		/* what happens if space is not available? */
-		return -1;
+	/* most latencies kept by a consumer; later ones overwrite */
+#define SAMPLES		65536
+
+	/* most items in a batch */
+#define MAX_BATCH	256
+
+#define MAX_THREADS	64
+
+	/* the mutex and condition variable FIFO */
+struct lockq {
+	pthread_mutex_t lock;
+	pthread_cond_t nonempty;
+	pthread_cond_t nonfull;
+	size_t head, tail, size;
+	uint64_t *item;
+};
+
+struct consumer {
+	pthread_t tid;
+	uint64_t popped;
+	int nsamples;
+	uint64_t sample[SAMPLES];
+};
+
+static int kind = Q_MPMC;
+static int batch = 1;
+static int waiting;
+static size_t size = 4096;
+
+static struct c4mpmc mpmc;
+static struct c4spsc spsc;
+static struct lockq lockq;
+
+static atomic_int running;
+static atomic_int producing;
+static atomic_ulong pushed;
+
+static void usage(char *prog);
+
+static uint64_t
+now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+
+/* Push up to n items, as many as fit, into the FIFO
+ */
+static size_t
+lock_push(uint64_t *item, size_t n, int wait) {
+	size_t i;
+
+	pthread_mutex_lock(&lockq.lock);
+	while (wait && lockq.tail - lockq.head == lockq.size
+			&& atomic_load(&running)) {
+		pthread_cond_wait(&lockq.nonfull, &lockq.lock);
+	}
+	for (i=0; i<n && lockq.tail - lockq.head < lockq.size; i++) {
+		lockq.item[lockq.tail++ % lockq.size] = item[i];
 	}
+	if (i > 0) {
+		pthread_cond_broadcast(&lockq.nonempty);
+	}
+	pthread_mutex_unlock(&lockq.lock);
+	return i;
+}
 
-	/* insert an item into buffer */
-	buffer[buff_idx] = item;
-	buff_idx++;
-	return 0;
+/* Pop up to n items from the FIFO; waiting, gives up after a while so
+ * that the caller can see whether the run is over
+ */
+static size_t
+lock_pop(uint64_t *item, size_t n, int wait) {
+	struct timespec ts;
+	size_t i;
+
+	pthread_mutex_lock(&lockq.lock);
+	if (wait && lockq.tail == lockq.head) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 10000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&lockq.nonempty, &lockq.lock, &ts);
+	}
+	for (i=0; i<n && lockq.head != lockq.tail; i++) {
+		item[i] = lockq.item[lockq.head++ % lockq.size];
+	}
+	if (i > 0) {
+		pthread_cond_broadcast(&lockq.nonfull);
+	}
+	pthread_mutex_unlock(&lockq.lock);
+	return i;
 }
 
-int remove_item(buffer_item *item) {
-	if (buff_idx == 0) {
-		/* what happens if the buffer is empty */
-		return -1;
+/* Push up to n items into whichever queue is measured, returning how
+ * many went in
+ */
+static size_t
+push(uint64_t *item, size_t n) {
+	switch (kind) {
+	case Q_SPSC:
+		if (waiting && n == 1) {
+			return c4spsc_push_wait(&spsc, item, 10) == 0;
+		}
+		return c4spsc_push_n(&spsc, item, n);
+	case Q_LOCK:
+		return lock_push(item, n, waiting);
 	}
-	/* remove an item from the buffer */
-	*item = buffer[buff_idx - 1];
-	buff_idx--;
-	return 0;
+	if (waiting && n == 1) {
+		return c4mpmc_push_wait(&mpmc, (void *)(uintptr_t)*item, 10)
+			== 0;
+	}
+	return c4mpmc_push_n(&mpmc, (void *const *)item, n);
+}
+
+static size_t
+pop(uint64_t *item, size_t n) {
+	void *p;
+
+	switch (kind) {
+	case Q_SPSC:
+		if (waiting && n == 1) {
+			return c4spsc_pop_wait(&spsc, item, 10) == 0;
+		}
+		return c4spsc_pop_n(&spsc, item, n);
+	case Q_LOCK:
+		return lock_pop(item, n, waiting);
+	}
+	if (waiting && n == 1) {
+		if ((p = c4mpmc_pop_wait(&mpmc, 10)) == NULL) {
+			return 0;
+		}
+		*item = (uintptr_t)p;
+		return 1;
+	}
+	return c4mpmc_pop_n(&mpmc, (void **)item, n);
 }
 
-void * producer(void * param) {
-	buffer_item item;
-	
-	while (1) {
-		/* sleep a random time period */
-		//sleep(PROD_SLEEP);
-
-		/* generate a random item */
-		item = rand();
-		
-		if (insert_item(item) == -1) {
-			fprintf(stderr,"buffer is full, cannot write\n");
-		} else {
-			printf("Producer produced %d\n",item);
+static void *
+producer(void *param) {
+	uint64_t item[MAX_BATCH];
+	uint64_t count = 0;
+	size_t i, k, n;
+
+	while (atomic_load_explicit(&running, memory_order_relaxed)) {
+		/* an item is the time it was made, never 0 for c4mpmc */
+		item[0] = now_ns();
+		for (i=1; i<(size_t)batch; i++) {
+			item[i] = item[0];
 		}
+		for (k=0; k<(size_t)batch; k += n) {
+			n = push(item + k, batch - k);
+			if (n == 0) {
+				if (!atomic_load_explicit(&running,
+						memory_order_relaxed)) {
+					break;
+				}
+				if (!waiting || batch > 1) {
+					sched_yield();
+				}
+			}
+		}
+		count += k;
 	}
+	atomic_fetch_add(&pushed, count);
+	atomic_fetch_sub(&producing, 1);
+	return NULL;
 }
 
-void * consumer(void * param) {
-	buffer_item item;
-
-	while (1) {
-		/* sleep a random time period */
-		//sleep(CONS_SLEEP);
-		
-		/* generate a random item */
-		if (remove_item(&item) == -1) {
-			fprintf(stderr,"buffer is empty, cannot read\n");
-		} else {
-			printf("Consumer consumed %d\n",item);
+static void *
+consumer(void *param) {
+	struct consumer *c = param;
+	uint64_t item[MAX_BATCH];
+	uint64_t next = SAMPLE;
+	size_t n;
+
+	for (;;) {
+		n = pop(item, batch);
+		if (n == 0) {
+			/* done once every producer has stopped and nothing
+			 * is left
+			 */
+			if (atomic_load(&producing) == 0
+					&& (n = pop(item, batch)) == 0) {
+				break;
+			}
+			if (n == 0) {
+				if (!waiting || batch > 1) {
+					sched_yield();
+				}
+				continue;
+			}
+		}
+		c->popped += n;
+		if (c->popped >= next) {
+			/* the oldest of the batch, which waited longest */
+			next += SAMPLE;
+			c->sample[c->nsamples++ % SAMPLES] = now_ns()
+				- item[0];
 		}
 	}
+	return NULL;
 }
 
-int main(int argc, char * argv[]) {
-	int i;
-	pthread_t prod_tid[MAX_PROD];
-	pthread_t cons_tid[MAX_CONS];
+static int
+cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
 
-	/* 1. get cmd line arguments */
-	long int num_sec = atoi(argv[1]);
-	long int num_prod = atoi(argv[2]);
-	long int num_cons = atoi(argv[3]);
+static const char *
+kind_name(void) {
+	return kind == Q_SPSC ? "spsc" : kind == Q_LOCK ? "lock" : "mpmc";
+}
 
-	buff_idx = 0;
+/* Run one configuration and print what it did
+ */
+static int
+run(int seconds, int nprod, int ncons) {
+	pthread_t prod[MAX_THREADS];
+	struct consumer *cons;
+	uint64_t *all, popped = 0, start, elapsed;
+	size_t nall = 0;
+	int i, k;
+
+	cons = calloc(ncons, sizeof(*cons));
+	all = malloc((size_t)ncons * SAMPLES * sizeof(*all));
+	if (cons == NULL || all == NULL) {
+		perror("ERROR allocating");
+		return -1;
+	}
+	switch (kind) {
+	case Q_MPMC:
+		k = c4mpmc_init(&mpmc, size, waiting ? C4RING_WAIT : 0);
+		break;
+	case Q_SPSC:
+		k = c4spsc_init(&spsc, size, sizeof(uint64_t),
+			waiting ? C4RING_WAIT : 0);
+		break;
+	default:
+		pthread_mutex_init(&lockq.lock, NULL);
+		pthread_cond_init(&lockq.nonempty, NULL);
+		pthread_cond_init(&lockq.nonfull, NULL);
+		lockq.head = lockq.tail = 0;
+		lockq.size = size;
+		k = (lockq.item = malloc(size * sizeof(uint64_t))) ? 0 : -1;
+	}
+	if (k < 0) {
+		perror("ERROR making queue");
+		return -1;
+	}
+	atomic_store(&running, 1);
+	atomic_store(&producing, nprod);
+	atomic_store(&pushed, 0);
+	start = now_ns();
+	for (i=0; i<ncons; i++) {
+		pthread_create(&cons[i].tid, NULL, consumer, &cons[i]);
+	}
+	for (i=0; i<nprod; i++) {
+		pthread_create(&prod[i], NULL, producer, NULL);
+	}
+	sleep(seconds);
+	atomic_store(&running, 0);
+	if (kind == Q_LOCK) {
+		/* producers asleep on a full FIFO must see it is over */
+		pthread_mutex_lock(&lockq.lock);
+		pthread_cond_broadcast(&lockq.nonfull);
+		pthread_mutex_unlock(&lockq.lock);
+	}
+	for (i=0; i<nprod; i++) {
+		pthread_join(prod[i], NULL);
+	}
+	for (i=0; i<ncons; i++) {
+		pthread_join(cons[i].tid, NULL);
+		popped += cons[i].popped;
+		k = cons[i].nsamples < SAMPLES ? cons[i].nsamples : SAMPLES;
+		memcpy(all + nall, cons[i].sample, k * sizeof(*all));
+		nall += k;
+	}
+	elapsed = now_ns() - start;
+	qsort(all, nall, sizeof(*all), cmp_u64);
 
-	/* 2. Initialize buffer */
-	memset((void*)buffer, 0, BUFFER_SIZE*sizeof(buffer_item));
+	printf("{\"queue\": \"%s\", \"producers\": %d, \"consumers\": %d, "
+		"\"batch\": %d, \"size\": %zu, \"wait\": %d, "
+		"\"items\": %llu, \"ops_per_sec\": %.0f, "
+		"\"p50_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu%s}\n",
+		kind_name(), nprod, ncons, batch, size, waiting,
+		(unsigned long long)popped, popped * 1e9 / elapsed,
+		(unsigned long long)(nall ? all[nall/2] : 0),
+		(unsigned long long)(nall ? all[nall*99/100] : 0),
+		(unsigned long long)(nall ? all[nall-1] : 0),
+		popped == atomic_load(&pushed) ? "" : ", \"lost\": true");
+	fflush(stdout);
 
-	/* 3. Create producer threads */
-	for (i = 0; i < num_prod; i++) {
-		pthread_create(&prod_tid[i], NULL, producer, NULL);
+	switch (kind) {
+	case Q_MPMC:
+		c4mpmc_free(&mpmc);
+		break;
+	case Q_SPSC:
+		c4spsc_free(&spsc);
+		break;
+	default:
+		free(lockq.item);
 	}
+	free(all);
+	free(cons);
+	return 0;
+}
 
-	/* 4. Create consumer threads */
-	for (i = 0; i < num_cons; i++) {
-		pthread_create(&cons_tid[i], NULL, consumer, NULL);
+int
+main(int argc, char *argv[]) {
+	int opt, sweep = 0, seconds, nprod, ncons, p, c;
+
+	while ((opt = getopt(argc, argv, "q:b:n:ws")) != -1) {
+		switch (opt) {
+		case 'q':
+			if (strcmp(optarg, "mpmc") == 0) {
+				kind = Q_MPMC;
+			} else if (strcmp(optarg, "spsc") == 0) {
+				kind = Q_SPSC;
+			} else if (strcmp(optarg, "lock") == 0) {
+				kind = Q_LOCK;
+			} else {
+				usage(argv[0]);
+			}
+			break;
+		case 'b':
+			batch = atoi(optarg);
+			break;
+		case 'n':
+			size = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			waiting = 1;
+			break;
+		case 's':
+			sweep = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind != 3) {
+		usage(argv[0]);
+	}
+	seconds = atoi(argv[optind]);
+	nprod = atoi(argv[optind+1]);
+	ncons = atoi(argv[optind+2]);
+	if (seconds < 1 || nprod < 1 || ncons < 1 || nprod > MAX_THREADS
+			|| ncons > MAX_THREADS || batch < 1
+			|| batch > MAX_BATCH || size < 2
+			|| (size & (size-1)) != 0) {
+		usage(argv[0]);
+	}
+	if (kind == Q_SPSC && (nprod > 1 || ncons > 1)) {
+		fprintf(stderr, "ERROR spsc takes one producer and one "
+			"consumer\n");
+		exit(1);
 	}
 
-	/* 5. Sleep */
-	sleep(num_sec);
-	
-	/* 6. Exit */
+	if (!sweep) {
+		return run(seconds, nprod, ncons) < 0;
+	}
+	for (p=1; p<=nprod; p *= 2) {
+		for (c=1; c<=ncons; c *= 2) {
+			if (run(seconds, p, c) < 0) {
+				return 1;
+			}
+		}
+	}
 	return 0;
-}
\ No newline at end of file
+}
+
+static void
+usage(char *prog) {
+	fprintf(stderr, "usage: %s [-q mpmc|spsc|lock] [-b batch] "
+		"[-n size] [-w] [-s] seconds producers consumers\n"
+		"\tsize is a power of 2, batch at most %d, threads at "
+		"most %d\n", prog, MAX_BATCH, MAX_THREADS);
+	exit(1);
+}
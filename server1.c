@@ -1,18 +1,142 @@
 /* A simple server in the internet domain using TCP
-The port number is passed as an argument 
-
-
- To compile: gcc server.c -o server -lsocket -lnsl
- 			(-l links required on csse Unix machines)	
+The port number is passed as an argument
+
+ The server runs one or more workers (-w). Each worker binds its own
+ listening socket to the port with SO_REUSEPORT, so the kernel spreads
+ new connections across them, and runs its own event loop over a
+ private pool of sessions (-S per worker). The loop is built on epoll
+ (c4epoll.c) or, with -I uring, on io_uring (c4uring.c). Workers are
+ pinned to a CPU each and share nothing on the move path. They are
+ threads by default, or separate processes with -P. The listen backlog
+ is set with -b.
+
+ Clients send one column number per line and get the server's reply
+ back the same way. A client that instead opens with "JOIN [rating]"
+ goes into the matchmaking lobby, where a lock-free queue per rating
+ band pairs it with another client; it is told "START Y" (moves first)
+ or "START R", plus the game's name, and from then on the server checks
+ each move against its own bitboard of the game and relays it to the
+ opponent. With -P the lobby is process 0's: the other processes hand
+ their JOIN clients' sockets over to it on a unix socket pair, so that
+ every client waiting is paired from the one set of queues. A client
+ opening with "WATCH <game>" follows a game as a spectator (see
+ c4watch.c); "games" on the admin socket lists them.
+
+ Moves are logged to log.txt through the asynchronous logger in c4log.c;
+ pass -B to block rather than drop events when the log falls behind.
+ Every game is also appended to the binary journal in c4journal.c,
+ kept in the directory given with -J (default "journal").
+ Each board is drawn on standard output by c4render.c, in one write;
+ -q turns the drawing and the commentary off, for load testing.
+ A client that opens with "HELLO" is given "TOKEN <w>-<slot>-<hex>"
+ for its game against the server. If its connection drops, or the
+ server itself dies and is started again, it can open a new one with
+ "RESUME <token>": it is sent "RESUMED <moves>", the game so far, and
+ play carries on. Resumable games are kept in a memory-mapped snapshot
+ (see c4snap.c) named with -R (default "c4sessions.snap", "" for none),
+ which a restarted server with the same -w and -S adopts; a game not
+ resumed within RESUME_WAIT is given up.
+ With -U path the workers also accept connections on a unix-domain
+ socket, for clients on the same machine. Such a client, or any other,
+ can open with "SHM <name>" to play the server over a shared-memory
+ segment it has made instead (see c4shm.h); it is answered "SHM OK",
+ or "NOSHM" to carry on over the socket.
+ A client that opens with "SPEC" is sent, before its first move and
+ with each of the server's replies, "SPEC <t>": for each column in turn
+ the server's answer should the client play there next ('-' if the
+ column is full, '=' if that move would end the game). The client can
+ show the answer the moment its move is made; the reply that follows
+ confirms it, as the server plays what it promised. Each answer is
+ chosen as a reply would be, by the book, the database and a search,
+ the seven of them sharing the time the scheduler gives the reply.
+ A client that opens with "ANALYZE <moves> [ms]" has the position
+ searched by -a analysis threads (default 2), which steal the parts of
+ each other's searches when they have none of their own, and is sent
+ the scores and principal variation as each depth completes; see
+ c4analyze.c. "steal" on the admin socket shows how each thread's
+ time has gone.
+ The server's own replies are searched for as long as the box can
+ spare: c4sched.c shares engine time out so that replies keep within
+ the latency objective set with -L (in ms, default 50; 0 for the
+ one-ply heuristic only), cutting the search short, or skipping it,
+ when the workers fall behind. Games opened with "RATED" are searched
+ before others when time is short.
+ The objective and the rest of the engine's settings, and an opening
+ book, can be read from a file given with -C (see c4conf.h), and read
+ again without a restart on SIGHUP or the admin command "reload";
+ "conf" on the admin socket shows what is in force. With -P each
+ worker process reloads on its own.
+ Built with -DC4TRACE, "trace <ms>" on the admin socket records for
+ that long what every thread spends its time on, from accept to send,
+ and writes it to the file given with -T (default "c4trace.json",
+ <path>.<worker> with -P) for chrome://tracing or Perfetto; see
+ c4trace.h. It is answered at once, and says on standard error when
+ the file is written.
+ With -X capture-file every line clients send is recorded, with when
+ it came in, for c4playback.c to send again to another build
+ (<path>.<worker> with -P); see c4capture.h.
+ With -D database the server's reply in a position in the database
+ built by c4dbbuild.c is looked up rather than searched for (after
+ the opening book); the file is mapped shared, so that with -P the
+ worker processes all read the one copy. See c4db.h.
+ With -E tables the engine's searches, replies and analysis alike,
+ look positions up in endgame tables built by c4tbgen.c, mapped the
+ same way, and stop there; see c4tb.h.
+ With -N weights a reply that is not searched is played by the
+ n-tuple network trained by c4nttrain.c rather than by suggest_move;
+ see c4ntuple.h and c4sched.h.
+
+ Metrics from c4metrics.c can be read as plain text from the local
+ admin socket given with -A (default "c4admin.sock"), e.g.
+ 	socat - UNIX-CONNECT:c4admin.sock
+ With -P each process has its own admin socket, named <path>.<worker>.
+
+ To compile: gcc server1.c c4watch.c c4game.c c4log.c c4journal.c \
+ 			c4metrics.c c4ring.c c4buf.c c4render.c c4snap.c \
+ 			c4epoll.c c4uring.c c4shm.c c4shmio.c \
+ 			c4search.c c4steal.c c4analyze.c c4sched.c c4conf.c \
+ 			c4trace.c c4capture.c c4counter.c c4db.c c4tb.c \
+ 			c4ntuple.c c4map.c -o server1 -lm -pthread
+ 			(add -DC4TRACE to build tracing in, -march=native
+ 			for the network's AVX2 and BMI2, and
+ 			-lsocket -lnsl on csse Unix machines)
+
+ To run: server1 [-B] [-J journal-dir] [-A admin-socket]
+ 		[-w workers] [-P] [-b backlog] [-S sessions] [-q]
+ 		[-R snapshot] [-I epoll|uring] [-U unix-socket]
+ 		[-a analysis-threads] [-L latency-ms] [-C settings]
+ 		[-T trace-file] [-X capture-file] [-D database]
+ 		[-E tables] [-N weights] port
 */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/types.h> 
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/wait.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <time.h>
+#include "c4server.h"
+#include "c4log.h"
+#include "c4metrics.h"
+#include "c4render.h"
+#include "c4trace.h"
+#include "c4capture.h"
+#include "c4db.h"
+#include "c4tb.h"
+#include "c4ntuple.h"
 #ifdef __unix__
 #include <unistd.h>
 #elif defined _WIN32
@@ -20,517 +144,1598 @@ The port number is passed as an argument
 #define sleep(x) Sleep(1000 * x)
 #endif
 
-	/* number of columns in the game */
-#define WIDTH		7
-
-	/* number of slots in each column */
-#define HEIGHT		6
+#define RSEED	876545678
 
-	/* number in row required for victory */
-#define STRAIGHT	4
+	/* default listen backlog of each worker's socket */
+#define BACKLOG		128
 
-	/* sign that a cell is still empty */
-#define EMPTY		' '
+	/* default number of sessions each worker can hold */
+#define SESSIONS	1024
 
-	/* the two colours used in the game */
-#define RED		'R'
-#define YELLOW		'Y'
+	/* most workers that can be asked for */
+#define MAX_WORKERS	256
 
-	/* horizontal size of each cell in the display grid */
-#define WGRID	5
+	/* the lobby has a queue for each band of RATING_STEP points */
+#define BUCKETS		16
+#define RATING_STEP	200
 
-	/* vertical size of each cell in the display grid */
-#define HGRID	3
+	/* most clients that can wait in each band */
+#define LOBBY_SIZE	4096
 
-#define RSEED	876545678
+	/* how often workers retry the lobby while anyone waits, in ms */
+#define LOBBY_POLL	50
 
-#define LEN 256
+	/* most spectators that can be in flight to one worker */
+#define INBOX_SIZE	4096
 
-typedef char c4_t[HEIGHT][WIDTH];
+	/* how long a game waits to be resumed, and how often workers
+	 * look for ones that have waited too long, in ms
+	 */
+#define RESUME_WAIT	120000
+#define PARK_POLL	1000
 
-void print_config(c4_t);
-void init_empty(c4_t);
-int do_move(c4_t, int, char);
-void undo_move(c4_t, int);
-int get_move(c4_t,char*,int);
-int move_possible(c4_t);
-char winner_found(c4_t);
-int rowformed(c4_t,  int r, int c);
-int explore(c4_t, int r_fix, int c_fix, int r_off, int c_off);
-int suggest_move(c4_t board, char colour);
-void qread(int newsockfd,char* buffer, int len);
-void qwrite(int newsockfd,char* buffer);
-void timestamp(char* timestmp);
+	/* longest a line to a socket no worker serves waits for room, in
+	 * ms
+	 */
+#define SEAT_WAIT	100
+
+int open_listener(int port, int backlog);
+int open_unix_listener(char *path, int backlog);
+void pin_cpu(int id);
+int worker_init(struct worker *w);
+void *worker_main(void *param);
+int session_line(struct worker *w, struct session *s, char *line, int len);
+int join_lobby(struct worker *w, struct session *s, int rating);
+void lobby_send(struct seat *seat);
+void *lobby_main(void *param);
+void lobby_match(struct worker *w);
+struct seat *lobby_pop(int bucket);
+void start_relay(struct worker *w, struct seat *a, struct seat *b);
+int relay_move(struct worker *w, struct session *s, char *line, int len);
+int play_move(struct worker *w, struct session *s, int move);
+int bot_move(struct worker *w, struct session *s);
+int engine_move(struct worker *w, struct session *s,
+	const struct c4conf *conf, const struct c4bb *pos, c4_t board);
+int spec_table(struct worker *w, struct session *s,
+	const struct c4conf *conf, const struct c4bb *pos, c4_t board,
+	char *out);
+int resume_request(struct worker *w, struct session *s, char *arg);
+int session_restore(struct worker *w, struct session *s);
+void session_park(struct worker *w, struct session *s);
+void expire_parked(struct worker *w);
+void start_game(struct session *s);
+void record_move(struct session *s, int c);
+void end_game(struct session *s, char result);
+void open_shared(int writer, char *adminpath);
+int admin_command(const char *cmd, char *out, int len);
+void close_journal(void);
+
+static struct c4journal *journal;
+static char *journaldir = "journal";
+static struct c4snap *snapshot;
+static char *snappath = "c4sessions.snap";
+static int use_procs;
+static const struct c4io *io = &c4io_epoll;
+static int logpolicy = C4LOG_DROP;
+static int quiet;
+static int portno, backlog = BACKLOG;
+static int unixfd = -1;
+static int nanalysis = 2;
+static int slo = C4SCHED_SLO;
+static char *confpath;
+static char *tracepath = "c4trace.json";
+static char tracefile[256];
+static char *capturepath;
+static struct c4db *db;
+struct c4tb *endgame;
+static struct c4nt *net;
+struct worker *workers;
+int nworkers = 1, nsessions = SESSIONS;
+static struct c4mpmc lobby[BUCKETS];
+static atomic_int lobby_waiting;
+	/* with -P, the datagram socket pair on which the other processes
+	 * hand JOIN clients to process 0: it reads [0], they write [1]
+	 */
+static int lobbyfd[2] = { -1, -1 };
 
 
 int main(int argc, char **argv)
 {
-	int sockfd, newsockfd, portno, clilen;
-	char buffer[256];
-	struct sockaddr_in serv_addr, cli_addr;
-	int n;
+	int opt, i;
+	char *adminpath = "c4admin.sock";
+	char *unixpath = NULL;
+	char path[256];
+	sigset_t hup;
+	pthread_t tid;
+	pid_t pid;
+
+	while ((opt = getopt(argc, argv,
+			"BJ:A:w:Pb:S:qR:I:U:a:L:C:T:X:D:E:N:")) != -1) {
+		if (opt == 'B') {
+			logpolicy = C4LOG_BLOCK;
+		} else if (opt == 'J') {
+			journaldir = optarg;
+		} else if (opt == 'A') {
+			adminpath = optarg;
+		} else if (opt == 'w') {
+			nworkers = atoi(optarg);
+		} else if (opt == 'P') {
+			use_procs = 1;
+		} else if (opt == 'b') {
+			backlog = atoi(optarg);
+		} else if (opt == 'S') {
+			nsessions = atoi(optarg);
+		} else if (opt == 'q') {
+			quiet = 1;
+		} else if (opt == 'R') {
+			snappath = optarg;
+		} else if (opt == 'I' && strcmp(optarg, "epoll") == 0) {
+			io = &c4io_epoll;
+		} else if (opt == 'I' && strcmp(optarg, "uring") == 0) {
+			io = &c4io_uring;
+		} else if (opt == 'U') {
+			unixpath = optarg;
+		} else if (opt == 'a') {
+			nanalysis = atoi(optarg);
+		} else if (opt == 'L') {
+			slo = atoi(optarg);
+		} else if (opt == 'C') {
+			confpath = optarg;
+		} else if (opt == 'T') {
+			tracepath = optarg;
+		} else if (opt == 'X') {
+			capturepath = optarg;
+		} else if (opt == 'D') {
+			if ((db = c4db_open(optarg)) == NULL) {
+				perror("ERROR opening position database");
+				exit(1);
+			}
+		} else if (opt == 'E') {
+			if ((endgame = c4tb_open(optarg)) == NULL) {
+				perror("ERROR opening endgame tables");
+				exit(1);
+			}
+		} else if (opt == 'N') {
+			if ((net = c4nt_open(optarg)) == NULL) {
+				perror("ERROR opening n-tuple weights");
+				exit(1);
+			}
+		} else {
+			fprintf(stderr,"usage: %s [-B] [-J journal-dir] "
+				"[-A admin-socket] [-w workers] [-P] "
+				"[-b backlog] [-S sessions] [-q] "
+				"[-R snapshot] [-I epoll|uring] "
+				"[-U unix-socket] [-a analysis-threads] "
+				"[-L latency-ms] [-C settings] "
+				"[-T trace-file] [-X capture-file] "
+				"[-D database] [-E tables] "
+				"[-N weights] port\n",
+				argv[0]);
+			exit(1);
+		}
+	}
 
-	if (argc < 2) 
+	if (optind >= argc)
 	{
 		fprintf(stderr,"ERROR, no port provided\n");
 		exit(1);
 	}
+	portno = atoi(argv[optind]);
 
-	 /* Create TCP socket */
-	
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (nworkers < 1 || nworkers > MAX_WORKERS || nsessions < 1
+			|| backlog < 1)
+	{
+		fprintf(stderr,"ERROR, bad worker, session or backlog count\n");
+		exit(1);
+	}
+
+	/* a client going away mid-write must not take the server with it */
+	signal(SIGPIPE, SIG_IGN);
+	/* SIGHUP is taken by the thread that reloads the settings */
+	sigemptyset(&hup);
+	sigaddset(&hup, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &hup, NULL);
+	c4render_init();
+	if (c4conf_init(confpath, slo) < 0) {
+		exit(1);
+	}
+
+	/* one unix-domain socket, shared by every worker */
+	if (unixpath != NULL
+			&& (unixfd = open_unix_listener(unixpath, backlog)) < 0) {
+		exit(1);
+	}
 
-	if (sockfd < 0) 
+	for (i=0; i<BUCKETS; i++) {
+		if (c4mpmc_init(&lobby[i], LOBBY_SIZE, 0) < 0) {
+			perror("ERROR allocating lobby");
+			exit(1);
+		}
+	}
+
+	workers = calloc(nworkers, sizeof(*workers));
+	if (workers == NULL)
 	{
-		perror("ERROR opening socket");
+		perror("ERROR allocating workers");
 		exit(1);
 	}
 
-	
-	bzero((char *) &serv_addr, sizeof(serv_addr));
+	if (use_procs) {
+		/* one process per worker, each with its own log, journal
+		 * segments and admin socket, and one lobby, process 0's
+		 */
+		if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0,
+				lobbyfd) < 0) {
+			perror("ERROR opening lobby socket");
+			exit(1);
+		}
+		for (i=0; i<nworkers; i++) {
+			pid = fork();
+			if (pid < 0) {
+				perror("ERROR on fork");
+				exit(1);
+			}
+			if (pid == 0) {
+				snprintf(path, sizeof(path), "%s.%d",
+					adminpath, i);
+				open_shared(i, *adminpath ? path : "");
+				workers[i].id = i;
+				if (worker_init(&workers[i]) < 0) {
+					exit(1);
+				}
+				if (i == 0) {
+					close(lobbyfd[1]);
+					lobbyfd[1] = -1;
+					if (pthread_create(&tid, NULL,
+							lobby_main,
+							&workers[0])) {
+						perror("ERROR creating lobby");
+						exit(1);
+					}
+				} else {
+					close(lobbyfd[0]);
+				}
+				worker_main(&workers[i]);
+				exit(0);
+			}
+		}
+		close(lobbyfd[0]);
+		close(lobbyfd[1]);
+		while (wait(NULL) > 0 || errno == EINTR) {
+			;
+		}
+		return 0;
+	}
 
-	portno = atoi(argv[1]);
-	
-	/* Create address we're going to listen on (given port number)
-	 - converted to network byte order & any IP address for 
-	 this machine */
-	
-	serv_addr.sin_family = AF_INET;
-	serv_addr.sin_addr.s_addr = INADDR_ANY;
-	serv_addr.sin_port = htons(portno);  // store in machine-neutral format
+	open_shared(0, adminpath);
+	for (i=0; i<nworkers; i++) {
+		workers[i].id = i;
+		if (worker_init(&workers[i]) < 0) {
+			exit(1);
+		}
+	}
+	for (i=0; i<nworkers; i++) {
+		if (pthread_create(&workers[i].tid, NULL, worker_main,
+				&workers[i])) {
+			perror("ERROR creating worker");
+			exit(1);
+		}
+	}
+	for (i=0; i<nworkers; i++) {
+		pthread_join(workers[i].tid, NULL);
+	}
 
-	 /* Bind address to the socket */
-	
-	if (bind(sockfd, (struct sockaddr *) &serv_addr,
-			sizeof(serv_addr)) < 0) 
+	return 0;
+}
+
+/* Start the log, journal, snapshot and admin socket used by this
+ * process
+ */
+void
+open_shared(int writer, char *adminpath) {
+	char path[256];
+
+	srand(RSEED);
+
+	/* with -P every process traces to a file of its own */
+	if (use_procs) {
+		snprintf(tracefile, sizeof(tracefile), "%s.%d", tracepath,
+			writer);
+	} else {
+		snprintf(tracefile, sizeof(tracefile), "%s", tracepath);
+	}
+
+	if (capturepath != NULL) {
+		/* ... and captures to one of its own */
+		if (use_procs) {
+			snprintf(path, sizeof(path), "%s.%d", capturepath,
+				writer);
+		} else {
+			snprintf(path, sizeof(path), "%s", capturepath);
+		}
+		if (c4cap_open(path) < 0)
+		{
+			perror("ERROR opening capture file");
+			exit(1);
+		}
+		atexit(c4cap_close);
+	}
+
+	if (c4log_open("log.txt", logpolicy) < 0)
 	{
-		perror("ERROR on binding");
+		perror("ERROR opening log.txt");
 		exit(1);
 	}
-	
-	/* Listen on socket - means we're ready to accept connections - 
-	 incoming connection requests will be queued */
-	
-	listen(sockfd,5);
-	
-	clilen = sizeof(cli_addr);
 
-	/* Accept a connection - block until a connection is ready to
-	 be accepted. Get back a new file descriptor to communicate on. */
+	if ((journal = c4journal_open(journaldir, writer, 0)) == NULL)
+	{
+		perror("ERROR opening journal");
+		exit(1);
+	}
+	atexit(close_journal);
+
+	if (*snappath) {
+		/* with -P every process keeps a snapshot of its own */
+		if (use_procs) {
+			snprintf(path, sizeof(path), "%s.%d", snappath, writer);
+			snapshot = c4snap_open(path, 1, nsessions);
+		} else {
+			snapshot = c4snap_open(snappath, nworkers, nsessions);
+		}
+		if (snapshot == NULL)
+		{
+			perror("ERROR opening session snapshot");
+			exit(1);
+		}
+	}
 
-	newsockfd = accept(	sockfd, (struct sockaddr *) &cli_addr, 
-						&clilen);
+	if (analyze_start(nanalysis) < 0)
+	{
+		perror("ERROR starting analysis threads");
+		exit(1);
+	}
 
-	if (newsockfd < 0) 
+	if (c4conf_watch() < 0)
 	{
-		perror("ERROR on accept");
+		perror("ERROR starting settings reloader");
 		exit(1);
 	}
-	char timestmp[30];
 
-	timestamp(timestmp);
+	if (*adminpath && c4metrics_serve(adminpath, admin_command) < 0)
+	{
+		perror("ERROR opening admin socket");
+		exit(1);
+	}
+	atexit(c4metrics_stop);
+}
 
-	FILE *fp;
-	fp=fopen("log.txt", "a");
+/* Admin commands beyond the metrics
+ */
+int
+admin_command(const char *cmd, char *out, int len) {
+	int n, ms;
 
-	char ip[100];
+	if ((n = watch_games(cmd, out, len)) >= 0) {
+		return n;
+	}
+	if (sscanf(cmd, "trace %d", &ms) == 1) {
+		return c4trace_window(ms, tracefile, out, len);
+	}
+	if (strcmp(cmd, "steal") == 0) {
+		return analyze_stats(out, len);
+	}
+	return c4conf_command(cmd, out, len);
+}
 
-	struct sockaddr_in* pV4Addr = (struct sockaddr_in*)&cli_addr;
-	int ipAddr = pV4Addr->sin_addr.s_addr;
+/* Create a listening socket of our own on the shared port
+ */
+int
+open_listener(int port, int backlog) {
+	struct sockaddr_in serv_addr;
+	int sockfd, on = 1;
 
+	 /* Create TCP socket */
 
+	sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
 
-	inet_ntop( AF_INET, &ipAddr, ip, INET_ADDRSTRLEN );
+	if (sockfd < 0)
+	{
+		perror("ERROR opening socket");
+		return -1;
+	}
 
-	fprintf(fp, "[%s] (%s) (soc_id %d) client connected\n",timestmp,ip,newsockfd);
+	/* let every worker bind the same port; the kernel then hashes
+	 incoming connections across all of their accept queues */
 
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0)
+	{
+		perror("ERROR setting SO_REUSEPORT");
+		close(sockfd);
+		return -1;
+	}
 
+	bzero((char *) &serv_addr, sizeof(serv_addr));
 
+	/* Create address we're going to listen on (given port number)
+	 - converted to network byte order & any IP address for
+	 this machine */
 
-	c4_t board;
-	int move;
+	serv_addr.sin_family = AF_INET;
+	serv_addr.sin_addr.s_addr = INADDR_ANY;
+	serv_addr.sin_port = htons(port);  // store in machine-neutral format
 
-	srand(RSEED);
-	init_empty(board);
-	print_config(board);
+	 /* Bind address to the socket */
 
-	while ((move = get_move(board,buffer,newsockfd)) != EOF) {
+	if (bind(sockfd, (struct sockaddr *) &serv_addr,
+			sizeof(serv_addr)) < 0)
+	{
+		perror("ERROR on binding");
+		close(sockfd);
+		return -1;
+	}
 
-		fprintf(fp, "[%s] (%s) (soc_id %d) client's move=%d'\n",timestmp,ip,newsockfd,move);
-		if (do_move(board, move, YELLOW)!=1) {
-			printf("Panic\n");
-			exit(EXIT_FAILURE);
-		}
+	/* Listen on socket - means we're ready to accept connections -
+	 incoming connection requests will be queued */
 
-		print_config(board);
+	if (listen(sockfd, backlog) < 0)
+	{
+		perror("ERROR on listen");
+		close(sockfd);
+		return -1;
+	}
+	return sockfd;
+}
 
-		if (winner_found(board) == YELLOW) {
-			/* rats, the person beat us! */
-			printf("Ok, you beat me, beginner's luck!\n");
-			fclose(fp);
-			exit(EXIT_SUCCESS);
-		}
+/* Create the unix-domain listening socket at path, replacing any
+ * left there by an earlier server
+ */
+int
+open_unix_listener(char *path, int backlog) {
+	struct sockaddr_un addr;
+	int sockfd;
 
-		if (!move_possible(board)) {
-			/* yes, looks like it was */
-			printf("An honourable draw\n");
-			fclose(fp);
-			exit(EXIT_SUCCESS);
-		}
-		/* otherwise, look for a move from the computer */
-		move = suggest_move(board, RED);
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "ERROR, unix socket path too long\n");
+		return -1;
+	}
+	sockfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (sockfd < 0)
+	{
+		perror("ERROR opening unix socket");
+		return -1;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (bind(sockfd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+			|| listen(sockfd, backlog) < 0)
+	{
+		perror("ERROR on unix socket");
+		close(sockfd);
+		return -1;
+	}
+	return sockfd;
+}
 
-		sprintf(buffer,"%d",move);
+/* Keep the calling thread on one CPU, spreading workers round-robin
+ */
+void
+pin_cpu(int id) {
+	cpu_set_t set;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
 
-		qwrite(newsockfd,buffer);
+	if (ncpu < 1) {
+		return;
+	}
+	CPU_ZERO(&set);
+	CPU_SET(id % ncpu, &set);
+	sched_setaffinity(0, sizeof(set), &set);
+}
 
-		printf("Ok, let's see now....");
-		sleep(1);
-		/* then play the move */
-		printf(" I play in column %d\n", move);
+/* Build a worker's session pool, listening socket and event loop
+ */
+int
+worker_init(struct worker *w) {
+	int i;
 
-		if (do_move(board, move, RED)!=1) {
-			printf("Panic\n");
-			exit(EXIT_FAILURE);
+	w->pool = calloc(nsessions, sizeof(*w->pool));
+	if (w->pool == NULL) {
+		perror("ERROR allocating sessions");
+		return -1;
+	}
+	if (snapshot != NULL) {
+		w->snap = snapshot->slot + (use_procs ? 0 : w->id*nsessions);
+	}
+	/* games left in the snapshot wait for their clients; every
+	 * other session is free
+	 */
+	w->free = NULL;
+	for (i=nsessions-1; i>=0; i--) {
+		w->pool[i].fd = -1;
+		if (snapshot != NULL && snapshot->adopted
+				&& session_restore(w, &w->pool[i])) {
+			continue;
 		}
+		w->pool[i].next = w->free;
+		w->free = &w->pool[i];
+	}
+	if (w->parked > 0 && !quiet) {
+		printf("worker %d: %d games waiting to be resumed\n",
+			w->id, w->parked);
+	}
 
-		fprintf(fp,"[%s] (0.0.0.0) server's move=%d\n",timestmp,move);
+	if ((w->listenfd = open_listener(portno, backlog)) < 0) {
+		return -1;
+	}
+	w->unixfd = unixfd;
 
-		print_config(board);
+	if (c4mpmc_init(&w->inbox, INBOX_SIZE, 0) < 0
+			|| (w->live = calloc(nsessions, sizeof(*w->live))) == NULL) {
+		perror("ERROR allocating inbox");
+		return -1;
+	}
+	if ((w->evfd = eventfd(0, EFD_NONBLOCK)) < 0) {
+		perror("ERROR creating eventfd");
+		return -1;
+	}
+	c4sched_init(&w->sched, w->id);
+	w->sched.tb = endgame;
+	w->sched.net = net;
+	w->io = io;
+	return io->init(w);
+}
 
-		if (winner_found(board) == RED) {
-			/* yes!!! */
-			printf("I guess I have your measure!\n");
-			fclose(fp);
-			exit(EXIT_SUCCESS);
+/* A worker's event loop; never returns unless its I/O backend fails
+ */
+void *
+worker_main(void *param) {
+	struct worker *w = param;
+	char name[32];
+	uint64_t t_sweep = 0;
+	int timeout;
+
+	pin_cpu(w->id);
+	snprintf(name, sizeof(name), "worker%d", w->id);
+	c4m_attach(name);
+	C4TRACE_ATTACH(name);
+
+	for (;;) {
+		/* wake up now and then to pair clients left in the lobby */
+		timeout = atomic_load(&lobby_waiting) > 0 ? LOBBY_POLL
+			: w->parked > 0 ? PARK_POLL : -1;
+		if (w->io->wait(w, timeout) < 0) {
+			break;
+		}
+		if (atomic_load(&lobby_waiting) > 1) {
+			lobby_match(w);
+		}
+		if (w->parked > 0 && c4m_now() >= t_sweep) {
+			expire_parked(w);
+			t_sweep = c4m_now() + PARK_POLL*1000000ull;
 		}
-
 	}
-	fclose(fp);
-	printf("\n");
+	return NULL;
+}
 
+/* A new connection, from the I/O backend
+ */
+void
+session_open(struct worker *w, int fd, uint32_t ip) {
+	struct session *s;
+	C4TRACE_BEGIN(t);
+
+	if ((s = session_get(w)) == NULL) {
+		/* every session is in use, so turn this one away */
+		close(fd);
+		return;
+	}
 
+	s->fd = fd;
+	s->ip = ip;
+	s->inlen = 0;
+	s->mode = MODE_NEW;
+	s->peer = NULL;
+	s->t_accept = c4m_now();
+	c4m_inc(C4M_SESSIONS_OPENED, 1);
+
+	if (w->io->add(w, s) < 0) {
+		perror("ERROR adding client to event loop");
+		session_close(w, s, -1);
+		return;
+	}
 
+	c4log_event(C4LOG_CONNECT, s->fd, s->ip, 0);
+	c4cap_record(s->fd, C4CAP_OPEN, NULL, 0);
+	C4TRACE_END(t, "accept", fd);
+}
 
+/* The I/O backend has put n more bytes of input in s->in, or found
+ * the connection closed if n <= 0: play each whole line of it
+ */
+void
+session_data(struct worker *w, struct session *s, int n) {
+	char *line, *end;
+	C4TRACE_BEGIN(t);
+
+	if (n <= 0) {
+		/* client has gone, or the connection broke */
+		if (s->mode == MODE_BOT && s->token != 0) {
+			/* ... but may come back for its game */
+			session_park(w, s);
+			return;
+		}
+		session_close(w, s, 0);
+		return;
+	}
+	if (s->mode == MODE_WATCH) {
+		/* spectators have nothing to say */
+		return;
+	}
+	s->inlen += n;
+	s->in[s->inlen] = '\0';
+
+	line = s->in;
+	while ((end = strchr(line, '\n')) != NULL) {
+		if (session_line(w, s, line, end - line + 1) < 0) {
+			/* session is closed, or has gone to the lobby */
+			C4TRACE_END(t, "parse", n);
+			return;
+		}
+		line = end + 1;
+	}
 
-	
-	// bzero(buffer,256);
+	/* keep any partial line for next time */
+	s->inlen -= line - s->in;
+	memmove(s->in, line, s->inlen);
+	if (s->inlen == LEN - 1) {
+		/* a line that long is not a move */
+		session_close(w, s, 0);
+	}
+	C4TRACE_END(t, "parse", n);
+}
 
-	// /* Read characters from the connection,
-	// 	then process */
-	
-	// n = read(newsockfd,buffer,255);
+/* Act on one line from the client, newline included; returns -1 once
+ * the session is no longer this worker's to read from
+ */
+int
+session_line(struct worker *w, struct session *s, char *line, int len) {
+	char *ptr, buffer[LEN];
+	const struct c4conf *conf;
+	struct c4bb pos;
+	c4_t board;
+	int move, n;
 
-	// if (n < 0) 
-	// {
-	// 	perror("ERROR reading from socket");
-	// 	exit(1);
-	// }
-	
-	// printf("Here is the message: %s\n",buffer);
+	c4cap_record(s->fd, C4CAP_LINE, line, len-1);
+	if (s->mode == MODE_RELAY) {
+		return relay_move(w, s, line, len);
+	}
+	if (s->mode == MODE_ANALYZE) {
+		return analyze_line(w, s, line, len);
+	}
+	if (s->mode == MODE_NEW && strncmp(line, "SPEC", 4) == 0) {
+		/* the client will show our answers before we send them:
+		 * tell it what they are for the empty board
+		 */
+		s->specon = 1;
+		init_empty(board);
+		c4bb_init(&pos);
+		conf = c4conf_enter();
+		spec_table(w, s, conf, &pos, board, buffer);
+		c4conf_leave();
+		if (session_send(w, s, buffer) < 0) {
+			session_close(w, s, 0);
+			return -1;
+		}
+		return 0;
+	}
+	if (s->mode == MODE_NEW && strncmp(line, "RATED", 5) == 0) {
+		s->rated = 1;
+		return 0;
+	}
+	if (s->mode == MODE_NEW && w->id >= 0) {
+		/* a lane has only its own game to play */
+		if (strncmp(line, "HELLO", 5) == 0) {
+			/* the client wants to be able to resume its game */
+			s->token = c4snap_token();
+			n = sprintf(buffer, "TOKEN %d-%d-%016" PRIx64 "\n",
+				w->id, (int)(s - w->pool), s->token);
+			c4cap_record(s->fd, C4CAP_TOKEN, buffer+6, n-7);
+			if (session_send(w, s, buffer) < 0) {
+				session_close(w, s, 0);
+				return -1;
+			}
+			return 0;
+		}
+		if (strncmp(line, "RESUME ", 7) == 0) {
+			line[len-1] = '\0';
+			return resume_request(w, s, line+7);
+		}
+		if (strncmp(line, "JOIN", 4) == 0) {
+			return join_lobby(w, s, atoi(line+4));
+		}
+		if (strncmp(line, "WATCH ", 6) == 0) {
+			line[len-1] = '\0';
+			watch_request(w, s, line+6);
+			return -1;
+		}
+		if (strncmp(line, "SHM ", 4) == 0) {
+			line[len-1] = '\0';
+			return shm_request(w, s, line+4);
+		}
+		if (strncmp(line, "ANALYZE", 7) == 0) {
+			line[len-1] = '\0';
+			return analyze_request(w, s, line+7);
+		}
+	}
 
-	// n = write(newsockfd,"I got your message",18);
-	
-	// if (n < 0) 
-	// {
-	// 	perror("ERROR writing to socket");
-	// 	exit(1);
-	// }
-	
-	/* close socket */
-	
-	close(sockfd);
-	
-	return 0; 
+	move = strtol(line, &ptr, 10);
+	if (ptr == line) {
+		/* not a move */
+		session_close(w, s, 0);
+		return -1;
+	}
+	if (s->mode == MODE_NEW) {
+		s->mode = MODE_BOT;
+		start_game(s);
+		if (s->token != 0 && w->snap != NULL) {
+			s->snap = &w->snap[s - w->pool];
+			c4snap_claim(s->snap, s->token);
+		}
+		watch_publish(w, s);
+		init_empty(s->board);
+		if (!quiet) {
+			printf("Welcome to connect-4 \n\n");
+			c4render_print(s->board);
+		}
+	}
+	if (play_move(w, s, move) < 0) {
+		/* a bad move, or the game is over */
+		if (s->fd >= 0) {
+			session_close(w, s, 0);
+		}
+		return -1;
+	}
+	return 0;
 }
 
+/* Move a client from this worker into the lobby and try to pair it
+ */
+int
+join_lobby(struct worker *w, struct session *s, int rating) {
+	struct seat *seat;
+	int b = rating / RATING_STEP;
+
+	if (b < 0) {
+		b = 0;
+	} else if (b >= BUCKETS) {
+		b = BUCKETS - 1;
+	}
+	if ((seat = session_detach(w, s)) == NULL) {
+		return -1;
+	}
+	seat->bucket = b;
+	if (lobbyfd[1] >= 0) {
+		/* the lobby is another process's */
+		lobby_send(seat);
+		return -1;
+	}
 
+	if (c4mpmc_push(&lobby[b], seat) < 0) {
+		/* lobby is full */
+		close(seat->fd);
+		c4m_inc(C4M_SESSIONS_CLOSED, 1);
+		free(seat);
+		return -1;
+	}
+	atomic_fetch_add(&lobby_waiting, 1);
+	lobby_match(w);
+	return -1;
+}
 
+/* Hand a lobby client over to process 0, with -P; the seat is gone
+ * either way, and the client too if the lobby cannot take it
+ */
+void
+lobby_send(struct seat *seat) {
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} u;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&u, 0, sizeof(u));
+	iov.iov_base = seat;
+	iov.iov_len = sizeof(*seat);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = u.buf;
+	msg.msg_controllen = sizeof(u.buf);
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cm), &seat->fd, sizeof(int));
+	while (sendmsg(lobbyfd[1], &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0
+			&& errno == EINTR) {
+	}
+	/* process 0 has the socket now, or the client is turned away */
+	close(seat->fd);
+	c4m_inc(C4M_SESSIONS_CLOSED, 1);
+	free(seat);
+}
 
+/* Process 0's thread taking the clients the others hand over into its
+ * lobby, and waking its worker to pair them
+ */
+void *
+lobby_main(void *param) {
+	struct worker *w = param;
+	struct seat in, *seat;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	union {
+		char buf[CMSG_SPACE(sizeof(int))];
+		struct cmsghdr align;
+	} u;
+	uint64_t one = 1;
+	ssize_t n;
+	int fd;
+
+	c4m_attach("lobby");
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = &in;
+		iov.iov_len = sizeof(in);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = u.buf;
+		msg.msg_controllen = sizeof(u.buf);
+		if ((n = recvmsg(lobbyfd[0], &msg, 0)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("ERROR reading lobby socket");
+			return NULL;
+		}
+		fd = -1;
+		cm = CMSG_FIRSTHDR(&msg);
+		if (cm != NULL && cm->cmsg_level == SOL_SOCKET
+				&& cm->cmsg_type == SCM_RIGHTS) {
+			memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+		}
+		if (fd < 0) {
+			continue;
+		}
+		c4m_inc(C4M_SESSIONS_OPENED, 1);
+		if (n != sizeof(in) || in.bucket < 0 || in.bucket >= BUCKETS
+				|| (seat = malloc(sizeof(*seat))) == NULL) {
+			close(fd);
+			c4m_inc(C4M_SESSIONS_CLOSED, 1);
+			continue;
+		}
+		*seat = in;
+		seat->fd = fd;
+		if (c4mpmc_push(&lobby[seat->bucket], seat) < 0) {
+			/* lobby is full */
+			close(fd);
+			c4m_inc(C4M_SESSIONS_CLOSED, 1);
+			free(seat);
+			continue;
+		}
+		atomic_fetch_add(&lobby_waiting, 1);
+		write(w->evfd, &one, sizeof(one));
+	}
+}
 
+/* Pair off waiting clients, two at a time from the same band. A lone
+ * client goes back in the queue for the next try
+ */
+void
+lobby_match(struct worker *w) {
+	struct seat *a, *b;
+	int i;
+
+	for (i=0; i<BUCKETS; i++) {
+		while ((a = lobby_pop(i)) != NULL) {
+			if ((b = lobby_pop(i)) == NULL) {
+				if (c4mpmc_push(&lobby[i], a) < 0) {
+					close(a->fd);
+					c4m_inc(C4M_SESSIONS_CLOSED, 1);
+					atomic_fetch_sub(&lobby_waiting, 1);
+					free(a);
+				}
+				break;
+			}
+			atomic_fetch_sub(&lobby_waiting, 2);
+			start_relay(w, a, b);
+		}
+	}
+}
 
+/* Next client waiting in a band, skipping any that have hung up
+ */
+struct seat *
+lobby_pop(int bucket) {
+	struct seat *a;
+	char c;
+
+	while ((a = c4mpmc_pop(&lobby[bucket])) != NULL) {
+		if (recv(a->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) != 0) {
+			return a;
+		}
+		close(a->fd);
+		c4m_inc(C4M_SESSIONS_CLOSED, 1);
+		atomic_fetch_sub(&lobby_waiting, 1);
+		free(a);
+	}
+	return NULL;
+}
 
+/* Take a pair of lobby clients into this worker and start their game;
+ * a, the one that has waited longest, moves first
+ */
+void
+start_relay(struct worker *w, struct seat *a, struct seat *b) {
+	struct session *y, *r;
+	char buffer[LEN];
+
+	if ((y = w->free) == NULL || (r = y->next) == NULL) {
+		close(a->fd);
+		close(b->fd);
+		c4m_inc(C4M_SESSIONS_CLOSED, 2);
+		free(a);
+		free(b);
+		return;
+	}
+	w->free = r->next;
+
+	y->fd = a->fd;
+	y->ip = a->ip;
+	y->t_accept = a->t_accept;
+	y->colour = YELLOW;
+	r->fd = b->fd;
+	r->ip = b->ip;
+	r->t_accept = b->t_accept;
+	r->colour = RED;
+	free(a);
+	free(b);
+
+	y->mode = r->mode = MODE_RELAY;
+	y->inlen = r->inlen = 0;
+	y->peer = r;
+	r->peer = y;
+	c4bb_init(&y->bb);
+	start_game(y);
+	y->game.rec.red = r->ip;
+	watch_publish(w, y);
+
+	if (w->io->add(w, y) < 0 || w->io->add(w, r) < 0
+			|| (sprintf(buffer, "START Y %d-%d-%u\n", w->id,
+				(int)(y - w->pool), y->gen),
+			session_send(w, y, buffer)) < 0
+			|| (buffer[6] = RED, session_send(w, r, buffer)) < 0) {
+		session_close(w, y, 0);
+	}
+}
 
-void timestamp(char *timestmp)
-{
-    time_t ltime; /* calendar time */
-    ltime=time(NULL); /* get current cal time */
-    strcpy(timestmp,asctime( localtime(&ltime) ) );
+/* Check a relayed move against the game and pass the line, as read,
+ * to the opponent with a single write
+ */
+int
+relay_move(struct worker *w, struct session *s, char *line, int len) {
+	struct session *y = (s->colour == YELLOW) ? s : s->peer;
+	struct c4bb *bb = &y->bb;
+	char *ptr;
+	char turn = (bb->nmoves & 1) ? RED : YELLOW;
+	int move;
+	uint64_t t;
+
+	move = strtol(line, &ptr, 10);
+	if (ptr == line || s->colour != turn || move < 1 || move > WIDTH
+			|| !c4bb_can_play(bb, move)) {
+		/* out of turn or not a legal move: game is forfeit */
+		session_close(w, s, 0);
+		return -1;
+	}
+	if (s->t_accept) {
+		c4m_record(C4M_FIRST_MOVE, c4m_now() - s->t_accept);
+		s->t_accept = 0;
+	}
+	c4bb_play(bb, move);
+	record_move(y, move);
+	c4m_inc(C4M_MOVES, 1);
+	c4log_event(C4LOG_CLIENT_MOVE, s->fd, s->ip, move);
+	watch_move(w, y, move);
+
+	t = c4m_now();
+	if (w->io->send(w, s->peer, line, len) < 0) {
+		session_close(w, s, 0);
+		return -1;
+	}
+	c4m_record(C4M_WRITE, c4m_now() - t);
+
+	if (c4bb_won(bb)) {
+		session_close(w, s, s->colour);
+		return -1;
+	}
+	if (c4bb_full(bb)) {
+		session_close(w, s, EMPTY);
+		return -1;
+	}
+	return 0;
 }
 
-void qwrite(int newsockfd,char* buffer) {
-	int n;
+/* Play the client's move and answer it; returns -1 once the session
+ * has been closed, either because the game ended or the move was bad
+ */
+int
+play_move(struct worker *w, struct session *s, int move) {
+	if (move < 1 || move > WIDTH || !move_possible(s->board)) {
+		return -1;
+	}
 
-	n = write(newsockfd,buffer,strlen(buffer));
-	
-	if (n < 0) 
-	{
-		perror("ERROR writing to socket");
-		exit(1);
+	c4log_event(C4LOG_CLIENT_MOVE, s->fd, s->ip, move);
+	if (s->t_accept) {
+		c4m_record(C4M_FIRST_MOVE, c4m_now() - s->t_accept);
+		s->t_accept = 0;
+	}
+	if (do_move(s->board, move, YELLOW)!=1) {
+		/* column is already full */
+		return -1;
 	}
+	record_move(s, move);
+	c4m_inc(C4M_MOVES, 1);
+	watch_move(w, s, move);
+
+	if (!quiet) {
+		c4render_print(s->board);
+	}
+
+	if (winner_found(s->board) == YELLOW) {
+		/* rats, the person beat us! */
+		if (!quiet) {
+			printf("Ok, you beat me, beginner's luck!\n");
+		}
+		session_close(w, s, YELLOW);
+		return -1;
+	}
+
+	if (!move_possible(s->board)) {
+		/* yes, looks like it was */
+		if (!quiet) {
+			printf("An honourable draw\n");
+		}
+		session_close(w, s, EMPTY);
+		return -1;
+	}
+	return bot_move(w, s);
 }
 
+/* The server's reply to the client's last move; returns -1 once the
+ * session has been closed
+ */
+int
+bot_move(struct worker *w, struct session *s) {
+	char buffer[LEN];
+	c4_t next;
+	const struct c4conf *conf = c4conf_enter();
+	struct c4bb pos;
+	int move = 0, n, i;
+	uint64_t t;
+
+	c4bb_init(&pos);
+	for (i=0; i<s->game.rec.nmoves; i++) {
+		c4bb_play(&pos, c4j_move(&s->game.rec, i));
+	}
+	/* the move promised in the client's table, if it has one, or
+	 * else look for a move from the computer
+	 */
+	if (s->specon && s->game.rec.nmoves > 0) {
+		move = s->spec[c4j_move(&s->game.rec,
+			s->game.rec.nmoves - 1) - 1];
+	}
+	if (move == 0) {
+		C4TRACE_BEGIN(te);
+		t = c4m_now();
+		move = engine_move(w, s, conf, &pos, s->board);
+		c4m_record(C4M_ENGINE, c4m_now() - t);
+		C4TRACE_END(te, "engine", move);
+	}
+
+	n = sprintf(buffer,"%d\n",move);
+	if (s->specon) {
+		/* and the table for the client's next move, in the same
+		 * write, unless this move ends the game
+		 */
+		memcpy(next, s->board, sizeof(next));
+		do_move(next, move, RED);
+		c4bb_play(&pos, move);
+		if (winner_found(next) != RED && move_possible(next)) {
+			spec_table(w, s, conf, &pos, next, buffer + n);
+		}
+	}
 
-void qread(int newsockfd,char* buffer, int len) {
+	if (session_send(w, s, buffer) < 0) {
+		c4conf_leave();
+		session_close(w, s, 0);
+		return -1;
+	}
+	t = c4m_now() - w->t_wake;
+	c4m_record(C4M_MOVE, t);
+	c4sched_done(&w->sched, conf, t);
+	c4conf_leave();
 
-	int n;
+	if (!quiet) {
+		printf("Ok, let's see now....");
+		/* then play the move */
+		printf(" I play in column %d\n", move);
+	}
 
-	bzero(buffer,len);
+	if (do_move(s->board, move, RED)!=1) {
+		printf("Panic\n");
+		exit(EXIT_FAILURE);
+	}
 
-	/* Read characters from the connection,
-		then process */
-	
-	n = read(newsockfd,buffer,len-1);
+	c4log_event(C4LOG_SERVER_MOVE, s->fd, s->ip, move);
+	record_move(s, move);
+	c4m_inc(C4M_MOVES, 1);
+	watch_move(w, s, move);
 
-	if (n < 0) 
-	{
-		perror("ERROR reading from socket");
-		exit(1);
+	if (!quiet) {
+		c4render_print(s->board);
 	}
-}
 
+	if (winner_found(s->board) == RED) {
+		/* yes!!! */
+		if (!quiet) {
+			printf("I guess I have your measure!\n");
+		}
+		session_close(w, s, RED);
+		return -1;
+	}
 
-/* Initialise the playing array to empty cells */
-void
-init_empty(c4_t board) {
-	int r, c;
-	for (r=HEIGHT-1; r>=0; r--) {
-		for (c=0; c<WIDTH; c++) {
-			board[r][c] = EMPTY;
+	if (!move_possible(s->board)) {
+		/* yellow moves first, so the board fills on our move */
+		if (!quiet) {
+			printf("An honourable draw\n");
 		}
+		session_close(w, s, EMPTY);
+		return -1;
 	}
-	printf("Welcome to connect-4 \n\n");
+	return 0;
 }
 
-/* Apply the specified move to the board
+/* The server's move in pos, also given as board: from the book, the
+ * database, or else a search for whatever time the scheduler can give
  */
 int
-do_move(c4_t board, int c, char colour) {
-	int r=0;
-	/* first, find the next empty slot in that column */
-	while ((r<HEIGHT) && (board[r][c-1]!=EMPTY)) {
-		r += 1;
-	}
-	if (r==HEIGHT) {
-		/* no move is possible */
-		return 0;
+engine_move(struct worker *w, struct session *s, const struct c4conf *conf,
+		const struct c4bb *pos, c4_t board) {
+	struct c4db_entry e;
+	int move;
+
+	if ((move = c4conf_book(conf, pos)) == 0 && db != NULL
+			&& c4db_probe(db, pos, &e) == 0
+			&& c4bb_can_play(pos, e.move)) {
+		move = e.move;
+		c4m_inc(C4M_DB_HITS, 1);
 	}
-	/* otherwise, do the assignment */
-	board[r][c-1] = colour;
-	return 1;
+	if (move == 0) {
+		move = c4sched_move(&w->sched, conf, s->rated
+			? C4SCHED_RATED : C4SCHED_CASUAL, w->t_wake,
+			pos, board, RED);
+	}
+	return move;
 }
 
-/* Remove the top token from the specified column c
+/* Work out the server's answer to each move the client could make in
+ * pos, also given as board, keep them in s->spec and put the "SPEC"
+ * line for them in out. Each search takes half the time left, as
+ * c4sched.c has it, so the last columns may get the heuristic
  */
-void
-undo_move(c4_t board, int c) {
-	int r=0;
-	/* first, find the next empty slot in that column, but be
-	 * careful not to run over the top of the array
-	 */
-	while ((r<HEIGHT) && board[r][c-1] != EMPTY) {
-		r += 1;
+int
+spec_table(struct worker *w, struct session *s, const struct c4conf *conf,
+		const struct c4bb *pos, c4_t board, char *out) {
+	struct c4bb child;
+	int c, n;
+	uint64_t t = c4m_now();
+
+	n = sprintf(out, "SPEC ");
+	for (c=1; c<=WIDTH; c++) {
+		s->spec[c-1] = 0;
+		if (!c4bb_can_play(pos, c)) {
+			out[n++] = '-';
+			continue;
+		}
+		child = *pos;
+		c4bb_play(&child, c);
+		if (c4bb_won(&child) || c4bb_full(&child)) {
+			out[n++] = '=';
+			continue;
+		}
+		do_move(board, c, YELLOW);
+		s->spec[c-1] = engine_move(w, s, conf, &child, board);
+		out[n++] = '0' + s->spec[c-1];
+		undo_move(board, c);
 	}
-	/* then do the assignment, assuming that r>=1 */
-	board[r-1][c-1] = EMPTY;
-	return;
+	out[n++] = '\n';
+	out[n] = '\0';
+	c4m_record(C4M_ENGINE, c4m_now() - t);
+	return n;
 }
 
-/* Check board to see if it is full or not */
+/* Write all of len bytes to a connection that is in no worker's I/O
+ * backend, such as a seat being handed over; -1 if it cannot be
+ */
 int
-move_possible(c4_t board) {
-	int c;
-	/* check that a move is possible */
-	for (c=0; c<WIDTH; c++) {
-		if (board[HEIGHT-1][c] == EMPTY) {
-			/* this move is possible */
-			return 1;
+seat_write(int fd, const char *buf, int len) {
+	struct pollfd p;
+	int n;
+
+	while (len > 0) {
+		n = send(fd, buf, len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n > 0) {
+			buf += n;
+			len -= n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR) {
+			continue;
 		}
+		p.fd = fd;
+		p.events = POLLOUT;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)
+				&& poll(&p, 1, SEAT_WAIT) == 1) {
+			continue;
+		}
+		return -1;
 	}
-	/* if here and loop is finished, and no move possible */
 	return 0;
 }
 
-
-/* Read the next column number, and check for legality 
+/* Write the whole of line the same way
  */
 int
-get_move(c4_t board,char *buffer, int newsockfd) {
-	int c;
-	char *ptr;
-	/* check that a move is possible */
-	if (!move_possible(board)) {
-		return EOF;
-	}
-	/* one is, so ask for user input */
-	qread(newsockfd,buffer,LEN);
+seat_send(int fd, const char *line) {
+	return seat_write(fd, line, strlen(line));
+}
 
-	c=strtol(buffer, &ptr, 10);
+/* Send a reply through the worker's I/O backend
+ */
+int
+session_send(struct worker *w, struct session *s, char *buffer) {
+	int n;
+	uint64_t t = c4m_now();
 
-	/* now have a valid move */
-	return c;
+	n = w->io->send(w, s, buffer, strlen(buffer));
+	c4m_record(C4M_WRITE, c4m_now() - t);
+	C4TRACE_SINCE(t, "send", s->fd);
+	return n;
 }
 
-/* Print out the current configuration of the board 
+/* Finish with a session, and its opponent if the game was relayed:
+ * result is the winner, EMPTY for a draw, 0 if the game was abandoned,
+ * or -1 if no game was ever started
  */
 void
-print_config(c4_t board) {
-	int r, c, i, j;
-	/* lots of complicated detail in here, mostly this function
-	 * is an exercise in attending to detail and working out the
-	 * exact layout that is required.
-	 */
-	printf("\n");
-	/* print cells starting from the top, each cell is spread over
-	 * several rows
-	 */
-	for (r=HEIGHT-1; r>=0; r--) {
-		for (i=0; i<HGRID; i++) {
-			printf("\t|");
-			/* next two loops step across one row */
-			for (c=0; c<WIDTH; c++) {
-				for (j=0; j<WGRID; j++) {
-					printf("%c", board[r][c]);
-				}
-				printf("|");
-			}
-			printf("\n");
-		}
+session_close(struct worker *w, struct session *s, int result) {
+	struct session *peer = (s->mode == MODE_RELAY) ? s->peer : NULL;
+
+	if (s->mode == MODE_WATCH) {
+		watch_close(w, s);
+		return;
 	}
-	/* now print the bottom line */
-	printf("\t+");
-	for (c=0; c<WIDTH; c++) {
-		for (j=0; j<WGRID; j++) {
-			printf("-");
+	if (s->mode == MODE_BOT || s->mode == MODE_RELAY) {
+		watch_end(w, game_of(s), result);
+		if (result >= 0) {
+			end_game(game_of(s), result);
 		}
-		printf("+");
 	}
-	printf("\n");
-	/* and the bottom legend */
-	printf("\t ");
-	for (c=0; c<WIDTH; c++) {
-		for (j=0; j<(WGRID-1)/2; j++) {
-			printf(" ");
-		}
-		printf("%1d ", c+1);
-		for (j=0; j<WGRID-1-(WGRID-1)/2; j++) {
-			printf(" ");
-		}
+	session_free(w, s, result);
+	if (peer != NULL) {
+		session_free(w, peer, result);
 	}
-	printf("\n\n");
 }
 
-/* Is there a winning position on the current board?
+/* Next free session of this worker's pool, or NULL if all are in use
  */
-char
-winner_found(c4_t board) {
-	int r, c;
-	/* check exhaustively from every position on the board
-	 * to see if there is a winner starting at that position.
-	 * could probably short-circuit some of the computatioin,
-	 * but hey, the computer has plenty of time to do the tesing
-	 */
-	for (r=0; r<HEIGHT; r++) {
-		for (c=0; c<WIDTH; c++) {
-			if ((board[r][c]!=EMPTY) && rowformed(board,r,c)) {
-				return board[r][c];
-			}
-		}
+struct session *
+session_get(struct worker *w) {
+	struct session *s = w->free;
+	if (s != NULL) {
+		w->free = s->next;
+		s->peer = NULL;
+		s->inlen = 0;
+		s->token = 0;
+		s->snap = NULL;
+		s->specon = 0;
+		s->rated = 0;
 	}
-	/* ok, went right through all positions and if we are still
-	 * here then there isn't a solution to be found
-	 */
-	return EMPTY;
+	return s;
 }
 
+/* Let go of a session but keep its connection open, so that the client
+ * can move on to the lobby or to another worker
+ */
+struct seat *
+session_detach(struct worker *w, struct session *s) {
+	struct seat *seat;
+
+	if ((seat = calloc(1, sizeof(*seat))) == NULL) {
+		session_free(w, s, -1);
+		return NULL;
+	}
+	seat->fd = s->fd;
+	seat->ip = s->ip;
+	seat->t_accept = s->t_accept;
+
+	w->io->remove(w, s);
+	s->fd = -1;
+	s->mode = MODE_NEW;
+	s->token = 0;
+	s->specon = 0;
+	s->rated = 0;
+	s->next = w->free;
+	w->free = s;
+	return seat;
+}
 
-/* Is there a row in any direction starting at [r][c]?
+void
+session_free(struct worker *w, struct session *s, int result) {
+	if (result > 0) {
+		c4log_event(C4LOG_GAME_OVER, s->fd, s->ip, result);
+	} else if (result == 0) {
+		c4log_event(C4LOG_DISCONNECT, s->fd, s->ip, 0);
+	}
+	if (s->fd >= 0) {
+		c4cap_record(s->fd, C4CAP_CLOSE, NULL, 0);
+		w->io->close(w, s);
+	}
+	analyze_drop(s);
+	s->fd = -1;
+	s->mode = MODE_NEW;
+	s->peer = NULL;
+	if (s->snap != NULL) {
+		c4snap_clear(s->snap);
+		s->snap = NULL;
+	}
+	s->token = 0;
+	s->specon = 0;
+	s->rated = 0;
+	c4m_inc(C4M_SESSIONS_CLOSED, 1);
+	s->next = w->free;
+	w->free = s;
+}
+
+/* Send a client that wants its game back to the worker that has it
  */
 int
-rowformed(c4_t board, int r, int c) {
-	return
-		explore(board, r, c, +1,  0) ||
-		explore(board, r, c, -1,  0) ||
-		explore(board, r, c,  0, +1) ||
-		explore(board, r, c,  0, -1) ||
-		explore(board, r, c, -1, -1) ||
-		explore(board, r, c, -1, +1) ||
-		explore(board, r, c, +1, -1) ||
-		explore(board, r, c, +1, +1);
-}
-
-/* Nitty-gritty detail of looking for a set of straight-line
- * items all the same colour. Need to be very careful not to step
- * over the edge of the array
+resume_request(struct worker *w, struct session *s, char *arg) {
+	struct seat *seat;
+	uint64_t token, one = 1;
+	int gw, gi;
+
+	if (sscanf(arg, "%d-%d-%" SCNx64, &gw, &gi, &token) != 3 || gw < 0
+			|| gw >= nworkers || gi < 0 || gi >= nsessions
+			|| token == 0 || workers[gw].pool == NULL) {
+		session_send(w, s, "GONE\n");
+		session_free(w, s, -1);
+		return -1;
+	}
+	if ((seat = session_detach(w, s)) == NULL) {
+		return -1;
+	}
+	seat->index = gi;
+	seat->token = token;
+	if (c4mpmc_push(&workers[gw].inbox, seat) < 0) {
+		close(seat->fd);
+		c4m_inc(C4M_SESSIONS_CLOSED, 1);
+		free(seat);
+		return -1;
+	}
+	if (gw != w->id) {
+		write(workers[gw].evfd, &one, sizeof(one));
+	} else {
+		watch_inbox(w);
+	}
+	return -1;
+}
+
+/* Give a parked game back to the client holding its token: send it
+ * the moves so far, and the server's reply if one is owed
+ */
+void
+session_resume(struct worker *w, struct seat *seat) {
+	struct session *s = &w->pool[seat->index];
+	char buffer[LEN];
+	int i, n;
+
+	if (s->mode != MODE_PARKED || s->token != seat->token) {
+		seat_send(seat->fd, "GONE\n");
+		close(seat->fd);
+		c4m_inc(C4M_SESSIONS_CLOSED, 1);
+		free(seat);
+		return;
+	}
+	s->fd = seat->fd;
+	s->ip = seat->ip;
+	s->inlen = 0;
+	s->t_accept = 0;
+	s->mode = MODE_BOT;
+	w->parked--;
+	free(seat);
+
+	if (w->io->add(w, s) < 0) {
+		session_close(w, s, 0);
+		return;
+	}
+	n = sprintf(buffer, "RESUMED ");
+	for (i=0; i<s->game.rec.nmoves; i++) {
+		buffer[n++] = '0' + c4j_move(&s->game.rec, i);
+	}
+	buffer[n++] = '\n';
+	buffer[n] = '\0';
+	if (session_send(w, s, buffer) < 0) {
+		session_close(w, s, 0);
+		return;
+	}
+	watch_publish(w, s);
+	if (s->game.rec.nmoves & 1) {
+		/* the server died before it could answer */
+		bot_move(w, s);
+	}
+}
+
+/* Take back a game found in the snapshot, to wait for its client;
+ * returns 0 if the slot holds nothing that can be played on
  */
 int
-explore(c4_t board, int r_fix, int c_fix, int r_off, int c_off) {
-	int r_lim, c_lim;
-	int r, c, i;
-	r_lim = r_fix + (STRAIGHT-1)*r_off;
-	c_lim = c_fix + (STRAIGHT-1)*c_off;
-	/* can we go in the specified direction?
-	 */
-	if (r_lim<0 || r_lim>=HEIGHT || c_lim<0 || c_lim>=WIDTH) {
-		/* no, not enough space */
+session_restore(struct worker *w, struct session *s) {
+	struct c4snap_slot *slot = &w->snap[s - w->pool];
+	struct c4bb bb;
+	struct timespec now;
+	int i, c;
+
+	if (slot->token == 0) {
+		return 0;
+	}
+	if (!c4snap_valid(slot)) {
+		c4snap_clear(slot);
 		return 0;
 	}
-	/* can, so check the colours for all the same */
-	for (i=1; i<STRAIGHT; i++) {
-		r = r_fix + i*r_off;
-		c = c_fix + i*c_off;
-		if (board[r][c] != board[r_fix][c_fix]) {
-			/* found one different, so cannotbe a row */
+	/* replay the moves, checking them on a bitboard as we go */
+	c4bb_init(&bb);
+	init_empty(s->board);
+	memset(&s->game, 0, sizeof(s->game));
+	s->snap = NULL;
+	for (i=0; i<slot->nmoves; i++) {
+		c = c4snap_move(slot, i);
+		if (c < 1 || c > WIDTH || !c4bb_can_play(&bb, c)
+				|| (i > 0 && c4bb_won(&bb))) {
+			c4snap_clear(slot);
 			return 0;
 		}
+		c4bb_play(&bb, c);
+		do_move(s->board, c, (i & 1) ? RED : YELLOW);
+		record_move(s, c);
 	}
-	/* by now, a straight row all the same colour has been found */
+	if ((bb.nmoves > 0 && c4bb_won(&bb)) || c4bb_full(&bb)) {
+		/* finished, but the server died before clearing it */
+		c4snap_clear(slot);
+		return 0;
+	}
+
+	s->t_start = s->t_parked = c4m_now();
+	clock_gettime(CLOCK_REALTIME, &now);
+	s->game.rec.start_ns = (uint64_t)now.tv_sec*1000000000u + now.tv_nsec;
+	s->gen++;
+	s->token = slot->token;
+	s->snap = slot;
+	s->mode = MODE_PARKED;
+	s->peer = NULL;
+	w->parked++;
 	return 1;
 }
 
-/* Try to find a good move for the specified colour
+/* Client has dropped mid-game: keep the game for it to resume
  */
-int
-suggest_move(c4_t board, char colour) {
-	int c;
-	/* look for a winning move for colour */
-	for (c=0; c<WIDTH; c++) {
-		/* temporarily move in column c... */
-		if (do_move(board, c+1, colour)) {
-			/* ... and check to see the outcome */
-			if (winner_found(board) == colour) {
-				/* it is good, so unassign and return c */
-				undo_move(board, c+1);
-				return c+1;
-			} else {
-				undo_move(board, c+1);
-			}
+void
+session_park(struct worker *w, struct session *s) {
+	c4log_event(C4LOG_DISCONNECT, s->fd, s->ip, 0);
+	c4cap_record(s->fd, C4CAP_CLOSE, NULL, 0);
+	w->io->close(w, s);
+	s->fd = -1;
+	s->mode = MODE_PARKED;
+	s->specon = 0;
+	s->t_parked = c4m_now();
+	w->parked++;
+	c4m_inc(C4M_SESSIONS_CLOSED, 1);
+}
+
+/* Give up on parked games whose clients have not come back in time
+ */
+void
+expire_parked(struct worker *w) {
+	struct session *s;
+	uint64_t now = c4m_now();
+	int i;
+
+	for (i=0; i<nsessions; i++) {
+		s = &w->pool[i];
+		if (s->mode != MODE_PARKED
+				|| now - s->t_parked < RESUME_WAIT*1000000ull) {
+			continue;
 		}
-	}
-	/* ok, no winning move, look for a blocking move */
-	if (colour == RED) {
-		colour = YELLOW;
-	} else {
-		colour = RED;
-	}
-	for (c=0; c<WIDTH; c++) {
-		/* temporarily move in column c... */
-		if (do_move(board, c+1, colour)) {
-			/* ... and check to see the outcome */
-			if (winner_found(board) == colour) {
-				/* it is good, so unassign and return c */
-				undo_move(board, c+1);
-				return c+1;
-			} else {
-				undo_move(board, c+1);
-			}
+		watch_end(w, s, 0);
+		end_game(s, 0);
+		if (s->snap != NULL) {
+			c4snap_clear(s->snap);
+			s->snap = NULL;
 		}
+		s->token = 0;
+		s->mode = MODE_NEW;
+		s->next = w->free;
+		w->free = s;
+		w->parked--;
 	}
-	/* no moves found? then pick at random... */
-	c = rand()%WIDTH;
-	while (board[HEIGHT-1][c]!=EMPTY) {
-		c = rand()%WIDTH;
+}
+
+/* Begin the journal record of a new game
+ */
+void
+start_game(struct session *s) {
+	struct timespec now;
+	s->t_start = c4m_now();
+	s->gen++;
+	memset(&s->game, 0, sizeof(s->game));
+	c4m_inc(C4M_GAMES_STARTED, 1);
+	s->game.rec.yellow = s->ip;
+	clock_gettime(CLOCK_REALTIME, &now);
+	s->game.rec.start_ns = (uint64_t)now.tv_sec*1000000000u + now.tv_nsec;
+}
+
+void
+record_move(struct session *s, int c) {
+	if (s->game.rec.nmoves < C4J_MAXMOVES) {
+		c4j_set_move(&s->game.rec, s->game.rec.nmoves++, c);
+	}
+	if (s->snap != NULL) {
+		c4snap_play(s->snap, c);
 	}
-	return c+1;
 }
 
+/* Hand the finished game to the journal; result 0 means abandoned
+ */
+void
+end_game(struct session *s, char result) {
+	struct c4bb b;
+	int i;
+
+	/* a full board was played out, however the session ended: the
+	 * 42nd move, red's, either won or drew
+	 */
+	if (result == 0 && s->game.rec.nmoves == WIDTH*HEIGHT) {
+		c4bb_init(&b);
+		for (i=0; i<s->game.rec.nmoves; i++) {
+			c4bb_play(&b, c4j_move(&s->game.rec, i));
+		}
+		result = c4bb_won(&b) ? RED : EMPTY;
+	}
+	s->game.rec.result = result;
+	c4m_inc(C4M_GAMES_FINISHED, 1);
+	s->game.rec.dur_ms = (c4m_now() - s->t_start) / 1000000;
+	s->game.rec.len = C4J_RECLEN(s->game.rec.nmoves);
+	c4journal_append(journal, &s->game.rec);
+}
+
+void
+close_journal(void) {
+	c4journal_close(journal);
+	journal = NULL;
+}
@@ -1,43 +1,206 @@
+/* Contention benchmark for shared counters
+
+   Each of n threads bumps one shared count the given number of times,
+   in one of these ways:
+
+   	racy	a plain ++ with no synchronisation, which loses updates
+   	mutex	a pthread mutex taken around each ++
+   	spin	a pthread spinlock taken around each ++
+   	atomic	one atomic fetch-and-add on a shared word
+   	sharded	a c4counter (see c4counter.h), a line per thread
+
+   For every way asked for, every thread count of 1, 2, 4 ... up to -t,
+   and every iteration count given, one JSON object is printed on
+   standard output: the count reached against the count expected, and
+   the time per increment and increments per second over all threads.
+   The threads start together from a barrier and are timed from the
+   first to start to the last to finish.
+
+   To compile: gcc -O2 thread2.c c4counter.c -o thread2 -pthread
+
+   To run: thread2 [-m racy|mutex|spin|atomic|sharded|all] [-t threads]
+   		iterations ...
+*/
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
 #include <unistd.h>
 #include <pthread.h>
+#include "c4counter.h"
+
+	/* ways of counting */
+#define M_RACY		0
+#define M_MUTEX		1
+#define M_SPIN		2
+#define M_ATOMIC	3
+#define M_SHARDED	4
+#define M_ALL		5
+
+#define MAX_THREADS	64
+
+static const char *mode_name[M_ALL] = {
+	"racy", "mutex", "spin", "atomic", "sharded",
+};
 
-#define N 2 
+static volatile uint64_t count;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_spinlock_t spin;
+static _Atomic uint64_t shared;
+static struct c4counter sharded;
 
-void *work_function(void *param);
+	/* when each thread started and finished */
+static uint64_t began[MAX_THREADS], ended[MAX_THREADS];
 
-int count=0;   
+static pthread_barrier_t ready;
+static int mode;
+static long iterations;
 
-int main(int args, char **argv) 
-{
-    pthread_t tid[N];
-    long int iterations = atoi(argv[1]);
+static void usage(char *prog);
+
+static uint64_t
+now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+
+static void *
+work_function(void *param) {
+	int me = (intptr_t)param;
+	long i;
+
+	/* the threads of earlier runs have gone, so their slots are free */
+	c4counter_slot = me + 1;
+	pthread_barrier_wait(&ready);
+	began[me] = now_ns();
+	switch (mode) {
+	case M_RACY:
+		for (i=0; i<iterations; i++) {
+			count++;
+		}
+		break;
+	case M_MUTEX:
+		for (i=0; i<iterations; i++) {
+			pthread_mutex_lock(&lock);
+			count++;
+			pthread_mutex_unlock(&lock);
+		}
+		break;
+	case M_SPIN:
+		for (i=0; i<iterations; i++) {
+			pthread_spin_lock(&spin);
+			count++;
+			pthread_spin_unlock(&spin);
+		}
+		break;
+	case M_ATOMIC:
+		for (i=0; i<iterations; i++) {
+			atomic_fetch_add_explicit(&shared, 1,
+				memory_order_relaxed);
+		}
+		break;
+	case M_SHARDED:
+		for (i=0; i<iterations; i++) {
+			c4counter_add(&sharded, 1);
+		}
+		break;
+	}
+	ended[me] = now_ns();
+	return NULL;
+}
+
+/* Run n threads counting iterations each, and print what they did
+ */
+static void
+run(int n) {
+	pthread_t tid[MAX_THREADS];
+	uint64_t start, end, elapsed, got, want = (uint64_t)n * iterations;
+	int i;
+
+	count = 0;
+	atomic_store(&shared, 0);
+	memset(&sharded, 0, sizeof(sharded));
+	pthread_barrier_init(&ready, NULL, n + 1);
+	for (i=0; i<n; i++) {
+		if (pthread_create(&tid[i], NULL, work_function,
+				(void *)(intptr_t)i)) {
+			perror("ERROR creating thread");
+			exit(1);
+		}
+	}
+	pthread_barrier_wait(&ready);
+	start = UINT64_MAX;
+	end = 0;
+	for (i=0; i<n; i++) {
+		pthread_join(tid[i], NULL);
+		start = began[i] < start ? began[i] : start;
+		end = ended[i] > end ? ended[i] : end;
+	}
+	elapsed = end > start ? end - start : 1;
+	pthread_barrier_destroy(&ready);
+
+	got = mode == M_ATOMIC ? atomic_load(&shared)
+		: mode == M_SHARDED ? c4counter_read(&sharded) : count;
+	printf("{\"mode\": \"%s\", \"threads\": %d, \"iterations\": %ld, "
+		"\"count\": %llu, \"expected\": %llu, \"ns_per_op\": %.2f, "
+		"\"ops_per_sec\": %.0f}\n", mode_name[mode], n, iterations,
+		(unsigned long long)got, (unsigned long long)want,
+		(double)elapsed / want, want * 1e9 / elapsed);
+	fflush(stdout);
+}
 
-    pthread_create(&tid[0], NULL, work_function, (void *) iterations);
-    pthread_create(&tid[1], NULL, work_function, (void *) iterations);
-    
-    pthread_join(tid[0], NULL);
-    pthread_join(tid[1], NULL);
+int
+main(int argc, char *argv[]) {
+	int opt, which = M_ALL, nthreads = 2, n, i;
 
-    if (count != iterations * 2)
-	    printf("Error: %d\n",count);
-    else
-	    printf("Value as expected: count = %d\n", count);
+	while ((opt = getopt(argc, argv, "m:t:")) != -1) {
+		switch (opt) {
+		case 'm':
+			for (which=0; which<M_ALL; which++) {
+				if (strcmp(optarg, mode_name[which]) == 0) {
+					break;
+				}
+			}
+			if (which == M_ALL && strcmp(optarg, "all") != 0) {
+				usage(argv[0]);
+			}
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind == argc || nthreads < 1 || nthreads > MAX_THREADS) {
+		usage(argv[0]);
+	}
+	pthread_spin_init(&spin, PTHREAD_PROCESS_PRIVATE);
 
-    pthread_exit(NULL); 
+	for (mode=0; mode<M_ALL; mode++) {
+		if (which != M_ALL && mode != which) {
+			continue;
+		}
+		for (n=1; n<=nthreads; n *= 2) {
+			for (i=optind; i<argc; i++) {
+				if ((iterations = atol(argv[i])) < 1) {
+					usage(argv[0]);
+				}
+				run(n);
+			}
+		}
+	}
+	return 0;
 }
 
-void *work_function(void *param)
-{
-    long int max_iter = (long int) param;
-    int i;
-    for(i = 0; i < max_iter; i++)
-		count++;
-    
-    pid_t pid = getpid();
-    pthread_t id = pthread_self();
-    printf("in thread: pid=%d and id=%u count=%d\n",
-		(unsigned int) pid, (unsigned int) id, count);
-	
-    pthread_exit(NULL); 
+static void
+usage(char *prog) {
+	fprintf(stderr, "usage: %s [-m racy|mutex|spin|atomic|sharded|all] "
+		"[-t threads] iterations ...\n\tthreads at most %d\n",
+		prog, MAX_THREADS);
+	exit(1);
 }